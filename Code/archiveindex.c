@@ -0,0 +1,266 @@
+/*******************************************************************************
+
+   File        : archiveindex.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Seekable index of the files in a backup archive.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 17/10/2026 - v1.01 - Forgetting files never written.
+                 17/10/2026 - v1.02 - Checked footers.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   Index layout, all numbers are little endian:
+
+   Records, one per file, starting on a block boundary:
+      8 bytes  header offset
+      8 bytes  size
+      8 bytes  modified time
+      2 bytes  path length
+      n bytes  path, not null terminated
+   Zero padding up to the next block.
+
+   Footer, the last block in the file:
+      8 bytes  INDEX_MAGIC
+      8 bytes  offset of the first record
+      8 bytes  number of records
+      8 bytes  length of the records, not including padding
+      Zeros for the rest of the block.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "archiveindex.h"
+
+#define INDEX_RECORD_SIZE 26
+
+static void putUInt64(unsigned char *bytes, uint64_t value);
+static uint64_t getUInt64(const unsigned char *bytes);
+
+/*******************************************************************************
+   indexInit
+      Sets up an empty index.
+*******************************************************************************/
+void indexInit(struct archive_index *index) {
+   memset(index, 0, sizeof(struct archive_index));
+}
+
+/*******************************************************************************
+   indexAdd
+      Adds a file to the index.
+*******************************************************************************/
+int indexAdd(struct archive_index *index, const char* path, off_t offset,
+   off_t size, time_t modifiedTime)
+{
+   size_t pathLength = strlen(path);
+   if(pathLength > UINT16_MAX) return -1;
+
+   if(index->count == index->capacity) {
+      size_t capacity = index->capacity > 0 ? index->capacity * 2 : 1024;
+      struct index_entry *entries
+         = realloc(index->entries, capacity * sizeof(struct index_entry));
+      if(entries == NULL) return -1;
+      index->entries = entries;
+      index->capacity = capacity;
+   }
+   if(index->pathsLength + pathLength + 1 > index->pathsCapacity) {
+      size_t capacity = index->pathsCapacity > 0
+         ? index->pathsCapacity * 2 : 64 * 1024;
+      while(index->pathsLength + pathLength + 1 > capacity) capacity *= 2;
+      char *paths = realloc(index->paths, capacity);
+      if(paths == NULL) return -1;
+      index->paths = paths;
+      index->pathsCapacity = capacity;
+   }
+
+   struct index_entry *entry = &index->entries[index->count++];
+   entry->path = index->pathsLength;
+   entry->offset = offset;
+   entry->size = size;
+   entry->modifiedTime = modifiedTime;
+   memcpy(&index->paths[index->pathsLength], path, pathLength + 1);
+   index->pathsLength += pathLength + 1;
+   return 0;
+}
+
+/*******************************************************************************
+   indexForget
+      Takes out the last entry for a path, and moves every entry after it
+      back by length. It's path stays in the pool, unused.
+*******************************************************************************/
+void indexForget(struct archive_index *index, const char* path,
+   off_t length)
+{
+   size_t i = index->count;
+   while(i > 0 && strcmp(indexPath(index, &index->entries[i - 1]), path) != 0)
+   {
+      i--;
+   }
+   if(i == 0) return;
+   for(size_t j = i; j < index->count; j++) {
+      index->entries[j].offset -= length;
+   }
+   memmove(&index->entries[i - 1], &index->entries[i],
+      (index->count - i) * sizeof(struct index_entry));
+   index->count--;
+}
+
+/*******************************************************************************
+   indexWrite
+      Writes the records and footer to the archive.
+*******************************************************************************/
+int indexWrite(const struct archive_index *index,
+   struct archive_writer *archive)
+{
+   /* Records start on a block boundary, as the end blocks leave it. */
+   if(archiveWritePadding(archive) != 0) return -1;
+   off_t start = archive->offset;
+
+   unsigned char record[INDEX_RECORD_SIZE];
+   for(size_t i = 0; i < index->count; i++) {
+      const struct index_entry *entry = &index->entries[i];
+      const char *path = indexPath(index, entry);
+      size_t pathLength = strlen(path);
+      putUInt64(&record[0], entry->offset);
+      putUInt64(&record[8], entry->size);
+      putUInt64(&record[16], (uint64_t)(int64_t)entry->modifiedTime);
+      record[24] = pathLength & 0xff;
+      record[25] = (pathLength >> 8) & 0xff;
+      if(archiveWrite(archive, record, INDEX_RECORD_SIZE) != 0
+         || archiveWrite(archive, path, pathLength) != 0)
+      {
+         return -1;
+      }
+   }
+   off_t length = archive->offset - start;
+   if(archiveWritePadding(archive) != 0) return -1;
+
+   unsigned char footer[ARCHIVE_BLOCK_SIZE];
+   memset(footer, 0, ARCHIVE_BLOCK_SIZE);
+   memcpy(footer, INDEX_MAGIC, 8);
+   putUInt64(&footer[8], start);
+   putUInt64(&footer[16], index->count);
+   putUInt64(&footer[24], length);
+   return archiveWrite(archive, footer, ARCHIVE_BLOCK_SIZE);
+}
+
+/*******************************************************************************
+   indexRead
+      Loads the index from the end of an archive.
+*******************************************************************************/
+int indexRead(struct archive_index *index, FILE *archiveFile) {
+   indexInit(index);
+
+   unsigned char footer[ARCHIVE_BLOCK_SIZE];
+   if(fseeko(archiveFile, -ARCHIVE_BLOCK_SIZE, SEEK_END) != 0
+      || fread(footer, ARCHIVE_BLOCK_SIZE, 1, archiveFile) != 1
+      || memcmp(footer, INDEX_MAGIC, 8) != 0)
+   {
+      return -1;
+   }
+   uint64_t start = getUInt64(&footer[8]);
+   uint64_t count = getUInt64(&footer[16]);
+   uint64_t length = getUInt64(&footer[24]);
+
+   /* A damaged footer mustn't size anything. The records have to fit 
+      before it, and each takes up at least INDEX_RECORD_SIZE bytes. */
+   off_t footerOffset = ftello(archiveFile) - ARCHIVE_BLOCK_SIZE;
+   if(footerOffset < 0 || length > (uint64_t)footerOffset
+      || start > (uint64_t)footerOffset - length
+      || count > length / INDEX_RECORD_SIZE)
+   {
+      return -1;
+   }
+
+   unsigned char *records = malloc(length > 0 ? length : 1);
+   if(records == NULL) return -1;
+   if(fseeko(archiveFile, (off_t)start, SEEK_SET) != 0
+      || (length > 0 && fread(records, length, 1, archiveFile) != 1))
+   {
+      free(records);
+      return -1;
+   }
+
+   /* The records hold everything needed, so the paths can be copied into
+      the pool without growing it over and over. */
+   index->paths = malloc(length > 0 ? length : 1);
+   index->entries = malloc((count > 0 ? count : 1)
+      * sizeof(struct index_entry));
+   if(index->paths == NULL || index->entries == NULL) {
+      free(records);
+      indexFree(index);
+      return -1;
+   }
+   index->pathsCapacity = length > 0 ? length : 1;
+   index->capacity = count > 0 ? count : 1;
+
+   uint64_t position = 0;
+   for(uint64_t i = 0; i < count; i++) {
+      if(position + INDEX_RECORD_SIZE > length) break;
+      const unsigned char *record = &records[position];
+      size_t pathLength = record[24] | (record[25] << 8);
+      position += INDEX_RECORD_SIZE;
+      if(position + pathLength > length) break;
+
+      struct index_entry *entry = &index->entries[index->count++];
+      entry->offset = getUInt64(&record[0]);
+      entry->size = getUInt64(&record[8]);
+      entry->modifiedTime = (time_t)(int64_t)getUInt64(&record[16]);
+      entry->path = index->pathsLength;
+      memcpy(&index->paths[index->pathsLength], &records[position],
+         pathLength);
+      index->paths[index->pathsLength + pathLength] = '\0';
+      /* Each record's path has at least 26 bytes of record before it,
+         so the pool can't overflow while adding the terminator. */
+      index->pathsLength += pathLength + 1;
+      position += pathLength;
+   }
+   free(records);
+
+   if(index->count != count) {
+      indexFree(index);
+      return -1;
+   }
+   return 0;
+}
+
+/*******************************************************************************
+   indexFree
+      Frees everything held by an index.
+*******************************************************************************/
+void indexFree(struct archive_index *index) {
+   free(index->entries);
+   free(index->paths);
+   indexInit(index);
+}
+
+/*******************************************************************************
+   putUInt64 / getUInt64
+      Little endian encoding, so indexes can be read on any machine.
+*******************************************************************************/
+static void putUInt64(unsigned char *bytes, uint64_t value) {
+   for(int i = 0; i < 8; i++) {
+      bytes[i] = (value >> (i * 8)) & 0xff;
+   }
+}
+
+static uint64_t getUInt64(const unsigned char *bytes) {
+   uint64_t value = 0;
+   for(int i = 7; i >= 0; i--) {
+      value = (value << 8) | bytes[i];
+   }
+   return value;
+}
@@ -0,0 +1,67 @@
+/*******************************************************************************
+
+   File        : archiveindex.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Seekable index of the files in a backup archive.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 17/10/2026 - v1.01 - Forgetting files never written.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef ARCHIVEINDEX_H
+#define ARCHIVEINDEX_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "archiveio.h"
+
+/* The index is written after the two empty blocks which end the archive,
+   where tar tools stop reading, so the archive is still a normal tar file.
+   It ends with a 512 byte footer, starting with this magic, which says where
+   the index starts. */
+#define INDEX_MAGIC "BKUPIDX1"
+
+struct index_entry {
+   /* Offset of the path in the index's path pool. */
+   size_t path;
+   /* Offset of the file's header block from the start of the archive. */
+   off_t offset;
+   off_t size;
+   time_t modifiedTime;
+};
+
+struct archive_index {
+   struct index_entry *entries;
+   size_t count;
+   size_t capacity;
+   /* Every path, null terminated, one after another. */
+   char *paths;
+   size_t pathsLength;
+   size_t pathsCapacity;
+};
+
+#define indexPath(index, entry) (&(index)->paths[(entry)->path])
+
+void indexInit(struct archive_index *index);
+int indexAdd(struct archive_index *index, const char* path, off_t offset,
+   off_t size, time_t modifiedTime);
+/* For a file added, but never written after all, takes out the last entry
+   for it's path, and moves everything after it back by length. */
+void indexForget(struct archive_index *index, const char* path,
+   off_t length);
+/* Writes the index and it's footer. Call after the end of archive blocks. */
+int indexWrite(const struct archive_index *index,
+   struct archive_writer *archive);
+/* Reads the index from the end of an archive. Returns -1 if there isn't one,
+   or it can't be read, leaving the archive's position undefined. */
+int indexRead(struct archive_index *index, FILE *archiveFile);
+void indexFree(struct archive_index *index);
+
+#endif
@@ -0,0 +1,415 @@
+/*******************************************************************************
+
+   File        : archiveio.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Buffered, streaming archive output for backup.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.01 - Optional compression.
+                 16/10/2026 - v1.02 - Stats.
+                 16/10/2026 - v1.03 - Streaming to pipes.
+                 16/10/2026 - v1.04 - Page cache modes.
+                 16/10/2026 - v1.05 - Throttling.
+                 17/10/2026 - v1.06 - Shared writeAll.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   backupFile used to read each file into memory in one go before writing it
+   to the archive, so memory use grew with the size of the backup.
+   The writer here never holds more than ARCHIVE_BUFFER_SIZE bytes:
+   -  Small files are read straight into the archive buffer, so the data is
+      only copied once, and the archive is written in full buffers.
+   -  Large files are handed to the kernel with copy_file_range, or sendfile
+      where that isn't supported, so the data never comes into user space.
+   When compressing, full buffers are handed to the compressor instead, and
+   everything goes through the buffer, as the kernel can't compress.
+   Archives are written once and not read back, so with archiveSetCacheMode
+   what's written leaves the cache as soon as it's on the disk. Waiting for
+   each buffer as it's written would stall, so write back is started on
+   every buffer as it goes out, and waited for, and the pages dropped, as
+   the next goes out.
+   All functions return 0 on success and -1 on failure, with errno set.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "archiveio.h"
+#include "throttle.h"
+#include "stats.h"
+
+/* Files smaller than this are read through the buffer, it isn't worth
+   breaking up the buffered writes for them. */
+#define ARCHIVE_COPY_THRESHOLD (64 * 1024)
+
+static int copyInKernel(struct archive_writer *archive, int sourceFd,
+   off_t *remaining);
+static int setDirect(struct archive_writer *archive, int direct);
+static void dropWritten(struct archive_writer *archive, off_t end,
+   int finishing);
+
+/*******************************************************************************
+   archiveOpen
+      Sets up a writer for an archive file descriptor, opened for writing.
+*******************************************************************************/
+int archiveOpen(struct archive_writer *archive, int fd) {
+   memset(archive, 0, sizeof(struct archive_writer));
+   void *buffer;
+   if(posix_memalign(&buffer, 4096, ARCHIVE_BUFFER_SIZE) != 0) {
+      errno = ENOMEM;
+      return -1;
+   }
+   archive->fd = fd;
+   archive->buffer = buffer;
+
+   /* Copying in the kernel breaks the archive up into a small write for
+      whatever was buffered, then the file's data in whatever pieces the
+      kernel likes. That doesn't matter to a file, but whatever reads a
+      pipe or socket gets every piece separately, so they only ever get
+      full buffers. */
+   struct stat archiveStatus;
+   if(fstat(fd, &archiveStatus) != 0) archiveStatus.st_mode = 0;
+   archive->isFile = S_ISREG(archiveStatus.st_mode);
+   archive->canCopyRange = archive->isFile;
+   archive->canSendFile = archive->isFile;
+   if(S_ISFIFO(archiveStatus.st_mode)) {
+      /* Let a whole buffer into the pipe at once, where we're allowed. */
+      fcntl(fd, F_SETPIPE_SZ, ARCHIVE_BUFFER_SIZE);
+   }
+   return 0;
+}
+
+/*******************************************************************************
+   archiveCompress
+      Starts compressing the archive. Anything already buffered is written
+      uncompressed first.
+*******************************************************************************/
+int archiveCompress(struct archive_writer *archive,
+   const struct compressor_options *options)
+{
+   if(archiveFlush(archive) != 0) return -1;
+   archive->compressor = compressorStart(archive->fd, ARCHIVE_BUFFER_SIZE,
+      options);
+   if(archive->compressor == NULL) {
+      errno = ENOMEM;
+      return -1;
+   }
+   archive->canCopyRange = 0;
+   archive->canSendFile = 0;
+   return 0;
+}
+
+/*******************************************************************************
+   archiveSetCacheMode
+      With CACHE_DIRECT, full buffers are written with O_DIRECT, falling
+      back to CACHE_DROP for the odd one which isn't aligned, such as the
+      last, or for the whole archive if the file system doesn't allow it,
+      or it's compressed. The kernel copies through the cache, so isn't
+      asked to.
+*******************************************************************************/
+void archiveSetCacheMode(struct archive_writer *archive,
+   enum cache_mode mode)
+{
+   archive->writtenBack = archive->offset - archive->used;
+   archive->dropped = archive->writtenBack;
+   if(!archive->isFile) mode = CACHE_NORMAL;
+   if(mode == CACHE_DIRECT 
+      && (archive->compressor != NULL || setDirect(archive, 1) != 0)) 
+   {
+      mode = CACHE_DROP;
+   }
+   archive->cacheMode = mode;
+   if(mode == CACHE_DIRECT) {
+      archive->canCopyRange = 0;
+      archive->canSendFile = 0;
+   }
+}
+
+/*******************************************************************************
+   archiveWrite
+      Adds data to the archive.
+*******************************************************************************/
+int archiveWrite(struct archive_writer *archive, const void *data,
+   size_t length)
+{
+   const char *bytes = (const char *)data;
+   while(length > 0) {
+      size_t space = ARCHIVE_BUFFER_SIZE - archive->used;
+      size_t chunk = length < space ? length : space;
+      memcpy(&archive->buffer[archive->used], bytes, chunk);
+      archive->used += chunk;
+      archive->offset += chunk;
+      bytes += chunk;
+      length -= chunk;
+      if(archive->used == ARCHIVE_BUFFER_SIZE && archiveFlush(archive) != 0) {
+         return -1;
+      }
+   }
+   return 0;
+}
+
+/*******************************************************************************
+   archiveWritePadding
+      Writes zeros up to the start of the next 512 byte block.
+*******************************************************************************/
+int archiveWritePadding(struct archive_writer *archive) {
+   static const char zeros[ARCHIVE_BLOCK_SIZE];
+   size_t partial = archive->offset % ARCHIVE_BLOCK_SIZE;
+   if(partial == 0) return 0;
+   return archiveWrite(archive, zeros, ARCHIVE_BLOCK_SIZE - partial);
+}
+
+/*******************************************************************************
+   archiveCopyFile
+      Copies exactly length bytes from sourceFd into the archive.
+      length should come from the same stat as the file's header. If the
+      file has shrunk since, the rest is filled with zeros, and if it has
+      grown, the extra data is left out, so the archive always matches the
+      header.
+      Hashing needs the data in user space, so it's always read through the
+      buffer when hash is given.
+*******************************************************************************/
+int archiveCopyFile(struct archive_writer *archive, int sourceFd,
+   off_t length, struct content_hash *hash)
+{
+   off_t remaining = length;
+
+   if(remaining >= ARCHIVE_COPY_THRESHOLD && hash == NULL
+      && (archive->canCopyRange || archive->canSendFile))
+   {
+      /* Everything buffered has to be in the file before the kernel
+         writes after it. */
+      if(archiveFlush(archive) != 0) return -1;
+      off_t before = remaining;
+      int result = copyInKernel(archive, sourceFd, &remaining);
+      statsAdd(STATS_BYTES_READ, before - remaining);
+      statsAdd(STATS_BYTES_WRITTEN, before - remaining);
+      archive->offset += before - remaining;
+      if(result != 0) return -1;
+      dropWritten(archive, archive->offset, 0);
+   }
+
+   while(remaining > 0) {
+      size_t space = ARCHIVE_BUFFER_SIZE - archive->used;
+      size_t chunk = remaining < (off_t)space ? (size_t)remaining : space;
+      throttleBytes(chunk);
+      uint64_t started = statsStart();
+      uint64_t throttleStarted = throttleStart();
+      ssize_t bytesRead = read(sourceFd, &archive->buffer[archive->used],
+         chunk);
+      throttleStop(throttleStarted);
+      statsStop(STATS_READ, started);
+      if(bytesRead < 0) {
+         if(errno == EINTR) continue;
+         return -1;
+      }
+      statsAdd(STATS_BYTES_READ, bytesRead);
+      if(bytesRead == 0) {
+         /* The file is shorter than it was, fill the gap. */
+         memset(&archive->buffer[archive->used], 0, chunk);
+         bytesRead = chunk;
+      }
+      if(hash != NULL) {
+         contentHashUpdate(hash, &archive->buffer[archive->used], bytesRead);
+      }
+      archive->used += bytesRead;
+      archive->offset += bytesRead;
+      remaining -= bytesRead;
+      if(archive->used == ARCHIVE_BUFFER_SIZE && archiveFlush(archive) != 0) {
+         return -1;
+      }
+   }
+   return 0;
+}
+
+/*******************************************************************************
+   copyInKernel
+      Copies as much as it can with copy_file_range, then sendfile.
+      The kernel reads and writes at once, it's counted as reading.
+      Leaves remaining at whatever is left to copy, which is only non-zero
+      if neither is supported for these files, or the source ran out early.
+*******************************************************************************/
+static int copyInKernel(struct archive_writer *archive, int sourceFd,
+   off_t *remaining)
+{
+   while(*remaining > 0 && archive->canCopyRange) {
+      size_t chunk = throttleChunk(*remaining);
+      throttleBytes(chunk);
+      uint64_t statsStarted = statsStart();
+      uint64_t started = throttleStart();
+      ssize_t copied = copy_file_range(sourceFd, NULL, archive->fd, NULL,
+         chunk, 0);
+      throttleStop(started);
+      statsStop(STATS_READ, statsStarted);
+      if(copied > 0) {
+         *remaining -= copied;
+         continue;
+      }
+      if(copied == 0) return 0;
+      if(errno == EINTR) continue;
+      /* Not supported between these files, or at all. */
+      if(errno == EXDEV || errno == EINVAL || errno == ENOSYS
+         || errno == EOPNOTSUPP || errno == EBADF)
+      {
+         archive->canCopyRange = 0;
+         break;
+      }
+      return -1;
+   }
+
+   while(*remaining > 0 && archive->canSendFile) {
+      size_t chunk = throttleChunk(*remaining);
+      throttleBytes(chunk);
+      uint64_t statsStarted = statsStart();
+      uint64_t started = throttleStart();
+      ssize_t copied = sendfile(archive->fd, sourceFd, NULL, chunk);
+      throttleStop(started);
+      statsStop(STATS_READ, statsStarted);
+      if(copied > 0) {
+         *remaining -= copied;
+         continue;
+      }
+      if(copied == 0) return 0;
+      if(errno == EINTR) continue;
+      if(errno == EINVAL || errno == ENOSYS) {
+         archive->canSendFile = 0;
+         break;
+      }
+      return -1;
+   }
+   return 0;
+}
+
+/*******************************************************************************
+   archiveFlush
+      Writes out anything in the buffer.
+*******************************************************************************/
+int archiveFlush(struct archive_writer *archive) {
+   if(archive->used == 0) return 0;
+   if(archive->compressor != NULL) {
+      if(compressorSubmit(archive->compressor, &archive->buffer,
+         archive->used) != 0)
+      {
+         errno = EIO;
+         return -1;
+      }
+      archive->used = 0;
+      return 0;
+   }
+   if(archive->cacheMode == CACHE_DIRECT) {
+      off_t start = archive->offset - archive->used;
+      if(setDirect(archive, start % CACHE_DIRECT_ALIGNMENT == 0
+         && archive->used % CACHE_DIRECT_ALIGNMENT == 0) != 0)
+      {
+         return -1;
+      }
+   }
+   if(writeAll(archive->fd, archive->buffer, archive->used) != 0) return -1;
+   archive->used = 0;
+   dropWritten(archive, archive->offset, 0);
+   return 0;
+}
+
+/*******************************************************************************
+   archiveClose
+      Flushes the writer, closes the archive, and frees the buffer.
+*******************************************************************************/
+int archiveClose(struct archive_writer *archive) {
+   int result = archiveFlush(archive);
+   off_t end = archive->offset;
+   if(archive->compressor != NULL) {
+      if(compressorFinish(archive->compressor) != 0) result = -1;
+      archive->compressor = NULL;
+      /* Where the compressed data ends is only known now, so it's all
+         dropped at once. */
+      end = lseek(archive->fd, 0, SEEK_CUR);
+   }
+   if(end > 0) dropWritten(archive, end, 1);
+   if(close(archive->fd) != 0) result = -1;
+   free(archive->buffer);
+   archive->buffer = NULL;
+   return result;
+}
+
+/*******************************************************************************
+   setDirect
+      Turns O_DIRECT on or off for the archive.
+*******************************************************************************/
+static int setDirect(struct archive_writer *archive, int direct) {
+   if(direct == archive->direct) return 0;
+   int flags = fcntl(archive->fd, F_GETFL);
+   if(flags == -1) return -1;
+   flags = direct ? flags | O_DIRECT : flags & ~O_DIRECT;
+   if(fcntl(archive->fd, F_SETFL, flags) != 0) return -1;
+   archive->direct = direct;
+   return 0;
+}
+
+/*******************************************************************************
+   dropWritten
+      Starts write back for everything written up to end since the last
+      call, then waits for what was started the time before, and drops it. When
+      finishing, everything is waited for, and dropped.
+      Pages written with O_DIRECT were never cached, so there's nothing to
+      wait for, and they're only counted.
+*******************************************************************************/
+static void dropWritten(struct archive_writer *archive, off_t end,
+   int finishing)
+{
+   if(archive->cacheMode == CACHE_NORMAL || archive->compressor != NULL) {
+      return;
+   }
+   if(end > archive->writtenBack) {
+      sync_file_range(archive->fd, archive->writtenBack,
+         end - archive->writtenBack, SYNC_FILE_RANGE_WRITE);
+   }
+   off_t dropTo = finishing ? end : archive->writtenBack;
+   archive->writtenBack = end;
+   if(dropTo <= archive->dropped) return;
+
+   /* Only whole pages are dropped, so the page the last drop ended part
+      way through is dropped again. */
+   off_t start = archive->dropped & ~(off_t)(CACHE_DIRECT_ALIGNMENT - 1);
+   sync_file_range(archive->fd, start, dropTo - start,
+      SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+      | SYNC_FILE_RANGE_WAIT_AFTER);
+   posix_fadvise(archive->fd, start, dropTo - start, POSIX_FADV_DONTNEED);
+   statsAdd(STATS_BYTES_UNCACHED, dropTo - archive->dropped);
+   archive->dropped = dropTo;
+}
+
+/*******************************************************************************
+   writeAll
+      write, carrying on after partial writes and interruptions.
+*******************************************************************************/
+int writeAll(int fd, const void *data, size_t length) {
+   const char *next = data;
+   while(length > 0) {
+      uint64_t started = statsStart();
+      ssize_t written = write(fd, next, length);
+      statsStop(STATS_WRITE, started);
+      if(written < 0) {
+         if(errno == EINTR) continue;
+         return -1;
+      }
+      statsAdd(STATS_BYTES_WRITTEN, written);
+      next += written;
+      length -= written;
+   }
+   return 0;
+}
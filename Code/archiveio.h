@@ -0,0 +1,81 @@
+/*******************************************************************************
+
+   File        : archiveio.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Buffered, streaming archive output for backup.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.01 - Optional compression.
+                 16/10/2026 - v1.02 - Page cache modes.
+                 17/10/2026 - v1.03 - Shared writeAll.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef ARCHIVEIO_H
+#define ARCHIVEIO_H
+
+#include <sys/types.h>
+
+#include "contenthash.h"
+#include "compressor.h"
+#include "pagecache.h"
+
+/* Tar files are made of 512 byte blocks. */
+#define ARCHIVE_BLOCK_SIZE 512
+
+/* Archive output is collected into a buffer of this size, and only written
+   out once it's full, so the archive gets large, page aligned writes
+   whatever the size of the files going into it. */
+#define ARCHIVE_BUFFER_SIZE (1024 * 1024)
+
+struct archive_writer {
+   int fd;
+   /* ARCHIVE_BUFFER_SIZE bytes, page aligned. */
+   char *buffer;
+   size_t used;
+   /* The number of bytes written to the archive so far, including anything
+      still sitting in the buffer. */
+   off_t offset;
+   /* Cleared the first time the kernel refuses, so we don't keep asking. */
+   int canCopyRange;
+   int canSendFile;
+   /* If set, full buffers go to the compressor rather than the file. */
+   struct compressor *compressor;
+   /* Only regular files are cached, pipes and sockets aren't. */
+   int isFile;
+   enum cache_mode cacheMode;
+   /* Whether the archive is open with O_DIRECT at the moment. */
+   int direct;
+   /* Write back has been started for everything before writtenBack, and
+      everything before dropped is on the disk, and out of the cache. */
+   off_t writtenBack;
+   off_t dropped;
+};
+
+int archiveOpen(struct archive_writer *archive, int fd);
+/* Compresses everything written from here on. */
+int archiveCompress(struct archive_writer *archive,
+   const struct compressor_options *options);
+/* Keeps what's written out of the page cache, see pagecache.h. Call it
+   once the archive is positioned where writing starts, after
+   archiveCompress if compressing. */
+void archiveSetCacheMode(struct archive_writer *archive,
+   enum cache_mode mode);
+int archiveWrite(struct archive_writer *archive, const void *data,
+   size_t length);
+int archiveWritePadding(struct archive_writer *archive);
+/* If hash isn't NULL, the data is also added to it. */
+int archiveCopyFile(struct archive_writer *archive, int sourceFd,
+   off_t length, struct content_hash *hash);
+int archiveFlush(struct archive_writer *archive);
+int archiveClose(struct archive_writer *archive);
+
+/* write, carrying on after partial writes and interruptions, for any file
+   descriptor. Counted in the stats as writes. */
+int writeAll(int fd, const void *data, size_t length);
+
+#endif
@@ -7,6 +7,27 @@
    Description : Assignment 2 Task 3, backup and restore files..
 
    History     : 18/12/2018 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.10 - Multi-threaded directory walker.
+                 16/10/2026 - v1.11 - Stream file data into the archive.
+                 16/10/2026 - v1.12 - Read-ahead pipeline.
+                 16/10/2026 - v1.13 - Archive index, selective restore.
+                 16/10/2026 - v1.14 - Header-only archive listing.
+                 16/10/2026 - v1.15 - Manifest based incremental backups.
+                 16/10/2026 - v1.16 - Parallel gzip compression.
+                 16/10/2026 - v1.17 - Cached user and group names.
+                 16/10/2026 - v1.18 - Parallel restore.
+                 16/10/2026 - v1.19 - io_uring I/O.
+                 16/10/2026 - v1.20 - Sparse files.
+                 16/10/2026 - v1.21 - Hard links.
+                 16/10/2026 - v1.22 - Stats.
+                 16/10/2026 - v1.23 - Header codec, checksums verified.
+                 16/10/2026 - v1.24 - Streaming through stdin and stdout.
+                 16/10/2026 - v1.25 - Leaving the page cache alone.
+                 16/10/2026 - v1.26 - Change journal.
+                 16/10/2026 - v1.27 - Disk order reads.
+                 16/10/2026 - v1.28 - Throttling.
+                 16/10/2026 - v1.29 - Exclude rules.
+                 17/10/2026 - v1.30 - Files deleted under the pipeline.
 
    Author      : Alex H. Newark
 
@@ -24,9 +45,8 @@
    -  Refactoring to make better use of variables and repeat operations less.
 *******************************************************************************/
 
-/* Required for nftw */
-#define _XOPEN_SOURCE 1
-#define _XOPEN_SOURCE_EXTENDED 1
+/* Required for fseeko, fnmatch's FNM_LEADING_DIR, strptime and timegm */
+#define _GNU_SOURCE
 
 #include <unistd.h>
 #include <dirent.h>
@@ -39,6 +59,30 @@
 #include <string.h>
 #include <fcntl.h>
 #include <utime.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "walker.h"
+#include "pathfilter.h"
+#include "idcache.h"
+#include "archiveio.h"
+#include "pipeline.h"
+#include "archiveindex.h"
+#include "manifest.h"
+#include "contenthash.h"
+#include "compressor.h"
+#include "restorer.h"
+#include "uring.h"
+#include "sparse.h"
+#include "linktable.h"
+#include "stats.h"
+#include "tarheader.h"
+#include "pagecache.h"
+#include "journal.h"
+#include "watcher.h"
+#include "readorder.h"
+#include "throttle.h"
 
 /* The path of a file is an array of characters with a max size of 4096.
    The path always includes the backup path, 
@@ -53,8 +97,75 @@
    path to be printed, which isn't the end of the world :) */
 static short backupPathLength = 0;
 static time_t modifiedAfterTimestamp = 0;
+/* Only regular files are archived, and the inode, which hard links and
+   the manifest need, always comes with the rest. */
+static struct walk_options walkOptions = { 1, 0, WALK_FILES,
+   WALK_MODE | WALK_LINKS | WALK_OWNER | WALK_SIZE | WALK_MODIFIED
+   | WALK_CHANGED };
+/* The archive is read with stdio when restoring, and written through an
+   archive_writer when backing up. */
 static FILE *archiveFile;
+static struct archive_writer archive;
+/* With --readers, files are read ahead by a pipeline, NULL otherwise. */
+static struct pipeline_options pipelineOptions = { 0, 64, 32, PIPELINE_IO_SYNC };
+static struct pipeline *pipeline = NULL;
+/* With -i, an index of every file is written after the end of the archive.
+   nextHeaderOffset is where the next header will be written, which is known
+   in advance, as even the pipeline writes files in the order given. */
+static char writeIndex = 0;
+static struct archive_index archiveIndex;
+static off_t nextHeaderOffset = 0;
+/* When restoring, the paths or globs of the files wanted. 
+   Everything is restored if there aren't any. */
+static char **restorePatterns = NULL;
+static int restorePatternCount = 0;
+/* Threads writing restored files, 0 for one per processor. */
+static int restoreThreads = 0;
+static struct restorer *restorer = NULL;
+/* With -z, or an archive named .gz or .tgz, the archive is gzip
+   compressed, see compressor.h. */
+static int compressing = 0;
+static struct compressor_options compressorOptions = {0, 0};
+/* With -m, files are compared against the manifest of a previous backup,
+   rather than the -t timestamp, and a new manifest is written next to the
+   archive. */
+static struct manifest *previousManifest = NULL;
+static struct manifest *newManifest = NULL;
 static char archivePath[4351];
+/* Pipes, and compressed archives, are read straight through, skipping
+   data by reading it, and can't use an index. */
+static int archiveSeekable = 0;
+/* Files with several hard links, by inode, so they're only archived once. */
+static struct link_table *linkTable = NULL;
+/* -1 without --stats, otherwise whether to print JSON. */
+static int statsJson = -1;
+/* With -r, new files are added to the end of an existing archive, rather
+   than replacing it. Each run records when it started, and the last of
+   these is the default -t for the next. */
+static char appending = 0;
+static char timestampGiven = 0;
+static time_t lastRunStarted = 0;
+static time_t runStarted = 0;
+/* With --cache, how files and the archive are kept out of the page cache,
+   see pagecache.h. */
+static enum cache_mode cacheMode = CACHE_NORMAL;
+/* Kept by backup --watch, as <archive path>.journal. Once taken, it's
+   finished with only after the archive is written. */
+static char journalPath[4359];
+static int journalTaken = 0;
+static struct journal journal;
+/* With --order, files are collected into a window, and archived in the
+   order they sit on the disk. fileCallback is what the walk calls, either
+   way. */
+static enum read_order readOrder = READ_ORDER_WALK;
+static int readWindowSize = READ_WINDOW_DEFAULT;
+static struct read_window *readWindow = NULL;
+static walkCallback fileCallback = NULL;
+/* With --limit-rate, --max-latency or --ionice, how backing up is held
+   back, see throttle.h. ioClass is 0 to leave the priority alone. */
+static struct throttle_options throttleOptions = { 0, 0, 0 };
+static int ioClass = 0;
+static int ioLevel = 7;
 
 /* Structure / Function Definitions
    Alternatively I could use a header, but the assignment brief only
@@ -62,61 +173,17 @@ static char archivePath[4351];
    When structures are defined, their body much be fully defined before they
    are refenced. So I'm placing them at the top. */
 
-/* Tar files are formed of 512 byte blocks. 
-   Before each file in the archive, there's a header block, containg file 
-   details. Following the header is the file's data, with padding to fill the 
-   gap between the end of file, and the next 512 byte block. 
-   
-   There are different tar header formats, I am using the UStar format.
-   Early formats only allowed file paths 100 characters long, maximum.
-   However, UStar format provides an extra 155 characters at the end of the 
-   header for longer files paths, which I am making use of. 
-   The extra characters, if not null, are appended to the beginning of the 
-   first filePath field. */
-struct tar_header_block {
-      /* Old, Pre-POSIX.1-1988 fields */
-      /* Must be null terminated unless all 100 characters are used. */
-      char filePath[100];
-      /* Octal mode. */
-      char fileMode[8];
-      /* Octal number in ASCII, null (or space) terminated, zero padded. */
-      char ownerId[8];
-      /* Octal number in ASCII, null (or space) terminated, zero padded. */
-      char groupId[8];
-      char fileSize[12];
-      /* Numeric, octal unix time format. */
-      char modifiedTime[12];
-      /* The checksum is calculated based on the header with an empty 
-         checksum containing space characters. */
-      char checksum[8];
-      /* This field was originally the link type, but with the ustar format,
-         it represents the file type. 
-         eg, normal file/symbolic link/directory... */
-      char type;
-      /* Must be null terminated unless all 100 characters are used. */
-      char linkName[100];
-      /* UStar only fields from here.   */
-      /* Must be null terminated */
-      char ustarMagic[6];
-      /* Always "00" */
-      char version[2];
-      /* Must be null terminated */
-      char ownerName[32];
-      /* Must be null terminated */
-      char groupName[32];
-      /* Magor and minor are for devices, which I'm not using, so for this
-         purpose they can be left null. */
-      char major[8];
-      char minor[8];
-      /* The file path prefix, must be null terminated unless all 155 characters
-         are used. */
-      char filePathPrefix[155];
-      /* The header uses 500/512 bytes of it's block. Some custom formats
-         can make use of the extra 12 bytes, but in generally it's null. 
-         As an improvement, this tool could use some of this space to store
-         a file's change timestamp (not modified date). */
-      char unused[12];
+/* Sparse files are archived with a pax extended header (type 'x') in front
+   of their own header, as GNU tar does, see sparse.c. When restoring or 
+   listing, this is what the last one said about the header after it. */
+struct extended_header {
+   int sparse;
+   /* The real path, as the header's is made up. Empty if not given. */
+   char path[256];
+   /* The size of the file once restored, rather than what's archived. */
+   off_t realSize;
 };
+static struct extended_header extendedHeader;
 
 static int backupFile(const char* path, const struct stat *fileStat, 
    int flag, struct FTW* fileTreeWalker);
@@ -124,10 +191,52 @@ void getModeString(mode_t mode, char modeStr[]);
 void printHelp();
 static void makeHeader(const char* relativePath, const struct stat *fileStatus, 
    struct tar_header_block *tarHeader);
+static int hasChangedSinceManifest(const char* path, 
+   const struct stat *fileStat);
+static void writeTombstones();
 static void backup(char* backupPath);
 static void restore();
-unsigned int convertOctalStringToUInt(char * octalString, 
-   unsigned int stringSize);
+static void finishRestore();
+static int hasSuffix(const char* string, const char* suffix);
+static void getRestorePath(char restorePath[4347]);
+static int backupHardLink(const char* path, const struct stat *fileStat,
+   const struct link_target *target);
+static void finishLinkRecords();
+static int backupSparseFile(const char* path, const struct stat *fileStat,
+   struct cached_file *source);
+static enum cache_mode ownReadMode();
+static void getSparseName(const char* relativePath, const char* folder,
+   char name[256]);
+static void addRecord(char *records, size_t *recordsLength, const char* key,
+   const char* value);
+static void hashZeros(struct content_hash *hash, off_t length);
+static int readHeader(struct tar_header_block *headerData);
+static int readExtendedRecords(const struct tar_header_block *headerData);
+static int parseExtendedHeader(const char *records, size_t length);
+static int isRecordKey(const char *key, size_t keyLength, const char* name);
+static int isEmptyBlock(const void *block);
+static int isValidHeader(const struct tar_header_block *headerData);
+static void listArchive();
+static void listMember(const struct tar_header_block *headerData);
+static void getMemberPath(const struct tar_header_block *headerData, 
+   char memberPath[256]);
+static int matchesRestorePatterns(const char* memberPath);
+static void skipMember(const struct tar_header_block *headerData);
+static void restoreMember(const struct tar_header_block *headerData);
+static FILE *openArchive();
+static void startAppending();
+static void writeRunRecord(time_t started);
+static int isSeekable(FILE *file);
+static int skipArchive(off_t length);
+static void drainArchive();
+static int backupJournal(const char* backupPath);
+static int compareJournalPaths(const void *a, const void *b);
+static int scheduleFile(const char* path, const struct stat *fileStat,
+   int flag, struct FTW* fileTreeWalker);
+static int backupScheduledFile(const char* path, const struct stat *fileStat,
+   int flag, struct FTW* fileTreeWalker);
+static void forgetSkippedFiles();
+static void forgetDeletedFile(const char* relativePath);
 
 /*******************************************************************************
    printHelp
@@ -144,11 +253,107 @@ void printHelp() {
          "      \"YYYY-MM-DD hh:mm:ss\", or as a file path, from which\n"
          "      the modified date will be read.\n"
          "      Defaults to 1970-01-01 00:00:00.\n"
+         "   -j <threads>\n"
+         "      the number of threads used to walk directories, or to\n"
+         "      write files when restoring. Defaults to 1 for backups,\n"
+         "      and one per processor for restores.\n"
+         "   -o\n"
+         "      archive files in name order, regardless of thread count.\n"
+         "   --exclude=<pattern>, --include=<pattern>\n"
+         "      skip, or keep, what matches the pattern, the first rule\n"
+         "      to match deciding. Patterns without a '/' match names at\n"
+         "      any depth, others the path within the backup directory,\n"
+         "      and those ending in '/' only folders. * ? [...] work as\n"
+         "      in the shell, and ** matches any number of folders.\n"
+         "      Excluded folders aren't read at all.\n"
+         "   --exclude-from=<file>\n"
+         "      add a rule for each line of the file, \"+ \" at the start\n"
+         "      making it an include. Blank lines and # comments are\n"
+         "      skipped.\n"
+         "   --readers=<threads>\n"
+         "      read files ahead with this many threads, while a single\n"
+         "      thread writes the archive. The archive is unchanged.\n"
+         "   --queue=<files>\n"
+         "      how many files can be read ahead. Defaults to 64.\n"
+         "   --buffers=<count>\n"
+         "      the number of 256KiB read-ahead buffers. Defaults to 32.\n"
+         "   --io=<uring|sync>\n"
+         "      how files are read when backing up, and written when\n"
+         "      restoring. uring keeps many opens, reads and writes in\n"
+         "      flight at once, where the kernel supports it.\n"
+         "      Defaults to sync.\n"
+         "   --stats[=json]\n"
+         "      print where the time went, and how much was done, to\n"
+         "      stderr once finished, as a table or a line of JSON.\n"
+         "   --cache=<normal|drop|direct>\n"
+         "      how backing up treats the page cache. drop reads files\n"
+         "      sequentially and drops them from the cache after, along\n"
+         "      with the archive, leaving files that were already cached\n"
+         "      alone. direct reads and writes with O_DIRECT instead,\n"
+         "      through aligned buffers, using a reader thread if\n"
+         "      --readers isn't given, and drops what it can't.\n"
+         "      Defaults to normal.\n"
+         "   --order=<walk|inode|physical>\n"
+         "      the order files are read and archived in. inode and\n"
+         "      physical sort each window of files by inode, or by\n"
+         "      where their data starts on the disk, so spinning disks\n"
+         "      read in sweeps rather than seeking. physical falls back\n"
+         "      to inode where the file system can't say.\n"
+         "      Defaults to walk, the order they're found in.\n"
+         "   --window=<files>\n"
+         "      how many files are sorted at once. Defaults to 8192.\n"
+         "   --limit-rate=<MB/s>[,<files/s>]\n"
+         "      read at most this many megabytes, and start at most this\n"
+         "      many files, a second. 0 for no limit on either.\n"
+         "   --max-latency=<ms>\n"
+         "      back off while reads take longer than this on average,\n"
+         "      so services on the same disks aren't starved.\n"
+         "   --ionice=<idle|best-effort[:<0-7>]>\n"
+         "      the I/O scheduling class. idle only reads when nothing\n"
+         "      else is, best-effort at a level, 7 being the lowest.\n"
+         "   --watch\n"
+         "      instead of backing up, watch the backup directory, and\n"
+         "      keep a journal of what changes in it, as\n"
+         "      <archive path>.journal, until interrupted. Later runs\n"
+         "      with -r, or -t, back up just what's in the journal,\n"
+         "      rather than looking at every file, whenever it covers\n"
+         "      everything since the time they'd back up from.\n"
          "   -h\n"
          "      Displays utility help (this messsge).\n"
+         "   -i\n"
+         "      write an index after the end of the archive, so restore\n"
+         "      can seek straight to the files asked for.\n"
+         "   -r\n"
+         "      add files to the end of the archive, rather than\n"
+         "      replacing it, and unless -t or -m is given, only those\n"
+         "      modified since the last run which wrote to it started.\n"
+         "      Restoring gives the newest copy of each file.\n"
+         "   -m <manifest>\n"
+         "      back up only files which have changed since the backup\n"
+         "      that wrote the manifest, and record files deleted since.\n"
+         "      Replaces -t. A new manifest is always written alongside\n"
+         "      the archive, as <archive path>.manifest.\n"
+         "   -z\n"
+         "      gzip compress the archive, using every processor.\n"
+         "      Archives named .gz or .tgz are always compressed, and\n"
+         "      compressed archives are detected when restoring.\n"
+         "   --level=<1-9>\n"
+         "      the compression level. Defaults to 6.\n"
+         "   --compressors=<threads>\n"
+         "      the number of compression threads. Defaults to one per\n"
+         "      processor.\n"
+         "   -l\n"
+         "      list the files in the archive, instead of backing up or\n"
+         "      restoring. Only the headers are read.\n"
          "   -f <filename>\n"
          "      (Required) The name/path of the archive file to"
-         "      backup to / restore from.\n\n");
+         "      backup to / restore from.\n"
+         "      - writes the archive to stdout, or reads it from stdin,\n"
+         "      without seeking. Messages go to stderr instead, and\n"
+         "      restored files go in the current folder.\n"
+         "usage: restore (options) -f <archive path> (paths or globs...)\n"
+         "   restores only the files matching any of the given paths or\n"
+         "   globs, or everything if none are given.\n\n");
    exit(1);
 }
 
@@ -170,11 +375,16 @@ int main(int argc, char *argv[])
 
    //Detect symbolic link.
    char restoring = 0;
-   if(!strcmp(argv[0], "restore")) {
+   const char *programName = strrchr(argv[0], '/');
+   programName = programName != NULL ? programName + 1 : argv[0];
+   if(!strcmp(programName, "restore")) {
       restoring = 1;
    }
 
-   char backupPath[4096];
+   char backupPath[4096] = "";
+   restorePatterns = malloc(argc * sizeof(char *));
+   char listing = 0;
+   char watching = 0;
 
    /* Parse Arguments */
    for(int i = 1; i < argc; i++) {
@@ -183,6 +393,139 @@ int main(int argc, char *argv[])
          printHelp();
       } 
       
+      else if(strcmp(argv[i], "-j") == 0) {
+         //If -j is provided with no thread count...
+         if(argc <= i + 1 || atoi(argv[i + 1]) < 1) {
+            printf("Invalid Arguments: No thread count provided.\n");
+            return 1;
+         }
+         walkOptions.threads = atoi(argv[i + 1]);
+         restoreThreads = walkOptions.threads;
+         i++;
+         continue;
+      }
+
+      else if(strcmp(argv[i], "-o") == 0) {
+         walkOptions.ordered = 1;
+      }
+
+      else if(pathFilterIsOption(argv[i])) {
+         if(pathFilterParseOption(&walkOptions.filter, argv[i]) != 0) {
+            return 1;
+         }
+      }
+
+      else if(strncmp(argv[i], "--readers=", 10) == 0) {
+         pipelineOptions.readers = atoi(&argv[i][10]);
+         if(pipelineOptions.readers < 1) {
+            printf("Invalid Arguments: Invalid reader count.\n");
+            return 1;
+         }
+      }
+
+      else if(strncmp(argv[i], "--queue=", 8) == 0) {
+         pipelineOptions.queueDepth = atoi(&argv[i][8]);
+         if(pipelineOptions.queueDepth < 1) {
+            printf("Invalid Arguments: Invalid queue depth.\n");
+            return 1;
+         }
+      }
+
+      else if(strcmp(argv[i], "--io=uring") == 0) {
+         pipelineOptions.io = PIPELINE_IO_URING;
+      }
+
+      else if(strcmp(argv[i], "--io=sync") == 0) {
+         pipelineOptions.io = PIPELINE_IO_SYNC;
+      }
+
+      else if(strcmp(argv[i], "--stats") == 0
+         || strcmp(argv[i], "--stats=json") == 0) 
+      {
+         statsJson = argv[i][7] == '=';
+         statsEnable();
+      }
+
+      else if(strcmp(argv[i], "--cache=normal") == 0) {
+         cacheMode = CACHE_NORMAL;
+      }
+
+      else if(strcmp(argv[i], "--cache=drop") == 0) {
+         cacheMode = CACHE_DROP;
+      }
+
+      else if(strcmp(argv[i], "--cache=direct") == 0) {
+         cacheMode = CACHE_DIRECT;
+      }
+
+      else if(strcmp(argv[i], "--order=walk") == 0) {
+         readOrder = READ_ORDER_WALK;
+      }
+
+      else if(strcmp(argv[i], "--order=inode") == 0) {
+         readOrder = READ_ORDER_INODE;
+      }
+
+      else if(strcmp(argv[i], "--order=physical") == 0) {
+         readOrder = READ_ORDER_PHYSICAL;
+      }
+
+      else if(strncmp(argv[i], "--window=", 9) == 0) {
+         readWindowSize = atoi(&argv[i][9]);
+         if(readWindowSize < 1) {
+            printf("Invalid Arguments: Invalid window size.\n");
+            return 1;
+         }
+      }
+
+      else if(strncmp(argv[i], "--limit-rate=", 13) == 0) {
+         char *end;
+         double megabytes = strtod(&argv[i][13], &end);
+         double files = *end == ',' ? strtod(&end[1], &end) : 0;
+         if(*end != '\0' || megabytes < 0 || files < 0) {
+            printf("Invalid Arguments: Invalid rate limit.\n");
+            return 1;
+         }
+         throttleOptions.bytesPerSecond = megabytes * 1024 * 1024;
+         throttleOptions.filesPerSecond = files;
+      }
+
+      else if(strncmp(argv[i], "--max-latency=", 14) == 0) {
+         throttleOptions.latencyLimit = atof(&argv[i][14]) * 1000;
+         if(throttleOptions.latencyLimit <= 0) {
+            printf("Invalid Arguments: Invalid latency.\n");
+            return 1;
+         }
+      }
+
+      else if(strcmp(argv[i], "--ionice=idle") == 0) {
+         ioClass = THROTTLE_CLASS_IDLE;
+         ioLevel = 0;
+      }
+
+      else if(strncmp(argv[i], "--ionice=best-effort", 20) == 0) {
+         ioClass = THROTTLE_CLASS_BEST_EFFORT;
+         ioLevel = argv[i][20] == ':' ? atoi(&argv[i][21]) : 7;
+         if((argv[i][20] != ':' && argv[i][20] != '\0')
+            || ioLevel < 0 || ioLevel > 7)
+         {
+            printf("Invalid Arguments: Invalid I/O priority.\n");
+            return 1;
+         }
+      }
+
+      else if(strcmp(argv[i], "--watch") == 0) {
+         watching = 1;
+      }
+
+      else if(strncmp(argv[i], "--buffers=", 10) == 0) {
+         pipelineOptions.buffers = atoi(&argv[i][10]);
+         if(pipelineOptions.buffers < 2) {
+            printf("Invalid Arguments: At least 2 buffers are needed.\n");
+            return 1;
+         }
+      }
+
       else if(strcmp(argv[i], "-t") == 0) {
          //If -t is provided with no datetime...
          if(argc <= i + 1) {
@@ -208,6 +551,7 @@ int main(int argc, char *argv[])
          } else {
             modifiedAfterTimestamp = timegm(&timestamp);
          }
+         timestampGiven = 1;
          i++;
          continue;
       }
@@ -225,6 +569,60 @@ int main(int argc, char *argv[])
          continue;
       }
       
+      else if(strcmp(argv[i], "-i") == 0) {
+         writeIndex = 1;
+      }
+
+      else if(strcmp(argv[i], "-r") == 0) {
+         appending = 1;
+      }
+
+      else if(strcmp(argv[i], "-l") == 0) {
+         listing = 1;
+      }
+
+      else if(strcmp(argv[i], "-z") == 0) {
+         compressing = 1;
+      }
+
+      else if(strncmp(argv[i], "--level=", 8) == 0) {
+         compressorOptions.level = atoi(&argv[i][8]);
+         if(compressorOptions.level < 1 || compressorOptions.level > 9) {
+            printf("Invalid Arguments: Invalid compression level.\n");
+            return 1;
+         }
+      }
+
+      else if(strncmp(argv[i], "--compressors=", 14) == 0) {
+         compressorOptions.threads = atoi(&argv[i][14]);
+         if(compressorOptions.threads < 1) {
+            printf("Invalid Arguments: Invalid compressor count.\n");
+            return 1;
+         }
+      }
+
+      else if(strcmp(argv[i], "-m") == 0) {
+         //If -m is provided with no filename...
+         if(argc <= i + 1) {
+            printf("Invalid Arguments: No manifest provided.\n");
+            return 1;
+         }
+         /* A missing manifest means this is the first run, so every file
+            is backed up. */
+         previousManifest = manifestLoad(argv[i + 1]);
+         newManifest = manifestCreate();
+         if(newManifest == NULL) {
+            printf("Fatal Error: Out of memory.\n");
+            return 1;
+         }
+         i++;
+         continue;
+      }
+      
+      else if(restoring) {
+         restorePatterns[restorePatternCount++] = argv[i];
+      }
+
       else {
          strcpy(backupPath, argv[i]);
       }
@@ -238,17 +636,123 @@ int main(int argc, char *argv[])
       return 1;
    }
 
-   if(backupPathLength > 1 && !restoring) {
-      archiveFile = fopen(archivePath, "wb+");
+   int streaming = strcmp(archivePath, "-") == 0;
+   if(streaming && newManifest != NULL && !restoring && !listing) {
+      printf("Invalid Arguments: -m needs an archive path, as the new\n"
+            "manifest is written alongside it.\n");
+      return 1;
+   }
+
+   if(watching && (streaming || restoring || listing || backupPathLength < 2))
+   {
+      printf("Invalid Arguments: --watch needs an archive path, and a\n"
+            "directory to watch.\n");
+      return 1;
+   }
+
+   /* Before -r is checked, which can't append to a compressed archive. */
+   if(hasSuffix(archivePath, ".gz") || hasSuffix(archivePath, ".tgz")) {
+      compressing = 1;
+   }
+
+   if(appending && (streaming || compressing) && !restoring && !listing) {
+      printf("Invalid Arguments: -r can only append to an uncompressed\n"
+            "archive file.\n");
+      return 1;
+   }
+
+   if(pipelineOptions.io == PIPELINE_IO_URING && !uringAvailable()) {
+      printf("\nWarning: io_uring isn't available, using synchronous I/O.");
+      pipelineOptions.io = PIPELINE_IO_SYNC;
+   }
+
+   /* Before any threads start, so they all share it. */
+   if(ioClass != 0 && throttleSetPriority(ioClass, ioLevel) != 0) {
+      printf("\nWarning: Unable to set the I/O priority.");
+   }
+   throttleEnable(&throttleOptions);
+
+   /* Only the pipeline's buffers are aligned for O_DIRECT. */
+   pipelineOptions.cacheMode = cacheMode;
+   if(cacheMode == CACHE_DIRECT && pipelineOptions.readers == 0) {
+      pipelineOptions.readers = 1;
+   }
+
+   if(!streaming) {
+      snprintf(journalPath, 4359, "%s.journal", archivePath);
+   }
+
+   if(watching) {
+      return watchTree(backupPath, journalPath, archivePath, &walkOptions) == 0
+         ? EXIT_SUCCESS : 1;
+   } else if(listing) {
+      archiveFile = openArchive();
+      if(archiveFile == NULL) {
+         printf("Fatal Error: Unable to open archive:\n"
+               "\"%s\"\n", archivePath);
+         return 1;
+      }
+      printf("\n\n");
+      listArchive();
+      fclose(archiveFile);
+   } else if(backupPathLength > 1 && !restoring) {
+      int archiveDescriptor;
+      if(streaming) {
+         if(isatty(STDOUT_FILENO)) {
+            printf("\nFatal Error: Refusing to write an archive to a "
+                  "terminal.\n");
+            return 1;
+         }
+         /* The archive takes stdout, and everything printed goes to
+            stderr, including what's still buffered. */
+         archiveDescriptor = dup(STDOUT_FILENO);
+         dup2(STDERR_FILENO, STDOUT_FILENO);
+      } else if(appending) {
+         archiveDescriptor = open(archivePath, O_RDWR | O_CREAT, 0666);
+      } else {
+         archiveDescriptor 
+            = open(archivePath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      }
+      if(archiveDescriptor == -1 
+         || archiveOpen(&archive, archiveDescriptor) != 0
+         || (compressing && archiveCompress(&archive, &compressorOptions) != 0)) 
+      {
+         printf("Fatal Error: Unable to create archive:\n"
+               "\"%s\"\n", archivePath);
+         return 1;
+      }
+      if(appending) startAppending();
+      archiveSetCacheMode(&archive, cacheMode);
       backup(backupPath);
+      if(archiveClose(&archive) != 0) {
+         printf("Fatal Error: Unable to write archive:\n"
+               "\"%s\"\n", archivePath);
+         return 1;
+      }
+      /* Without -r there's no run record, so the archive's modified time
+         says when the run started instead, for a later -r. */
+      if(!appending && !streaming) {
+         struct utimbuf times = { runStarted, runStarted };
+         utime(archivePath, &times);
+      }
+      if(journalTaken) journalFinish(journalPath);
    } else {
-      archiveFile = fopen(archivePath, "rb");
+      archiveFile = openArchive();
+      if(archiveFile == NULL) {
+         printf("Fatal Error: Unable to open archive:\n"
+               "\"%s\"\n", archivePath);
+         return 1;
+      }
       restore();
+      fclose(archiveFile);
    }
 
-   fclose(archiveFile);
    printf("\n");
 
+   if(statsJson != -1) {
+      statsReport(restoring ? "restore" : "backup", statsJson);
+   }
+
    return EXIT_SUCCESS;
 }
 
@@ -269,19 +773,385 @@ static void backup(char* backupPath) {
    printf("%s", timestampString);
    printf("\n\n");
 
-   int nfds;
-   nfds = getdtablesize();
-	if (nftw(backupPath, backupFile, nfds, FTW_F | FTW_D) != 0) {
+   /* The journal is taken as the run starts, so anything changed from here
+      on is in the next one. It's only used if it goes back as far as the
+      files wanted, and nothing was missed. With -m, deleted files are
+      found by looking at every file, so it isn't used at all. */
+   time_t started = runStarted = time(NULL);
+   char rootPath[PATH_MAX];
+   journalTaken = journalPath[0] != '\0'
+      && realpath(backupPath, rootPath) != NULL
+      && journalTake(journalPath, rootPath, started, &journal) == 0;
+   int useJournal = journalTaken && !journal.lost && journal.since != 0
+      && journal.since <= modifiedAfterTimestamp && newManifest == NULL;
+   if(useJournal) {
+      printf("Using the change journal, %zu changed paths.\n\n",
+         journal.count);
+      /* Everything in the journal has changed since it started, whatever
+         it's times say. The watcher only adds changes once a second, so
+         one made just before the last run took it's journal can be in
+         this one instead, with times from before the last run started,
+         which the cutoff would drop. */
+      modifiedAfterTimestamp = 0;
+   }
+
+   if(appending) writeRunRecord(started);
+
+   if(pipelineOptions.readers > 0 || pipelineOptions.io == PIPELINE_IO_URING) {
+      pipeline = pipelineStart(&archive, &pipelineOptions);
+      /* If the threads can't be started, a sequential backup still works. */
+      if(pipeline == NULL) {
+         printf("Warning: Unable to start reader threads.\n");
+      }
+   }
+
+   linkTable = linkTableCreate();
+   if(readOrder != READ_ORDER_WALK) {
+      readWindow = readWindowCreate(readOrder, readWindowSize);
+   }
+   if(linkTable == NULL || (readOrder != READ_ORDER_WALK && readWindow == NULL))
+   {
+      printf("Fatal Error: Out of memory.\n");
+      archiveClose(&archive);
+      exit(1);
+   }
+   fileCallback = readWindow != NULL ? scheduleFile : backupFile;
+
+   int walkResult = useJournal ? backupJournal(backupPath)
+      : walkTree(backupPath, fileCallback, &walkOptions);
+   if(readWindow != NULL) {
+      /* What's left of the last window. */
+      if(walkResult == 0) {
+         walkResult = readWindowDrain(readWindow, backupScheduledFile);
+      }
+      readWindowFree(readWindow);
+      readWindow = NULL;
+   }
+   if(journalTaken) journalFree(&journal);
+
+   if(pipeline != NULL) {
+      if(pipelineFinish(pipeline) != 0) {
+         printf("Fatal Error: Unable to write \"%s\" to the archive.\n",
+            &pipelineFailedPath(pipeline)[backupPathLength]);
+         archiveClose(&archive);
+         exit(1);
+      }
+      forgetSkippedFiles();
+      pipelineFree(pipeline);
+      pipeline = NULL;
+   }
+
+	if (walkResult != 0) {
       printf("Fatal Error: Could not find files.\n"
                "Please check the provided path: \"%s\".\n", backupPath);
-      fclose(archiveFile);
+      archiveClose(&archive);
       exit(1);
    }
+
+   if(previousManifest != NULL) writeTombstones();
    /* Write two empty blocks to the end of the file. */
-   /* There has to be a better way to do this... */
-   char padding[1024];
-   memset(padding, 0, 1024);
-   fwrite((void*)padding, 1, 1024, archiveFile);
+   static const char padding[1024];
+   if(archiveWrite(&archive, padding, 1024) != 0
+      || (writeIndex && indexWrite(&archiveIndex, &archive) != 0)
+      /* Whatever was after the old end, such as it's index, may go further
+         than the new one. */
+      || (appending && !compressing && (archiveFlush(&archive) != 0
+         || ftruncate(archive.fd, archive.offset) != 0)))
+   {
+      printf("Fatal Error: Unable to write archive:\n"
+            "\"%s\"\n", archivePath);
+      archiveClose(&archive);
+      exit(1);
+   }
+   indexFree(&archiveIndex);
+
+   if(newManifest != NULL) {
+      finishLinkRecords();
+      char manifestPath[4361];
+      snprintf(manifestPath, 4361, "%s.manifest", archivePath);
+      if(manifestSave(newManifest, manifestPath) != 0) {
+         printf("Fatal Error: Unable to write manifest:\n"
+               "\"%s\"\n", manifestPath);
+         archiveClose(&archive);
+         exit(1);
+      }
+      manifestFree(newManifest);
+      newManifest = NULL;
+   }
+   if(previousManifest != NULL) {
+      manifestFree(previousManifest);
+      previousManifest = NULL;
+   }
+   linkTableFree(linkTable);
+   linkTable = NULL;
+}
+
+/*******************************************************************************
+   backupJournal
+      Backs up just the paths in the journal. Sorted, a folder comes
+      straight before everything in it, so once a folder has been walked,
+      the paths in it can be skipped. Paths deleted since are skipped too.
+      There's no modified time filter, see backup. Folders are only in the
+      journal when they're created or moved in, so everything in them is
+      new here anyway. The journal records everything, so exclude
+      rules are checked here, against each folder in the path too, and
+      folders are walked with them, relative to the backup directory.
+*******************************************************************************/
+static int backupJournal(const char* backupPath) {
+   qsort(journal.paths, journal.count, sizeof(char *), compareJournalPaths);
+   struct walk_options folderOptions = walkOptions;
+   folderOptions.filterBase = backupPathLength;
+
+   const char *walkedFolder = NULL;
+   char path[4096 + 256];
+   for(size_t i = 0; i < journal.count; i++) {
+      const char *relativePath = journal.paths[i];
+      if(i > 0 && strcmp(relativePath, journal.paths[i - 1]) == 0) continue;
+      size_t folderLength = walkedFolder != NULL ? strlen(walkedFolder) : 0;
+      if(walkedFolder != NULL && (folderLength == 0
+         || (strncmp(relativePath, walkedFolder, folderLength) == 0
+            && relativePath[folderLength] == '/')))
+      {
+         continue;
+      }
+
+      if(relativePath[0] == '\0') {
+         snprintf(path, 4096 + 256, "%s", backupPath);
+      } else {
+         snprintf(path, 4096 + 256, "%s/%s", backupPath, relativePath);
+      }
+      struct stat fileStatus;
+      if(lstat(path, &fileStatus) != 0) continue;
+      if(walkOptions.filter != NULL
+         && pathFilterExcludesPath(walkOptions.filter, relativePath,
+            S_ISDIR(fileStatus.st_mode)))
+      {
+         continue;
+      }
+
+      int result = 0;
+      if(S_ISDIR(fileStatus.st_mode)) {
+         walkedFolder = relativePath;
+         result = walkTree(path, fileCallback, &folderOptions);
+      } else if(S_ISREG(fileStatus.st_mode)) {
+         result = fileCallback(path, &fileStatus, FTW_F, NULL);
+      }
+      /* Deleted while it was being backed up, which is fine. */
+      if(result != 0 && lstat(path, &fileStatus) == 0) return result;
+   }
+   return 0;
+}
+
+/*******************************************************************************
+   compareJournalPaths
+      Orders paths with '/' before every other character, so "a/b" comes
+      between "a" and "a-b", and a folder's paths are all together.
+*******************************************************************************/
+static int compareJournalPaths(const void *a, const void *b) {
+   const unsigned char *first = *(const unsigned char **)a;
+   const unsigned char *second = *(const unsigned char **)b;
+   while(*first != '\0' && *first == *second) {
+      first++;
+      second++;
+   }
+   int firstCharacter = *first == '/' ? 1 : *first == '\0' ? 0 : *first + 1;
+   int secondCharacter = *second == '/' ? 1 : *second == '\0' ? 0
+      : *second + 1;
+   return firstCharacter - secondCharacter;
+}
+
+/*******************************************************************************
+   scheduleFile
+      With --order, the walk adds files to the window, rather than
+      archiving them, and the window is archived each time it fills.
+      Files too old to be archived aren't worth a place. With a manifest,
+      it's their content that decides, so they all go in, and are
+      compared in disk order too.
+*******************************************************************************/
+static int scheduleFile(const char* path, const struct stat *fileStat,
+   int flag, struct FTW* fileTreeWalker)
+{
+   if(!S_ISREG(fileStat->st_mode)) return 0;
+   if(newManifest == NULL && fileStat->st_mtime < modifiedAfterTimestamp
+      && fileStat->st_ctime < modifiedAfterTimestamp)
+   {
+      return 0;
+   }
+
+   int full = readWindowAdd(readWindow, path, fileStat);
+   if(full < 0) {
+      printf("Fatal Error: Out of memory while ordering files.\n");
+      exit(1);
+   }
+   return full ? readWindowDrain(readWindow, backupScheduledFile) : 0;
+}
+
+/*******************************************************************************
+   backupScheduledFile
+      A file can be deleted between being found, and it's window being
+      archived, which isn't an error.
+*******************************************************************************/
+static int backupScheduledFile(const char* path, const struct stat *fileStat,
+   int flag, struct FTW* fileTreeWalker)
+{
+   int result = backupFile(path, fileStat, flag, fileTreeWalker);
+   struct stat fileStatus;
+   if(result != 0 && lstat(path, &fileStatus) != 0) {
+      forgetDeletedFile(&path[backupPathLength]);
+      return 0;
+   }
+   return result;
+}
+
+/*******************************************************************************
+   forgetSkippedFiles
+      The pipeline leaves out files deleted before it could open them, so
+      everything after one is further back in the archive than planned.
+      Called each time the pipeline has caught up, before anything else is
+      written, to take them out of the index, the manifest and the link
+      table, and move the next header back.
+*******************************************************************************/
+static void forgetSkippedFiles() {
+   struct pipeline_skip *skipped;
+   size_t count = pipelineTakeSkipped(pipeline, &skipped);
+   for(size_t i = 0; i < count; i++) {
+      const char *relativePath = &skipped[i].path[backupPathLength];
+      printf("Warning: \"%s\" was deleted before it could be read,\n"
+            "and is left out.\n", relativePath);
+      if(writeIndex) {
+         indexForget(&archiveIndex, relativePath, skipped[i].length);
+      }
+      forgetDeletedFile(relativePath);
+      linkTableForget(linkTable, relativePath);
+      nextHeaderOffset -= skipped[i].length;
+   }
+   pipelineFreeSkipped(skipped, count);
+}
+
+/*******************************************************************************
+   forgetDeletedFile
+      Takes a file deleted before it could be archived back out of the new
+      manifest, and marks it unseen in the previous one, so it gets a
+      tombstone like any other deleted file.
+*******************************************************************************/
+static void forgetDeletedFile(const char* relativePath) {
+   if(newManifest == NULL) return;
+   manifestRemove(newManifest, relativePath);
+   struct manifest_record *previous = previousManifest != NULL
+      ? manifestFind(previousManifest, relativePath) : NULL;
+   if(previous != NULL) previous->seen = 0;
+}
+
+/*******************************************************************************
+   startAppending
+      Finds where the archive's end blocks start, so the new files are
+      written over them, and the time the last run started, from it's run
+      record. The headers are read one after another, skipping the data,
+      and with -i, indexed again, as the old index is overwritten.
+*******************************************************************************/
+static void startAppending() {
+   struct stat archiveStatus;
+   if(fstat(archive.fd, &archiveStatus) != 0) {
+      printf("Fatal Error: Unable to read archive:\n"
+            "\"%s\"\n", archivePath);
+      exit(1);
+   }
+   /* A new archive is started from scratch, with every file. */
+   if(archiveStatus.st_size == 0) return;
+
+   archiveFile = fdopen(dup(archive.fd), "rb");
+   unsigned char magic[2];
+   if(archiveFile == NULL || fread(magic, 2, 1, archiveFile) != 1) {
+      printf("Fatal Error: Unable to read archive:\n"
+            "\"%s\"\n", archivePath);
+      exit(1);
+   }
+   if(magic[0] == 0x1f && magic[1] == 0x8b) {
+      printf("Fatal Error: Unable to append to a compressed archive:\n"
+            "\"%s\"\n", archivePath);
+      exit(1);
+   }
+   rewind(archiveFile);
+   archiveSeekable = 1;
+
+   struct tar_header_block headerData;
+   char memberPath[256];
+   off_t headerOffset = 0;
+   int result;
+   while((result = readHeader(&headerData)) == 0) {
+      if(writeIndex) {
+         getMemberPath(&headerData, memberPath);
+         off_t size = headerData.type == '1' || headerData.type == 'T' ? 0
+            : extendedHeader.sparse ? extendedHeader.realSize
+            : tarGetNumber(headerData.fileSize, 12);
+         if(indexAdd(&archiveIndex, memberPath, headerOffset, size,
+            tarGetNumber(headerData.modifiedTime, 12)) != 0)
+         {
+            printf("Fatal Error: Out of memory while indexing files.\n");
+            exit(1);
+         }
+      }
+      skipMember(&headerData);
+      headerOffset = ftello(archiveFile);
+   }
+   off_t end = ftello(archiveFile) - 512;
+   /* Closing the stream moves the descriptor it shares with the archive,
+      so it's closed before the archive is moved to the end. */
+   fclose(archiveFile);
+   archiveFile = NULL;
+   if(result < 0 || end < 0 || lseek(archive.fd, end, SEEK_SET) != end) {
+      printf("Fatal Error: Corrupted backup file.\n"
+         "Please check the provided file: \"%s\".\n", archivePath);
+      exit(1);
+   }
+   archive.offset = end;
+   nextHeaderOffset = end;
+
+   if(!timestampGiven && newManifest == NULL) {
+      /* Archives written without -r leave it's modified time at when
+         the run started. */
+      modifiedAfterTimestamp = lastRunStarted != 0 ? lastRunStarted
+         : archiveStatus.st_mtime;
+   }
+}
+
+/*******************************************************************************
+   writeRunRecord
+      Starts the run's files with a pax global header, saying when it
+      started, for -r to find next time. Tar tools read it as settings for
+      what follows, and ignore a setting they don't know.
+      Only written with -r, so other runs over the same files give the
+      same archive.
+*******************************************************************************/
+static void writeRunRecord(time_t started) {
+   char records[512];
+   size_t recordsLength = 0;
+   char value[21];
+   snprintf(value, 21, "%lld", (long long)started);
+   addRecord(records, &recordsLength, "BACKUP.started", value);
+   memset(&records[recordsLength], 0, 512 - recordsLength);
+
+   struct stat headerStatus;
+   memset(&headerStatus, 0, sizeof(headerStatus));
+   headerStatus.st_mode = S_IFREG | 0644;
+   headerStatus.st_uid = geteuid();
+   headerStatus.st_gid = getegid();
+   headerStatus.st_size = recordsLength;
+   headerStatus.st_mtime = started;
+   struct tar_header_block tarHeader;
+   makeHeader("pax_global_header", &headerStatus, &tarHeader);
+   tarHeader.type = 'g';
+   tarSetChecksum(&tarHeader);
+
+   if(archiveWrite(&archive, &tarHeader, 512) != 0
+      || archiveWrite(&archive, records, 512) != 0)
+   {
+      printf("Fatal Error: Unable to write archive:\n"
+            "\"%s\"\n", archivePath);
+      archiveClose(&archive);
+      exit(1);
+   }
+   nextHeaderOffset += 1024;
 }
 
 /*******************************************************************************
@@ -290,83 +1160,536 @@ static void backup(char* backupPath) {
 *******************************************************************************/
 static void restore() {
    char restorePath[4347];
-   strncpy(restorePath, archivePath, strlen(archivePath) - 4);
-   mkdir(restorePath, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
-   
-   fseek(archiveFile, 0, SEEK_END);
-   long int fileLen = ftell(archiveFile);
-   rewind(archiveFile);
+   getRestorePath(restorePath);
+   restorer = restorerStart(restorePath, restoreThreads,
+      pipelineOptions.io == PIPELINE_IO_URING);
+   if(restorer == NULL) {
+      printf("Fatal Error: Unable to create restore folder:\n"
+            "\"%s\"\n", restorePath);
+      exit(1);
+   }
+
+   struct tar_header_block headerData;
+   char memberPath[256];
+
+   /* If only some files are wanted, and the archive has an index, seek
+      straight to them, rather than reading through the whole archive. */
+   struct archive_index index;
+   if(restorePatternCount > 0 && archiveSeekable
+      && indexRead(&index, archiveFile) == 0)
+   {
+      for(size_t i = 0; i < index.count; i++) {
+         struct index_entry *entry = &index.entries[i];
+         if(!matchesRestorePatterns(indexPath(&index, entry))) continue;
+
+         if(fseeko(archiveFile, entry->offset, SEEK_SET) != 0
+            || readHeader(&headerData) != 0)
+         {
+            printf("Fatal Error: Corrupted backup file.\n"
+               "Please check the provided file: \"%s\".\n", archivePath);
+            exit(1);
+         }
+         restoreMember(&headerData);
+      }
+      indexFree(&index);
+      finishRestore();
+      return;
+   }
+
+   /* Otherwise read every header, up to the empty blocks at the end.
+      Anything after them (such as an index) isn't part of the archive. */
+   if(archiveSeekable) rewind(archiveFile);
+   int result;
+   while((result = readHeader(&headerData)) == 0) {
+      getMemberPath(&headerData, memberPath);
+      if(restorePatternCount > 0 && !matchesRestorePatterns(memberPath)) {
+         skipMember(&headerData);
+      } else {
+         restoreMember(&headerData);
+      }
+   }
 
-   if(fileLen % 512 != 0) {
+   if(result < 0) {
       printf("Fatal Error: Corrupted backup file.\n"
          "Please check the provided file: \"%s\".\n", archivePath);
       exit(1);
    }
+   drainArchive();
 
-   /* Ignore the 1024 buffer at the end*/
-   long int filePos = 0;
-   while(filePos < fileLen - 1024) {
-      struct tar_header_block *headerData = malloc(512);
-      fread(headerData, 512, 1, archiveFile);
-      //printf("\n%s%s\n", headerData->filePathPrefix, headerData->filePath);
-      filePos += 512;
-
-      int fileSize 
-         = convertOctalStringToUInt(headerData->fileSize, 11);
-      char *fileData = malloc(fileSize);
-      fread(fileData, fileSize, 1, archiveFile);
-      filePos += fileSize;
-
-      char *restoreFilePath = malloc(4351);
-      strcat(restoreFilePath, restorePath);
-      strcat(restoreFilePath, "/");
-      strcat(restoreFilePath, headerData->filePathPrefix);
-      strcat(restoreFilePath, headerData->filePath);
-
-      //Make necessary folders.
-      char *currentFolderEnd = strchr(restoreFilePath, (int)'/');
-      while(currentFolderEnd != NULL) {
-         int currentFolderPathLength 
-            = currentFolderEnd - restoreFilePath;
-         char *currentFolder = malloc(4096);
-         memcpy(currentFolder, restoreFilePath, currentFolderPathLength);
-         currentFolder[currentFolderPathLength] = '\0';
-         mkdir(currentFolder, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
-         currentFolderEnd = 
-            strchr(&restoreFilePath[currentFolderPathLength + 1], (int)'/');
-      }
-
-      FILE *restoreFile = fopen(restoreFilePath, "wb+");
-      fwrite(fileData, 1, fileSize, restoreFile);
-      fclose(restoreFile);
-      chmod(restoreFilePath, convertOctalStringToUInt(headerData->fileMode, 8));
-      struct utimbuf timeStamps;
-      timeStamps.actime = time(NULL);
-      timeStamps.modtime = convertOctalStringToUInt(headerData->modifiedTime, 11);
-      utime(restoreFilePath, &timeStamps);
-      int filePadding = 512 - (fileSize % 512);
-      fseek(archiveFile, filePadding, SEEK_CUR);
-      filePos += filePadding;
-   }
+   finishRestore();
+}
 
+/*******************************************************************************
+   finishRestore
+      Waits for the last files to be written.
+*******************************************************************************/
+static void finishRestore() {
+   long failures = restorerFinish(restorer);
+   restorer = NULL;
+   if(failures > 0) {
+      printf("\n%ld files could not be restored.\n", failures);
+      exit(1);
+   }
    printf("\nSuccessfully restored from backup.\n");
 }
 
 /*******************************************************************************
-   convertOctalStringToUInt
-      Converts an octal strigt to a uint and returns it.
+   getRestorePath
+      Files are restored into a folder named after the archive, without it's
+      extension, or with ".d" added if it hasn't got one.
 *******************************************************************************/
-unsigned int convertOctalStringToUInt(char * octalString, 
-   unsigned int stringSize)
+static void getRestorePath(char restorePath[4347]) {
+   static const char *suffixes[] = { ".tar.gz", ".tgz", ".tar", ".gz" };
+   size_t restorePathLength = strlen(archivePath);
+   for(int i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+      if(hasSuffix(archivePath, suffixes[i]) 
+         && restorePathLength > strlen(suffixes[i])) 
+      {
+         restorePathLength -= strlen(suffixes[i]);
+         memcpy(restorePath, archivePath, restorePathLength);
+         restorePath[restorePathLength] = '\0';
+         return;
+      }
+   }
+   if(strcmp(archivePath, "-") == 0) {
+      strcpy(restorePath, ".");
+      return;
+   }
+   snprintf(restorePath, 4347, "%.4344s.d", archivePath);
+}
+
+static int hasSuffix(const char* string, const char* suffix) {
+   size_t stringLength = strlen(string);
+   size_t suffixLength = strlen(suffix);
+   return stringLength >= suffixLength 
+      && strcmp(&string[stringLength - suffixLength], suffix) == 0;
+}
+
+/*******************************************************************************
+   readHeader
+      Reads the next header block from the archive. An extended header is
+      read into extendedHeader, and the header after it is returned.
+      Returns 0 if a header was read, 1 at the end of the archive, 
+      or -1 if the archive is cut short or corrupt.
+*******************************************************************************/
+static int readHeader(struct tar_header_block *headerData) {
+   memset(&extendedHeader, 0, sizeof(extendedHeader));
+   if(fread(headerData, 512, 1, archiveFile) != 1) return -1;
+
+   /* The archive ends with empty blocks. */
+   if(isEmptyBlock(headerData)) return 1;
+   if(!isValidHeader(headerData)) return -1;
+
+   /* Global headers are about the run which wrote what follows, not the
+      next header, see writeRunRecord. */
+   while(headerData->type == 'g') {
+      if(readExtendedRecords(headerData) != 0
+         || fread(headerData, 512, 1, archiveFile) != 1)
+      {
+         return -1;
+      }
+      memset(&extendedHeader, 0, sizeof(extendedHeader));
+      if(isEmptyBlock(headerData)) return 1;
+      if(!isValidHeader(headerData)) return -1;
+   }
+   if(headerData->type != 'x') return 0;
+
+   int result = readExtendedRecords(headerData) != 0
+      || fread(headerData, 512, 1, archiveFile) != 1
+      || isEmptyBlock(headerData)
+      || !isValidHeader(headerData)
+      || headerData->type == 'x'
+      || headerData->type == 'g';
+   return result ? -1 : 0;
+}
+
+/*******************************************************************************
+   readExtendedRecords
+      Reads and parses the records after an extended header.
+      Returns -1 if they're cut short or corrupt.
+*******************************************************************************/
+static int readExtendedRecords(const struct tar_header_block *headerData) {
+   size_t recordsLength = tarGetNumber(headerData->fileSize, 12);
+   size_t paddedLength = (recordsLength + 511) / 512 * 512;
+   char *records = malloc(paddedLength > 0 ? paddedLength : 1);
+   if(records == NULL) {
+      printf("Fatal Error: Out of memory.\n");
+      exit(1);
+   }
+   int result = (paddedLength > 0 
+         && fread(records, paddedLength, 1, archiveFile) != 1)
+      || parseExtendedHeader(records, recordsLength) != 0;
+   free(records);
+   return result ? -1 : 0;
+}
+
+/*******************************************************************************
+   parseExtendedHeader
+      Reads the records of a pax extended header into extendedHeader.
+      Each record is "<length> <key>=<value>\n", where the length counts
+      the whole record. Keys other than those for GNU sparse files, the
+      path, and when a run started, are ignored.
+      Returns -1 if the records are corrupt.
+*******************************************************************************/
+static int parseExtendedHeader(const char *records, size_t length) {
+   size_t position = 0;
+   while(position < length) {
+      size_t recordLength = 0;
+      size_t keyStart = position;
+      while(keyStart < length && keyStart - position < 10
+         && records[keyStart] >= '0' && records[keyStart] <= '9')
+      {
+         recordLength = recordLength * 10 + (records[keyStart++] - '0');
+      }
+      if(keyStart == position || keyStart >= length 
+         || records[keyStart] != ' '
+         || recordLength <= keyStart - position + 1
+         || recordLength > length - position
+         || records[position + recordLength - 1] != '\n')
+      {
+         return -1;
+      }
+      keyStart++;
+
+      const char *key = &records[keyStart];
+      const char *recordEnd = &records[position + recordLength - 1];
+      const char *equals = memchr(key, '=', recordEnd - key);
+      if(equals == NULL) return -1;
+      size_t keyLength = equals - key;
+      const char *value = equals + 1;
+      size_t valueLength = recordEnd - value;
+
+      if(isRecordKey(key, keyLength, "GNU.sparse.major")) {
+         extendedHeader.sparse = valueLength == 1 && *value == '1';
+      } else if(isRecordKey(key, keyLength, "GNU.sparse.realsize")) {
+         char number[21];
+         snprintf(number, 21, "%.*s", (int)valueLength, value);
+         extendedHeader.realSize = strtoll(number, NULL, 10);
+      } else if(isRecordKey(key, keyLength, "BACKUP.started")) {
+         char number[21];
+         snprintf(number, 21, "%.*s", (int)valueLength, value);
+         lastRunStarted = strtoll(number, NULL, 10);
+      } else if(isRecordKey(key, keyLength, "GNU.sparse.name")
+         || isRecordKey(key, keyLength, "path"))
+      {
+         if(valueLength > 255) return -1;
+         memcpy(extendedHeader.path, value, valueLength);
+         extendedHeader.path[valueLength] = '\0';
+      }
+      position += recordLength;
+   }
+   return 0;
+}
+
+static int isRecordKey(const char *key, size_t keyLength, const char* name) {
+   return keyLength == strlen(name) && memcmp(key, name, keyLength) == 0;
+}
+
+/*******************************************************************************
+   isEmptyBlock
+      Checks whether a 512 byte block is all zeros.
+*******************************************************************************/
+static int isEmptyBlock(const void *block) {
+   const unsigned char *blockBytes = (const unsigned char *)block;
+   for(int i = 0; i < 512; i++) {
+      if(blockBytes[i] != 0) return 0;
+   }
+   return 1;
+}
+
+/*******************************************************************************
+   isValidHeader
+      Checks a header's checksum, and that it's size makes sense, so a
+      corrupt header isn't followed off into the middle of a file.
+*******************************************************************************/
+static int isValidHeader(const struct tar_header_block *headerData) {
+   return tarVerifyChecksum(headerData)
+      && tarGetNumber(headerData->fileSize, 12) >= 0;
+}
+
+/*******************************************************************************
+   listArchive
+      Prints the files in the archive, ls -l style, reading only the headers.
+      The archive is mapped into memory where possible, so only the pages 
+      holding headers are ever read from disk, and listing costs the same 
+      however large the files in it are.
+*******************************************************************************/
+static void listArchive() {
+   struct stat archiveStatus;
+   unsigned char *mappedArchive = MAP_FAILED;
+   if(fstat(fileno(archiveFile), &archiveStatus) == 0 
+      && S_ISREG(archiveStatus.st_mode) && archiveStatus.st_size > 0) 
+   {
+      mappedArchive = mmap(NULL, archiveStatus.st_size, PROT_READ, 
+         MAP_PRIVATE, fileno(archiveFile), 0);
+   }
+
+   if(mappedArchive != MAP_FAILED) {
+      /* Don't let read-ahead pull in the file data around each header. */
+      madvise(mappedArchive, archiveStatus.st_size, MADV_RANDOM);
+
+      off_t position = 0;
+      while(position + 512 <= archiveStatus.st_size
+         && !isEmptyBlock(&mappedArchive[position])) 
+      {
+         const struct tar_header_block *headerData 
+            = (const struct tar_header_block *)&mappedArchive[position];
+         memset(&extendedHeader, 0, sizeof(extendedHeader));
+         if(!isValidHeader(headerData)) {
+            printf("Fatal Error: Corrupted backup file.\n"
+               "Please check the provided file: \"%s\".\n", archivePath);
+            exit(1);
+         }
+         if(headerData->type == 'g') {
+            /* A run record, nothing to list. */
+            position += 512 
+               + (tarGetNumber(headerData->fileSize, 12) + 511) / 512 * 512;
+            continue;
+         }
+         if(headerData->type == 'x') {
+            /* The header it describes comes after it's records. */
+            off_t recordsLength = tarGetNumber(headerData->fileSize, 12);
+            position += 512 + (recordsLength + 511) / 512 * 512;
+            if(position + 512 > archiveStatus.st_size
+               || parseExtendedHeader((const char *)&headerData[1],
+                  recordsLength) != 0
+               || isEmptyBlock(&mappedArchive[position])
+               || !isValidHeader((const struct tar_header_block *)
+                  &mappedArchive[position]))
+            {
+               printf("Fatal Error: Corrupted backup file.\n"
+                  "Please check the provided file: \"%s\".\n", archivePath);
+               exit(1);
+            }
+            headerData 
+               = (const struct tar_header_block *)&mappedArchive[position];
+         }
+         listMember(headerData);
+         off_t fileSize = tarGetNumber(headerData->fileSize, 12);
+         position += 512 + (fileSize + 511) / 512 * 512;
+      }
+      munmap(mappedArchive, archiveStatus.st_size);
+
+      if(position + 512 > archiveStatus.st_size) {
+         printf("Fatal Error: Corrupted backup file.\n"
+            "Please check the provided file: \"%s\".\n", archivePath);
+         exit(1);
+      }
+      return;
+   }
+
+   /* Not something that can be mapped, so skip over the file data. */
+   struct tar_header_block headerData;
+   int result;
+   while((result = readHeader(&headerData)) == 0) {
+      listMember(&headerData);
+      skipMember(&headerData);
+   }
+   if(result < 0) {
+      printf("Fatal Error: Corrupted backup file.\n"
+         "Please check the provided file: \"%s\".\n", archivePath);
+      exit(1);
+   }
+   drainArchive();
+}
+
+/*******************************************************************************
+   listMember
+      Prints a file's details from it's header, if it was asked for.
+*******************************************************************************/
+static void listMember(const struct tar_header_block *headerData) {
+   char memberPath[256];
+   getMemberPath(headerData, memberPath);
+   if(restorePatternCount > 0 && !matchesRestorePatterns(memberPath)) return;
+
+   /* A tombstone isn't a file, just a note that one was deleted. */
+   if(headerData->type == 'T') {
+      printf("deleted %s\n", memberPath);
+      return;
+   }
+
+   char modeStr[11];
+   getModeString(
+      tarGetNumber(headerData->fileMode, 8), modeStr);
+
+   char ownerName[33];
+   char groupName[33];
+   snprintf(ownerName, 33, "%.32s", headerData->ownerName);
+   snprintf(groupName, 33, "%.32s", headerData->groupName);
+
+   time_t modifiedTime = tarGetNumber(headerData->modifiedTime, 12);
+   char dateString[13];
+   strftime(dateString, 13, "%d %b %R", gmtime(&modifiedTime));
+
+   /* A sparse file's header has the size of just it's data. */
+   long long fileSize = extendedHeader.sparse ? extendedHeader.realSize 
+      : tarGetNumber(headerData->fileSize, 12);
+
+   printf("%s %s %6s %7lld %s %s", 
+      modeStr, 
+      ownerName, groupName, 
+      fileSize, 
+      dateString, 
+      memberPath);
+   if(headerData->type == '1') {
+      printf(" link to %.100s", headerData->linkName);
+   }
+   printf("\n");
+}
+
+/*******************************************************************************
+   getMemberPath
+      Joins a header's path prefix and path, neither of which have to be 
+      null terminated if they're full. An extended header's path is used
+      instead, if it had one.
+*******************************************************************************/
+static void getMemberPath(const struct tar_header_block *headerData, 
+   char memberPath[256])
 {
-    unsigned int converted = 0;
-    int i = 0;
-    while ((i < stringSize) && octalString[i]){
-        converted = (converted << 3) | (unsigned int) (octalString[i++] - '0');
-    }
-    return converted;
+   if(extendedHeader.path[0] != '\0') {
+      strcpy(memberPath, extendedHeader.path);
+      return;
+   }
+   size_t prefixLength = strnlen(headerData->filePathPrefix, 155);
+   size_t pathLength = strnlen(headerData->filePath, 100);
+   memcpy(memberPath, headerData->filePathPrefix, prefixLength);
+   memcpy(&memberPath[prefixLength], headerData->filePath, pathLength);
+   memberPath[prefixLength + pathLength] = '\0';
 }
 
+/*******************************************************************************
+   matchesRestorePatterns
+      Checks whether a file was asked for on the command line.
+      Patterns are globs, and also match everything inside a matching
+      directory.
+*******************************************************************************/
+static int matchesRestorePatterns(const char* memberPath) {
+   for(int i = 0; i < restorePatternCount; i++) {
+      if(fnmatch(restorePatterns[i], memberPath, FNM_LEADING_DIR) == 0) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+/*******************************************************************************
+   skipMember
+      Skips over a file's data and padding, without reading it.
+*******************************************************************************/
+static void skipMember(const struct tar_header_block *headerData) {
+   off_t fileSize = tarGetNumber(headerData->fileSize, 12);
+   skipArchive((fileSize + 511) / 512 * 512);
+}
+
+/*******************************************************************************
+   skipArchive
+      Moves length bytes further on in the archive. Pipes can't seek, so
+      the data is read and thrown away.
+      Returns -1 if the archive ends first.
+*******************************************************************************/
+static int skipArchive(off_t length) {
+   if(length == 0) return 0;
+   if(archiveSeekable) return fseeko(archiveFile, length, SEEK_CUR);
+
+   char discard[65536];
+   while(length > 0) {
+      size_t chunk = length < 65536 ? length : 65536;
+      if(fread(discard, chunk, 1, archiveFile) != 1) return -1;
+      length -= chunk;
+   }
+   return 0;
+}
+
+/*******************************************************************************
+   drainArchive
+      Reads whatever follows the end of a piped archive, such as the second
+      empty block, or an index, so whatever is writing it isn't cut off
+      with SIGPIPE.
+*******************************************************************************/
+static void drainArchive() {
+   if(archiveSeekable) return;
+   char discard[65536];
+   while(fread(discard, 1, 65536, archiveFile) > 0) {}
+}
+
+/*******************************************************************************
+   restoreMember
+      Restores a file from the archive. The archive must be positioned just
+      after it's header, and is left positioned at the next header.
+      The file itself is written by the restorer, see restorer.c.
+*******************************************************************************/
+static void restoreMember(const struct tar_header_block *headerData) {
+   char memberPath[256];
+   getMemberPath(headerData, memberPath);
+
+   /* The file was deleted since the previous backup. */
+   if(headerData->type == 'T') {
+      if(restorerDelete(restorer, memberPath) != 0) {
+         printf("Fatal Error: Out of memory.\n");
+         exit(1);
+      }
+      return;
+   }
+
+   /* Another path to a file restored earlier. */
+   if(headerData->type == '1') {
+      char linkTarget[101];
+      snprintf(linkTarget, 101, "%.100s", headerData->linkName);
+      if(restorerLink(restorer, memberPath, linkTarget) != 0) {
+         printf("Fatal Error: Out of memory.\n");
+         exit(1);
+      }
+      return;
+   }
+
+   statsAdd(STATS_FILES, 1);
+   off_t fileSize = tarGetNumber(headerData->fileSize, 12);
+   mode_t mode = tarGetNumber(headerData->fileMode, 8);
+   time_t modifiedTime = tarGetNumber(headerData->modifiedTime, 12);
+   int result;
+   if(extendedHeader.sparse) {
+      /* The data starts with a map of where it goes. */
+      struct sparse_map map;
+      off_t mapLength;
+      result = sparseReadMap(archiveFile, &map, &mapLength);
+      if(result == 0) {
+         result = mapLength + map.dataSize == fileSize
+            ? restorerAddSparseFile(restorer, memberPath, mode, modifiedTime,
+               archiveFile, &map, extendedHeader.realSize)
+            : -1;
+         sparseFree(&map);
+      }
+   } else {
+      result = restorerAddFile(restorer, memberPath, mode, modifiedTime,
+         archiveFile, fileSize);
+   }
+   if(result != 0) {
+      printf("Fatal Error: Corrupted backup file.\n"
+         "Please check the provided file: \"%s\".\n", archivePath);
+      exit(1);
+   }
+
+   /* Files which fill their last block exactly have no padding. */
+   skipArchive((512 - (fileSize % 512)) % 512);
+}
+
+/*******************************************************************************
+   openArchive
+      Opens the archive to restore or list, or stdin if it's "-".
+*******************************************************************************/
+static FILE *openArchive() {
+   FILE *file = strcmp(archivePath, "-") == 0
+      ? compressedOpenDescriptor(STDIN_FILENO) : compressedOpen(archivePath);
+   if(file != NULL) archiveSeekable = isSeekable(file);
+   return file;
+}
+
+/* Only plain files, compressed archives have no descriptor of their own. */
+static int isSeekable(FILE *file) {
+   struct stat fileStatus;
+   return fileno(file) >= 0 && fstat(fileno(file), &fileStatus) == 0
+      && S_ISREG(fileStatus.st_mode);
+}
 
 /*******************************************************************************
    getModeString
@@ -423,8 +1746,11 @@ static int backupFile(const char* path, const struct stat *fileStat,
       return 0;
 
    /* If the file modified or changed timestamp is lower than (before) the 
-      supplied modified after timestamp, return, don't print it. */
-   if(fileStat->st_mtime < modifiedAfterTimestamp 
+      supplied modified after timestamp, return, don't print it. 
+      With a manifest, the content decides instead. */
+   if(newManifest != NULL) {
+      if(!hasChangedSinceManifest(path, fileStat)) return 0;
+   } else if(fileStat->st_mtime < modifiedAfterTimestamp 
       && fileStat->st_ctime < modifiedAfterTimestamp) 
    {
       return 0;
@@ -437,11 +1763,8 @@ static int backupFile(const char* path, const struct stat *fileStat,
    char modeStr[11];
    getModeString(fileStat->st_mode, modeStr);
 
-   struct group *fileGroup;
-   fileGroup = getgrgid(fileStat->st_gid);
-
-   struct passwd *fileOwner;
-   fileOwner = getpwuid(fileStat->st_uid);
+   const char *groupName = idCacheGroupName(fileStat->st_gid);
+   const char *ownerName = idCacheUserName(fileStat->st_uid);
 
    char dateString[13];
    strftime(dateString, 13, "%d %b %R\0", gmtime(&(fileStat->st_mtime)));
@@ -451,64 +1774,467 @@ static int backupFile(const char* path, const struct stat *fileStat,
       by looping through files before printing to calculate how many characters
       the longest field in each column contains. */
 
-   FILE *file;
-   char *fileData;
-   long int filelen;
-
-   /* Open the file... */
-   file = fopen(path, "rb");
-   /* If it couldn't be opened, move on... */
-   if(file == NULL) return 1;
-   /* Skip to the end of the file */
-   fseek(file, 0, SEEK_END); 
-   /* The length of the file is the cursor's position */
-   filelen = ftell(file);
-   /* Go back to the start of the file. */
-   rewind(file);
-
-   /* Allocate an array for file data */
-   fileData = (char *)malloc((filelen)*sizeof(char));
-   /* Read file data. */
-   fread(fileData, filelen, 1, file); // Read in the entire file
-   /* Close the file */
-   fclose(file);
+   throttleFile();
+
+   /* Open the file... 
+      When reading ahead, the pipeline opens it instead. */
+   struct cached_file source;
+   int fileDescriptor = source.fd = -1;
+   if(pipeline == NULL) {
+      uint64_t started = statsStart();
+      fileDescriptor = cacheOpen(&source, path, ownReadMode());
+      statsStop(STATS_OPEN, started);
+      /* If it couldn't be opened, move on... */
+      if(fileDescriptor == -1) return 1;
+   }
+   statsAdd(STATS_FILES, 1);
 
    /* Print file details. */
    printf("%s %d %s %6s %7lld %s %s\n", 
       modeStr, 
       fileStat->st_nlink, 
-      fileOwner->pw_name, fileGroup->gr_name, 
+      ownerName, groupName, 
       fileStat->st_size, 
       dateString, 
       &path[backupPathLength]);
 
-   /* Allocate space for a new tar header. */
-   struct tar_header_block *tarHeader = malloc(sizeof(struct tar_header_block));
+   /* A file with several links is only archived under the first path it's
+      found at, later ones are links to that. ustar only has room for 100
+      characters of link target, so files first found at longer paths are
+      archived again in full. */
+   struct link_target *firstLink = NULL;
+   if(fileStat->st_nlink > 1) {
+      struct link_target *target = linkTableFind(linkTable, 
+         fileStat->st_dev, fileStat->st_ino);
+      /* The pipeline leaves the file out if it's deleted before it's
+         opened, so a link to it has to wait to see it written, and if it
+         wasn't, this path is archived in full in it's place. */
+      if(target != NULL && strlen(target->path) <= 100 && target->job >= 0) {
+         int skipped = pipelineWaitWritten(pipeline, target->job);
+         if(skipped < 0) return -1;
+         if(skipped) {
+            linkTableForget(linkTable, target->path);
+            target = NULL;
+         }
+      }
+      if(target != NULL && strlen(target->path) <= 100) {
+         if(fileDescriptor != -1) close(fileDescriptor);
+         return backupHardLink(path, fileStat, target);
+      }
+      if(target == NULL) {
+         firstLink = linkTableAdd(linkTable, fileStat->st_dev,
+            fileStat->st_ino, &path[backupPathLength]);
+         if(firstLink == NULL) {
+            printf("Fatal Error: Out of memory while recording links.\n");
+            exit(1);
+         }
+      }
+   }
+
+   /* Files taking up less space than their size have holes, and only
+      their data needs archiving. */
+   if(fileStat->st_blocks * 512 < fileStat->st_size) {
+      int result = backupSparseFile(path, fileStat, &source);
+      if(result != 1) {
+         if(fileDescriptor != -1) close(fileDescriptor);
+         return result;
+      }
+   }
+
    /* Make a tar header for the file */
-   makeHeader(&path[backupPathLength], fileStat, tarHeader);
-   /* Write the header to the archive */
-   fwrite((void*)tarHeader, 1, 512, archiveFile);
-
-   /* While the file has full 512 blocks of data left... */
-   while(filelen > 512) {
-      /* Write them to the file */
-      fwrite(fileData, 1, 512, archiveFile);
-      fileData = &fileData[512];
-      filelen -= 512;
-   }
-   /* If the file has any remaining data... */
-   if(filelen > 0) {
-      /* Write it. */
-      fwrite(fileData, 1, filelen, archiveFile);
-      /* Write padding. */
-      char *padding = malloc(512 - filelen);
-      memset(padding, 0, 512 - filelen);
-      fwrite((void*)padding, 1, 512 - filelen, archiveFile);
+   struct tar_header_block tarHeader;
+   makeHeader(&path[backupPathLength], fileStat, &tarHeader);
+
+   if(writeIndex && indexAdd(&archiveIndex, &path[backupPathLength], 
+      nextHeaderOffset, fileStat->st_size, fileStat->st_mtime) != 0) 
+   {
+      printf("Fatal Error: Out of memory while indexing files.\n");
+      exit(1);
    }
-   
+   nextHeaderOffset += 512 + (fileStat->st_size + 511) / 512 * 512;
+
+   /* The new manifest needs the hash of what's archived, which is worked 
+      out as the data is copied. */
+   struct manifest_record *record = NULL;
+   if(newManifest != NULL) {
+      record = manifestAdd(newManifest, &path[backupPathLength], fileStat, 0);
+      if(record == NULL) {
+         printf("Fatal Error: Out of memory while recording files.\n");
+         exit(1);
+      }
+   }
+
+   /* The pipeline writes exactly what's written below, in the order files
+      are submitted, while later files are being read. */
+   if(pipeline != NULL) {
+      if(firstLink != NULL) firstLink->job = pipelineSubmitted(pipeline);
+      return pipelineSubmit(pipeline, path, &tarHeader, fileStat->st_size,
+         record != NULL ? &record->hash : NULL);
+   }
+
+   struct content_hash hash;
+   contentHashInit(&hash);
+
+   /* Write the header, then stream the file's data and padding into the
+      archive. The data is never held in memory all at once, so memory use
+      doesn't depend on the size of the file. 
+      The size written is the size in the header, even if the file has 
+      changed since it was stat'd, otherwise the archive would be corrupt. */
+   if(archiveWrite(&archive, &tarHeader, 512) != 0
+      || archiveCopyFile(&archive, fileDescriptor, fileStat->st_size,
+         record != NULL ? &hash : NULL) != 0
+      || archiveWritePadding(&archive) != 0)
+   {
+      printf("Fatal Error: Unable to write \"%s\" to the archive.\n",
+         &path[backupPathLength]);
+      close(fileDescriptor);
+      archiveClose(&archive);
+      exit(1);
+   }
+
+   cacheFinish(&source, fileStat->st_size);
+   close(fileDescriptor);
+   if(record != NULL) record->hash = contentHashFinal(&hash);
+
    return 0;
 }
 
+/*******************************************************************************
+   backupHardLink
+      Writes a hard link (type '1') entry, with no data, for a file already
+      in the archive under another path.
+*******************************************************************************/
+static int backupHardLink(const char* path, const struct stat *fileStat,
+   const struct link_target *target)
+{
+   const char *relativePath = &path[backupPathLength];
+   struct stat linkStatus = *fileStat;
+   linkStatus.st_size = 0;
+   struct tar_header_block tarHeader;
+   makeHeader(relativePath, &linkStatus, &tarHeader);
+   tarHeader.type = '1';
+   /* Doesn't need a terminator if it's full. */
+   strncpy(tarHeader.linkName, target->path, 100);
+   tarSetChecksum(&tarHeader);
+
+   if(writeIndex && indexAdd(&archiveIndex, relativePath, nextHeaderOffset,
+      0, fileStat->st_mtime) != 0) 
+   {
+      printf("Fatal Error: Out of memory while indexing files.\n");
+      exit(1);
+   }
+   nextHeaderOffset += 512;
+
+   /* The hash is the target's, which isn't known until it's archived, see
+      finishLinkRecords. */
+   if(newManifest != NULL
+      && manifestAdd(newManifest, relativePath, fileStat, 0) == NULL) 
+   {
+      printf("Fatal Error: Out of memory while recording files.\n");
+      exit(1);
+   }
+
+   if(pipeline != NULL) {
+      return pipelineSubmitHeader(pipeline, path, &tarHeader);
+   }
+   if(archiveWrite(&archive, &tarHeader, 512) != 0) {
+      printf("Fatal Error: Unable to write \"%s\" to the archive.\n",
+         relativePath);
+      archiveClose(&archive);
+      exit(1);
+   }
+   return 0;
+}
+
+/*******************************************************************************
+   finishLinkRecords
+      Copies each file's hash to the manifest records of it's other links,
+      once everything has been archived and hashed.
+*******************************************************************************/
+static void finishLinkRecords() {
+   for(size_t i = 0; i < manifestCount(newManifest); i++) {
+      struct manifest_record *record = manifestRecord(newManifest, i);
+      const struct link_target *target
+         = linkTableFind(linkTable, record->device, record->inode);
+      if(target == NULL) continue;
+      struct manifest_record *targetRecord 
+         = manifestFind(newManifest, target->path);
+      if(targetRecord != NULL && targetRecord != record) {
+         record->hash = targetRecord->hash;
+      }
+   }
+}
+
+/*******************************************************************************
+   backupSparseFile
+      Writes a file with holes to the archive as a GNU sparse file, with 
+      only it's data, and a map of where it goes, see sparse.c. 
+      source's descriptor can be -1 when reading ahead, in which case the
+      file is opened here, and the pipeline is left to catch up before the
+      archive is written directly.
+      Returns 1 if the file has no holes after all, and should be backed up
+      as usual.
+*******************************************************************************/
+static int backupSparseFile(const char* path, const struct stat *fileStat,
+   struct cached_file *source)
+{
+   const char *relativePath = &path[backupPathLength];
+   struct cached_file ownSource;
+   int ownDescriptor = -1;
+   int fileDescriptor = source->fd;
+   if(fileDescriptor == -1) {
+      uint64_t started = statsStart();
+      source = &ownSource;
+      ownDescriptor = fileDescriptor 
+         = cacheOpen(source, path, ownReadMode());
+      statsStop(STATS_OPEN, started);
+      if(fileDescriptor == -1) return 1;
+   }
+
+   struct sparse_map map;
+   int result = sparseMapFile(fileDescriptor, fileStat->st_size, &map);
+   char *mapText = NULL;
+   size_t mapLength = result == 0 ? sparseMapText(&map, &mapText) : 0;
+   if(result == -1 || (result == 0 && mapLength == 0)) {
+      printf("Fatal Error: Out of memory while mapping \"%s\".\n",
+         relativePath);
+      exit(1);
+   }
+   if(result == 1) {
+      if(ownDescriptor != -1) close(ownDescriptor);
+      return 1;
+   }
+
+   /* The extended header holds the real path and size, the headers have
+      made up names, for tar tools which don't understand sparse files. */
+   char records[1024];
+   size_t recordsLength = 0;
+   char realSize[21];
+   snprintf(realSize, 21, "%lld", (long long)fileStat->st_size);
+   addRecord(records, &recordsLength, "GNU.sparse.major", "1");
+   addRecord(records, &recordsLength, "GNU.sparse.minor", "0");
+   addRecord(records, &recordsLength, "GNU.sparse.name", relativePath);
+   addRecord(records, &recordsLength, "GNU.sparse.realsize", realSize);
+   size_t paddedRecordsLength = (recordsLength + 511) / 512 * 512;
+   memset(&records[recordsLength], 0, paddedRecordsLength - recordsLength);
+
+   char name[256];
+   struct stat headerStatus = *fileStat;
+   struct tar_header_block extendedTarHeader;
+   getSparseName(relativePath, "PaxHeaders.0", name);
+   headerStatus.st_size = recordsLength;
+   makeHeader(name, &headerStatus, &extendedTarHeader);
+   extendedTarHeader.type = 'x';
+   tarSetChecksum(&extendedTarHeader);
+
+   struct tar_header_block tarHeader;
+   getSparseName(relativePath, "GNUSparseFile.0", name);
+   headerStatus.st_size = mapLength + map.dataSize;
+   makeHeader(name, &headerStatus, &tarHeader);
+
+   if(writeIndex && indexAdd(&archiveIndex, relativePath, nextHeaderOffset,
+      fileStat->st_size, fileStat->st_mtime) != 0) 
+   {
+      printf("Fatal Error: Out of memory while indexing files.\n");
+      exit(1);
+   }
+   nextHeaderOffset += 1024 + paddedRecordsLength
+      + (headerStatus.st_size + 511) / 512 * 512;
+
+   struct manifest_record *record = NULL;
+   if(newManifest != NULL) {
+      record = manifestAdd(newManifest, relativePath, fileStat, 0);
+      if(record == NULL) {
+         printf("Fatal Error: Out of memory while recording files.\n");
+         exit(1);
+      }
+   }
+
+   /* Nothing else can be written while the pipeline is. */
+   if(pipeline != NULL && pipelineDrain(pipeline) != 0) {
+      if(ownDescriptor != -1) close(ownDescriptor);
+      free(mapText);
+      sparseFree(&map);
+      return -1;
+   }
+   if(pipeline != NULL) forgetSkippedFiles();
+
+   /* The manifest's hash is of the whole file, the same as for any other,
+      so the holes are hashed as zeros. */
+   struct content_hash hash;
+   contentHashInit(&hash);
+   off_t hashed = 0;
+   int failed = archiveWrite(&archive, &extendedTarHeader, 512) != 0
+      || archiveWrite(&archive, records, paddedRecordsLength) != 0
+      || archiveWrite(&archive, &tarHeader, 512) != 0
+      || archiveWrite(&archive, mapText, mapLength) != 0;
+   for(size_t i = 0; i < map.count && !failed; i++) {
+      struct sparse_extent *extent = &map.extents[i];
+      if(record != NULL) hashZeros(&hash, extent->offset - hashed);
+      failed = lseek(fileDescriptor, extent->offset, SEEK_SET) < 0
+         || archiveCopyFile(&archive, fileDescriptor, extent->length,
+            record != NULL ? &hash : NULL) != 0;
+      hashed = extent->offset + extent->length;
+   }
+   if(failed || archiveWritePadding(&archive) != 0) {
+      printf("Fatal Error: Unable to write \"%s\" to the archive.\n",
+         relativePath);
+      close(fileDescriptor);
+      archiveClose(&archive);
+      exit(1);
+   }
+   if(record != NULL) record->hash = contentHashFinal(&hash);
+
+   cacheFinish(source, map.dataSize);
+   if(ownDescriptor != -1) close(ownDescriptor);
+   free(mapText);
+   sparseFree(&map);
+   return 0;
+}
+
+/*******************************************************************************
+   ownReadMode
+      How files read here, rather than by the pipeline, are opened. They're
+      read into the archive buffer wherever it's got to, which O_DIRECT
+      can't do, so they're only dropped.
+*******************************************************************************/
+static enum cache_mode ownReadMode() {
+   return cacheMode == CACHE_DIRECT ? CACHE_DROP : cacheMode;
+}
+
+/*******************************************************************************
+   getSparseName
+      Makes up the name a sparse file's headers are given, by adding a
+      folder in front of the file name, as GNU tar does.
+*******************************************************************************/
+static void getSparseName(const char* relativePath, const char* folder,
+   char name[256])
+{
+   const char *fileName = strrchr(relativePath, '/');
+   int parentLength = fileName != NULL ? fileName - relativePath + 1 : 0;
+   fileName = fileName != NULL ? fileName + 1 : relativePath;
+   if(snprintf(name, 256, "%.*s%s/%s", parentLength, relativePath, folder,
+      fileName) > 255)
+   {
+      /* It's only a name, the real path is in the extended header. */
+      snprintf(name, 256, "%s/%.80s", folder, fileName);
+   }
+}
+
+/*******************************************************************************
+   addRecord
+      Adds a "<length> <key>=<value>\n" record to a pax extended header.
+      The length includes it's own digits, so it's found by trying them.
+*******************************************************************************/
+static void addRecord(char *records, size_t *recordsLength, const char* key,
+   const char* value)
+{
+   size_t contentLength = strlen(key) + strlen(value) + 3;
+   size_t recordLength = contentLength + 1;
+   while(snprintf(NULL, 0, "%zu", recordLength) + contentLength 
+      != recordLength)
+   {
+      recordLength = snprintf(NULL, 0, "%zu", recordLength) + contentLength;
+   }
+   *recordsLength += sprintf(&records[*recordsLength], "%zu %s=%s\n",
+      recordLength, key, value);
+}
+
+/*******************************************************************************
+   hashZeros
+      Adds a run of zeros to a hash, for a hole.
+*******************************************************************************/
+static void hashZeros(struct content_hash *hash, off_t length) {
+   static const char zeros[64 * 1024];
+   while(length > 0) {
+      size_t chunk = length < (off_t)sizeof(zeros) 
+         ? (size_t)length : sizeof(zeros);
+      contentHashUpdate(hash, zeros, chunk);
+      length -= chunk;
+   }
+}
+
+/*******************************************************************************
+   hasChangedSinceManifest
+      Compares a file with it's record in the previous manifest.
+      Unchanged files are recorded in the new manifest straight away, 
+      changed ones are recorded once they're archived.
+*******************************************************************************/
+static int hasChangedSinceManifest(const char* path, 
+   const struct stat *fileStat)
+{
+   const char *relativePath = &path[backupPathLength];
+   struct manifest_record *previous = previousManifest != NULL
+      ? manifestFind(previousManifest, relativePath) : NULL;
+   if(previous == NULL) return 1;
+
+   /* Anything left unseen at the end has been deleted. */
+   previous->seen = 1;
+   if(previous->size != (uint64_t)fileStat->st_size) return 1;
+
+   /* If the file has been touched, or replaced by another with the same 
+      size, only the content can say whether it has really changed. 
+      The ctime is ignored, as it changes when the content doesn't. */
+   uint64_t hash = previous->hash;
+   if(previous->modifiedTime != fileStat->st_mtime 
+      || previous->inode != (uint64_t)fileStat->st_ino
+      || previous->device != (uint64_t)fileStat->st_dev)
+   {
+      if(contentHashFile(path, &hash) != 0 || hash != previous->hash) {
+         return 1;
+      }
+   }
+
+   if(manifestAdd(newManifest, relativePath, fileStat, hash) == NULL) {
+      printf("Fatal Error: Out of memory while recording files.\n");
+      exit(1);
+   }
+   return 0;
+}
+
+/*******************************************************************************
+   writeTombstones
+      Adds an entry to the archive for every file in the previous manifest
+      which no longer exists, so restoring this backup on top of the 
+      previous one deletes it.
+      Tombstones use the vendor specific type 'T', which other tar tools 
+      extract as an empty file. They're indexed like any other member, with
+      a size of 0, so a restore through the index deletes the file too.
+*******************************************************************************/
+static void writeTombstones() {
+   struct stat tombstoneStatus;
+   memset(&tombstoneStatus, 0, sizeof(tombstoneStatus));
+   tombstoneStatus.st_mode = S_IFREG;
+   tombstoneStatus.st_uid = getuid();
+   tombstoneStatus.st_gid = getgid();
+   tombstoneStatus.st_mtime = time(NULL);
+
+   for(size_t i = 0; i < manifestCount(previousManifest); i++) {
+      struct manifest_record *previous = manifestRecord(previousManifest, i);
+      if(previous->seen) continue;
+
+      printf("deleted %s\n", previous->path);
+
+      struct tar_header_block tarHeader;
+      makeHeader(previous->path, &tombstoneStatus, &tarHeader);
+      tarHeader.type = 'T';
+      tarSetChecksum(&tarHeader);
+      if(writeIndex && indexAdd(&archiveIndex, previous->path,
+         nextHeaderOffset, 0, tombstoneStatus.st_mtime) != 0)
+      {
+         printf("Fatal Error: Out of memory while indexing files.\n");
+         exit(1);
+      }
+      if(archiveWrite(&archive, &tarHeader, 512) != 0) {
+         printf("Fatal Error: Unable to write archive:\n"
+               "\"%s\"\n", archivePath);
+         archiveClose(&archive);
+         exit(1);
+      }
+      nextHeaderOffset += 512;
+   }
+}
+
 /*******************************************************************************
    makeHeader
       Creates a tar header for a file.
@@ -516,6 +2242,7 @@ static int backupFile(const char* path, const struct stat *fileStat,
 static void makeHeader(const char* relativePath, const struct stat *fileStatus, 
    struct tar_header_block *tarHeader)
 {
+   uint64_t started = statsStart();
    memset(tarHeader, '\0', 512);
    /* setup ustar magic and checksum empty */
    strcpy(tarHeader->ustarMagic, "ustar");
@@ -561,30 +2288,17 @@ static void makeHeader(const char* relativePath, const struct stat *fileStatus,
       exit(1);
    }
    
-   sprintf(tarHeader->fileMode, "%06o ", fileStatus->st_mode);
-   sprintf(tarHeader->ownerId, "%06o ", fileStatus->st_uid);
-   sprintf(tarHeader->groupId, "%06o ", fileStatus->st_gid);
-   sprintf(tarHeader->fileSize, "%011o", (int)fileStatus->st_size);
-   tarHeader->fileSize[11] = ' ';
-   sprintf(tarHeader->modifiedTime, "%0lo", fileStatus->st_mtime);
-   tarHeader->modifiedTime[11] = ' ';
+   /* Sizes from 8GiB, and times before 1970, go in base-256. */
+   tarPutNumber(tarHeader->fileMode, 8, 6, fileStatus->st_mode);
+   tarPutNumber(tarHeader->ownerId, 8, 6, fileStatus->st_uid);
+   tarPutNumber(tarHeader->groupId, 8, 6, fileStatus->st_gid);
+   tarPutNumber(tarHeader->fileSize, 12, 11, fileStatus->st_size);
+   tarPutNumber(tarHeader->modifiedTime, 12, 11, fileStatus->st_mtime);
    
-   struct passwd *fileOwner = getpwuid(fileStatus->st_uid);
-   strcpy(tarHeader->ownerName, fileOwner->pw_name);
-
-   struct group *fileGroup = getgrgid(fileStatus->st_gid);
-   strcpy(tarHeader->groupName, fileGroup->gr_name);
-
-   /* The checksum is very important, if it's wrong, the tar won't be opened
-      by many tools */
-   unsigned int checksum = 0;
-   unsigned char *tarHeaderBytes = (unsigned char*)tarHeader;
-
-   for (int i = 0; i < 500; i++) {
-      checksum += tarHeaderBytes[i];
-   }
+   /* The name fields don't need a terminator if they're full. */
+   strncpy(tarHeader->ownerName, idCacheUserName(fileStatus->st_uid), 32);
+   strncpy(tarHeader->groupName, idCacheGroupName(fileStatus->st_gid), 32);
 
-   sprintf(tarHeader->checksum, "%06o", checksum);
-   tarHeader->checksum[6] = '\0';
-   tarHeader->checksum[7] = ' ';
+   tarSetChecksum(tarHeader);
+   statsStop(STATS_FORMAT, started);
 }
\ No newline at end of file
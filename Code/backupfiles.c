@@ -7,6 +7,11 @@
    Description : Assignment 2 Task 2, file list with date condition.
 
    History     : 18/12/2018 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.10 - Multi-threaded directory walker.
+                 16/10/2026 - v1.11 - Cached user and group names.
+                 16/10/2026 - v1.12 - Buffered output, and aligned columns.
+                 16/10/2026 - v1.13 - Stats.
+                 16/10/2026 - v1.14 - Exclude rules.
 
    Author      : Alex H. Newark
 
@@ -27,6 +32,11 @@
 #include <string.h>
 #include <fcntl.h>
 
+#include "walker.h"
+#include "pathfilter.h"
+#include "listing.h"
+#include "stats.h"
+
 /* The path of a file is an array of characters with a max size of 4096.
    The path always includes the backup path, 
    which doesn't need to be printed.
@@ -40,13 +50,21 @@
    path to be printed, which isn't the end of the world :) */
 static short lengthOfBackupPath = 0;
 static time_t modifiedAfterTimestamp = 0;
+/* Only regular files are listed, with what a listing line shows, and
+   the times they're filtered on. */
+static struct walk_options walkOptions = { 1, 0, WALK_FILES,
+   WALK_MODE | WALK_LINKS | WALK_OWNER | WALK_SIZE | WALK_MODIFIED
+   | WALK_CHANGED };
+static struct listing_options listingOptions = { 0, 0 };
+static struct listing *listing = NULL;
+/* -1 without --stats, otherwise whether to print JSON. */
+static int statsJson = -1;
 
 /* These are optional due to the order of functions,
    but I've added them in case I move things around, or call functions more. 
    Alternatively I could use a header. */
 static int printFile(const char* path, const struct stat *fileStat, 
    int flag, struct FTW* fileTreeWalker);
-void getModeString(mode_t mode, char modeStr[]);
 void printHelp();
 
 void printHelp() {
@@ -60,6 +78,27 @@ void printHelp() {
             "      \"YYYY-MM-DD hh:mm:ss\", or as a file path, from which\n"
             "      the modified date will be read.\n"
             "      Defaults to 1970-01-01 00:00:00.\n"
+            "   -j <threads>\n"
+            "      the number of threads used to walk directories.\n"
+            "      Defaults to 1.\n"
+            "   -o\n"
+            "      list files in name order, regardless of thread count.\n"
+            "   --exclude=<pattern>, --include=<pattern>\n"
+            "      skip, or keep, what matches the pattern, the first rule\n"
+            "      to match deciding. Patterns without a '/' match names at\n"
+            "      any depth, others the path within the list directory,\n"
+            "      and those ending in '/' only folders. * ? [...] work as\n"
+            "      in the shell, and ** matches any number of folders.\n"
+            "      Excluded folders aren't read at all.\n"
+            "   --exclude-from=<file>\n"
+            "      add a rule for each line of the file, \"+ \" at the start\n"
+            "      making it an include. Blank lines and # comments are\n"
+            "      skipped.\n"
+            "   --aligned\n"
+            "      size the columns to fit, once every file is found.\n"
+            "   --stats[=json]\n"
+            "      print where the time went, and how much was done, to\n"
+            "      stderr once finished, as a table or a line of JSON.\n"
             "   -h\n"
             "      Displays utility help (this messsge).\n\n");
    exit(1);
@@ -80,6 +119,38 @@ int main(int argc, char *argv[])
          printHelp();
       } 
       
+      else if(strcmp(argv[i], "-j") == 0) {
+         //If -j is provided with no thread count...
+         if(argc <= i + 1 || atoi(argv[i + 1]) < 1) {
+            printf("Invalid Arguments: No thread count provided.\n");
+            return 1;
+         }
+         walkOptions.threads = atoi(argv[i + 1]);
+         i++;
+         continue;
+      }
+
+      else if(strcmp(argv[i], "-o") == 0) {
+         walkOptions.ordered = 1;
+      }
+
+      else if(pathFilterIsOption(argv[i])) {
+         if(pathFilterParseOption(&walkOptions.filter, argv[i]) != 0) {
+            return 1;
+         }
+      }
+
+      else if(strcmp(argv[i], "--aligned") == 0) {
+         listingOptions.aligned = 1;
+      }
+
+      else if(strcmp(argv[i], "--stats") == 0
+         || strcmp(argv[i], "--stats=json") == 0) 
+      {
+         statsJson = argv[i][7] == '=';
+         statsEnable();
+      }
+
       else if(strcmp(argv[i], "-t") == 0) {
          //If -t is provided with no datetime...
          if(argc <= i + 1) {
@@ -130,47 +201,28 @@ int main(int argc, char *argv[])
    printf("%s", timestampString);
    printf("\n\n");
 
-   int nfds;
-   nfds = getdtablesize();
-	if (nftw(path, printFile, nfds, FTW_F | FTW_D) != 0) {
+   listing = listingStart(STDOUT_FILENO, &listingOptions);
+   if(listing == NULL) {
+      printf("Fatal Error: Out of memory.\n");
+      return 1;
+   }
+
+	if (walkTree(path, printFile, &walkOptions) != 0) {
       printf("Fatal Error: Could not find files.\n"
                "Please check the provided path: \"%s\".\n", path);
       return 1;
    }
 
+   if(listingFinish(listing) != 0) {
+      printf("Fatal Error: Unable to write the file list.\n");
+      return 1;
+   }
+
    printf("\n");
 
-   return EXIT_SUCCESS;
-}
+   if(statsJson != -1) statsReport("backupfiles", statsJson);
 
-void getModeString(mode_t mode, char modeStr[]) {
-
-   /* Allocate a character array (a string) for the permissions string.
-      Strings are null-terminated. A null character has a value of 0.
-      '\0' is a character of value 0.
-      If strings aren't terminated correcvtly, problems can occur.*/
-   modeStr = strcpy(modeStr, "----------\0");
-
-   /* Currently, no directory modes use this function,
-      but I'm going to leave this condition in in case of reuse/expansion.
-      the performance benefit without it is greatly insignificant
-      when considering the time it may take another developer to understamd
-      why this isn't working as they expect in potential future reuse. */
-   if (mode & S_IFDIR) modeStr[0] = 'd';
-   if (mode & S_IRUSR) modeStr[1] = 'r';
-   if (mode & S_IWUSR) modeStr[2] = 'w';
-   if (mode & S_IXUSR) modeStr[3] = 'x';
-   if (mode & S_IRGRP) modeStr[4] = 'r';
-   if (mode & S_IWGRP) modeStr[5] = 'w';
-   if (mode & S_IXGRP) modeStr[6] = 'x';
-   if (mode & S_IROTH) modeStr[7] = 'r';
-   if (mode & S_IWOTH) modeStr[8] = 'w';
-   if (mode & S_IXOTH) modeStr[9] = 'x';
-   /* Interesting note:
-      During development, I tested this on Mac OS for convenience. 
-      Mac OS has extended attributes, 
-      which it displays with an extra mode character, '@'.
-      eg "-rw-r--r--@ 1 alex231  staff  275 16 Dec 17:21 .gitignore" */
+   return EXIT_SUCCESS;
 }
 
 static int printFile(const char* path, const struct stat *fileStat, 
@@ -188,33 +240,10 @@ static int printFile(const char* path, const struct stat *fileStat,
       return 0;
    }
 
-   /* As a personal preference, when declaring array pointers, I place the
-      asterisk before the space, and otherwise after. 
-      If contributing to a shared project, I follow the existing  standard, 
-      but here the placement is mixed but consistent. */
-   char modeStr[11];
-   getModeString(fileStat->st_mode, modeStr);
-
-   struct group *fileGroup;
-   fileGroup = getgrgid(fileStat->st_gid);
-
-   struct passwd *fileOwner;
-   fileOwner = getpwuid(fileStat->st_uid);
-
-   char dateString[13];
-   strftime(dateString, 13, "%d %b %R\0", gmtime(&(fileStat->st_mtime)));
-
-   /* I'm using fixed column sizes here for convenience.
-      As a future improvement, these column lengths could by dynamic,
-      by looping through files before printing to calculate how many characters
-      the longest field in each column contains. */
-   printf("%s %d %s %6s %7lld %s %s\n", 
-      modeStr, 
-      fileStat->st_nlink, 
-      fileOwner->pw_name, fileGroup->gr_name, 
-      fileStat->st_size, 
-      dateString, 
-      &path[lengthOfBackupPath]);
+   /* Lines are formatted straight into the listing's buffer, see
+      listing.c. */
+   statsAdd(STATS_FILES, 1);
+   listingAdd(listing, &path[lengthOfBackupPath], fileStat);
    
    return 0;
 }
@@ -0,0 +1,524 @@
+/*******************************************************************************
+
+   File        : bench.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Benchmarks listfiles, backupfiles, backup and restore, and
+                 the system tar, against a generated tree.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   Each tool is run several times with a warm page cache, after one run to
+   warm it, and several times with a cold one, and the median is reported.
+   The cache is emptied through /proc/sys/vm/drop_caches where that's
+   allowed. Otherwise every file in the tree, and the archive, is dropped
+   with posix_fadvise, which only needs the files to be readable, and only
+   leaves the folders and inodes cached.
+
+   Peak RSS comes from wait4. System calls are counted in one extra warm
+   run, with the tool traced by ptrace, stopping on every call into and out
+   of the kernel, across all of it's threads. That run is much slower, so
+   it isn't timed. Where ptrace isn't allowed, the count is left out.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/ptrace.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <ftw.h>
+
+#include "treegen.h"
+
+#define BENCH_MAX_ARGS 64
+
+struct bench_options {
+   const char *directory;
+   const char *binDirectory;
+   int runs;
+   int compareTar;
+   int countSyscalls;
+   int keep;
+   /* Extra arguments for backup and restore, and for the listing tools. */
+   char *backupArgs;
+   char *listArgs;
+};
+
+struct run_result {
+   double seconds;
+   long peakRssKb;
+   long long syscalls;
+};
+
+/* A tool to run, with the files the cache has to be emptied of. */
+struct bench_case {
+   const char *name;
+   char *arguments[BENCH_MAX_ARGS];
+   const char *workingDirectory;
+   /* Emptied before every run, such as a restore's output. */
+   const char *outputDirectory;
+   /* Listing tools don't read file data, so MB/s means nothing. */
+   int readsData;
+};
+
+static struct bench_options benchOptions = {
+   "/tmp/backup-bench", "bin", 3, 1, 1, 0, "", ""
+};
+static struct tree_options treeOptions = {
+   10000, 3, 8, 0, 1024 * 1024, 1, 64 * 1024 * 1024, 5, 1
+};
+static struct tree_summary treeSummary;
+static char treePath[4096];
+static char archivePath[4096];
+
+void printHelp();
+static void runCase(struct bench_case *benchCase);
+static int runTool(struct bench_case *benchCase, int traced,
+   struct run_result *result);
+static long long traceSyscalls(pid_t child);
+static const char *dropCaches();
+static int dropFile(const char* path, const struct stat *status, int flag,
+   struct FTW *walker);
+static void addArguments(struct bench_case *benchCase, int *count,
+   char *arguments);
+static int compareResults(const void *first, const void *second);
+static double now();
+
+void printHelp() {
+   printf("\nbench\n\n"
+            "Generates a tree, then times the tools against it.\n"
+            "usage: bench <options>\n"
+            "options: \n"
+            "   --dir=<path>\n"
+            "      the folder to work in, emptied first.\n"
+            "      Defaults to /tmp/backup-bench.\n"
+            "   --bin=<path>\n"
+            "      the folder holding the tools. Defaults to bin.\n"
+            "   --files=<count>\n"
+            "      files in the tree, including links. Defaults to 10000.\n"
+            "   --depth=<levels>, --fanout=<folders>\n"
+            "      the shape of the folder tree. Default to 3 and 8.\n"
+            "   --min-size=<bytes>, --max-size=<bytes>\n"
+            "      the range of file sizes, spread evenly over each power\n"
+            "      of two. Default to 0 and 1048576.\n"
+            "   --sparse=<percent>, --sparse-size=<bytes>\n"
+            "      how many files are sparse, and their size.\n"
+            "      Default to 1 and 67108864.\n"
+            "   --links=<percent>\n"
+            "      how many entries are extra hard links. Defaults to 5.\n"
+            "   --seed=<number>\n"
+            "      the same seed always makes the same tree. Defaults to 1.\n"
+            "   --runs=<count>\n"
+            "      timed runs of each tool, with a warm and a cold cache.\n"
+            "      Defaults to 3.\n"
+            "   --backup-args=<arguments>, --list-args=<arguments>\n"
+            "      extra arguments for backup and restore, or for\n"
+            "      listfiles and backupfiles, such as \"--io=uring\".\n"
+            "   --no-tar\n"
+            "      don't compare against the system tar.\n"
+            "   --no-syscalls\n"
+            "      don't count system calls.\n"
+            "   --keep\n"
+            "      leave the tree and archives behind.\n"
+            "   -h\n"
+            "      Displays utility help (this messsge).\n\n");
+   exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+   for(int i = 1; i < argc; i++) {
+      char *value = strchr(argv[i], '=');
+      value = value != NULL ? value + 1 : "";
+
+      if(strcmp(argv[i], "-h") == 0) {
+         printHelp();
+      } else if(strncmp(argv[i], "--dir=", 6) == 0) {
+         benchOptions.directory = value;
+      } else if(strncmp(argv[i], "--bin=", 6) == 0) {
+         benchOptions.binDirectory = value;
+      } else if(strncmp(argv[i], "--files=", 8) == 0) {
+         treeOptions.files = strtoul(value, NULL, 10);
+      } else if(strncmp(argv[i], "--depth=", 8) == 0) {
+         treeOptions.depth = atoi(value);
+      } else if(strncmp(argv[i], "--fanout=", 9) == 0) {
+         treeOptions.fanout = atoi(value);
+      } else if(strncmp(argv[i], "--min-size=", 11) == 0) {
+         treeOptions.minSize = strtoll(value, NULL, 10);
+      } else if(strncmp(argv[i], "--max-size=", 11) == 0) {
+         treeOptions.maxSize = strtoll(value, NULL, 10);
+      } else if(strncmp(argv[i], "--sparse=", 9) == 0) {
+         treeOptions.sparsePercent = atoi(value);
+      } else if(strncmp(argv[i], "--sparse-size=", 14) == 0) {
+         treeOptions.sparseSize = strtoll(value, NULL, 10);
+      } else if(strncmp(argv[i], "--links=", 8) == 0) {
+         treeOptions.linkPercent = atoi(value);
+      } else if(strncmp(argv[i], "--seed=", 7) == 0) {
+         treeOptions.seed = strtoull(value, NULL, 10);
+      } else if(strncmp(argv[i], "--runs=", 7) == 0) {
+         benchOptions.runs = atoi(value);
+      } else if(strncmp(argv[i], "--backup-args=", 14) == 0) {
+         benchOptions.backupArgs = value;
+      } else if(strncmp(argv[i], "--list-args=", 12) == 0) {
+         benchOptions.listArgs = value;
+      } else if(strcmp(argv[i], "--no-tar") == 0) {
+         benchOptions.compareTar = 0;
+      } else if(strcmp(argv[i], "--no-syscalls") == 0) {
+         benchOptions.countSyscalls = 0;
+      } else if(strcmp(argv[i], "--keep") == 0) {
+         benchOptions.keep = 1;
+      } else {
+         printf("Invalid Arguments: Unknown option \"%s\".\n", argv[i]);
+         return 1;
+      }
+   }
+   if(benchOptions.runs < 1 || treeOptions.depth < 0
+      || treeOptions.fanout < 1 || treeOptions.maxSize < treeOptions.minSize
+      || treeOptions.sparseSize < 64 * 1024)
+   {
+      printf("Invalid Arguments: Use -h for help.\n");
+      return 1;
+   }
+
+   /* The tools are run from other folders, so they need full paths. */
+   char binDirectory[4096];
+   if(realpath(benchOptions.binDirectory, binDirectory) == NULL) {
+      printf("Fatal Error: Unable to find the tools in \"%s\".\n",
+         benchOptions.binDirectory);
+      return 1;
+   }
+
+   snprintf(treePath, 4096, "%s/tree", benchOptions.directory);
+   snprintf(archivePath, 4096, "%s/bench.tar", benchOptions.directory);
+   mkdir(benchOptions.directory, 0755);
+   treeRemove(treePath);
+
+   printf("\nGenerating %lu files in:\n%s\n", treeOptions.files, treePath);
+   double started = now();
+   if(treeGenerate(treePath, &treeOptions, &treeSummary) != 0) {
+      printf("Fatal Error: Unable to generate the tree: %s\n",
+         strerror(errno));
+      return 1;
+   }
+   printf("%lu files, %lu folders, %lu links, %lu sparse files,\n"
+      "%.1f MB in files, %.1f MB of data, generated in %.1fs.\n\n",
+      treeSummary.files, treeSummary.directories, treeSummary.links,
+      treeSummary.sparseFiles, treeSummary.bytes / 1e6,
+      treeSummary.dataBytes / 1e6, now() - started);
+
+   printf("%-12s %-5s %9s %11s %9s %10s %10s\n",
+      "tool", "cache", "seconds", "files/s", "MB/s", "peak RSS", "syscalls");
+
+   char tools[4][4200];
+   const char *toolNames[4] = { "listfiles", "backupfiles", "backup",
+      "restore" };
+   for(int i = 0; i < 4; i++) {
+      snprintf(tools[i], 4200, "%s/%s", binDirectory, toolNames[i]);
+   }
+   char restorePath[4096];
+   snprintf(restorePath, 4096, "%s/bench", benchOptions.directory);
+
+   struct bench_case listCase = { "listfiles", { tools[0] }, treePath };
+   int count = 1;
+   addArguments(&listCase, &count, benchOptions.listArgs);
+   runCase(&listCase);
+
+   struct bench_case backupFilesCase = { "backupfiles", { tools[1] } };
+   count = 1;
+   addArguments(&backupFilesCase, &count, benchOptions.listArgs);
+   backupFilesCase.arguments[count] = treePath;
+   runCase(&backupFilesCase);
+
+   struct bench_case backupCase = { "backup", { tools[2] } };
+   backupCase.readsData = 1;
+   count = 1;
+   addArguments(&backupCase, &count, benchOptions.backupArgs);
+   backupCase.arguments[count++] = "-f";
+   backupCase.arguments[count++] = archivePath;
+   backupCase.arguments[count] = treePath;
+   runCase(&backupCase);
+
+   struct bench_case restoreCase = { "restore", { tools[3] } };
+   restoreCase.readsData = 1;
+   restoreCase.outputDirectory = restorePath;
+   count = 1;
+   addArguments(&restoreCase, &count, benchOptions.backupArgs);
+   restoreCase.arguments[count++] = "-f";
+   restoreCase.arguments[count] = archivePath;
+   runCase(&restoreCase);
+
+   char tarArchivePath[4096];
+   char tarRestorePath[4096];
+   snprintf(tarArchivePath, 4096, "%s/tar.tar", benchOptions.directory);
+   snprintf(tarRestorePath, 4096, "%s/tar", benchOptions.directory);
+   if(benchOptions.compareTar) {
+      /* The same work as backup, sparse files and all. */
+      struct bench_case tarCase = { "tar -c", { "tar", "--sparse", "-cf",
+         tarArchivePath, "-C", treePath, "." } };
+      tarCase.readsData = 1;
+      runCase(&tarCase);
+
+      struct bench_case untarCase = { "tar -x", { "tar", "-xf",
+         tarArchivePath, "-C", tarRestorePath } };
+      untarCase.readsData = 1;
+      untarCase.outputDirectory = tarRestorePath;
+      runCase(&untarCase);
+   }
+
+   struct stat archiveStatus;
+   if(stat(archivePath, &archiveStatus) == 0) {
+      printf("\nbackup archive: %.1f MB", archiveStatus.st_size / 1e6);
+      if(benchOptions.compareTar
+         && stat(tarArchivePath, &archiveStatus) == 0)
+      {
+         printf(", tar archive: %.1f MB", archiveStatus.st_size / 1e6);
+      }
+      printf("\n");
+   }
+   printf("\n");
+
+   if(!benchOptions.keep) {
+      treeRemove(treePath);
+      treeRemove(restorePath);
+      treeRemove(tarRestorePath);
+      unlink(archivePath);
+      unlink(tarArchivePath);
+   }
+   return EXIT_SUCCESS;
+}
+
+/*******************************************************************************
+   runCase
+      Times a tool with a warm and cold cache, and prints a line for each.
+*******************************************************************************/
+static void runCase(struct bench_case *benchCase) {
+   struct run_result results[benchOptions.runs];
+   struct run_result warmUp;
+   long long syscalls = -1;
+
+   /* The first run warms the cache, and makes the archive for restore. */
+   if(runTool(benchCase, 0, &warmUp) != 0) {
+      printf("%-12s failed, see it's output by running it by hand.\n",
+         benchCase->name);
+      return;
+   }
+   if(benchOptions.countSyscalls) {
+      struct run_result traced;
+      if(runTool(benchCase, 1, &traced) == 0) syscalls = traced.syscalls;
+   }
+
+   for(int cold = 0; cold < 2; cold++) {
+      const char *method = NULL;
+      int failed = 0;
+      for(int i = 0; i < benchOptions.runs && !failed; i++) {
+         if(cold) method = dropCaches();
+         failed = runTool(benchCase, 0, &results[i]) != 0;
+      }
+      if(failed) {
+         printf("%-12s %-5s failed\n", benchCase->name,
+            cold ? "cold" : "warm");
+         continue;
+      }
+      qsort(results, benchOptions.runs, sizeof(struct run_result),
+         compareResults);
+      struct run_result *median = &results[benchOptions.runs / 2];
+
+      char megabytes[16] = "-";
+      if(benchCase->readsData) {
+         snprintf(megabytes, 16, "%.1f",
+            treeSummary.bytes / 1e6 / median->seconds);
+      }
+      char syscallString[24] = "-";
+      if(syscalls >= 0) snprintf(syscallString, 24, "%lld", syscalls);
+
+      printf("%-12s %-5s %9.3f %11.0f %9s %7ld KB %10s%s\n",
+         benchCase->name, cold ? "cold" : "warm", median->seconds,
+         treeSummary.files / median->seconds, megabytes,
+         median->peakRssKb, cold ? "-" : syscallString,
+         method != NULL && strcmp(method, "fadvise") == 0
+            ? " (fadvise)" : "");
+      fflush(stdout);
+   }
+}
+
+/*******************************************************************************
+   runTool
+      Runs a tool to completion, with it's output thrown away.
+      Returns -1 if it couldn't be run or didn't exit successfully.
+*******************************************************************************/
+static int runTool(struct bench_case *benchCase, int traced,
+   struct run_result *result)
+{
+   memset(result, 0, sizeof(struct run_result));
+   if(benchCase->outputDirectory != NULL) {
+      treeRemove(benchCase->outputDirectory);
+      /* tar won't make it's own. */
+      mkdir(benchCase->outputDirectory, 0755);
+   }
+
+   double started = now();
+   pid_t child = fork();
+   if(child == -1) return -1;
+   if(child == 0) {
+      int nullFd = open("/dev/null", O_WRONLY);
+      dup2(nullFd, STDOUT_FILENO);
+      dup2(nullFd, STDERR_FILENO);
+      if(benchCase->workingDirectory != NULL
+         && chdir(benchCase->workingDirectory) != 0)
+      {
+         _exit(127);
+      }
+      if(traced) {
+         if(ptrace(PTRACE_TRACEME, 0, NULL, NULL) != 0) _exit(126);
+         raise(SIGSTOP);
+      }
+      execvp(benchCase->arguments[0], benchCase->arguments);
+      _exit(127);
+   }
+
+   int status;
+   if(traced) {
+      result->syscalls = traceSyscalls(child);
+      return result->syscalls >= 0 ? 0 : -1;
+   }
+
+   struct rusage usage;
+   if(wait4(child, &status, 0, &usage) != child) return -1;
+   result->seconds = now() - started;
+   result->peakRssKb = usage.ru_maxrss;
+   return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/*******************************************************************************
+   traceSyscalls
+      Counts the system calls made by a traced child, and every thread it
+      starts, until it exits. Each call stops the thread twice, going in
+      and coming out.
+      Returns -1 if it can't be traced, or doesn't exit successfully.
+*******************************************************************************/
+static long long traceSyscalls(pid_t child) {
+   int status;
+   if(waitpid(child, &status, 0) != child || !WIFSTOPPED(status)) {
+      return -1;
+   }
+   if(ptrace(PTRACE_SETOPTIONS, child, NULL, PTRACE_O_TRACESYSGOOD
+      | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK
+      | PTRACE_O_EXITKILL) != 0)
+   {
+      kill(child, SIGKILL);
+      waitpid(child, &status, 0);
+      return -1;
+   }
+
+   long long stops = 0;
+   int exitStatus = -1;
+   ptrace(PTRACE_SYSCALL, child, NULL, NULL);
+   for(;;) {
+      pid_t thread = waitpid(-1, &status, __WALL);
+      if(thread == -1) {
+         if(errno == EINTR) continue;
+         break;
+      }
+      if(WIFEXITED(status) || WIFSIGNALED(status)) {
+         if(thread == child) exitStatus = status;
+         continue;
+      }
+      if(!WIFSTOPPED(status)) continue;
+
+      int signal = WSTOPSIG(status);
+      if(signal == (SIGTRAP | 0x80)) {
+         stops++;
+         signal = 0;
+      } else if(signal == SIGTRAP || signal == SIGSTOP) {
+         /* New threads, and ptrace events, not real signals. */
+         signal = 0;
+      }
+      ptrace(PTRACE_SYSCALL, thread, NULL, (void *)(long)signal);
+   }
+
+   if(exitStatus == -1 || !WIFEXITED(exitStatus)
+      || WEXITSTATUS(exitStatus) != 0)
+   {
+      return -1;
+   }
+   return stops / 2;
+}
+
+/*******************************************************************************
+   dropCaches
+      Empties the page cache of the tree and archive.
+      Returns how it was done.
+*******************************************************************************/
+static const char *dropCaches() {
+   sync();
+   int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+   if(fd != -1) {
+      int written = write(fd, "3", 1) == 1;
+      close(fd);
+      if(written) return "drop_caches";
+   }
+
+   nftw(treePath, dropFile, 64, FTW_PHYS);
+   struct stat status;
+   if(stat(archivePath, &status) == 0) {
+      dropFile(archivePath, &status, FTW_F, NULL);
+   }
+   return "fadvise";
+}
+
+static int dropFile(const char* path, const struct stat *status, int flag,
+   struct FTW *walker)
+{
+   if(flag != FTW_F || !S_ISREG(status->st_mode)) return 0;
+   int fd = open(path, O_RDONLY);
+   if(fd == -1) return 0;
+   posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+   close(fd);
+   return 0;
+}
+
+/*******************************************************************************
+   addArguments
+      Splits a string of extra arguments on spaces, in place.
+*******************************************************************************/
+static void addArguments(struct bench_case *benchCase, int *count,
+   char *arguments)
+{
+   char *saved;
+   for(char *argument = strtok_r(arguments, " ", &saved);
+      argument != NULL && *count < BENCH_MAX_ARGS - 4;
+      argument = strtok_r(NULL, " ", &saved))
+   {
+      benchCase->arguments[(*count)++] = argument;
+   }
+}
+
+static int compareResults(const void *first, const void *second) {
+   double difference = ((const struct run_result *)first)->seconds
+      - ((const struct run_result *)second)->seconds;
+   return difference < 0 ? -1 : difference > 0;
+}
+
+static double now() {
+   struct timespec time;
+   clock_gettime(CLOCK_MONOTONIC, &time);
+   return time.tv_sec + time.tv_nsec / 1e9;
+}
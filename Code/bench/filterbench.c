@@ -0,0 +1,250 @@
+/*******************************************************************************
+
+   File        : filterbench.c
+
+   Date        : Saturday 17th October 2026
+
+   Description : Checks the exclude rules match what they should, and
+                 nothing else, then times them over a made up tree's paths,
+                 see pathfilter.c.
+
+   History     : 17/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   Every rule is checked on it's own against paths it must match, and
+   paths which only look like they might, such as a name with the rule's
+   folder name at the end of it. Any difference is fatal, as a rule
+   matching too much silently leaves files out of backups.
+
+   The timing uses rules like a real exclude file's, mostly plain names,
+   with a few globs, and as many more plain names as --rules asks for,
+   which shouldn't change the time much, as they all go in the tries.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../pathfilter.h"
+
+struct filter_case {
+   const char *pattern;
+   const char *path;
+   int isDirectory;
+   int excluded;
+};
+
+static const struct filter_case cases[] = {
+   /* Names, at any depth. */
+   { "node_modules", "node_modules", 1, 1 },
+   { "node_modules", "a/b/node_modules", 1, 1 },
+   { "node_modules", "a/my_node_modules", 1, 0 },
+   { "*.log", "a/b.log", 0, 1 },
+   { "*.log", "a/b.log/c", 0, 0 },
+   { "*.log", "a.logs", 0, 0 },
+   /* Folders only. */
+   { "build/", "build", 1, 1 },
+   { "build/", "build", 0, 0 },
+   { "build/", "src/build", 1, 1 },
+   /* Whole paths. */
+   { "/build", "build", 1, 1 },
+   { "/build", "src/build", 1, 0 },
+   { "src/build", "src/build", 1, 1 },
+   { "src/build", "x/src/build", 1, 0 },
+   { "logs/*", "logs/one", 0, 1 },
+   { "logs/*", "logs/a/one", 0, 0 },
+   /* ** as whole folders, which can be none, but never part of a name. */
+   { "**/build", "build", 1, 1 },
+   { "**/build", "src/build", 1, 1 },
+   { "**/build", "src/a/build", 1, 1 },
+   { "**/build", "src/mybuild", 1, 0 },
+   { "**/build", "mybuild", 1, 0 },
+   { "**/foo", "xfoo", 0, 0 },
+   { "**/foo", "a/xfoo", 0, 0 },
+   { "a/**/b", "a/b", 0, 1 },
+   { "a/**/b", "a/x/b", 0, 1 },
+   { "a/**/b", "a/x/y/b", 0, 1 },
+   { "a/**/b", "a/xb", 0, 0 },
+   { "a/**/b", "a/x/yb", 0, 0 },
+   { "a/**/b", "ab", 0, 0 },
+   { "a/**", "a/x", 0, 1 },
+   { "a/**", "a/x/y", 0, 1 },
+   { "a/**", "ax", 0, 0 },
+   { "a/x**b", "a/x/y/b", 0, 1 },
+   { "deep/**/*.tmp", "deep/t.tmp", 0, 1 },
+   { "deep/**/*.tmp", "deep/a/b/t.tmp", 0, 1 },
+   { "deep/**/*.tmp", "deeper/t.tmp", 0, 0 },
+   /* Sets, and escapes. */
+   { "[abc].txt", "b.txt", 0, 1 },
+   { "[abc].txt", "d.txt", 0, 0 },
+   { "[!abc].txt", "d.txt", 0, 1 },
+   { "[^a-c].txt", "b.txt", 0, 0 },
+   { "[]x]", "]", 0, 1 },
+   { "c\\[1\\]", "c[1]", 1, 1 },
+   { "c[[]1]", "c[1]", 1, 1 },
+   { "[unclosed", "[unclosed", 0, 1 },
+   { "l?gs", "logs", 1, 1 },
+   { "l?gs", "lgs", 1, 0 },
+   { "*", "a/b", 0, 1 }
+};
+
+static void checkCases();
+static void checkOrder();
+static double now();
+
+/* Where results are added up, so the work can't be optimised out. */
+static volatile int sink;
+
+int main(int argc, char *argv[]) {
+   int count = 65536;
+   int rounds = 50;
+   int extraRules = 0;
+   for(int i = 1; i < argc; i++) {
+      if(strncmp(argv[i], "--paths=", 8) == 0) {
+         count = atoi(&argv[i][8]);
+      } else if(strncmp(argv[i], "--rounds=", 9) == 0) {
+         rounds = atoi(&argv[i][9]);
+      } else if(strncmp(argv[i], "--rules=", 8) == 0) {
+         extraRules = atoi(&argv[i][8]);
+      } else {
+         printf("usage: filterbench (--paths=<count>) (--rounds=<count>)"
+            " (--rules=<count>)\n");
+         exit(strcmp(argv[i], "-h") == 0 ? 0 : 1);
+      }
+   }
+   if(count < 1 || rounds < 1 || extraRules < 0) {
+      printf("Fatal Error: --paths and --rounds must be at least 1.\n");
+      exit(1);
+   }
+
+   checkCases();
+   checkOrder();
+
+   static const char *rules[] = { "node_modules/", ".git/", "__pycache__/",
+      "*.o", "*.pyc", "*.log", "/build", "**/target/**", "cache[0-9]",
+      "*~", ".*.swp" };
+   struct path_filter *filter = pathFilterCreate();
+   if(filter == NULL) {
+      printf("Fatal Error: Out of memory.\n");
+      exit(1);
+   }
+   for(size_t i = 0; i < sizeof(rules) / sizeof(rules[0]); i++) {
+      pathFilterAdd(filter, rules[i], 0);
+   }
+   char rule[32];
+   for(int i = 0; i < extraRules; i++) {
+      snprintf(rule, sizeof(rule), "name%d", i);
+      pathFilterAdd(filter, rule, 0);
+   }
+
+   /* Paths a few folders deep, with common extensions. */
+   static const char *folders[] = { "src", "lib", "include", "docs", "test",
+      "target", "node_modules", "vendor" };
+   static const char *extensions[] = { ".c", ".h", ".o", ".txt", ".log",
+      ".js", ".pyc", "" };
+   char (*paths)[128] = malloc(count * sizeof(*paths));
+   if(paths == NULL) {
+      printf("Fatal Error: Out of memory.\n");
+      exit(1);
+   }
+   srandom(1);
+   for(int i = 0; i < count; i++) {
+      int length = 0;
+      int depth = random() % 5;
+      for(int j = 0; j < depth; j++) {
+         length += snprintf(&paths[i][length], 128 - length, "%s%ld/",
+            folders[random() % 8], random() % 10);
+      }
+      snprintf(&paths[i][length], 128 - length, "file%ld%s",
+         random() % 1000, extensions[random() % 8]);
+   }
+
+   int excluded = 0;
+   for(int i = 0; i < count; i++) {
+      excluded += pathFilterExcludes(filter, paths[i], 0);
+   }
+   double started = now();
+   for(int round = 0; round < rounds; round++) {
+      for(int i = 0; i < count; i++) {
+         sink += pathFilterExcludes(filter, paths[i], 0);
+      }
+   }
+   double elapsed = now() - started;
+
+   printf("%d rules, %d of %d paths excluded\n",
+      (int)(sizeof(rules) / sizeof(rules[0])) + extraRules, excluded, count);
+   printf("%.0f lookups/s, %.1f ns each\n", (double)count * rounds / elapsed,
+      elapsed * 1e9 / count / rounds);
+
+   free(paths);
+   pathFilterFree(filter);
+   return 0;
+}
+
+/*******************************************************************************
+   checkCases
+      Each case's rule, on it's own, against it's path.
+*******************************************************************************/
+static void checkCases() {
+   for(size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+      struct path_filter *filter = pathFilterCreate();
+      if(filter == NULL || pathFilterAdd(filter, cases[i].pattern, 0) != 0) {
+         printf("Fatal Error: Unable to add \"%s\".\n", cases[i].pattern);
+         exit(1);
+      }
+      if(pathFilterExcludes(filter, cases[i].path, cases[i].isDirectory)
+         != cases[i].excluded)
+      {
+         printf("Fatal Error: \"%s\" should %sexclude \"%s\".\n",
+            cases[i].pattern, cases[i].excluded ? "" : "not ",
+            cases[i].path);
+         exit(1);
+      }
+      pathFilterFree(filter);
+   }
+}
+
+/*******************************************************************************
+   checkOrder
+      The first rule to match decides, whether it's a name, a path, or a
+      glob, and folders above a path count too, for pathFilterExcludesPath.
+*******************************************************************************/
+static void checkOrder() {
+   struct path_filter *filter = pathFilterCreate();
+   if(filter == NULL) {
+      printf("Fatal Error: Out of memory.\n");
+      exit(1);
+   }
+   pathFilterAdd(filter, "important.log", 1);
+   pathFilterAdd(filter, "*.log", 0);
+   pathFilterAdd(filter, "keep/*.tmp", 1);
+   pathFilterAdd(filter, "*.tmp", 0);
+   pathFilterAdd(filter, "skip/", 0);
+   if(pathFilterExcludes(filter, "a/important.log", 0)
+      || !pathFilterExcludes(filter, "a/other.log", 0)
+      || pathFilterExcludes(filter, "keep/a.tmp", 0)
+      || !pathFilterExcludes(filter, "other/a.tmp", 0)
+      || pathFilterExcludes(filter, "skip/a", 0)
+      || !pathFilterExcludesPath(filter, "x/skip/a", 0)
+      || pathFilterExcludesPath(filter, "x/skipped/a", 0))
+   {
+      printf("Fatal Error: Rules weren't applied in order.\n");
+      exit(1);
+   }
+   pathFilterFree(filter);
+}
+
+static double now() {
+   struct timespec time;
+   clock_gettime(CLOCK_MONOTONIC, &time);
+   return time.tv_sec + time.tv_nsec / 1e9;
+}
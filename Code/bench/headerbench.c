@@ -0,0 +1,318 @@
+/*******************************************************************************
+
+   File        : headerbench.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Benchmarks making and reading tar headers, with sprintf
+                 and a loop per digit as backup did before, and with the
+                 header codec, see tarheader.c.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   Only the numbers and checksum are timed, the parts of a header which
+   changed, the paths and names are copied the same way by both. The old
+   code never checked checksums when reading, so reading with the codec is
+   timed with and without checking them.
+
+   Before timing anything, every header the codec makes is compared with
+   the one the old code makes, and read back, along with numbers the old
+   code couldn't hold, sizes from 8GiB and times before 1970. Any
+   difference is fatal.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../tarheader.h"
+
+struct header_values {
+   unsigned int mode;
+   unsigned int uid;
+   unsigned int gid;
+   int64_t size;
+   int64_t modifiedTime;
+};
+
+static void makeValues(struct header_values *values, int count);
+static void checkCodec(const struct header_values *values, int count);
+static void checkRoundTrip(int64_t value, size_t fieldSize, size_t digits);
+static void oldMakeHeader(const struct header_values *values,
+   struct tar_header_block *header);
+static void oldReadHeader(const struct tar_header_block *header,
+   struct header_values *values);
+static unsigned int oldGetNumber(const char *field, unsigned int fieldSize);
+static void newMakeHeader(const struct header_values *values,
+   struct tar_header_block *header);
+static void newDecodeHeader(const struct tar_header_block *header,
+   struct header_values *values);
+static int newReadHeader(const struct tar_header_block *header,
+   struct header_values *values);
+static double now();
+
+/* Where results are added up, so the work can't be optimised out. */
+static volatile uint64_t sink;
+
+int main(int argc, char *argv[]) {
+   int count = 4096;
+   int rounds = 500;
+   for(int i = 1; i < argc; i++) {
+      if(strncmp(argv[i], "--headers=", 10) == 0) {
+         count = atoi(&argv[i][10]);
+      } else if(strncmp(argv[i], "--rounds=", 9) == 0) {
+         rounds = atoi(&argv[i][9]);
+      } else {
+         printf("usage: headerbench (--headers=<count>) (--rounds=<count>)\n");
+         exit(strcmp(argv[i], "-h") == 0 ? 0 : 1);
+      }
+   }
+   if(count < 1 || rounds < 1) {
+      printf("Fatal Error: --headers and --rounds must be at least 1.\n");
+      exit(1);
+   }
+
+   struct header_values *values = malloc(count * sizeof(*values));
+   struct header_values *readValues = malloc(count * sizeof(*readValues));
+   struct tar_header_block *headers = calloc(count, sizeof(*headers));
+   if(values == NULL || readValues == NULL || headers == NULL) {
+      printf("Fatal Error: Out of memory.\n");
+      exit(1);
+   }
+   makeValues(values, count);
+   checkCodec(values, count);
+
+   double total = (double)count * rounds;
+   double started = now();
+   for(int round = 0; round < rounds; round++) {
+      for(int i = 0; i < count; i++) oldMakeHeader(&values[i], &headers[i]);
+   }
+   double oldMake = now() - started;
+
+   started = now();
+   for(int round = 0; round < rounds; round++) {
+      for(int i = 0; i < count; i++) {
+         oldReadHeader(&headers[i], &readValues[i]);
+         sink += readValues[i].size;
+      }
+   }
+   double oldRead = now() - started;
+
+   started = now();
+   for(int round = 0; round < rounds; round++) {
+      for(int i = 0; i < count; i++) newMakeHeader(&values[i], &headers[i]);
+   }
+   double newMake = now() - started;
+
+   started = now();
+   for(int round = 0; round < rounds; round++) {
+      for(int i = 0; i < count; i++) {
+         sink += newReadHeader(&headers[i], &readValues[i]);
+         sink += readValues[i].size;
+      }
+   }
+   double newVerifiedRead = now() - started;
+
+   started = now();
+   for(int round = 0; round < rounds; round++) {
+      for(int i = 0; i < count; i++) {
+         newDecodeHeader(&headers[i], &readValues[i]);
+         sink += readValues[i].size;
+      }
+   }
+   double newRead = now() - started;
+
+   printf("%-22s %16s %16s %8s\n", "", "before headers/s", "after headers/s",
+      "speedup");
+   printf("%-22s %16.0f %16.0f %7.1fx\n", "make", total / oldMake,
+      total / newMake, oldMake / newMake);
+   printf("%-22s %16.0f %16.0f %7.1fx\n", "read", total / oldRead,
+      total / newRead, oldRead / newRead);
+   printf("%-22s %16.0f %16.0f %7.1fx\n", "read and verify", total / oldRead,
+      total / newVerifiedRead, oldRead / newVerifiedRead);
+
+   free(values);
+   free(readValues);
+   free(headers);
+   return 0;
+}
+
+/*******************************************************************************
+   makeValues
+      Numbers like a real tree's, sizes mostly small with a few large, all
+      within what the old code could write.
+*******************************************************************************/
+static void makeValues(struct header_values *values, int count) {
+   srandom(1);
+   for(int i = 0; i < count; i++) {
+      values[i].mode = (i % 8 == 0 ? 040755 : 0100644) | (random() & 0111);
+      values[i].uid = random() % 70000;
+      values[i].gid = random() % 70000;
+      values[i].size = i % 64 == 0 ? random() % 0x7FFFFFFF
+         : random() % (1 << (random() % 20 + 1));
+      values[i].modifiedTime = 1500000000 + random() % 300000000;
+   }
+}
+
+/*******************************************************************************
+   checkCodec
+      Makes sure the codec writes exactly what the old code did, and reads
+      back what was written.
+*******************************************************************************/
+static void checkCodec(const struct header_values *values, int count) {
+   for(int i = 0; i < count; i++) {
+      struct tar_header_block oldHeader;
+      struct tar_header_block newHeader;
+      oldMakeHeader(&values[i], &oldHeader);
+      newMakeHeader(&values[i], &newHeader);
+      struct header_values readValues;
+      if(memcmp(&oldHeader, &newHeader, sizeof(oldHeader)) != 0
+         || !newReadHeader(&newHeader, &readValues)
+         || readValues.mode != values[i].mode
+         || readValues.uid != values[i].uid
+         || readValues.gid != values[i].gid
+         || readValues.size != values[i].size
+         || readValues.modifiedTime != values[i].modifiedTime)
+      {
+         printf("Fatal Error: Header %d differs from the old code's.\n", i);
+         exit(1);
+      }
+   }
+
+   int64_t numbers[] = { 0, 1, 7, 8, 0777777, 01000000, 07777777,
+      077777777777LL, 0100000000000LL, 9LL << 30, 1LL << 62, INT64_MAX,
+      -1, -86400, INT64_MIN };
+   for(size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++) {
+      checkRoundTrip(numbers[i], 12, 11);
+      checkRoundTrip(numbers[i], 8, 6);
+   }
+
+   /* One changed byte must fail the checksum. */
+   struct tar_header_block header;
+   newMakeHeader(&values[0], &header);
+   header.filePath[3] ^= 1;
+   if(tarVerifyChecksum(&header)) {
+      printf("Fatal Error: A corrupt header passed it's checksum.\n");
+      exit(1);
+   }
+}
+
+static void checkRoundTrip(int64_t value, size_t fieldSize, size_t digits) {
+   char field[12];
+   memset(field, 0, sizeof(field));
+   tarPutNumber(field, fieldSize, digits, value);
+   /* 7 bytes of base-256 can't hold the largest. */
+   if(fieldSize == 8 && (value >= 1LL << 55 || value < -(1LL << 55))) return;
+   if(tarGetNumber(field, fieldSize) != value) {
+      printf("Fatal Error: %lld didn't survive a %zu byte field.\n",
+         (long long)value, fieldSize);
+      exit(1);
+   }
+}
+
+/*******************************************************************************
+   oldMakeHeader
+      What backup's makeHeader and setHeaderChecksum did.
+*******************************************************************************/
+static void oldMakeHeader(const struct header_values *values,
+   struct tar_header_block *header)
+{
+   memset(header, '\0', 512);
+   strcpy(header->ustarMagic, "ustar");
+   memset(header->version, '0', 2);
+   strcpy(header->filePath, "d001/d002/f000123");
+   header->type = '0';
+   strcpy(header->ownerName, "root");
+   strcpy(header->groupName, "root");
+
+   sprintf(header->fileMode, "%06o ", values->mode);
+   sprintf(header->ownerId, "%06o ", values->uid);
+   sprintf(header->groupId, "%06o ", values->gid);
+   sprintf(header->fileSize, "%011o", (int)values->size);
+   header->fileSize[11] = ' ';
+   sprintf(header->modifiedTime, "%0lo", (long)values->modifiedTime);
+   header->modifiedTime[11] = ' ';
+
+   memset(header->checksum, ' ', 8);
+   unsigned int checksum = 0;
+   unsigned char *headerBytes = (unsigned char *)header;
+   for(int i = 0; i < 500; i++) {
+      checksum += headerBytes[i];
+   }
+   sprintf(header->checksum, "%06o", checksum);
+   header->checksum[6] = '\0';
+   header->checksum[7] = ' ';
+}
+
+static void oldReadHeader(const struct tar_header_block *header,
+   struct header_values *values)
+{
+   values->mode = oldGetNumber(header->fileMode, 8);
+   values->uid = oldGetNumber(header->ownerId, 8);
+   values->gid = oldGetNumber(header->groupId, 8);
+   values->size = oldGetNumber(header->fileSize, 11);
+   values->modifiedTime = oldGetNumber(header->modifiedTime, 11);
+}
+
+/* What backup's convertOctalStringToUInt did. */
+static unsigned int oldGetNumber(const char *field, unsigned int fieldSize) {
+   unsigned int converted = 0;
+   unsigned int i = 0;
+   while(i < fieldSize && field[i] >= '0' && field[i] <= '7') {
+      converted = (converted << 3) | (unsigned int)(field[i++] - '0');
+   }
+   return converted;
+}
+
+static void newMakeHeader(const struct header_values *values,
+   struct tar_header_block *header)
+{
+   memset(header, '\0', 512);
+   strcpy(header->ustarMagic, "ustar");
+   memset(header->version, '0', 2);
+   strcpy(header->filePath, "d001/d002/f000123");
+   header->type = '0';
+   strcpy(header->ownerName, "root");
+   strcpy(header->groupName, "root");
+
+   tarPutNumber(header->fileMode, 8, 6, values->mode);
+   tarPutNumber(header->ownerId, 8, 6, values->uid);
+   tarPutNumber(header->groupId, 8, 6, values->gid);
+   tarPutNumber(header->fileSize, 12, 11, values->size);
+   tarPutNumber(header->modifiedTime, 12, 11, values->modifiedTime);
+   tarSetChecksum(header);
+}
+
+static void newDecodeHeader(const struct tar_header_block *header,
+   struct header_values *values)
+{
+   values->mode = tarGetNumber(header->fileMode, 8);
+   values->uid = tarGetNumber(header->ownerId, 8);
+   values->gid = tarGetNumber(header->groupId, 8);
+   values->size = tarGetNumber(header->fileSize, 12);
+   values->modifiedTime = tarGetNumber(header->modifiedTime, 12);
+}
+
+/* Returns 0 if the checksum is wrong. */
+static int newReadHeader(const struct tar_header_block *header,
+   struct header_values *values)
+{
+   newDecodeHeader(header, values);
+   return tarVerifyChecksum(header);
+}
+
+static double now() {
+   struct timespec time;
+   clock_gettime(CLOCK_MONOTONIC, &time);
+   return time.tv_sec + time.tv_nsec / 1e9;
+}
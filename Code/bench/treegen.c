@@ -0,0 +1,315 @@
+/*******************************************************************************
+
+   File        : treegen.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Reproducible synthetic folder trees for benchmarking.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   Everything about the tree, the names, sizes, contents, which files are
+   sparse and which are links, comes from a xorshift generator seeded from
+   the options, and every file and folder is given the same modified time,
+   so two trees made with the same options are identical, and so are the
+   archives made from them.
+
+   File contents are drawn from a 64 character alphabet, so they compress
+   to roughly three quarters of their size, rather than not at all.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <ftw.h>
+
+#include "treegen.h"
+
+/* Every entry's modified time, 2020-01-01 00:00:00 UTC. */
+#define TREE_TIMESTAMP 1577836800
+/* Files are written in pieces of this size. */
+#define TREE_WRITE_SIZE (64 * 1024)
+/* The runs of data in each sparse file. */
+#define TREE_SPARSE_RUNS 4
+
+/* Everything needed while a tree is being made. */
+struct generator {
+   const struct tree_options *options;
+   struct tree_summary *summary;
+   unsigned long long state;
+   char **folders;
+   size_t folderCount;
+   size_t foldersMade;
+   /* Regular files made so far, which links can be made to. */
+   char **filePaths;
+   unsigned long fileCount;
+   char *buffer;
+};
+
+static int makeFolders(struct generator *generator, const char* root);
+static int makeFiles(struct generator *generator);
+static unsigned long long nextRandom(unsigned long long *state);
+static off_t pickSize(unsigned long long *state, off_t minSize,
+   off_t maxSize);
+static int writeContent(int fd, unsigned long long *state, off_t offset,
+   off_t length, char *buffer);
+static int setTimestamp(const char* path);
+static int removeEntry(const char* path, const struct stat *status,
+   int flag, struct FTW *walker);
+
+/*******************************************************************************
+   treeGenerate
+      Makes the folders, then the files, spread over them at random.
+*******************************************************************************/
+int treeGenerate(const char* root, const struct tree_options *options,
+   struct tree_summary *summary)
+{
+   memset(summary, 0, sizeof(struct tree_summary));
+   struct generator generator;
+   memset(&generator, 0, sizeof(struct generator));
+   generator.options = options;
+   generator.summary = summary;
+   generator.state = options->seed * 0x9E3779B97F4A7C15ULL + 1;
+
+   /* Folders, level by level, the root first. */
+   generator.folderCount = 1;
+   size_t levelSize = 1;
+   for(int level = 0; level < options->depth; level++) {
+      levelSize *= options->fanout;
+      generator.folderCount += levelSize;
+   }
+   generator.folders = calloc(generator.folderCount, sizeof(char *));
+   generator.filePaths = calloc(options->files > 0 ? options->files : 1,
+      sizeof(char *));
+   generator.buffer = malloc(TREE_WRITE_SIZE);
+
+   int result = -1;
+   if(generator.folders == NULL || generator.filePaths == NULL 
+      || generator.buffer == NULL) 
+   {
+      errno = ENOMEM;
+   } else if(makeFolders(&generator, root) == 0 
+      && makeFiles(&generator) == 0) 
+   {
+      /* Adding files changed the folders' times, so set them last, 
+         deepest first. */
+      result = 0;
+      for(size_t i = generator.folderCount; i > 0 && result == 0; i--) {
+         result = setTimestamp(generator.folders[i - 1]);
+      }
+   }
+
+   for(size_t i = 0; i < generator.foldersMade; i++) {
+      free(generator.folders[i]);
+   }
+   for(unsigned long i = 0; i < generator.fileCount; i++) {
+      free(generator.filePaths[i]);
+   }
+   free(generator.folders);
+   free(generator.filePaths);
+   free(generator.buffer);
+   return result;
+}
+
+/*******************************************************************************
+   makeFolders
+      Makes the root, then each folder's children in turn.
+*******************************************************************************/
+static int makeFolders(struct generator *generator, const char* root) {
+   if(mkdir(root, 0755) != 0) return -1;
+   generator->folders[0] = strdup(root);
+   if(generator->folders[0] == NULL) return -1;
+   generator->foldersMade = 1;
+
+   for(size_t parent = 0; generator->foldersMade < generator->folderCount;
+      parent++)
+   {
+      for(int child = 0; child < generator->options->fanout; child++) {
+         char *folder;
+         if(asprintf(&folder, "%s/d%03d", generator->folders[parent],
+            child) < 0)
+         {
+            errno = ENOMEM;
+            return -1;
+         }
+         generator->folders[generator->foldersMade++] = folder;
+         if(mkdir(folder, 0755) != 0) return -1;
+      }
+   }
+   generator->summary->directories = generator->folderCount - 1;
+   return 0;
+}
+
+/*******************************************************************************
+   makeFiles
+      Makes each file, sparse file or link in a folder picked at random.
+*******************************************************************************/
+static int makeFiles(struct generator *generator) {
+   const struct tree_options *options = generator->options;
+   struct tree_summary *summary = generator->summary;
+   unsigned long long *state = &generator->state;
+
+   for(unsigned long i = 0; i < options->files; i++) {
+      const char *folder 
+         = generator->folders[nextRandom(state) % generator->folderCount];
+      char *path;
+      if(asprintf(&path, "%s/f%06lu", folder, i) < 0) {
+         errno = ENOMEM;
+         return -1;
+      }
+
+      unsigned long long kind = nextRandom(state) % 100;
+      if(generator->fileCount > 0
+         && kind < (unsigned long long)options->linkPercent) 
+      {
+         const char *target 
+            = generator->filePaths[nextRandom(state) % generator->fileCount];
+         struct stat targetStatus;
+         int failed = link(target, path) != 0 
+            || stat(target, &targetStatus) != 0;
+         free(path);
+         if(failed) return -1;
+         summary->links++;
+         summary->files++;
+         summary->bytes += targetStatus.st_size;
+         continue;
+      }
+
+      int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+      if(fd == -1) {
+         free(path);
+         return -1;
+      }
+      int failed = 0;
+      kind = nextRandom(state) % 100;
+      if(kind < (unsigned long long)options->sparsePercent) {
+         /* A few runs of data, at block aligned offsets. */
+         off_t runLength = 64 * 1024;
+         for(int run = 0; run < TREE_SPARSE_RUNS && !failed; run++) {
+            off_t blocks = (options->sparseSize - runLength) / 4096;
+            off_t offset = blocks > 0
+               ? (off_t)(nextRandom(state) % blocks) * 4096 : 0;
+            failed = writeContent(fd, state, offset, runLength, 
+               generator->buffer);
+            summary->dataBytes += runLength;
+         }
+         failed = failed || ftruncate(fd, options->sparseSize) != 0;
+         summary->sparseFiles++;
+         summary->bytes += options->sparseSize;
+      } else {
+         off_t size = pickSize(state, options->minSize, options->maxSize);
+         failed = writeContent(fd, state, 0, size, generator->buffer);
+         summary->bytes += size;
+         summary->dataBytes += size;
+      }
+      if(close(fd) != 0 || failed || setTimestamp(path) != 0) {
+         free(path);
+         return -1;
+      }
+      generator->filePaths[generator->fileCount++] = path;
+      summary->files++;
+   }
+   return 0;
+}
+
+/*******************************************************************************
+   treeRemove
+      Deletes a tree, children before their folders.
+*******************************************************************************/
+int treeRemove(const char* root) {
+   struct stat status;
+   if(lstat(root, &status) != 0) return errno == ENOENT ? 0 : -1;
+   return nftw(root, removeEntry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+static int removeEntry(const char* path, const struct stat *status,
+   int flag, struct FTW *walker)
+{
+   return remove(path);
+}
+
+static unsigned long long nextRandom(unsigned long long *state) {
+   unsigned long long x = *state;
+   x ^= x << 13;
+   x ^= x >> 7;
+   x ^= x << 17;
+   *state = x;
+   return x;
+}
+
+/*******************************************************************************
+   pickSize
+      Picks a power of two between the limits, then a size within it.
+*******************************************************************************/
+static off_t pickSize(unsigned long long *state, off_t minSize,
+   off_t maxSize)
+{
+   if(maxSize <= minSize) return minSize;
+   int lowBit = 0;
+   int highBit = 0;
+   while(((off_t)1 << (lowBit + 1)) <= minSize) lowBit++;
+   while(((off_t)1 << (highBit + 1)) <= maxSize) highBit++;
+
+   int bit = lowBit + nextRandom(state) % (highBit - lowBit + 1);
+   off_t size = ((off_t)1 << bit)
+      + nextRandom(state) % ((unsigned long long)1 << bit);
+   if(size < minSize) size = minSize;
+   if(size > maxSize) size = maxSize;
+   return size;
+}
+
+/*******************************************************************************
+   writeContent
+      Writes length bytes of generated text at offset.
+*******************************************************************************/
+static int writeContent(int fd, unsigned long long *state, off_t offset,
+   off_t length, char *buffer)
+{
+   static const char alphabet[]
+      = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 \n";
+   while(length > 0) {
+      size_t chunk = length < TREE_WRITE_SIZE ? length : TREE_WRITE_SIZE;
+      for(size_t i = 0; i < chunk; i += 8) {
+         unsigned long long bits = nextRandom(state);
+         for(size_t j = i; j < i + 8 && j < chunk; j++) {
+            buffer[j] = alphabet[bits & 63];
+            bits >>= 8;
+         }
+      }
+      size_t written = 0;
+      while(written < chunk) {
+         ssize_t result = pwrite(fd, &buffer[written], chunk - written,
+            offset + written);
+         if(result < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+         }
+         written += result;
+      }
+      offset += chunk;
+      length -= chunk;
+   }
+   return 0;
+}
+
+static int setTimestamp(const char* path) {
+   struct timespec times[2];
+   times[0].tv_sec = TREE_TIMESTAMP;
+   times[0].tv_nsec = 0;
+   times[1] = times[0];
+   return utimensat(AT_FDCWD, path, times, 0);
+}
@@ -0,0 +1,60 @@
+/*******************************************************************************
+
+   File        : treegen.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Reproducible synthetic folder trees for benchmarking.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef TREEGEN_H
+#define TREEGEN_H
+
+#include <sys/types.h>
+
+struct tree_options {
+   /* Entries to create, including hard links. */
+   unsigned long files;
+   /* Levels of folders below the root, and folders in each folder. */
+   int depth;
+   int fanout;
+   /* File sizes are spread evenly over each power of two between these,
+      so most files are small, as in real trees. */
+   off_t minSize;
+   off_t maxSize;
+   /* Percentage of files which are sparse, each sparseSize long with a
+      few small runs of data. */
+   int sparsePercent;
+   off_t sparseSize;
+   /* Percentage of entries which are extra hard links to earlier files. */
+   int linkPercent;
+   /* The same seed always makes the same tree. */
+   unsigned long long seed;
+};
+
+struct tree_summary {
+   unsigned long files;
+   unsigned long directories;
+   unsigned long links;
+   unsigned long sparseFiles;
+   /* The size of every entry added up, as the tools see them. */
+   off_t bytes;
+   /* What's actually stored, once holes and links are left out. */
+   off_t dataBytes;
+};
+
+/* Creates the tree at root, which mustn't exist.
+   Returns -1 with errno set if anything couldn't be created. */
+int treeGenerate(const char* root, const struct tree_options *options,
+   struct tree_summary *summary);
+
+/* Deletes a folder and everything in it. Returns -1 if anything couldn't
+   be deleted. */
+int treeRemove(const char* root);
+
+#endif
@@ -0,0 +1,425 @@
+/*******************************************************************************
+
+   File        : compressor.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Parallel gzip compression of the archive stream, and
+                 transparent decompression when reading it back.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.01 - Stats.
+                 16/10/2026 - v1.02 - Reading from pipes.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   The archive stream is cut into the blocks the archive writer already
+   flushes, and each block is compressed as a complete gzip member of it's
+   own, the same way pigz splits it's input. Members don't depend on each
+   other, so every processor can compress one at once, and gzip, zcat and
+   zlib all read a file of concatenated members as a single stream.
+
+   Submitted blocks sit in a ring of slots. Compression threads take them
+   in the order they were submitted, and a single writer thread writes
+   them out in the same order, so the output is the same whatever the
+   number of threads.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <zlib.h>
+
+#include "compressor.h"
+#include "archiveio.h"
+#include "stats.h"
+
+enum slot_state {
+   SLOT_FREE,
+   SLOT_SUBMITTED,
+   SLOT_COMPRESSING,
+   SLOT_COMPRESSED
+};
+
+struct compressor_slot {
+   enum slot_state state;
+   char *input;
+   size_t inputLength;
+   unsigned char *output;
+   size_t outputLength;
+};
+
+struct compressor {
+   int fd;
+   int level;
+   size_t blockSize;
+   int slotCount;
+   struct compressor_slot *slots;
+
+   pthread_t *threads;
+   int threadCount;
+   pthread_t writer;
+   int writerStarted;
+
+   /* Protects everything below, and the contents of the slots. */
+   pthread_mutex_t lock;
+   pthread_cond_t compressWake;
+   pthread_cond_t writerWake;
+   pthread_cond_t submitWake;
+   /* Block sequence numbers, each block lives in
+      slots[sequence % slotCount]. */
+   long submitted;
+   long nextToCompress;
+   long nextToWrite;
+   int finishing;
+   int failed;
+};
+
+static void *compressThread(void *argument);
+static void *writerThread(void *argument);
+static void freeCompressor(struct compressor *compressor);
+static ssize_t gzipCookieRead(void *cookie, char *buffer, size_t size);
+static int gzipCookieSeek(void *cookie, off64_t *offset, int whence);
+static int gzipCookieClose(void *cookie);
+
+/*******************************************************************************
+   compressorStart
+      Allocates the slots and starts the threads.
+*******************************************************************************/
+struct compressor *compressorStart(int fd, size_t blockSize,
+   const struct compressor_options *options)
+{
+   struct compressor *compressor = calloc(1, sizeof(struct compressor));
+   if(compressor == NULL) return NULL;
+
+   int threadCount = options->threads;
+   if(threadCount < 1) threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+   if(threadCount < 1) threadCount = 1;
+
+   compressor->fd = fd;
+   compressor->level = options->level >= 1 && options->level <= 9
+      ? options->level : Z_DEFAULT_COMPRESSION;
+   compressor->blockSize = blockSize;
+   /* Enough for every thread to be busy while the last blocks are written
+      and the next ones are filled. */
+   compressor->slotCount = threadCount * 2;
+   compressor->slots = calloc(compressor->slotCount,
+      sizeof(struct compressor_slot));
+   compressor->threads = calloc(threadCount, sizeof(pthread_t));
+   if(compressor->slots == NULL || compressor->threads == NULL) {
+      freeCompressor(compressor);
+      return NULL;
+   }
+
+   /* A gzip member never grows by more than deflateBound allows for. */
+   z_stream stream;
+   memset(&stream, 0, sizeof(stream));
+   if(deflateInit2(&stream, compressor->level, Z_DEFLATED, 15 + 16, 8,
+      Z_DEFAULT_STRATEGY) != Z_OK)
+   {
+      freeCompressor(compressor);
+      return NULL;
+   }
+   size_t outputSize = deflateBound(&stream, blockSize);
+   deflateEnd(&stream);
+
+   for(int i = 0; i < compressor->slotCount; i++) {
+      void *input;
+      if(posix_memalign(&input, 4096, blockSize) != 0) {
+         freeCompressor(compressor);
+         return NULL;
+      }
+      compressor->slots[i].input = input;
+      compressor->slots[i].output = malloc(outputSize);
+      if(compressor->slots[i].output == NULL) {
+         freeCompressor(compressor);
+         return NULL;
+      }
+   }
+
+   pthread_mutex_init(&compressor->lock, NULL);
+   pthread_cond_init(&compressor->compressWake, NULL);
+   pthread_cond_init(&compressor->writerWake, NULL);
+   pthread_cond_init(&compressor->submitWake, NULL);
+
+   if(pthread_create(&compressor->writer, NULL, writerThread, compressor)
+      != 0)
+   {
+      freeCompressor(compressor);
+      return NULL;
+   }
+   compressor->writerStarted = 1;
+   for(int i = 0; i < threadCount; i++) {
+      if(pthread_create(&compressor->threads[i], NULL, compressThread,
+         compressor) != 0)
+      {
+         break;
+      }
+      compressor->threadCount++;
+   }
+   if(compressor->threadCount == 0) {
+      compressorFinish(compressor);
+      return NULL;
+   }
+   return compressor;
+}
+
+/*******************************************************************************
+   compressorSubmit
+      Swaps the caller's full buffer for the empty one in the next slot.
+*******************************************************************************/
+int compressorSubmit(struct compressor *compressor, char **buffer,
+   size_t length)
+{
+   pthread_mutex_lock(&compressor->lock);
+   struct compressor_slot *slot
+      = &compressor->slots[compressor->submitted % compressor->slotCount];
+   while(slot->state != SLOT_FREE && !compressor->failed) {
+      pthread_cond_wait(&compressor->submitWake, &compressor->lock);
+   }
+   if(compressor->failed) {
+      pthread_mutex_unlock(&compressor->lock);
+      return -1;
+   }
+
+   char *empty = slot->input;
+   slot->input = *buffer;
+   slot->inputLength = length;
+   slot->state = SLOT_SUBMITTED;
+   *buffer = empty;
+   compressor->submitted++;
+   pthread_cond_signal(&compressor->compressWake);
+   pthread_mutex_unlock(&compressor->lock);
+   return 0;
+}
+
+/*******************************************************************************
+   compressorFinish
+      Waits for the threads to compress and write everything, then frees
+      the compressor.
+*******************************************************************************/
+int compressorFinish(struct compressor *compressor) {
+   pthread_mutex_lock(&compressor->lock);
+   compressor->finishing = 1;
+   pthread_cond_broadcast(&compressor->compressWake);
+   pthread_cond_broadcast(&compressor->writerWake);
+   pthread_mutex_unlock(&compressor->lock);
+
+   for(int i = 0; i < compressor->threadCount; i++) {
+      pthread_join(compressor->threads[i], NULL);
+   }
+   if(compressor->writerStarted) {
+      pthread_join(compressor->writer, NULL);
+   }
+
+   int result = compressor->failed ? -1 : 0;
+   pthread_mutex_destroy(&compressor->lock);
+   pthread_cond_destroy(&compressor->compressWake);
+   pthread_cond_destroy(&compressor->writerWake);
+   pthread_cond_destroy(&compressor->submitWake);
+   freeCompressor(compressor);
+   return result;
+}
+
+/*******************************************************************************
+   compressThread
+      Compresses blocks, in the order they were submitted, each into a
+      gzip member of it's own.
+*******************************************************************************/
+static void *compressThread(void *argument) {
+   struct compressor *compressor = (struct compressor *)argument;
+
+   z_stream stream;
+   memset(&stream, 0, sizeof(stream));
+   int ready = deflateInit2(&stream, compressor->level, Z_DEFLATED,
+      15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+
+   pthread_mutex_lock(&compressor->lock);
+   while(1) {
+      while(compressor->nextToCompress == compressor->submitted
+         && !compressor->finishing && !compressor->failed)
+      {
+         pthread_cond_wait(&compressor->compressWake, &compressor->lock);
+      }
+      if(compressor->failed || !ready
+         || compressor->nextToCompress == compressor->submitted)
+      {
+         break;
+      }
+
+      struct compressor_slot *slot = &compressor->slots[
+         compressor->nextToCompress % compressor->slotCount];
+      compressor->nextToCompress++;
+      slot->state = SLOT_COMPRESSING;
+      pthread_mutex_unlock(&compressor->lock);
+
+      /* The output buffer is always big enough, so one call does it. */
+      uint64_t started = statsStart();
+      deflateReset(&stream);
+      stream.next_in = (unsigned char *)slot->input;
+      stream.avail_in = slot->inputLength;
+      stream.next_out = slot->output;
+      stream.avail_out = deflateBound(&stream, compressor->blockSize);
+      int result = deflate(&stream, Z_FINISH);
+      slot->outputLength = stream.total_out;
+      statsStop(STATS_COMPRESS, started);
+
+      pthread_mutex_lock(&compressor->lock);
+      if(result != Z_STREAM_END) {
+         compressor->failed = 1;
+         pthread_cond_broadcast(&compressor->submitWake);
+         pthread_cond_broadcast(&compressor->compressWake);
+      }
+      slot->state = SLOT_COMPRESSED;
+      pthread_cond_signal(&compressor->writerWake);
+   }
+
+   if(!ready) {
+      compressor->failed = 1;
+      pthread_cond_broadcast(&compressor->submitWake);
+      pthread_cond_broadcast(&compressor->compressWake);
+   }
+   pthread_cond_signal(&compressor->writerWake);
+   pthread_mutex_unlock(&compressor->lock);
+   if(ready) deflateEnd(&stream);
+   return NULL;
+}
+
+/*******************************************************************************
+   writerThread
+      Writes compressed blocks in the order they were submitted.
+*******************************************************************************/
+static void *writerThread(void *argument) {
+   struct compressor *compressor = (struct compressor *)argument;
+
+   pthread_mutex_lock(&compressor->lock);
+   while(1) {
+      struct compressor_slot *slot = &compressor->slots[
+         compressor->nextToWrite % compressor->slotCount];
+      while(!compressor->failed
+         && !(compressor->nextToWrite < compressor->submitted
+            && slot->state == SLOT_COMPRESSED)
+         && !(compressor->finishing
+            && compressor->nextToWrite == compressor->submitted))
+      {
+         pthread_cond_wait(&compressor->writerWake, &compressor->lock);
+      }
+      if(compressor->failed
+         || compressor->nextToWrite == compressor->submitted)
+      {
+         break;
+      }
+      pthread_mutex_unlock(&compressor->lock);
+
+      int written = writeAll(compressor->fd, slot->output,
+         slot->outputLength) == 0;
+
+      pthread_mutex_lock(&compressor->lock);
+      if(!written) {
+         compressor->failed = 1;
+         pthread_cond_broadcast(&compressor->compressWake);
+      }
+      slot->state = SLOT_FREE;
+      compressor->nextToWrite++;
+      pthread_cond_broadcast(&compressor->submitWake);
+   }
+   pthread_mutex_unlock(&compressor->lock);
+   return NULL;
+}
+
+static void freeCompressor(struct compressor *compressor) {
+   if(compressor->slots != NULL) {
+      for(int i = 0; i < compressor->slotCount; i++) {
+         free(compressor->slots[i].input);
+         free(compressor->slots[i].output);
+      }
+   }
+   free(compressor->slots);
+   free(compressor->threads);
+   free(compressor);
+}
+
+/*******************************************************************************
+   compressedOpen
+      Checks for the gzip magic number, and if it's there, puts zlib
+      behind a stdio stream, so the rest of restore doesn't need to know.
+*******************************************************************************/
+FILE *compressedOpen(const char* filePath) {
+   int fd = open(filePath, O_RDONLY);
+   if(fd == -1) return NULL;
+   return compressedOpenDescriptor(fd);
+}
+
+FILE *compressedOpenDescriptor(int fd) {
+   struct stat fileStatus;
+   if(fstat(fd, &fileStatus) == 0 && S_ISREG(fileStatus.st_mode)) {
+      FILE *archiveFile = fdopen(fd, "rb");
+      if(archiveFile == NULL) {
+         close(fd);
+         return NULL;
+      }
+      unsigned char magic[2];
+      int compressed = fread(magic, 2, 1, archiveFile) == 1
+         && magic[0] == 0x1f && magic[1] == 0x8b;
+      rewind(archiveFile);
+      if(!compressed) return archiveFile;
+      fd = dup(fileno(archiveFile));
+      fclose(archiveFile);
+      if(fd == -1) return NULL;
+   }
+
+   gzFile gzipFile = gzdopen(fd, "rb");
+   if(gzipFile == NULL) {
+      close(fd);
+      return NULL;
+   }
+   gzbuffer(gzipFile, 256 * 1024);
+
+   cookie_io_functions_t functions = {
+      .read = gzipCookieRead,
+      .write = NULL,
+      .seek = gzipCookieSeek,
+      .close = gzipCookieClose
+   };
+   FILE *archiveFile = fopencookie(gzipFile, "rb", functions);
+   if(archiveFile == NULL) gzclose(gzipFile);
+   return archiveFile;
+}
+
+static ssize_t gzipCookieRead(void *cookie, char *buffer, size_t size) {
+   int bytesRead = gzread((gzFile)cookie, buffer, size);
+   return bytesRead < 0 ? -1 : bytesRead;
+}
+
+/* zlib can only seek forward by decompressing and throwing the data away,
+   or back by starting again, and doesn't know where the end is. */
+static int gzipCookieSeek(void *cookie, off64_t *offset, int whence) {
+   if(whence == SEEK_END) {
+      errno = ESPIPE;
+      return -1;
+   }
+   z_off_t position = gzseek((gzFile)cookie, *offset, whence);
+   if(position < 0) {
+      errno = EINVAL;
+      return -1;
+   }
+   *offset = position;
+   return 0;
+}
+
+static int gzipCookieClose(void *cookie) {
+   return gzclose((gzFile)cookie) == Z_OK ? 0 : -1;
+}
@@ -0,0 +1,60 @@
+/*******************************************************************************
+
+   File        : compressor.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Parallel gzip compression of the archive stream, and
+                 transparent decompression when reading it back.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.01 - Reading from pipes.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+#include <sys/types.h>
+#include <stdio.h>
+
+struct compressor_options {
+   /* Threads compressing blocks, 0 for one per processor. */
+   int threads;
+   /* zlib compression level, 1 to 9. */
+   int level;
+};
+
+struct compressor;
+
+/* Starts the compression threads, writing to fd. blockSize is the size of
+   the buffers which will be submitted.
+   Returns NULL if the threads or buffers couldn't be created. */
+struct compressor *compressorStart(int fd, size_t blockSize,
+   const struct compressor_options *options);
+
+/* Queues a block of the stream to be compressed. The compressor takes
+   *buffer, which must be page aligned and blockSize long, and replaces it
+   with an empty one. Blocks while every buffer is in use.
+   Returns -1 once anything has gone wrong. */
+int compressorSubmit(struct compressor *compressor, char **buffer,
+   size_t length);
+
+/* Waits for everything submitted to be written, stops the threads and
+   frees the compressor. Returns 0 if everything was written. */
+int compressorFinish(struct compressor *compressor);
+
+/* Opens an archive for reading. If it's gzip compressed, it's decompressed
+   as it's read, and the stream can only seek forward or back to the start.
+   Returns NULL if it can't be opened. */
+FILE *compressedOpen(const char* filePath);
+
+/* The same, for something already open, such as stdin. Pipes can't be
+   rewound after looking for the gzip magic number, so zlib reads them
+   whether they're compressed or not, passing plain archives straight
+   through, and they can't seek at all. Takes over fd. */
+FILE *compressedOpenDescriptor(int fd);
+
+#endif
@@ -0,0 +1,217 @@
+/*******************************************************************************
+
+   File        : contenthash.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Fast 64 bit content hash (XXH64) for backup manifests.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.01 - Throttling.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   This is XXH64, with a seed of 0. It isn't cryptographic, it only needs to
+   tell whether a file's content has changed, and it hashes at close to
+   memory speed, so it doesn't slow down the backup it's part of.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "contenthash.h"
+#include "throttle.h"
+
+#define PRIME1 11400714785074694791ULL
+#define PRIME2 14029467366897019727ULL
+#define PRIME3 1609587929392839161ULL
+#define PRIME4 9650029242287828579ULL
+#define PRIME5 2870177450012600261ULL
+
+static uint64_t rotateLeft(uint64_t value, int bits);
+static uint64_t read64(const unsigned char *bytes);
+static uint32_t read32(const unsigned char *bytes);
+static uint64_t round64(uint64_t accumulator, uint64_t input);
+static uint64_t mergeRound(uint64_t hash, uint64_t accumulator);
+
+/*******************************************************************************
+   contentHashInit
+      Starts a new hash.
+*******************************************************************************/
+void contentHashInit(struct content_hash *hash) {
+   memset(hash, 0, sizeof(struct content_hash));
+   hash->accumulators[0] = PRIME1 + PRIME2;
+   hash->accumulators[1] = PRIME2;
+   hash->accumulators[2] = 0;
+   hash->accumulators[3] = -PRIME1;
+}
+
+/*******************************************************************************
+   contentHashUpdate
+      Adds data to a hash, 32 bytes at a time, keeping any left over until
+      the next call.
+*******************************************************************************/
+void contentHashUpdate(struct content_hash *hash, const void *data,
+   size_t length)
+{
+   const unsigned char *bytes = (const unsigned char *)data;
+   hash->totalLength += length;
+
+   if(hash->pendingLength > 0) {
+      size_t wanted = 32 - hash->pendingLength;
+      if(length < wanted) {
+         memcpy(&hash->pending[hash->pendingLength], bytes, length);
+         hash->pendingLength += length;
+         return;
+      }
+      memcpy(&hash->pending[hash->pendingLength], bytes, wanted);
+      for(int i = 0; i < 4; i++) {
+         hash->accumulators[i] = round64(hash->accumulators[i],
+            read64(&hash->pending[i * 8]));
+      }
+      bytes += wanted;
+      length -= wanted;
+      hash->pendingLength = 0;
+   }
+
+   uint64_t a0 = hash->accumulators[0];
+   uint64_t a1 = hash->accumulators[1];
+   uint64_t a2 = hash->accumulators[2];
+   uint64_t a3 = hash->accumulators[3];
+   while(length >= 32) {
+      a0 = round64(a0, read64(bytes));
+      a1 = round64(a1, read64(bytes + 8));
+      a2 = round64(a2, read64(bytes + 16));
+      a3 = round64(a3, read64(bytes + 24));
+      bytes += 32;
+      length -= 32;
+   }
+   hash->accumulators[0] = a0;
+   hash->accumulators[1] = a1;
+   hash->accumulators[2] = a2;
+   hash->accumulators[3] = a3;
+
+   memcpy(hash->pending, bytes, length);
+   hash->pendingLength = length;
+}
+
+/*******************************************************************************
+   contentHashFinal
+      Returns the hash of everything added so far.
+*******************************************************************************/
+uint64_t contentHashFinal(const struct content_hash *hash) {
+   uint64_t result;
+   if(hash->totalLength >= 32) {
+      result = rotateLeft(hash->accumulators[0], 1)
+         + rotateLeft(hash->accumulators[1], 7)
+         + rotateLeft(hash->accumulators[2], 12)
+         + rotateLeft(hash->accumulators[3], 18);
+      for(int i = 0; i < 4; i++) {
+         result = mergeRound(result, hash->accumulators[i]);
+      }
+   } else {
+      result = PRIME5;
+   }
+   result += hash->totalLength;
+
+   const unsigned char *bytes = hash->pending;
+   size_t length = hash->pendingLength;
+   while(length >= 8) {
+      result ^= round64(0, read64(bytes));
+      result = rotateLeft(result, 27) * PRIME1 + PRIME4;
+      bytes += 8;
+      length -= 8;
+   }
+   if(length >= 4) {
+      result ^= (uint64_t)read32(bytes) * PRIME1;
+      result = rotateLeft(result, 23) * PRIME2 + PRIME3;
+      bytes += 4;
+      length -= 4;
+   }
+   while(length > 0) {
+      result ^= (*bytes) * PRIME5;
+      result = rotateLeft(result, 11) * PRIME1;
+      bytes++;
+      length--;
+   }
+
+   result ^= result >> 33;
+   result *= PRIME2;
+   result ^= result >> 29;
+   result *= PRIME3;
+   result ^= result >> 32;
+   return result;
+}
+
+/*******************************************************************************
+   contentHashFile
+      Reads a file from start to end, and hashes it.
+*******************************************************************************/
+int contentHashFile(const char* path, uint64_t *result) {
+   int fileDescriptor = open(path, O_RDONLY);
+   if(fileDescriptor == -1) return -1;
+
+   struct content_hash hash;
+   contentHashInit(&hash);
+   char buffer[64 * 1024];
+   for(;;) {
+      throttleBytes(sizeof(buffer));
+      uint64_t started = throttleStart();
+      ssize_t bytesRead = read(fileDescriptor, buffer, sizeof(buffer));
+      throttleStop(started);
+      if(bytesRead < 0) {
+         if(errno == EINTR) continue;
+         close(fileDescriptor);
+         return -1;
+      }
+      if(bytesRead == 0) break;
+      contentHashUpdate(&hash, buffer, bytesRead);
+   }
+   close(fileDescriptor);
+   *result = contentHashFinal(&hash);
+   return 0;
+}
+
+static uint64_t rotateLeft(uint64_t value, int bits) {
+   return (value << bits) | (value >> (64 - bits));
+}
+
+/* Little endian loads, done with memcpy so unaligned data is fine. */
+static uint64_t read64(const unsigned char *bytes) {
+   uint64_t value;
+   memcpy(&value, bytes, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+   value = __builtin_bswap64(value);
+#endif
+   return value;
+}
+
+static uint32_t read32(const unsigned char *bytes) {
+   uint32_t value;
+   memcpy(&value, bytes, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+   value = __builtin_bswap32(value);
+#endif
+   return value;
+}
+
+static uint64_t round64(uint64_t accumulator, uint64_t input) {
+   accumulator += input * PRIME2;
+   accumulator = rotateLeft(accumulator, 31);
+   return accumulator * PRIME1;
+}
+
+static uint64_t mergeRound(uint64_t hash, uint64_t accumulator) {
+   hash ^= round64(0, accumulator);
+   return hash * PRIME1 + PRIME4;
+}
@@ -0,0 +1,38 @@
+/*******************************************************************************
+
+   File        : contenthash.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Fast 64 bit content hash (XXH64) for backup manifests.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef CONTENTHASH_H
+#define CONTENTHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Data can be added in pieces of any size, the result is the same as
+   hashing it all at once. */
+struct content_hash {
+   uint64_t accumulators[4];
+   uint64_t totalLength;
+   unsigned char pending[32];
+   size_t pendingLength;
+};
+
+void contentHashInit(struct content_hash *hash);
+void contentHashUpdate(struct content_hash *hash, const void *data,
+   size_t length);
+uint64_t contentHashFinal(const struct content_hash *hash);
+
+/* Hashes a whole file. Returns -1 if it can't be read. */
+int contentHashFile(const char* path, uint64_t *result);
+
+#endif
@@ -0,0 +1,202 @@
+/*******************************************************************************
+
+   File        : idcache.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Cached user and group name lookups, shared by all the tools.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.01 - Stats.
+                 17/10/2026 - v1.02 - Lookups outside the lock.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   getpwuid and getgrgid go through NSS, which can mean a round trip to an
+   LDAP or SSSD server, and every file used to look its owner and group up
+   again. Trees almost always belong to a handful of users, so each id is
+   only ever looked up once, and kept in an open addressing table.
+   Names are never freed, the tables live as long as the program.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <grp.h>
+#include <pwd.h>
+
+#include "idcache.h"
+#include "stats.h"
+
+/* The most a single lookup's buffer is grown to. */
+#define ID_BUFFER_LIMIT (16 * 1024 * 1024)
+
+struct id_entry {
+   unsigned int id;
+   /* NULL for an empty slot. */
+   char *name;
+};
+
+struct id_table {
+   struct id_entry *entries;
+   /* A power of 2. */
+   size_t size;
+   size_t count;
+};
+
+static struct id_table users;
+static struct id_table groups;
+static struct id_cache_stats cacheStats;
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *lookupName(struct id_table *table, unsigned int id,
+   int isGroup);
+static char *askSystem(unsigned int id, int isGroup);
+static struct id_entry *findSlot(struct id_table *table, unsigned int id);
+static int growTable(struct id_table *table);
+
+const char *idCacheUserName(uid_t uid) {
+   return lookupName(&users, uid, 0);
+}
+
+const char *idCacheGroupName(gid_t gid) {
+   return lookupName(&groups, gid, 1);
+}
+
+void idCacheStats(struct id_cache_stats *stats) {
+   pthread_mutex_lock(&cacheLock);
+   *stats = cacheStats;
+   pthread_mutex_unlock(&cacheLock);
+}
+
+/*******************************************************************************
+   lookupName
+      Finds an id in the table, asking the system on the first lookup.
+      The lock isn't held while asking, as that can take a while, so two
+      threads can both ask for a new id, and the first to finish wins.
+*******************************************************************************/
+static const char *lookupName(struct id_table *table, unsigned int id,
+   int isGroup)
+{
+   pthread_mutex_lock(&cacheLock);
+   struct id_entry *entry = table->size > 0 ? findSlot(table, id) : NULL;
+   if(entry != NULL && entry->name != NULL) {
+      cacheStats.hits++;
+      pthread_mutex_unlock(&cacheLock);
+      return entry->name;
+   }
+   cacheStats.misses++;
+   pthread_mutex_unlock(&cacheLock);
+
+   char *name = askSystem(id, isGroup);
+   /* Deleted users still own files, show their id like ls does. */
+   if(name == NULL) {
+      char idString[11];
+      snprintf(idString, sizeof(idString), "%u", id);
+      name = strdup(idString);
+   }
+   if(name == NULL) return "?";
+
+   pthread_mutex_lock(&cacheLock);
+   entry = table->size > 0 ? findSlot(table, id) : NULL;
+   if(entry != NULL && entry->name != NULL) {
+      free(name);
+      name = entry->name;
+   } else if((table->count + 1) * 4 > table->size * 3
+      && growTable(table) != 0)
+   {
+      /* Not kept, so asked for again next time. */
+      free(name);
+      name = "?";
+   } else {
+      entry = findSlot(table, id);
+      entry->id = id;
+      entry->name = name;
+      table->count++;
+   }
+   pthread_mutex_unlock(&cacheLock);
+   return name;
+}
+
+/*******************************************************************************
+   askSystem
+      Looks a name up through NSS, returning a copy, or NULL if there isn't
+      one. The reentrant versions, as other threads might be using the
+      non-reentrant ones' static buffers. A group with a lot of members
+      can need more than the system suggests, so the buffer grows until
+      it's big enough.
+*******************************************************************************/
+static char *askSystem(unsigned int id, int isGroup) {
+   long suggested = sysconf(isGroup ? _SC_GETGR_R_SIZE_MAX
+      : _SC_GETPW_R_SIZE_MAX);
+   size_t bufferSize = suggested > 0 ? (size_t)suggested : 4096;
+   char *buffer = NULL;
+   char *name = NULL;
+   int result = ERANGE;
+   uint64_t started = statsStart();
+   while(result == ERANGE && bufferSize <= ID_BUFFER_LIMIT) {
+      char *grown = realloc(buffer, bufferSize);
+      if(grown == NULL) break;
+      buffer = grown;
+      if(isGroup) {
+         struct group groupEntry;
+         struct group *found = NULL;
+         result = getgrgid_r(id, &groupEntry, buffer, bufferSize, &found);
+         if(result == 0 && found != NULL) name = strdup(found->gr_name);
+      } else {
+         struct passwd passwordEntry;
+         struct passwd *found = NULL;
+         result = getpwuid_r(id, &passwordEntry, buffer, bufferSize, &found);
+         if(result == 0 && found != NULL) name = strdup(found->pw_name);
+      }
+      bufferSize *= 2;
+   }
+   statsStop(STATS_LOOKUP, started);
+   free(buffer);
+   return name;
+}
+
+/*******************************************************************************
+   findSlot
+      The slot holding id, or the empty slot where it belongs.
+*******************************************************************************/
+static struct id_entry *findSlot(struct id_table *table, unsigned int id) {
+   size_t mask = table->size - 1;
+   /* Ids are often small and sequential, so mix them up a little. */
+   size_t slot = (id * 2654435761u) & mask;
+   while(table->entries[slot].name != NULL && table->entries[slot].id != id) {
+      slot = (slot + 1) & mask;
+   }
+   return &table->entries[slot];
+}
+
+/*******************************************************************************
+   growTable
+      Doubles the table, and re-inserts every entry.
+*******************************************************************************/
+static int growTable(struct id_table *table) {
+   struct id_table grown;
+   grown.size = table->size > 0 ? table->size * 2 : 64;
+   grown.count = table->count;
+   grown.entries = calloc(grown.size, sizeof(struct id_entry));
+   if(grown.entries == NULL) return -1;
+
+   for(size_t i = 0; i < table->size; i++) {
+      if(table->entries[i].name == NULL) continue;
+      *findSlot(&grown, table->entries[i].id) = table->entries[i];
+   }
+   free(table->entries);
+   *table = grown;
+   return 0;
+}
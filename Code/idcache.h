@@ -0,0 +1,36 @@
+/*******************************************************************************
+
+   File        : idcache.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Cached user and group name lookups, shared by all the tools.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef IDCACHE_H
+#define IDCACHE_H
+
+#include <sys/types.h>
+
+struct id_cache_stats {
+   /* Lookups answered from the cache. */
+   unsigned long hits;
+   /* Lookups which had to ask the system, one per id, unless several
+      threads ask for a new one at once. */
+   unsigned long misses;
+};
+
+/* The name of a user or group, or the id as a decimal string if it hasn't
+   got one. The string stays valid until the program exits.
+   Safe to call from any thread. */
+const char *idCacheUserName(uid_t uid);
+const char *idCacheGroupName(gid_t gid);
+
+void idCacheStats(struct id_cache_stats *stats);
+
+#endif
@@ -0,0 +1,328 @@
+/*******************************************************************************
+
+   File        : journal.c
+
+   Date        : Friday 16th October 2026
+
+   Description : The journal of changed paths kept by backup --watch, and
+                 taken by the next backup, so it doesn't have to look at
+                 every file to find the few that changed.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   The journal is a file next to the archive, which the watcher adds to, and
+   a backup takes away by renaming it, so the watcher starts a new one the
+   next time it adds to it. Both lock the file while they use it, and the
+   watcher checks the file it locked is still the journal, so nothing is
+   added to a journal after it has been read.
+
+   A backup only trusts a journal if it knows when it started. The watcher
+   can't know that, it may have missed changes before it started, so the
+   first thing it adds is a JOURNAL_LOST record. The backup taking a
+   journal does know, so it starts the new one with a JOURNAL_SINCE record
+   of when it took the old one. Anything it goes on to miss, such as
+   changes made while it's running, is in the new one.
+
+   What's taken is added to <journal>.taken, and only deleted once the
+   archive is written, so a backup which fails leaves it for the next. The
+   journal is renamed to <journal>.taking on the way, and anything left
+   there is picked up the same way.
+
+   Whether a watcher is keeping the journal is told by <journal>.lock,
+   which the watcher holds a lock on for as long as it runs, and which
+   holds the folder it watches. The folder is only written once the watcher
+   is watching everything, and has added it's JOURNAL_LOST record, so a
+   journal left by a watcher which has died is never trusted.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "journal.h"
+#include "archiveio.h"
+
+/* Room for an archive path, and the longest suffix. */
+#define JOURNAL_PATH_LENGTH 4400
+
+static int isWatching(const char* journalPath, const char* rootPath);
+static int foldJournal(const char* fromPath, const char* toPath);
+static int readJournal(const char* path, struct journal *journal);
+
+/*******************************************************************************
+   journalAddRecord
+      Adds a record to the end of those built up so far.
+*******************************************************************************/
+int journalAddRecord(struct journal_records *records, char type,
+   const char* text)
+{
+   size_t textLength = strlen(text) + 1;
+   if(records->length + 1 + textLength > records->capacity) {
+      size_t capacity = records->capacity > 0 ? records->capacity * 2 : 4096;
+      while(capacity < records->length + 1 + textLength) capacity *= 2;
+      char *data = realloc(records->data, capacity);
+      if(data == NULL) return -1;
+      records->data = data;
+      records->capacity = capacity;
+   }
+   records->data[records->length++] = type;
+   memcpy(&records->data[records->length], text, textLength);
+   records->length += textLength;
+   return 0;
+}
+
+void journalFreeRecords(struct journal_records *records) {
+   free(records->data);
+   memset(records, 0, sizeof(struct journal_records));
+}
+
+/*******************************************************************************
+   journalStartWatching
+      Locks the lock file, and empties it. The file descriptor is left open,
+      closing it would let the lock go.
+*******************************************************************************/
+int journalStartWatching(const char* journalPath) {
+   char lockPath[JOURNAL_PATH_LENGTH];
+   snprintf(lockPath, JOURNAL_PATH_LENGTH, "%s.lock", journalPath);
+   int fd = open(lockPath, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+   if(fd == -1) return -1;
+   if(flock(fd, LOCK_EX | LOCK_NB) != 0 || ftruncate(fd, 0) != 0) {
+      int error = errno;
+      close(fd);
+      errno = error;
+      return -1;
+   }
+   return fd;
+}
+
+/*******************************************************************************
+   journalWatching
+      Writes the watched folder into the lock file, which backups compare
+      with the folder they're backing up.
+*******************************************************************************/
+int journalWatching(int lockFd, const char* rootPath) {
+   return writeAll(lockFd, rootPath, strlen(rootPath));
+}
+
+/*******************************************************************************
+   journalLock
+      Tries again if the journal is taken while waiting for the lock.
+*******************************************************************************/
+int journalLock(const char* journalPath, struct stat *fileStatus) {
+   for(;;) {
+      int fd = open(journalPath, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+         0666);
+      if(fd == -1) return -1;
+      if(flock(fd, LOCK_EX) != 0 || fstat(fd, fileStatus) != 0) {
+         int error = errno;
+         close(fd);
+         errno = error;
+         return -1;
+      }
+      struct stat pathStatus;
+      if(stat(journalPath, &pathStatus) == 0
+         && pathStatus.st_ino == fileStatus->st_ino
+         && pathStatus.st_dev == fileStatus->st_dev)
+      {
+         return fd;
+      }
+      close(fd);
+   }
+}
+
+/*******************************************************************************
+   journalUnlock
+      Records only partly written are cut off again, otherwise the next
+      record added would be read as the rest of it. Closing the file lets
+      the lock go.
+*******************************************************************************/
+int journalUnlock(int fd, const struct journal_records *records) {
+   off_t end = lseek(fd, 0, SEEK_END);
+   int result = writeAll(fd, records->data, records->length);
+   if(result != 0 && end != -1 && ftruncate(fd, end) != 0) result = -1;
+   if(close(fd) != 0) result = -1;
+   return result;
+}
+
+/*******************************************************************************
+   journalTake
+      Moves the journal, and anything left by earlier backups, into
+      <journal>.taken, starts the new journal, then reads what was taken.
+*******************************************************************************/
+int journalTake(const char* journalPath, const char* rootPath, time_t now,
+   struct journal *journal)
+{
+   memset(journal, 0, sizeof(struct journal));
+   if(!isWatching(journalPath, rootPath)) return -1;
+
+   char takingPath[JOURNAL_PATH_LENGTH];
+   char takenPath[JOURNAL_PATH_LENGTH];
+   snprintf(takingPath, JOURNAL_PATH_LENGTH, "%s.taking", journalPath);
+   snprintf(takenPath, JOURNAL_PATH_LENGTH, "%s.taken", journalPath);
+   if(foldJournal(takingPath, takenPath) != 0) return -1;
+   if(rename(journalPath, takingPath) != 0 && errno != ENOENT) return -1;
+   if(foldJournal(takingPath, takenPath) != 0) return -1;
+
+   struct journal_records records = { NULL, 0, 0 };
+   char since[24];
+   snprintf(since, 24, "%lld", (long long)now);
+   struct stat fileStatus;
+   int fd = -1;
+   int result = journalAddRecord(&records, JOURNAL_SINCE, since) != 0
+      || (fd = journalLock(journalPath, &fileStatus)) == -1
+      || journalUnlock(fd, &records) != 0 ? -1 : 0;
+   journalFreeRecords(&records);
+   if(result != 0) return -1;
+
+   return readJournal(takenPath, journal);
+}
+
+/*******************************************************************************
+   journalFinish
+      Deletes what was taken.
+*******************************************************************************/
+void journalFinish(const char* journalPath) {
+   char takenPath[JOURNAL_PATH_LENGTH];
+   snprintf(takenPath, JOURNAL_PATH_LENGTH, "%s.taken", journalPath);
+   unlink(takenPath);
+}
+
+void journalFree(struct journal *journal) {
+   free(journal->paths);
+   free(journal->data);
+   memset(journal, 0, sizeof(struct journal));
+}
+
+/*******************************************************************************
+   isWatching
+      A watcher holds an exclusive lock, so a shared lock can only be had if
+      there isn't one.
+*******************************************************************************/
+static int isWatching(const char* journalPath, const char* rootPath) {
+   char lockPath[JOURNAL_PATH_LENGTH];
+   snprintf(lockPath, JOURNAL_PATH_LENGTH, "%s.lock", journalPath);
+   int fd = open(lockPath, O_RDONLY | O_CLOEXEC);
+   if(fd == -1) return 0;
+   if(flock(fd, LOCK_SH | LOCK_NB) == 0) {
+      close(fd);
+      return 0;
+   }
+
+   char watchedPath[JOURNAL_PATH_LENGTH];
+   ssize_t length = read(fd, watchedPath, JOURNAL_PATH_LENGTH - 1);
+   close(fd);
+   if(length <= 0) return 0;
+   watchedPath[length] = '\0';
+   return strcmp(watchedPath, rootPath) == 0;
+}
+
+/*******************************************************************************
+   foldJournal
+      Adds a journal to the end of another, then deletes it. Taking the
+      lock waits for the watcher to finish anything it was adding when the
+      journal was renamed.
+      Returns 0 if there was nothing to add.
+*******************************************************************************/
+static int foldJournal(const char* fromPath, const char* toPath) {
+   int from = open(fromPath, O_RDONLY | O_CLOEXEC);
+   if(from == -1) return errno == ENOENT ? 0 : -1;
+
+   int result = -1;
+   int to = -1;
+   if(flock(from, LOCK_EX) == 0 && (to = open(toPath,
+      O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666)) != -1)
+   {
+      char buffer[65536];
+      ssize_t bytesRead;
+      result = 0;
+      while(result == 0 && (bytesRead = read(from, buffer, 65536)) != 0) {
+         if(bytesRead < 0) {
+            if(errno != EINTR) result = -1;
+            continue;
+         }
+         result = writeAll(to, buffer, bytesRead);
+      }
+      /* The journal is about to be deleted, what it held has to last. */
+      if(result == 0) result = fdatasync(to);
+   }
+   if(to != -1) close(to);
+   close(from);
+   if(result == 0) unlink(fromPath);
+   return result;
+}
+
+/*******************************************************************************
+   readJournal
+      Reads every record. A record cut short, by the watcher being killed
+      part way through writing it, is ignored. A journal which doesn't
+      exist is empty, with no start time.
+*******************************************************************************/
+static int readJournal(const char* path, struct journal *journal) {
+   int fd = open(path, O_RDONLY | O_CLOEXEC);
+   if(fd == -1) return errno == ENOENT ? 0 : -1;
+   struct stat fileStatus;
+   if(fstat(fd, &fileStatus) != 0) {
+      close(fd);
+      return -1;
+   }
+   size_t length = 0;
+   journal->data = malloc(fileStatus.st_size + 1);
+   while(journal->data != NULL && length < (size_t)fileStatus.st_size) {
+      ssize_t bytesRead = read(fd, &journal->data[length],
+         fileStatus.st_size - length);
+      if(bytesRead < 0 && errno == EINTR) continue;
+      if(bytesRead <= 0) break;
+      length += bytesRead;
+   }
+   close(fd);
+   if(journal->data == NULL || length < (size_t)fileStatus.st_size) {
+      journalFree(journal);
+      return -1;
+   }
+
+   size_t capacity = 0;
+   size_t position = 0;
+   while(position < length) {
+      char type = journal->data[position];
+      char *text = &journal->data[position + 1];
+      char *end = memchr(text, '\0', length - position - 1);
+      if(end == NULL) break;
+      position = end - journal->data + 1;
+
+      if(type == JOURNAL_LOST) {
+         journal->lost = 1;
+      } else if(type == JOURNAL_SINCE) {
+         time_t since = strtoll(text, NULL, 10);
+         if(journal->since == 0 || since < journal->since) {
+            journal->since = since;
+         }
+      } else if(type == JOURNAL_PATH) {
+         if(journal->count == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 256;
+            char **paths = realloc(journal->paths, capacity * sizeof(char *));
+            if(paths == NULL) {
+               journalFree(journal);
+               return -1;
+            }
+            journal->paths = paths;
+         }
+         journal->paths[journal->count++] = text;
+      }
+   }
+   return 0;
+}
@@ -0,0 +1,88 @@
+/*******************************************************************************
+
+   File        : journal.h
+
+   Date        : Friday 16th October 2026
+
+   Description : The journal of changed paths kept by backup --watch, and
+                 taken by the next backup, so it doesn't have to look at
+                 every file to find the few that changed.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/* Journals are a list of records, each a type character, then text up to
+   a null. */
+/* A file or folder which changed, relative to the watched folder. */
+#define JOURNAL_PATH 'P'
+/* Changes have been missed, so nothing before it can be trusted. */
+#define JOURNAL_LOST 'L'
+/* Every change from this time on is in the journal, in seconds. */
+#define JOURNAL_SINCE 'S'
+
+/* Records built up to be added to the journal at once. */
+struct journal_records {
+   char *data;
+   size_t length;
+   size_t capacity;
+};
+
+/* What a journal says has changed. */
+struct journal {
+   /* Relative to the watched folder, pointing into data. */
+   char **paths;
+   size_t count;
+   char *data;
+   /* The earliest time every change is recorded from, 0 if unknown. */
+   time_t since;
+   int lost;
+};
+
+/* Returns -1 if out of memory. */
+int journalAddRecord(struct journal_records *records, char type,
+   const char* text);
+
+void journalFreeRecords(struct journal_records *records);
+
+/* Marks the journal as kept by this process. The lock is held until the
+   process exits, but backups won't trust the journal until
+   journalWatching is called. Returns the lock's file descriptor, or -1
+   with errno EWOULDBLOCK if another process already keeps it. */
+int journalStartWatching(const char* journalPath);
+
+/* Tells backups the journal can be trusted, from here on, for changes
+   under rootPath, which has to be an absolute path. */
+int journalWatching(int lockFd, const char* rootPath);
+
+/* Opens the journal to add to, creating it if needed, and locks it, so
+   it isn't taken half written. fileStatus is filled in for the file
+   opened. Returns the file descriptor, or -1 with errno set. */
+int journalLock(const char* journalPath, struct stat *fileStatus);
+
+/* Adds the records to a locked journal, then unlocks and closes it.
+   Returns -1 if they couldn't all be written. */
+int journalUnlock(int fd, const struct journal_records *records);
+
+/* Takes the journal away from the watcher, along with any taken by a
+   backup which didn't finish, and starts a new one from now.
+   Returns -1, and takes nothing, unless a watcher is keeping the journal
+   for rootPath. */
+int journalTake(const char* journalPath, const char* rootPath, time_t now,
+   struct journal *journal);
+
+/* Once everything taken is safely in an archive, forgets it. */
+void journalFinish(const char* journalPath);
+
+void journalFree(struct journal *journal);
+
+#endif
@@ -0,0 +1,179 @@
+/*******************************************************************************
+
+   File        : linktable.c
+
+   Date        : Friday 16th October 2026
+
+   Description : The first path archived for each file with several hard
+                 links, so later paths can be archived as links to it.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 17/10/2026 - v1.01 - Forgetting paths.
+                 17/10/2026 - v1.02 - Pipeline jobs.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   Only files with more than one link are added, so the table stays small
+   for most trees. It's a chained hash table on the device and inode, which
+   doubles once it's three quarters full. It isn't locked, the walker only
+   calls back from one thread at a time.
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "linktable.h"
+
+struct link_table {
+   struct link_target **buckets;
+   size_t bucketCount;
+   size_t count;
+};
+
+static size_t hashInode(uint64_t device, uint64_t inode);
+static int growTable(struct link_table *table);
+
+/*******************************************************************************
+   linkTableCreate
+      Makes an empty table.
+*******************************************************************************/
+struct link_table *linkTableCreate() {
+   struct link_table *table = calloc(1, sizeof(struct link_table));
+   if(table == NULL) return NULL;
+   table->bucketCount = 256;
+   table->buckets = calloc(table->bucketCount, sizeof(struct link_target *));
+   if(table->buckets == NULL) {
+      free(table);
+      return NULL;
+   }
+   return table;
+}
+
+/*******************************************************************************
+   linkTableFind
+      Looks up the path a file was first archived under.
+*******************************************************************************/
+struct link_target *linkTableFind(struct link_table *table, dev_t device,
+   ino_t inode)
+{
+   size_t bucket = hashInode(device, inode) % table->bucketCount;
+   for(struct link_target *target = table->buckets[bucket]; target != NULL;
+      target = target->nextInBucket)
+   {
+      if(target->inode == (uint64_t)inode
+         && target->device == (uint64_t)device)
+      {
+         return target;
+      }
+   }
+   return NULL;
+}
+
+/*******************************************************************************
+   linkTableAdd
+      Records the path a file is being archived under.
+*******************************************************************************/
+struct link_target *linkTableAdd(struct link_table *table, dev_t device,
+   ino_t inode, const char* path)
+{
+   if((table->count + 1) * 4 > table->bucketCount * 3
+      && growTable(table) != 0)
+   {
+      return NULL;
+   }
+
+   struct link_target *target = malloc(sizeof(struct link_target));
+   if(target == NULL) return NULL;
+   target->path = strdup(path);
+   if(target->path == NULL) {
+      free(target);
+      return NULL;
+   }
+   target->device = device;
+   target->inode = inode;
+   target->job = -1;
+
+   size_t bucket = hashInode(device, inode) % table->bucketCount;
+   target->nextInBucket = table->buckets[bucket];
+   table->buckets[bucket] = target;
+   table->count++;
+   return target;
+}
+
+/*******************************************************************************
+   linkTableForget
+      Forgets the file archived under a path. Targets are found by inode,
+      so every one is looked at, which is fine for something so rare.
+*******************************************************************************/
+void linkTableForget(struct link_table *table, const char* path) {
+   for(size_t i = 0; i < table->bucketCount; i++) {
+      struct link_target **link = &table->buckets[i];
+      while(*link != NULL) {
+         struct link_target *target = *link;
+         if(strcmp(target->path, path) == 0) {
+            *link = target->nextInBucket;
+            free(target->path);
+            free(target);
+            table->count--;
+            return;
+         }
+         link = &target->nextInBucket;
+      }
+   }
+}
+
+void linkTableFree(struct link_table *table) {
+   for(size_t i = 0; i < table->bucketCount; i++) {
+      struct link_target *target = table->buckets[i];
+      while(target != NULL) {
+         struct link_target *next = target->nextInBucket;
+         free(target->path);
+         free(target);
+         target = next;
+      }
+   }
+   free(table->buckets);
+   free(table);
+}
+
+/*******************************************************************************
+   hashInode
+      Mixes the device and inode, as inodes are often close together.
+*******************************************************************************/
+static size_t hashInode(uint64_t device, uint64_t inode) {
+   uint64_t hash = (inode ^ (device * 0x9E3779B97F4A7C15ULL))
+      * 0xBF58476D1CE4E5B9ULL;
+   return (size_t)(hash ^ (hash >> 31));
+}
+
+/*******************************************************************************
+   growTable
+      Doubles the number of buckets, moving every target to it's new one.
+*******************************************************************************/
+static int growTable(struct link_table *table) {
+   size_t bucketCount = table->bucketCount * 2;
+   struct link_target **buckets
+      = calloc(bucketCount, sizeof(struct link_target *));
+   if(buckets == NULL) return -1;
+
+   for(size_t i = 0; i < table->bucketCount; i++) {
+      struct link_target *target = table->buckets[i];
+      while(target != NULL) {
+         struct link_target *next = target->nextInBucket;
+         size_t bucket = hashInode(target->device, target->inode)
+            % bucketCount;
+         target->nextInBucket = buckets[bucket];
+         buckets[bucket] = target;
+         target = next;
+      }
+   }
+   free(table->buckets);
+   table->buckets = buckets;
+   table->bucketCount = bucketCount;
+   return 0;
+}
@@ -0,0 +1,54 @@
+/*******************************************************************************
+
+   File        : linktable.h
+
+   Date        : Friday 16th October 2026
+
+   Description : The first path archived for each file with several hard
+                 links, so later paths can be archived as links to it.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 17/10/2026 - v1.01 - Forgetting paths.
+                 17/10/2026 - v1.02 - Pipeline jobs.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef LINKTABLE_H
+#define LINKTABLE_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+struct link_target {
+   uint64_t device;
+   uint64_t inode;
+   /* Relative to the backup folder, as it is in the archive. */
+   char *path;
+   /* The caller's pipeline job archiving it, -1 until set. */
+   long job;
+   struct link_target *nextInBucket;
+};
+
+struct link_table;
+
+/* Returns NULL if out of memory. */
+struct link_table *linkTableCreate();
+
+/* Returns NULL if the file hasn't been added. */
+struct link_target *linkTableFind(struct link_table *table, dev_t device,
+   ino_t inode);
+
+/* Records the path a file was archived under. Targets are never moved once
+   added. Returns NULL if out of memory. */
+struct link_target *linkTableAdd(struct link_table *table, dev_t device,
+   ino_t inode, const char* path);
+
+/* For a file which wasn't archived after all, so later links to it are
+   archived in full instead. */
+void linkTableForget(struct link_table *table, const char* path);
+
+void linkTableFree(struct link_table *table);
+
+#endif
@@ -7,6 +7,11 @@
    Description : Assignment 2 Task 1, ls -l style recursive file list.
    
    History     : 17/12/2018 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.10 - Multi-threaded directory walker.
+                 16/10/2026 - v1.11 - Cached user and group names.
+                 16/10/2026 - v1.12 - Buffered output, and aligned columns.
+                 16/10/2026 - v1.13 - Stats.
+                 16/10/2026 - v1.14 - Exclude rules.
 
    Author      : Alex H. Newark
 
@@ -26,6 +31,11 @@
 #include <ftw.h>
 #include <string.h>
 
+#include "walker.h"
+#include "pathfilter.h"
+#include "listing.h"
+#include "stats.h"
+
 /* The path of a file is an array of characters with a max size of 4096.
    The path always includes the working directory, 
    which doesn't need to be printed.
@@ -39,40 +49,16 @@
    path to be printed, which isn't the end of the world :) */
 
 static short lengthOfWorkingDirectory = 0;
+/* Only regular files are listed, with what a listing line shows. */
+static struct walk_options walkOptions = { 1, 0, WALK_FILES,
+   WALK_MODE | WALK_LINKS | WALK_OWNER | WALK_SIZE | WALK_MODIFIED };
+static struct listing_options listingOptions = { 0, 1 };
+static struct listing *listing = NULL;
+/* -1 without --stats, otherwise whether to print JSON. */
+static int statsJson = -1;
 
 static int printFile(const char* path, const struct stat *fileStat, 
    int flag, struct FTW* fileTreeWalker);
-void getModeString(mode_t mode, char modeStr[]);
-
-void getModeString(mode_t mode, char modeStr[]) {
-
-   /* Allocate a character array (a string) for the permissions string.
-      Strings are null-terminated. A null character has a value of 0.
-      '\0' is a character of value 0.
-      If strings aren't terminated correcvtly, problems can occur.*/
-   modeStr = strcpy(modeStr, "----------\0");
-
-   /* Currently, no directory modes use this function,
-      but I'm going to leave this condition in in case of reuse/expansion.
-      the performance benefit without it is greatly insignificant
-      when considering the time it may take another developer to understamd
-      why this isn't working as they expect in potential future reuse. */
-   if (mode & S_IFDIR) modeStr[0] = 'd';
-   if (mode & S_IRUSR) modeStr[1] = 'r';
-   if (mode & S_IWUSR) modeStr[2] = 'w';
-   if (mode & S_IXUSR) modeStr[3] = 'x';
-   if (mode & S_IRGRP) modeStr[4] = 'r';
-   if (mode & S_IWGRP) modeStr[5] = 'w';
-   if (mode & S_IXGRP) modeStr[6] = 'x';
-   if (mode & S_IROTH) modeStr[7] = 'r';
-   if (mode & S_IWOTH) modeStr[8] = 'w';
-   if (mode & S_IXOTH) modeStr[9] = 'x';
-   /* Interesting note:
-      During development, I tested this on Mac OS for convenience. 
-      Mac OS has extended attributes, 
-      which it displays with an extra mode character, '@'.
-      eg "-rw-r--r--@ 1 alex231  staff  275 16 Dec 17:21 .gitignore" */
-}
 
 int main(int argc, char *argv[])
 {
@@ -84,19 +70,64 @@ int main(int argc, char *argv[])
 
    lengthOfWorkingDirectory = (short)strlen(currentDirectory) + 1;
 
+   /* Parse Arguments */
+   for(int i = 1; i < argc; i++) {
+      if(strcmp(argv[i], "-j") == 0) {
+         //If -j is provided with no thread count...
+         if(argc <= i + 1 || atoi(argv[i + 1]) < 1) {
+            printf("Invalid Arguments: No thread count provided.\n");
+            return 1;
+         }
+         walkOptions.threads = atoi(argv[i + 1]);
+         i++;
+      }
+
+      else if(strcmp(argv[i], "-o") == 0) {
+         walkOptions.ordered = 1;
+      }
+
+      else if(pathFilterIsOption(argv[i])) {
+         if(pathFilterParseOption(&walkOptions.filter, argv[i]) != 0) {
+            return 1;
+         }
+      }
+
+      else if(strcmp(argv[i], "--aligned") == 0) {
+         listingOptions.aligned = 1;
+      }
+
+      else if(strcmp(argv[i], "--stats") == 0
+         || strcmp(argv[i], "--stats=json") == 0) 
+      {
+         statsJson = argv[i][7] == '=';
+         statsEnable();
+      }
+   }
+
    printf("\nSearching for files in:\n");
    printf("%s", currentDirectory);
    printf("\n\n");
 
-   int nfds;
-   nfds = getdtablesize();
-	if (nftw(currentDirectory, printFile, nfds, FTW_F | FTW_D) != 0) {
+   listing = listingStart(STDOUT_FILENO, &listingOptions);
+   if(listing == NULL) {
+      printf("Fatal Error: Out of memory.\n");
+      return 1;
+   }
+
+	if (walkTree(currentDirectory, printFile, &walkOptions) != 0) {
       printf("Fatal Error: something went wrong while looking for files.");
       return 1;
    }
 
+   if(listingFinish(listing) != 0) {
+      printf("Fatal Error: Unable to write the file list.\n");
+      return 1;
+   }
+
    printf("\n");
 
+   if(statsJson != -1) statsReport("listfiles", statsJson);
+
    return EXIT_SUCCESS;
 }
 
@@ -107,33 +138,10 @@ static int printFile(const char* path, const struct stat *fileStat,
       continue looping (skip it). */
    if (!S_ISREG(fileStat->st_mode)) return 0;
 
-   /* As a personal preference, when declaring array pointers, I place the
-      asterisk before the space, and otherwise after. 
-      If contributing to a shared project, I follow the existing  standard, 
-      but here the placement is mixed but consistent. */
-   char modeStr[11];
-   getModeString(fileStat->st_mode, modeStr);
-
-   struct group *fileGroup;
-   fileGroup = getgrgid(fileStat->st_gid);
-
-   struct passwd *fileOwner;
-   fileOwner = getpwuid(fileStat->st_uid);
-
-   char dateString[13];
-   strftime(dateString, 13, "%d %b %R\0", localtime(&(fileStat->st_mtime)));
-
-   /* I'm using fixed column sizes here for convenience.
-      As a future improvement, these column lengths could by dynamic,
-      by looping through files before printing to calculate how many characters
-      the longest field in each column contains. */
-   printf("%s %d %s %6s %7lld %s %s\n", 
-      modeStr, 
-      fileStat->st_nlink, 
-      fileOwner->pw_name, fileGroup->gr_name, 
-      fileStat->st_size, 
-      dateString, 
-      &path[lengthOfWorkingDirectory]);
+   /* Lines are formatted straight into the listing's buffer, see
+      listing.c. */
+   statsAdd(STATS_FILES, 1);
+   listingAdd(listing, &path[lengthOfWorkingDirectory], fileStat);
    
    return 0;
 }
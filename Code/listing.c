@@ -0,0 +1,379 @@
+/*******************************************************************************
+
+   File        : listing.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Buffered ls -l style output for listfiles and backupfiles.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.01 - Stats.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   Listing a large tree used to cost a printf per file, and most of the time
+   went on parsing the format string, and on strftime. Here every field is
+   formatted by hand, straight into a large buffer, which is only written out
+   when it's full.
+
+   By default lines are written as they're found, with the same fixed widths
+   printf used. In aligned mode, entries are collected into an array of small
+   records and a pool of paths, and once everything is found, the widest 
+   value of each column is worked out and the lines are written to fit,
+   as ls does.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include "listing.h"
+#include "idcache.h"
+#include "stats.h"
+
+#define LISTING_BUFFER_SIZE (1024 * 1024)
+
+/* An entry kept for aligned mode. */
+struct listing_entry {
+   mode_t mode;
+   uid_t uid;
+   gid_t gid;
+   nlink_t linkCount;
+   off_t size;
+   time_t modifiedTime;
+   /* Where the path starts in the path pool. */
+   size_t path;
+};
+
+struct listing {
+   int fd;
+   struct listing_options options;
+   char *buffer;
+   size_t used;
+   int failed;
+
+   /* The last time formatted, to the minute, which most neighbouring
+      files share. */
+   time_t cachedMinute;
+   char cachedDate[12];
+
+   struct listing_entry *entries;
+   size_t count;
+   size_t capacity;
+   char *paths;
+   size_t pathsUsed;
+   size_t pathsCapacity;
+};
+
+static const char months[12][4] = {
+   "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+   "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static void writeLine(struct listing *listing, const char* path,
+   mode_t mode, nlink_t linkCount, const char* ownerName, 
+   const char* groupName, off_t size, time_t modifiedTime,
+   const int widths[4]);
+static void reserve(struct listing *listing, size_t length);
+static void flushBuffer(struct listing *listing);
+static char *putMode(char *out, mode_t mode);
+static char *putText(char *out, const char* text, size_t length, int width,
+   int leftAligned);
+static char *putNumber(char *out, unsigned long long value, int width);
+static int numberWidth(unsigned long long value);
+static char *putDate(struct listing *listing, char *out, time_t time);
+
+/*******************************************************************************
+   listingStart
+      Allocates the output buffer.
+*******************************************************************************/
+struct listing *listingStart(int fd, const struct listing_options *options) {
+   struct listing *listing = calloc(1, sizeof(struct listing));
+   if(listing == NULL) return NULL;
+   listing->buffer = malloc(LISTING_BUFFER_SIZE);
+   if(listing->buffer == NULL) {
+      free(listing);
+      return NULL;
+   }
+   listing->fd = fd;
+   listing->options = *options;
+   listing->cachedMinute = -1;
+   fflush(stdout);
+   return listing;
+}
+
+/*******************************************************************************
+   listingAdd
+      Writes a file's line, or keeps it for later in aligned mode.
+*******************************************************************************/
+int listingAdd(struct listing *listing, const char* path,
+   const struct stat *fileStatus)
+{
+   if(listing->failed) return -1;
+   if(!listing->options.aligned) {
+      /* The widths printf used to be given. */
+      static const int fixedWidths[4] = { 0, 0, 6, 7 };
+      writeLine(listing, path, fileStatus->st_mode, fileStatus->st_nlink,
+         idCacheUserName(fileStatus->st_uid), 
+         idCacheGroupName(fileStatus->st_gid),
+         fileStatus->st_size, fileStatus->st_mtime, fixedWidths);
+      return listing->failed ? -1 : 0;
+   }
+
+   size_t pathLength = strlen(path) + 1;
+   if(listing->count == listing->capacity) {
+      size_t capacity = listing->capacity > 0 ? listing->capacity * 2 : 4096;
+      struct listing_entry *entries = realloc(listing->entries,
+         capacity * sizeof(struct listing_entry));
+      if(entries == NULL) {
+         listing->failed = 1;
+         return -1;
+      }
+      listing->entries = entries;
+      listing->capacity = capacity;
+   }
+   if(listing->pathsUsed + pathLength > listing->pathsCapacity) {
+      size_t capacity = listing->pathsCapacity > 0 
+         ? listing->pathsCapacity * 2 : 256 * 1024;
+      while(capacity < listing->pathsUsed + pathLength) capacity *= 2;
+      char *paths = realloc(listing->paths, capacity);
+      if(paths == NULL) {
+         listing->failed = 1;
+         return -1;
+      }
+      listing->paths = paths;
+      listing->pathsCapacity = capacity;
+   }
+
+   struct listing_entry *entry = &listing->entries[listing->count++];
+   entry->mode = fileStatus->st_mode;
+   entry->uid = fileStatus->st_uid;
+   entry->gid = fileStatus->st_gid;
+   entry->linkCount = fileStatus->st_nlink;
+   entry->size = fileStatus->st_size;
+   entry->modifiedTime = fileStatus->st_mtime;
+   entry->path = listing->pathsUsed;
+   memcpy(&listing->paths[listing->pathsUsed], path, pathLength);
+   listing->pathsUsed += pathLength;
+   return 0;
+}
+
+/*******************************************************************************
+   listingFinish
+      In aligned mode, measures every column, then writes the lines.
+*******************************************************************************/
+int listingFinish(struct listing *listing) {
+   if(listing->options.aligned) {
+      int widths[4] = { 0, 0, 0, 0 };
+      for(size_t i = 0; i < listing->count; i++) {
+         struct listing_entry *entry = &listing->entries[i];
+         int width = numberWidth(entry->linkCount);
+         if(width > widths[0]) widths[0] = width;
+         width = strlen(idCacheUserName(entry->uid));
+         if(width > widths[1]) widths[1] = width;
+         width = strlen(idCacheGroupName(entry->gid));
+         if(width > widths[2]) widths[2] = width;
+         width = numberWidth(entry->size);
+         if(width > widths[3]) widths[3] = width;
+      }
+      /* Names line up on the left, numbers on the right. */
+      widths[1] = -widths[1];
+      widths[2] = -widths[2];
+
+      for(size_t i = 0; i < listing->count; i++) {
+         struct listing_entry *entry = &listing->entries[i];
+         writeLine(listing, &listing->paths[entry->path], entry->mode,
+            entry->linkCount, idCacheUserName(entry->uid),
+            idCacheGroupName(entry->gid), entry->size, entry->modifiedTime,
+            widths);
+      }
+   }
+   flushBuffer(listing);
+
+   int result = listing->failed ? -1 : 0;
+   free(listing->entries);
+   free(listing->paths);
+   free(listing->buffer);
+   free(listing);
+   return result;
+}
+
+/*******************************************************************************
+   writeLine
+      Formats a line into the buffer, the same as
+      "%s %<w0>d %<w1>s %<w2>s %<w3>lld %s %s\n" would, where a negative 
+      width lines up on the left.
+*******************************************************************************/
+static void writeLine(struct listing *listing, const char* path,
+   mode_t mode, nlink_t linkCount, const char* ownerName, 
+   const char* groupName, off_t size, time_t modifiedTime,
+   const int widths[4])
+{
+   size_t ownerLength = strlen(ownerName);
+   size_t groupLength = strlen(groupName);
+   size_t pathLength = strlen(path);
+   /* Mode, date, spaces and numbers are never longer than this. */
+   reserve(listing, 96 + ownerLength + groupLength + pathLength
+      + abs(widths[1]) + abs(widths[2]));
+   if(listing->failed) return;
+
+   /* Timed after reserve, which may write the buffer out. */
+   uint64_t started = statsStart();
+   char *out = &listing->buffer[listing->used];
+   out = putMode(out, mode);
+   *out++ = ' ';
+   out = putNumber(out, linkCount, widths[0]);
+   *out++ = ' ';
+   out = putText(out, ownerName, ownerLength, abs(widths[1]), widths[1] < 0);
+   *out++ = ' ';
+   out = putText(out, groupName, groupLength, abs(widths[2]), widths[2] < 0);
+   *out++ = ' ';
+   out = putNumber(out, size < 0 ? 0 : size, widths[3]);
+   *out++ = ' ';
+   out = putDate(listing, out, modifiedTime);
+   *out++ = ' ';
+   memcpy(out, path, pathLength);
+   out += pathLength;
+   *out++ = '\n';
+   listing->used = out - listing->buffer;
+   statsStop(STATS_FORMAT, started);
+}
+
+/*******************************************************************************
+   reserve
+      Makes sure there's room for length bytes in the buffer.
+      Lines longer than the whole buffer get one to themselves.
+*******************************************************************************/
+static void reserve(struct listing *listing, size_t length) {
+   if(listing->used + length <= LISTING_BUFFER_SIZE) return;
+   flushBuffer(listing);
+   if(length <= LISTING_BUFFER_SIZE) return;
+   char *buffer = realloc(listing->buffer, length);
+   if(buffer == NULL) {
+      listing->failed = 1;
+      return;
+   }
+   listing->buffer = buffer;
+}
+
+static void flushBuffer(struct listing *listing) {
+   const char *data = listing->buffer;
+   size_t length = listing->used;
+   while(length > 0 && !listing->failed) {
+      uint64_t started = statsStart();
+      ssize_t written = write(listing->fd, data, length);
+      statsStop(STATS_WRITE, started);
+      if(written < 0) {
+         if(errno == EINTR) continue;
+         listing->failed = 1;
+         break;
+      }
+      statsAdd(STATS_BYTES_WRITTEN, written);
+      data += written;
+      length -= written;
+   }
+   listing->used = 0;
+}
+
+/*******************************************************************************
+   putMode
+      The same as getModeString, without the string copying.
+*******************************************************************************/
+static char *putMode(char *out, mode_t mode) {
+   out[0] = S_ISDIR(mode) ? 'd' : '-';
+   out[1] = mode & S_IRUSR ? 'r' : '-';
+   out[2] = mode & S_IWUSR ? 'w' : '-';
+   out[3] = mode & S_IXUSR ? 'x' : '-';
+   out[4] = mode & S_IRGRP ? 'r' : '-';
+   out[5] = mode & S_IWGRP ? 'w' : '-';
+   out[6] = mode & S_IXGRP ? 'x' : '-';
+   out[7] = mode & S_IROTH ? 'r' : '-';
+   out[8] = mode & S_IWOTH ? 'w' : '-';
+   out[9] = mode & S_IXOTH ? 'x' : '-';
+   return &out[10];
+}
+
+static char *putText(char *out, const char* text, size_t length, int width,
+   int leftAligned)
+{
+   int padding = width > (int)length ? width - (int)length : 0;
+   if(!leftAligned) {
+      memset(out, ' ', padding);
+      out += padding;
+   }
+   memcpy(out, text, length);
+   out += length;
+   if(leftAligned) {
+      memset(out, ' ', padding);
+      out += padding;
+   }
+   return out;
+}
+
+/*******************************************************************************
+   putNumber
+      Writes a decimal number, right aligned to width.
+*******************************************************************************/
+static char *putNumber(char *out, unsigned long long value, int width) {
+   char digits[20];
+   int count = 0;
+   do {
+      digits[count++] = '0' + value % 10;
+      value /= 10;
+   } while(value > 0);
+
+   for(int i = count; i < width; i++) *out++ = ' ';
+   while(count > 0) *out++ = digits[--count];
+   return out;
+}
+
+static int numberWidth(unsigned long long value) {
+   int width = 1;
+   while(value >= 10) {
+      value /= 10;
+      width++;
+   }
+   return width;
+}
+
+/*******************************************************************************
+   putDate
+      Writes a time as "%d %b %R" would, 12 characters.
+*******************************************************************************/
+static char *putDate(struct listing *listing, char *out, time_t time) {
+   time_t minute = time >= 0 ? time / 60 : (time - 59) / 60;
+   if(minute != listing->cachedMinute) {
+      struct tm brokenDown;
+      if(listing->options.localTime) {
+         localtime_r(&time, &brokenDown);
+      } else {
+         gmtime_r(&time, &brokenDown);
+      }
+      char *date = listing->cachedDate;
+      date[0] = '0' + brokenDown.tm_mday / 10;
+      date[1] = '0' + brokenDown.tm_mday % 10;
+      date[2] = ' ';
+      memcpy(&date[3], months[brokenDown.tm_mon], 3);
+      date[6] = ' ';
+      date[7] = '0' + brokenDown.tm_hour / 10;
+      date[8] = '0' + brokenDown.tm_hour % 10;
+      date[9] = ':';
+      date[10] = '0' + brokenDown.tm_min / 10;
+      date[11] = '0' + brokenDown.tm_min % 10;
+      listing->cachedMinute = minute;
+   }
+   memcpy(out, listing->cachedDate, 12);
+   return &out[12];
+}
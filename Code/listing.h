@@ -0,0 +1,44 @@
+/*******************************************************************************
+
+   File        : listing.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Buffered ls -l style output for listfiles and backupfiles.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+struct listing_options {
+   /* Collect every entry first, and size the columns to fit, rather than
+      writing each line as it's found with fixed widths. */
+   int aligned;
+   /* Show times in the local time zone, rather than UTC. */
+   int localTime;
+};
+
+struct listing;
+
+/* Returns NULL if out of memory. Anything already printed to stdout is
+   flushed first, as the listing writes straight to the file descriptor. */
+struct listing *listingStart(int fd, const struct listing_options *options);
+
+/* Adds a file to the listing. Not thread safe, the walker only runs one
+   callback at a time. */
+int listingAdd(struct listing *listing, const char* path,
+   const struct stat *fileStatus);
+
+/* Writes anything left, and frees the listing. Returns 0 if everything
+   was written. */
+int listingFinish(struct listing *listing);
+
+#endif
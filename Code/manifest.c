@@ -0,0 +1,345 @@
+/*******************************************************************************
+
+   File        : manifest.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Backup manifests, a record of every file in a backed up
+                 tree, used to work out what has really changed since.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 17/10/2026 - v1.01 - Removing records.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   File layout, all numbers are little endian:
+      8 bytes  MANIFEST_MAGIC
+      8 bytes  number of records
+   Then for each record:
+      8 bytes  device
+      8 bytes  inode
+      8 bytes  size
+      8 bytes  modified time
+      8 bytes  content hash
+      2 bytes  path length
+      n bytes  path, not null terminated
+
+   Records are kept in fixed size chunks, so adding one never moves the
+   others, and looked up by path through an open addressing hash table.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "manifest.h"
+
+#define MANIFEST_CHUNK_SIZE 4096
+#define MANIFEST_RECORD_SIZE 42
+
+struct manifest {
+   struct manifest_record **chunks;
+   size_t chunkCount;
+   size_t count;
+   /* Open addressing table of records, a power of 2 in size. */
+   struct manifest_record **table;
+   size_t tableSize;
+};
+
+static uint64_t hashPath(const char* path);
+static int insertIntoTable(struct manifest *manifest,
+   struct manifest_record *record);
+static int growTable(struct manifest *manifest);
+static void putUInt64(unsigned char *bytes, uint64_t value);
+static uint64_t getUInt64(const unsigned char *bytes);
+
+/*******************************************************************************
+   manifestCreate
+      Creates an empty manifest.
+*******************************************************************************/
+struct manifest *manifestCreate() {
+   return calloc(1, sizeof(struct manifest));
+}
+
+/*******************************************************************************
+   manifestAdd
+      Adds a record for a file.
+*******************************************************************************/
+struct manifest_record *manifestAdd(struct manifest *manifest,
+   const char* path, const struct stat *fileStatus, uint64_t hash)
+{
+   if(manifest->count == manifest->chunkCount * MANIFEST_CHUNK_SIZE) {
+      struct manifest_record **chunks = realloc(manifest->chunks,
+         (manifest->chunkCount + 1) * sizeof(struct manifest_record *));
+      if(chunks == NULL) return NULL;
+      manifest->chunks = chunks;
+      chunks[manifest->chunkCount] = malloc(MANIFEST_CHUNK_SIZE
+         * sizeof(struct manifest_record));
+      if(chunks[manifest->chunkCount] == NULL) return NULL;
+      manifest->chunkCount++;
+   }
+   if((manifest->count + 1) * 4 > manifest->tableSize * 3
+      && growTable(manifest) != 0)
+   {
+      return NULL;
+   }
+
+   struct manifest_record *record
+      = &manifest->chunks[manifest->count / MANIFEST_CHUNK_SIZE]
+         [manifest->count % MANIFEST_CHUNK_SIZE];
+   record->path = strdup(path);
+   if(record->path == NULL) return NULL;
+   record->device = fileStatus->st_dev;
+   record->inode = fileStatus->st_ino;
+   record->size = fileStatus->st_size;
+   record->modifiedTime = fileStatus->st_mtime;
+   record->hash = hash;
+   record->seen = 0;
+   manifest->count++;
+
+   insertIntoTable(manifest, record);
+   return record;
+}
+
+/*******************************************************************************
+   manifestFind
+      Looks up a file's record by path, NULL if it isn't there.
+*******************************************************************************/
+struct manifest_record *manifestFind(struct manifest *manifest,
+   const char* path)
+{
+   if(manifest->tableSize == 0) return NULL;
+   size_t mask = manifest->tableSize - 1;
+   for(size_t slot = hashPath(path) & mask; manifest->table[slot] != NULL;
+      slot = (slot + 1) & mask)
+   {
+      if(strcmp(manifest->table[slot]->path, path) == 0) {
+         return manifest->table[slot];
+      }
+   }
+   return NULL;
+}
+
+/*******************************************************************************
+   manifestRemove
+      Removes a file's record, if it's there. The last record is moved into
+      it's place, and the records after it in the table put back, so none
+      are left behind the gap.
+*******************************************************************************/
+void manifestRemove(struct manifest *manifest, const char* path) {
+   if(manifest->tableSize == 0) return;
+   size_t mask = manifest->tableSize - 1;
+   size_t slot = hashPath(path) & mask;
+   while(manifest->table[slot] != NULL
+      && strcmp(manifest->table[slot]->path, path) != 0)
+   {
+      slot = (slot + 1) & mask;
+   }
+   struct manifest_record *record = manifest->table[slot];
+   if(record == NULL) return;
+
+   manifest->table[slot] = NULL;
+   for(slot = (slot + 1) & mask; manifest->table[slot] != NULL;
+      slot = (slot + 1) & mask)
+   {
+      struct manifest_record *moved = manifest->table[slot];
+      manifest->table[slot] = NULL;
+      insertIntoTable(manifest, moved);
+   }
+
+   free(record->path);
+   struct manifest_record *last = manifestRecord(manifest, manifest->count - 1);
+   if(last != record) {
+      slot = hashPath(last->path) & mask;
+      while(manifest->table[slot] != last) slot = (slot + 1) & mask;
+      *record = *last;
+      manifest->table[slot] = record;
+   }
+   manifest->count--;
+}
+
+size_t manifestCount(const struct manifest *manifest) {
+   return manifest->count;
+}
+
+struct manifest_record *manifestRecord(const struct manifest *manifest,
+   size_t recordIndex)
+{
+   return &manifest->chunks[recordIndex / MANIFEST_CHUNK_SIZE]
+      [recordIndex % MANIFEST_CHUNK_SIZE];
+}
+
+/*******************************************************************************
+   manifestLoad
+      Reads a manifest written by manifestSave.
+*******************************************************************************/
+struct manifest *manifestLoad(const char* filePath) {
+   FILE *manifestFile = fopen(filePath, "rb");
+   if(manifestFile == NULL) return NULL;
+
+   unsigned char header[16];
+   if(fread(header, 16, 1, manifestFile) != 1
+      || memcmp(header, MANIFEST_MAGIC, 8) != 0)
+   {
+      fclose(manifestFile);
+      return NULL;
+   }
+   uint64_t count = getUInt64(&header[8]);
+
+   struct manifest *manifest = manifestCreate();
+   if(manifest == NULL) {
+      fclose(manifestFile);
+      return NULL;
+   }
+
+   unsigned char record[MANIFEST_RECORD_SIZE];
+   char path[65536];
+   for(uint64_t i = 0; i < count; i++) {
+      if(fread(record, MANIFEST_RECORD_SIZE, 1, manifestFile) != 1) break;
+      size_t pathLength = record[40] | (record[41] << 8);
+      if(fread(path, 1, pathLength, manifestFile) != pathLength) break;
+      path[pathLength] = '\0';
+
+      struct stat fileStatus;
+      memset(&fileStatus, 0, sizeof(fileStatus));
+      fileStatus.st_dev = getUInt64(&record[0]);
+      fileStatus.st_ino = getUInt64(&record[8]);
+      fileStatus.st_size = getUInt64(&record[16]);
+      fileStatus.st_mtime = (int64_t)getUInt64(&record[24]);
+      if(manifestAdd(manifest, path, &fileStatus,
+         getUInt64(&record[32])) == NULL)
+      {
+         break;
+      }
+   }
+   fclose(manifestFile);
+
+   if(manifest->count != count) {
+      manifestFree(manifest);
+      return NULL;
+   }
+   return manifest;
+}
+
+/*******************************************************************************
+   manifestSave
+      Writes a manifest to a file.
+*******************************************************************************/
+int manifestSave(const struct manifest *manifest, const char* filePath) {
+   FILE *manifestFile = fopen(filePath, "wb");
+   if(manifestFile == NULL) return -1;
+
+   unsigned char header[16];
+   memcpy(header, MANIFEST_MAGIC, 8);
+   putUInt64(&header[8], manifest->count);
+   int result = fwrite(header, 16, 1, manifestFile) == 1 ? 0 : -1;
+
+   unsigned char record[MANIFEST_RECORD_SIZE];
+   for(size_t i = 0; result == 0 && i < manifest->count; i++) {
+      const struct manifest_record *entry = manifestRecord(manifest, i);
+      size_t pathLength = strlen(entry->path);
+      if(pathLength > UINT16_MAX) {
+         result = -1;
+         break;
+      }
+      putUInt64(&record[0], entry->device);
+      putUInt64(&record[8], entry->inode);
+      putUInt64(&record[16], entry->size);
+      putUInt64(&record[24], (uint64_t)entry->modifiedTime);
+      putUInt64(&record[32], entry->hash);
+      record[40] = pathLength & 0xff;
+      record[41] = (pathLength >> 8) & 0xff;
+      if(fwrite(record, MANIFEST_RECORD_SIZE, 1, manifestFile) != 1
+         || fwrite(entry->path, 1, pathLength, manifestFile) != pathLength)
+      {
+         result = -1;
+      }
+   }
+
+   if(fclose(manifestFile) != 0) result = -1;
+   return result;
+}
+
+/*******************************************************************************
+   manifestFree
+      Frees a manifest and all of it's records.
+*******************************************************************************/
+void manifestFree(struct manifest *manifest) {
+   for(size_t i = 0; i < manifest->count; i++) {
+      free(manifestRecord(manifest, i)->path);
+   }
+   for(size_t i = 0; i < manifest->chunkCount; i++) {
+      free(manifest->chunks[i]);
+   }
+   free(manifest->chunks);
+   free(manifest->table);
+   free(manifest);
+}
+
+/*******************************************************************************
+   hashPath
+      FNV-1a, good enough for spreading paths around the table.
+*******************************************************************************/
+static uint64_t hashPath(const char* path) {
+   uint64_t hash = 14695981039346656037ULL;
+   for(const unsigned char *byte = (const unsigned char *)path; *byte;
+      byte++)
+   {
+      hash ^= *byte;
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+static int insertIntoTable(struct manifest *manifest,
+   struct manifest_record *record)
+{
+   size_t mask = manifest->tableSize - 1;
+   size_t slot = hashPath(record->path) & mask;
+   while(manifest->table[slot] != NULL) slot = (slot + 1) & mask;
+   manifest->table[slot] = record;
+   return 0;
+}
+
+/*******************************************************************************
+   growTable
+      Doubles the table, and re-inserts every record.
+*******************************************************************************/
+static int growTable(struct manifest *manifest) {
+   size_t tableSize = manifest->tableSize > 0 ? manifest->tableSize * 2 : 1024;
+   struct manifest_record **table
+      = calloc(tableSize, sizeof(struct manifest_record *));
+   if(table == NULL) return -1;
+
+   free(manifest->table);
+   manifest->table = table;
+   manifest->tableSize = tableSize;
+   for(size_t i = 0; i < manifest->count; i++) {
+      insertIntoTable(manifest, manifestRecord(manifest, i));
+   }
+   return 0;
+}
+
+static void putUInt64(unsigned char *bytes, uint64_t value) {
+   for(int i = 0; i < 8; i++) {
+      bytes[i] = (value >> (i * 8)) & 0xff;
+   }
+}
+
+static uint64_t getUInt64(const unsigned char *bytes) {
+   uint64_t value = 0;
+   for(int i = 7; i >= 0; i--) {
+      value = (value << 8) | bytes[i];
+   }
+   return value;
+}
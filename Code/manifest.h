@@ -0,0 +1,59 @@
+/*******************************************************************************
+
+   File        : manifest.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Backup manifests, a record of every file in a backed up
+                 tree, used to work out what has really changed since.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 17/10/2026 - v1.01 - Removing records.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
+#define MANIFEST_MAGIC "BKUPMAN1"
+
+struct manifest_record {
+   char *path;
+   uint64_t device;
+   uint64_t inode;
+   uint64_t size;
+   int64_t modifiedTime;
+   uint64_t hash;
+   /* Set when the file is found again while diffing a later run. */
+   int seen;
+};
+
+struct manifest;
+
+struct manifest *manifestCreate();
+/* Returns NULL if the file doesn't exist or isn't a manifest. */
+struct manifest *manifestLoad(const char* filePath);
+int manifestSave(const struct manifest *manifest, const char* filePath);
+void manifestFree(struct manifest *manifest);
+
+/* Records are only moved by manifestRemove, so the returned pointer stays
+   valid until the manifest is freed, or a record removed. Returns NULL if
+   out of memory. */
+struct manifest_record *manifestAdd(struct manifest *manifest,
+   const char* path, const struct stat *fileStatus, uint64_t hash);
+struct manifest_record *manifestFind(struct manifest *manifest,
+   const char* path);
+/* Moves the last record into the removed one's place. */
+void manifestRemove(struct manifest *manifest, const char* path);
+
+size_t manifestCount(const struct manifest *manifest);
+struct manifest_record *manifestRecord(const struct manifest *manifest,
+   size_t recordIndex);
+
+#endif
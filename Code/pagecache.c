@@ -0,0 +1,153 @@
+/*******************************************************************************
+
+   File        : pagecache.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Reading files for backup without filling the page cache
+                 with them.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   A backup reads everything once, and never again, but the kernel keeps
+   it all cached anyway, pushing out whatever the machine was actually
+   using. With CACHE_DROP, the kernel is told the file will be read from
+   start to end, for more read-ahead, and once it has been, to drop it.
+   Files which already had pages cached are left as they are, as something
+   else is using them, and dropping them would cost that a trip to the
+   disk. cachestat tells us that in one system call, on kernels that have
+   it, older ones drop everything.
+
+   With CACHE_DIRECT, reads skip the cache altogether, which also saves
+   copying the data out of it. O_DIRECT reads have to be aligned, which the
+   pipeline's buffers are, and only the last read of a file needs rounding
+   up. File systems without O_DIRECT refuse the open, and get CACHE_DROP
+   instead.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "pagecache.h"
+#include "stats.h"
+
+/* Not in older headers, it's the same number on every architecture. */
+#ifndef __NR_cachestat
+#define __NR_cachestat 451
+#endif
+
+struct cachestat_range {
+   uint64_t offset;
+   uint64_t length;
+};
+
+struct cachestat {
+   uint64_t cached;
+   uint64_t dirty;
+   uint64_t writeback;
+   uint64_t evicted;
+   uint64_t recentlyEvicted;
+};
+
+static int isCached(int fd);
+
+/*******************************************************************************
+   cacheOpen
+      Opens a file to read, falling back to an ordinary open where O_DIRECT
+      isn't supported.
+*******************************************************************************/
+int cacheOpen(struct cached_file *file, const char* path,
+   enum cache_mode mode)
+{
+   int direct = mode == CACHE_DIRECT;
+   int fd = open(path, cacheOpenFlags(mode));
+   if(fd == -1 && direct && errno == EINVAL) {
+      direct = 0;
+      fd = open(path, O_RDONLY);
+   }
+   if(fd == -1) return -1;
+   cacheAdopt(file, fd, mode, direct);
+   return fd;
+}
+
+/*******************************************************************************
+   cacheAdopt
+      Checks whether a file is already cached, before reading it changes
+      that.
+*******************************************************************************/
+void cacheAdopt(struct cached_file *file, int fd, enum cache_mode mode,
+   int direct)
+{
+   file->fd = fd;
+   file->mode = mode;
+   file->direct = direct;
+   file->wasCached = 0;
+   if(mode == CACHE_NORMAL || direct) return;
+   file->wasCached = isCached(fd);
+   posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+int cacheOpenFlags(enum cache_mode mode) {
+   return mode == CACHE_DIRECT ? O_RDONLY | O_DIRECT : O_RDONLY;
+}
+
+size_t cacheReadLength(const struct cached_file *file, size_t length) {
+   if(!file->direct) return length;
+   return (length + CACHE_DIRECT_ALIGNMENT - 1)
+      & ~(size_t)(CACHE_DIRECT_ALIGNMENT - 1);
+}
+
+/*******************************************************************************
+   cacheStopDirect
+      Reads from here on go through the cache, and are dropped after.
+*******************************************************************************/
+int cacheStopDirect(struct cached_file *file) {
+   if(!file->direct) return 0;
+   int flags = fcntl(file->fd, F_GETFL);
+   if(flags == -1 || fcntl(file->fd, F_SETFL, flags & ~O_DIRECT) != 0) {
+      return -1;
+   }
+   cacheAdopt(file, file->fd, file->mode, 0);
+   return 0;
+}
+
+/*******************************************************************************
+   cacheFinish
+      Drops a file once it has been read. Dirty pages can't be dropped, but
+      the file was only read, so there shouldn't be any.
+*******************************************************************************/
+void cacheFinish(struct cached_file *file, off_t length) {
+   if(file->mode == CACHE_NORMAL || length <= 0) return;
+   if(!file->direct) {
+      if(file->wasCached) return;
+      posix_fadvise(file->fd, 0, 0, POSIX_FADV_DONTNEED);
+   }
+   statsAdd(STATS_BYTES_UNCACHED, length);
+}
+
+/* Whether any of the file is in the cache. Without cachestat, the answer is
+   always no. */
+static int isCached(int fd) {
+   static int supported = 1;
+   if(!supported) return 0;
+   struct cachestat_range range = { 0, 0 };
+   struct cachestat status;
+   if(syscall(__NR_cachestat, fd, &range, &status, 0) != 0) {
+      if(errno == ENOSYS) supported = 0;
+      return 0;
+   }
+   return status.cached > 0;
+}
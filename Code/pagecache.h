@@ -0,0 +1,74 @@
+/*******************************************************************************
+
+   File        : pagecache.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Reading files for backup without filling the page cache
+                 with them.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include <sys/types.h>
+
+/* How reading and writing treats the page cache. */
+enum cache_mode {
+   /* Everything read or written stays cached, as the kernel likes. */
+   CACHE_NORMAL,
+   /* Files are read sequentially, then dropped from the cache, unless
+      they were already in it. */
+   CACHE_DROP,
+   /* Files are read with O_DIRECT, bypassing the cache, where the file
+      system allows it, and dropped as with CACHE_DROP where it doesn't. */
+   CACHE_DIRECT
+};
+
+/* O_DIRECT needs buffers, offsets and lengths aligned to the device's
+   block size. A page covers any block size in use. */
+#define CACHE_DIRECT_ALIGNMENT 4096
+
+/* A file being read for backup. */
+struct cached_file {
+   int fd;
+   enum cache_mode mode;
+   /* Opened with O_DIRECT. */
+   int direct;
+   /* Some of the file was already cached before it was read, so whoever
+      put it there is probably using it, and it's left alone. */
+   int wasCached;
+};
+
+/* Opens path to read. With CACHE_DIRECT, tries O_DIRECT first.
+   Returns the file descriptor, or -1 with errno set. */
+int cacheOpen(struct cached_file *file, const char* path,
+   enum cache_mode mode);
+
+/* The same, for a file opened elsewhere, such as through io_uring, with
+   direct set if it was opened with O_DIRECT. */
+void cacheAdopt(struct cached_file *file, int fd, enum cache_mode mode,
+   int direct);
+
+/* The flags to open a file with, to read it with this mode. */
+int cacheOpenFlags(enum cache_mode mode);
+
+/* How much to ask for to read length bytes. Direct reads are rounded up to
+   a whole block, so there must be room for that after the buffer, and
+   anything read past length ignored. */
+size_t cacheReadLength(const struct cached_file *file, size_t length);
+
+/* Turns O_DIRECT off, for a read the kernel refused, or one which can't be
+   aligned. Returns -1 if it couldn't be turned off. */
+int cacheStopDirect(struct cached_file *file);
+
+/* Drops the file from the cache, unless it was there already, and counts
+   the length read as kept out of the cache. Doesn't close the file. */
+void cacheFinish(struct cached_file *file, off_t length);
+
+#endif
@@ -0,0 +1,597 @@
+/*******************************************************************************
+
+   File        : pathfilter.c
+
+   Date        : Friday 16th October 2026
+
+   Description : --exclude and --include rules, compiled once, and checked by
+                 the walker before it stats or reads anything.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 17/10/2026 - v1.01 - ** only skips whole folders.
+                 17/10/2026 - v1.02 - Parsing the options.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   Every entry the walker finds is checked, so it has to be cheap, and it
+   mustn't get slower the more rules there are, as exclude files collected
+   over the years tend to be long.
+
+   Most rules are plain names or paths, without any wildcards, and those go
+   in one of two tries, one for names, and one for whole paths. Looking an
+   entry up walks it's name, then it's path, through them once, however
+   many rules there are, and usually falls off within a character or two.
+   Each node keeps the first rule ending there, so the order still holds.
+
+   The rest are compiled to a list of tokens, and run as a little automaton,
+   following every position the pattern could have reached at once, rather
+   than backtracking, so no pattern can take longer than it's length times
+   the path's. Only the globs which come before whatever the tries matched
+   need trying at all.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "pathfilter.h"
+
+/* Patterns are limited to this many characters, so the automaton's states
+   fit on the stack. */
+#define PATH_FILTER_MAX_TOKENS 1024
+#define EXCLUDE_OPTION "--exclude="
+#define INCLUDE_OPTION "--include="
+#define EXCLUDE_FROM_OPTION "--exclude-from="
+/* The automaton's states, see globMatches. */
+#define STATE_ENTERED 1
+#define STATE_INSIDE 2
+
+enum token_type {
+   TOKEN_CHARACTER,
+   /* ? */
+   TOKEN_ANY,
+   /* [...] */
+   TOKEN_SET,
+   /* *, which doesn't cross a '/'. */
+   TOKEN_STAR,
+   /* **, which does. */
+   TOKEN_ANYTHING,
+   /* **, followed by '/', as a whole folder name, which matches nothing, or
+      anything ending with a '/'. Matching nothing is only possible where
+      it starts, not part way through a name. */
+   TOKEN_FOLDERS
+};
+
+struct glob_token {
+   unsigned char type;
+   unsigned char character;
+   /* TOKEN_SET only, a bit for each character. */
+   unsigned char set[32];
+};
+
+struct filter_rule {
+   int include;
+   int directoryOnly;
+   /* Matched against the whole path, rather than the name. */
+   int anchored;
+   /* Only globs have tokens, the rest are in a trie. */
+   struct glob_token *tokens;
+   int tokenCount;
+};
+
+struct trie_node {
+   unsigned char character;
+   /* Index of the first child, and of the next node with the same parent.
+      The root is node 0, which is never anyone's child, so 0 is none. */
+   int child;
+   int sibling;
+   /* The first rule ending here, for any entry, and for folders only,
+      -1 for none. */
+   int rule;
+   int directoryRule;
+};
+
+struct trie {
+   struct trie_node *nodes;
+   int count;
+   int capacity;
+};
+
+struct path_filter {
+   struct filter_rule *rules;
+   int ruleCount;
+   int ruleCapacity;
+   struct trie names;
+   struct trie paths;
+   /* The glob rules, by index, in order. */
+   int *globs;
+   int globCount;
+};
+
+static int excludes(const struct path_filter *filter, const char* path,
+   int length, int isDirectory);
+static int compilePattern(const char* pattern, int length,
+   struct glob_token *tokens);
+static int compileSet(const char* pattern, int start, int length,
+   struct glob_token *token);
+static int globMatches(const struct filter_rule *rule, const char* text,
+   int length);
+static void followEmpty(const struct filter_rule *rule, char *states);
+static int trieStart(struct trie *trie);
+static int trieAdd(struct trie *trie, const char* key, int length, int rule,
+   int directoryOnly);
+static int trieFind(const struct trie *trie, const char* key, int length,
+   int isDirectory);
+
+/*******************************************************************************
+   pathFilterCreate
+      Makes a filter without any rules, which excludes nothing.
+*******************************************************************************/
+struct path_filter *pathFilterCreate() {
+   struct path_filter *filter = calloc(1, sizeof(struct path_filter));
+   if(filter == NULL) return NULL;
+   if(trieStart(&filter->names) != 0 || trieStart(&filter->paths) != 0) {
+      pathFilterFree(filter);
+      return NULL;
+   }
+   return filter;
+}
+
+/*******************************************************************************
+   pathFilterAdd
+      Compiles a pattern, adding it to a trie if it turns out not to have
+      any wildcards.
+*******************************************************************************/
+int pathFilterAdd(struct path_filter *filter, const char* pattern,
+   int include)
+{
+   int length = strlen(pattern);
+   int directoryOnly = 0;
+   while(length > 0 && pattern[length - 1] == '/') {
+      length--;
+      directoryOnly = 1;
+   }
+   int start = 0;
+   int anchored = 0;
+   while(start < length && pattern[start] == '/') {
+      start++;
+      anchored = 1;
+   }
+   length -= start;
+   pattern += start;
+   if(length < 1 || length > PATH_FILTER_MAX_TOKENS) return -1;
+   if(memchr(pattern, '/', length) != NULL) anchored = 1;
+
+   if(filter->ruleCount == filter->ruleCapacity) {
+      int capacity = filter->ruleCapacity > 0 ? filter->ruleCapacity * 2 : 16;
+      struct filter_rule *rules
+         = realloc(filter->rules, capacity * sizeof(struct filter_rule));
+      if(rules == NULL) return -1;
+      filter->rules = rules;
+      int *globs = realloc(filter->globs, capacity * sizeof(int));
+      if(globs == NULL) return -1;
+      filter->globs = globs;
+      filter->ruleCapacity = capacity;
+   }
+
+   struct glob_token *tokens = malloc(length * sizeof(struct glob_token));
+   if(tokens == NULL) return -1;
+   int tokenCount = compilePattern(pattern, length, tokens);
+
+   int index = filter->ruleCount;
+   struct filter_rule *rule = &filter->rules[index];
+   rule->include = include;
+   rule->directoryOnly = directoryOnly;
+   rule->anchored = anchored;
+   rule->tokens = NULL;
+   rule->tokenCount = 0;
+
+   int literal = 1;
+   for(int i = 0; literal && i < tokenCount; i++) {
+      literal = tokens[i].type == TOKEN_CHARACTER;
+   }
+   if(literal) {
+      /* Escapes are gone, so the key can be shorter than the pattern. */
+      char key[PATH_FILTER_MAX_TOKENS];
+      for(int i = 0; i < tokenCount; i++) key[i] = tokens[i].character;
+      free(tokens);
+      if(trieAdd(anchored ? &filter->paths : &filter->names, key, tokenCount,
+         index, directoryOnly) != 0)
+      {
+         return -1;
+      }
+   } else {
+      rule->tokens = tokens;
+      rule->tokenCount = tokenCount;
+      filter->globs[filter->globCount++] = index;
+   }
+   filter->ruleCount++;
+   return 0;
+}
+
+/*******************************************************************************
+   pathFilterAddFile
+      Adds a rule for each line of a file.
+*******************************************************************************/
+int pathFilterAddFile(struct path_filter *filter, const char* path) {
+   FILE *file = fopen(path, "r");
+   if(file == NULL) return -1;
+
+   char *line = NULL;
+   size_t lineCapacity = 0;
+   ssize_t length;
+   int result = 0;
+   while(result == 0 && (length = getline(&line, &lineCapacity, file)) >= 0)
+   {
+      while(length > 0
+         && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+      {
+         line[--length] = '\0';
+      }
+      if(length == 0 || line[0] == '#') continue;
+
+      int include = 0;
+      const char *pattern = line;
+      if(length > 1 && (line[0] == '+' || line[0] == '-') && line[1] == ' ')
+      {
+         include = line[0] == '+';
+         pattern = &line[2];
+      }
+      result = pathFilterAdd(filter, pattern, include);
+   }
+   if(ferror(file)) result = -1;
+   free(line);
+   fclose(file);
+   return result;
+}
+
+int pathFilterExcludes(const struct path_filter *filter,
+   const char* relativePath, int isDirectory)
+{
+   return excludes(filter, relativePath, strlen(relativePath), isDirectory);
+}
+
+/*******************************************************************************
+   pathFilterExcludesPath
+      Checks each folder on the way to the path, as the walker would have
+      on it's way down, then the path itself.
+*******************************************************************************/
+int pathFilterExcludesPath(const struct path_filter *filter,
+   const char* relativePath, int isDirectory)
+{
+   int length = strlen(relativePath);
+   for(int i = 1; i < length; i++) {
+      if(relativePath[i] == '/' && excludes(filter, relativePath, i, 1)) {
+         return 1;
+      }
+   }
+   return excludes(filter, relativePath, length, isDirectory);
+}
+
+void pathFilterFree(struct path_filter *filter) {
+   for(int i = 0; i < filter->ruleCount; i++) free(filter->rules[i].tokens);
+   free(filter->rules);
+   free(filter->globs);
+   free(filter->names.nodes);
+   free(filter->paths.nodes);
+   free(filter);
+}
+
+int pathFilterIsOption(const char* argument) {
+   return strncmp(argument, EXCLUDE_OPTION, strlen(EXCLUDE_OPTION)) == 0
+      || strncmp(argument, INCLUDE_OPTION, strlen(INCLUDE_OPTION)) == 0
+      || strncmp(argument, EXCLUDE_FROM_OPTION,
+         strlen(EXCLUDE_FROM_OPTION)) == 0;
+}
+
+/*******************************************************************************
+   pathFilterParseOption
+      Adds whatever an option gives. The filter is only made once there's
+      a rule, so without any, the walker doesn't check anything.
+*******************************************************************************/
+int pathFilterParseOption(struct path_filter **filter, const char* argument) {
+   if(*filter == NULL && (*filter = pathFilterCreate()) == NULL) {
+      printf("Fatal Error: Out of memory.\n");
+      return -1;
+   }
+
+   if(strncmp(argument, EXCLUDE_FROM_OPTION,
+      strlen(EXCLUDE_FROM_OPTION)) == 0)
+   {
+      const char *path = &argument[strlen(EXCLUDE_FROM_OPTION)];
+      if(pathFilterAddFile(*filter, path) != 0) {
+         printf("Invalid Arguments: Unable to read exclude rules from:\n"
+               "\"%s\"\n", path);
+         return -1;
+      }
+      return 0;
+   }
+
+   int include = strncmp(argument, INCLUDE_OPTION,
+      strlen(INCLUDE_OPTION)) == 0;
+   const char *pattern = &argument[include ? strlen(INCLUDE_OPTION)
+      : strlen(EXCLUDE_OPTION)];
+   if(pathFilterAdd(*filter, pattern, include) != 0) {
+      printf("Invalid Arguments: Invalid pattern \"%s\".\n", pattern);
+      return -1;
+   }
+   return 0;
+}
+
+/*******************************************************************************
+   excludes
+      Finds the first rule matching the first length characters of path,
+      which needn't be terminated there.
+*******************************************************************************/
+static int excludes(const struct path_filter *filter, const char* path,
+   int length, int isDirectory)
+{
+   if(length < 1) return 0;
+   int nameStart = length;
+   while(nameStart > 0 && path[nameStart - 1] != '/') nameStart--;
+   const char *name = &path[nameStart];
+   int nameLength = length - nameStart;
+
+   int first = trieFind(&filter->names, name, nameLength, isDirectory);
+   int pathRule = trieFind(&filter->paths, path, length, isDirectory);
+   if(pathRule < first) first = pathRule;
+
+   for(int i = 0; i < filter->globCount && filter->globs[i] < first; i++) {
+      const struct filter_rule *rule = &filter->rules[filter->globs[i]];
+      if(rule->directoryOnly && !isDirectory) continue;
+      if(rule->anchored ? globMatches(rule, path, length)
+         : globMatches(rule, name, nameLength))
+      {
+         first = filter->globs[i];
+      }
+   }
+   return first != INT_MAX && !filter->rules[first].include;
+}
+
+/*******************************************************************************
+   compilePattern
+      Turns a pattern into tokens, returning how many. There's never more
+      than one per character.
+*******************************************************************************/
+static int compilePattern(const char* pattern, int length,
+   struct glob_token *tokens)
+{
+   int count = 0;
+   for(int i = 0; i < length; i++) {
+      struct glob_token *token = &tokens[count++];
+      memset(token, 0, sizeof(struct glob_token));
+      int end;
+      if(pattern[i] == '\\' && i + 1 < length) {
+         token->type = TOKEN_CHARACTER;
+         token->character = pattern[++i];
+      } else if(pattern[i] == '?') {
+         token->type = TOKEN_ANY;
+      } else if(pattern[i] == '*') {
+         int first = i;
+         while(i + 1 < length && pattern[i + 1] == '*') i++;
+         if(i == first) {
+            token->type = TOKEN_STAR;
+         } else if((first == 0 || pattern[first - 1] == '/')
+            && i + 1 < length && pattern[i + 1] == '/')
+         {
+            token->type = TOKEN_FOLDERS;
+            i++;
+         } else {
+            token->type = TOKEN_ANYTHING;
+         }
+      } else if(pattern[i] == '['
+         && (end = compileSet(pattern, i, length, token)) != i)
+      {
+         i = end;
+      } else {
+         token->type = TOKEN_CHARACTER;
+         token->character = pattern[i];
+      }
+   }
+   return count;
+}
+
+/*******************************************************************************
+   compileSet
+      Compiles the set starting at pattern[start], returning where it ends,
+      or start if it's never closed, in which case the '[' is just a
+      character.
+*******************************************************************************/
+static int compileSet(const char* pattern, int start, int length,
+   struct glob_token *token)
+{
+   int i = start + 1;
+   int negated = i < length && (pattern[i] == '!' || pattern[i] == '^');
+   if(negated) i++;
+   /* A ']' straight after the '[' is part of the set. */
+   int first = i;
+   while(i < length && (i == first || pattern[i] != ']')) {
+      unsigned char low = pattern[i];
+      if(low == '\\' && i + 1 < length) low = pattern[++i];
+      unsigned char high = low;
+      if(i + 2 < length && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+         high = pattern[i + 2];
+         i += 2;
+      }
+      for(int character = low; character <= high; character++) {
+         token->set[character / 8] |= 1 << (character % 8);
+      }
+      i++;
+   }
+   if(i >= length) {
+      memset(token->set, 0, sizeof(token->set));
+      return start;
+   }
+   if(negated) {
+      for(int j = 0; j < 32; j++) token->set[j] = ~token->set[j];
+   }
+   token->type = TOKEN_SET;
+   return i;
+}
+
+/*******************************************************************************
+   globMatches
+      Runs the rule's tokens over the text. states[n] is set while the
+      pattern could have matched up to token n, and it matches if the last
+      one is reached once the text runs out. A state is STATE_ENTERED when
+      token n is yet to match anything, and STATE_INSIDE when a star has
+      matched part of the text, and carries on matching.
+*******************************************************************************/
+static int globMatches(const struct filter_rule *rule, const char* text,
+   int length)
+{
+   char states[2][PATH_FILTER_MAX_TOKENS + 1];
+   char *current = states[0];
+   char *next = states[1];
+   int count = rule->tokenCount;
+   memset(current, 0, count + 1);
+   current[0] = STATE_ENTERED;
+   followEmpty(rule, current);
+
+   for(int i = 0; i < length; i++) {
+      unsigned char character = text[i];
+      int separator = character == '/';
+      int alive = 0;
+      memset(next, 0, count + 1);
+      for(int j = 0; j < count; j++) {
+         if(!current[j]) continue;
+         const struct glob_token *token = &rule->tokens[j];
+         int advance = 0;
+         int stay = 0;
+         if(token->type == TOKEN_CHARACTER) {
+            advance = character == token->character;
+         } else if(token->type == TOKEN_ANY) {
+            advance = !separator;
+         } else if(token->type == TOKEN_SET) {
+            advance = !separator
+               && (token->set[character / 8] & (1 << (character % 8)));
+         } else if(token->type == TOKEN_STAR) {
+            stay = !separator;
+         } else if(token->type == TOKEN_ANYTHING) {
+            stay = 1;
+         } else {
+            stay = 1;
+            advance = separator;
+         }
+         if(stay) {
+            next[j] |= STATE_INSIDE;
+            alive = 1;
+         }
+         if(advance) {
+            next[j + 1] |= STATE_ENTERED;
+            alive = 1;
+         }
+      }
+      if(!alive) return 0;
+      followEmpty(rule, next);
+      char *swap = current;
+      current = next;
+      next = swap;
+   }
+   return current[count] != 0;
+}
+
+/*******************************************************************************
+   followEmpty
+      Stars can match nothing, so whatever reaches one also reaches the
+      token after it. In order, so runs of them are followed too. Folders
+      can only match nothing where they start, right after a '/', or at the
+      start of the text, otherwise "**", "/" and "b" would match "xb".
+*******************************************************************************/
+static void followEmpty(const struct filter_rule *rule, char *states) {
+   for(int j = 0; j < rule->tokenCount; j++) {
+      int type = rule->tokens[j].type;
+      if(type == TOKEN_FOLDERS ? (states[j] & STATE_ENTERED)
+         : states[j] && type >= TOKEN_STAR)
+      {
+         states[j + 1] |= STATE_ENTERED;
+      }
+   }
+}
+
+static int trieStart(struct trie *trie) {
+   trie->nodes = calloc(16, sizeof(struct trie_node));
+   if(trie->nodes == NULL) return -1;
+   trie->capacity = 16;
+   trie->count = 1;
+   trie->nodes[0].rule = -1;
+   trie->nodes[0].directoryRule = -1;
+   return 0;
+}
+
+/*******************************************************************************
+   trieAdd
+      Adds a key, keeping the first rule to end at each node, as a later
+      one could never be the first to match.
+*******************************************************************************/
+static int trieAdd(struct trie *trie, const char* key, int length, int rule,
+   int directoryOnly)
+{
+   int node = 0;
+   for(int i = 0; i < length; i++) {
+      int child = trie->nodes[node].child;
+      while(child != 0 && trie->nodes[child].character
+         != (unsigned char)key[i])
+      {
+         child = trie->nodes[child].sibling;
+      }
+      if(child == 0) {
+         if(trie->count == trie->capacity) {
+            struct trie_node *nodes = realloc(trie->nodes,
+               trie->capacity * 2 * sizeof(struct trie_node));
+            if(nodes == NULL) return -1;
+            trie->nodes = nodes;
+            trie->capacity *= 2;
+         }
+         child = trie->count++;
+         struct trie_node *added = &trie->nodes[child];
+         added->character = key[i];
+         added->child = 0;
+         added->sibling = trie->nodes[node].child;
+         added->rule = -1;
+         added->directoryRule = -1;
+         trie->nodes[node].child = child;
+      }
+      node = child;
+   }
+   int *ending = directoryOnly ? &trie->nodes[node].directoryRule
+      : &trie->nodes[node].rule;
+   if(*ending == -1) *ending = rule;
+   return 0;
+}
+
+/*******************************************************************************
+   trieFind
+      The first rule for exactly this key, or INT_MAX if there isn't one.
+*******************************************************************************/
+static int trieFind(const struct trie *trie, const char* key, int length,
+   int isDirectory)
+{
+   int node = 0;
+   for(int i = 0; i < length; i++) {
+      int child = trie->nodes[node].child;
+      while(child != 0 && trie->nodes[child].character
+         != (unsigned char)key[i])
+      {
+         child = trie->nodes[child].sibling;
+      }
+      if(child == 0) return INT_MAX;
+      node = child;
+   }
+   int rule = trie->nodes[node].rule;
+   int directoryRule = trie->nodes[node].directoryRule;
+   if(isDirectory && directoryRule != -1
+      && (rule == -1 || directoryRule < rule))
+   {
+      rule = directoryRule;
+   }
+   return rule == -1 ? INT_MAX : rule;
+}
@@ -0,0 +1,70 @@
+/*******************************************************************************
+
+   File        : pathfilter.h
+
+   Date        : Friday 16th October 2026
+
+   Description : --exclude and --include rules, compiled once, and checked by
+                 the walker before it stats or reads anything.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 17/10/2026 - v1.01 - Parsing the options.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef PATHFILTER_H
+#define PATHFILTER_H
+
+/* Rules are checked in the order they were added, and the first to match
+   a path decides whether it's excluded. Paths no rule matches are kept.
+
+   A rule without a '/' in it, other than at the end, matches the name of
+   an entry at any depth, so "node_modules" or "*.log". Anything else is
+   matched against the whole path, relative to the folder being walked,
+   with or without a leading '/', so "/build" is only the top level one.
+   A rule ending in '/' only matches folders.
+
+   *     anything, other than a '/'
+   ?     any one character, other than a '/'
+   [a-z] any one character in the set, [!a-z] or [^a-z] any other
+   **    anything at all, '/' included. As a whole folder name it also
+         matches no folders, so a rule of "a", "**" and "b", joined with
+         '/'s, matches "a/b" as well as "a/x/y/b".
+   \     the next character, as it is
+
+   A folder which is excluded isn't read at all, so nothing under it can be
+   included again. */
+
+struct path_filter;
+
+/* Returns NULL if out of memory. */
+struct path_filter *pathFilterCreate();
+/* Returns -1 if the pattern is empty, or too long. */
+int pathFilterAdd(struct path_filter *filter, const char* pattern,
+   int include);
+/* Adds a rule for each line of a file, skipping blank lines, and those
+   starting with '#'. Lines starting "+ " are include rules, anything else
+   excludes, with an optional "- ". Returns -1 if the file can't be read,
+   or a line isn't a valid rule. */
+int pathFilterAddFile(struct path_filter *filter, const char* path);
+/* Whether an entry is excluded, by it's path relative to the folder being
+   walked. Only the entry itself is checked, the walker never reaches
+   anything under an excluded folder. Safe to call from several threads. */
+int pathFilterExcludes(const struct path_filter *filter,
+   const char* relativePath, int isDirectory);
+/* As above, but also excluded if any folder on the way to it is, for paths
+   which weren't found by walking. */
+int pathFilterExcludesPath(const struct path_filter *filter,
+   const char* relativePath, int isDirectory);
+void pathFilterFree(struct path_filter *filter);
+
+/* Whether an argument is --exclude=, --include= or --exclude-from=, which
+   every tool walking files takes. */
+int pathFilterIsOption(const char* argument);
+/* Adds the rule, or the file's rules, an option gives, making the filter
+   the first time. Prints why, and returns -1, if it can't. */
+int pathFilterParseOption(struct path_filter **filter, const char* argument);
+
+#endif
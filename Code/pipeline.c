@@ -0,0 +1,1047 @@
+/*******************************************************************************
+
+   File        : pipeline.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Read-ahead pipeline for backup. Reader threads read files
+                 into a pool of buffers, while a single writer thread adds
+                 them to the archive in the order they were submitted.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.01 - io_uring reader.
+                 16/10/2026 - v1.02 - Draining, for files written directly.
+                 16/10/2026 - v1.03 - Header only entries.
+                 16/10/2026 - v1.04 - Stats.
+                 16/10/2026 - v1.05 - Reused job paths.
+                 16/10/2026 - v1.06 - Page cache modes.
+                 16/10/2026 - v1.07 - Throttling.
+                 17/10/2026 - v1.08 - Skipping deleted files.
+                 17/10/2026 - v1.09 - Waiting for single jobs.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   Submitted files sit in a ring of queueDepth jobs. Readers take jobs in
+   the order they were submitted, and the writer finishes them in the same
+   order, so the archive comes out byte for byte the same as a sequential
+   backup.
+
+   Each job has a list of filled buffers waiting for the writer. A large file
+   can need more buffers than the pool holds, so a reader only takes the
+   last free buffer if it's reading the job the writer is waiting on.
+   Otherwise readers working ahead could fill the pool with later files,
+   while the writer waits forever for the rest of the current one.
+
+   With PIPELINE_IO_URING, a single reader thread does all the reading
+   through an io_uring, with opens for the files queued, and several reads 
+   for each open file, in flight at once. Reads can finish in any order, so 
+   each file's buffers are only handed to the writer, and hashed, once 
+   everything before them has arrived. The same rule about the last free 
+   buffer applies.
+
+   Nothing is allocated per file. Each job in the ring keeps it's path 
+   buffer when it's finished, and the next file submitted to it copies it's
+   path in, only growing the buffer if the path is longer.
+
+   Buffers are page aligned, and each read starts a whole number of buffers
+   into the file, so files opened with O_DIRECT can be read straight into
+   them, with the last read of each file rounded up to a whole block. If
+   the kernel refuses a read anyway, O_DIRECT is turned off for the file,
+   and the read is tried again.
+
+   A file deleted between being submitted and opened is left out, header
+   and all, so everything after it lands earlier than the caller planned.
+   The writer keeps a list of them, with the space each was given, which
+   the caller takes once the writer has caught up, and corrects it's
+   offsets from. Headers that point back at a file, like hard links, can't
+   be queued until it's known the file made it, so the caller can wait for
+   a single job to be written first.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "pipeline.h"
+#include "throttle.h"
+#include "uring.h"
+#include "stats.h"
+
+struct pipeline_buffer {
+   struct pipeline_buffer *next;
+   size_t length;
+   char *data;
+   /* Only used by the io_uring reader, while the buffer is being read. */
+   size_t filled;
+   off_t offset;
+   int complete;
+   struct uring_file *file;
+   /* When the read was queued, for the stats, and the throttle. */
+   uint64_t started;
+   uint64_t throttleStarted;
+};
+
+/* A file being read by the io_uring reader. Only that thread uses these. */
+struct uring_file {
+   struct pipeline_job *job;
+   /* The descriptor is -1 until the file is opened. */
+   struct cached_file source;
+   /* How much of the file reads have been queued for. */
+   off_t queued;
+   /* Reads in flight. */
+   int reads;
+   int endOfFile;
+   int failed;
+   /* When the open was queued, for the stats. */
+   uint64_t openStarted;
+   struct content_hash hash;
+   /* Buffers being read, in file order. */
+   struct pipeline_buffer *first;
+   struct pipeline_buffer *last;
+};
+
+struct pipeline_job {
+   /* Kept from one file to the next, see submitJob. */
+   char *path;
+   size_t pathCapacity;
+   char header[ARCHIVE_BLOCK_SIZE];
+   off_t size;
+   uint64_t *hashResult;
+   long sequence;
+   /* Set by the reader once the file is open, so the header can go out. */
+   int opened;
+   /* Set by the reader once it has finished with the job, either way. */
+   int done;
+   int failed;
+   /* Set instead of failed if the file was deleted before it was opened. */
+   int vanished;
+   /* Filled buffers, waiting to be written. */
+   struct pipeline_buffer *first;
+   struct pipeline_buffer *last;
+};
+
+struct pipeline {
+   struct archive_writer *archive;
+   int queueDepth;
+   struct pipeline_job *jobs;
+
+   pthread_t *readers;
+   int readerCount;
+   int useUring;
+   enum cache_mode cacheMode;
+   /* Set once the io_uring reader finds O_DIRECT isn't supported, so it
+      stops asking. Only that thread uses it. */
+   int directRefused;
+   pthread_t writer;
+   int writerStarted;
+
+   char *bufferMemory;
+   struct pipeline_buffer *buffers;
+
+   /* Protects everything below, and the contents of the jobs. */
+   pthread_mutex_t lock;
+   pthread_cond_t readersWake;
+   pthread_cond_t writerWake;
+   pthread_cond_t submitWake;
+   struct pipeline_buffer *freeBuffers;
+   int freeCount;
+   /* Job sequence numbers, each job lives in jobs[sequence % queueDepth]. */
+   long submitted;
+   long nextToRead;
+   long nextToWrite;
+   int finishing;
+   int failed;
+   char *failedPath;
+   /* Files left out as they'd been deleted, until the caller takes them. */
+   struct pipeline_skip *skipped;
+   size_t skippedCount;
+   size_t skippedCapacity;
+};
+
+static int submitJob(struct pipeline *pipeline, const char* path,
+   const void *header, off_t size, uint64_t *hashResult, int headerOnly);
+static void *readerThread(void *argument);
+static void *uringReaderThread(void *argument);
+static size_t queueUringReads(struct pipeline *pipeline, struct uring *ring,
+   struct uring_file *files);
+static void completeUringOperation(struct pipeline *pipeline,
+   struct uring *ring, struct uring_file *files, uint64_t userData, 
+   int result);
+static int publishUringFile(struct pipeline *pipeline, struct uring *ring,
+   struct uring_file *file);
+static void *writerThread(void *argument);
+static void readJob(struct pipeline *pipeline, struct pipeline_job *job);
+static void failPipeline(struct pipeline *pipeline, const char* path);
+static void skipJob(struct pipeline *pipeline, struct pipeline_job *job);
+
+/*******************************************************************************
+   pipelineStart
+      Allocates the buffer pool and job ring, and starts the threads.
+*******************************************************************************/
+struct pipeline *pipelineStart(struct archive_writer *archive,
+   const struct pipeline_options *options)
+{
+   struct pipeline *pipeline = calloc(1, sizeof(struct pipeline));
+   if(pipeline == NULL) return NULL;
+
+   pipeline->archive = archive;
+   pipeline->cacheMode = options->cacheMode;
+   pipeline->queueDepth = options->queueDepth > 0 ? options->queueDepth : 1;
+   int bufferCount = options->buffers > 2 ? options->buffers : 2;
+   int readerCount = options->readers > 0 ? options->readers : 1;
+
+   pipeline->jobs = calloc(pipeline->queueDepth, sizeof(struct pipeline_job));
+   pipeline->readers = calloc(readerCount, sizeof(pthread_t));
+   pipeline->buffers = calloc(bufferCount, sizeof(struct pipeline_buffer));
+   void *bufferMemory = NULL;
+   if(pipeline->jobs == NULL || pipeline->readers == NULL
+      || pipeline->buffers == NULL
+      || posix_memalign(&bufferMemory, 4096,
+         (size_t)bufferCount * PIPELINE_BUFFER_SIZE) != 0)
+   {
+      pipelineFree(pipeline);
+      return NULL;
+   }
+   pipeline->bufferMemory = bufferMemory;
+
+   for(int i = 0; i < bufferCount; i++) {
+      pipeline->buffers[i].data
+         = &pipeline->bufferMemory[(size_t)i * PIPELINE_BUFFER_SIZE];
+      pipeline->buffers[i].next = pipeline->freeBuffers;
+      pipeline->freeBuffers = &pipeline->buffers[i];
+   }
+   pipeline->freeCount = bufferCount;
+
+   pthread_mutex_init(&pipeline->lock, NULL);
+   pthread_cond_init(&pipeline->readersWake, NULL);
+   pthread_cond_init(&pipeline->writerWake, NULL);
+   pthread_cond_init(&pipeline->submitWake, NULL);
+
+   /* A single thread drives the ring, if the kernel has one. */
+   if(options->io == PIPELINE_IO_URING && uringAvailable()) {
+      pipeline->useUring = 1;
+      readerCount = 1;
+   }
+   for(int i = 0; i < readerCount; i++) {
+      if(pthread_create(&pipeline->readers[i], NULL, 
+         pipeline->useUring ? uringReaderThread : readerThread,
+         pipeline) != 0)
+      {
+         break;
+      }
+      pipeline->readerCount++;
+   }
+   if(pipeline->readerCount > 0
+      && pthread_create(&pipeline->writer, NULL, writerThread, pipeline) == 0)
+   {
+      pipeline->writerStarted = 1;
+   }
+   if(!pipeline->writerStarted) {
+      pipelineFinish(pipeline);
+      pipelineFree(pipeline);
+      return NULL;
+   }
+
+   return pipeline;
+}
+
+/*******************************************************************************
+   pipelineSubmit
+      Queues a file, waiting for space in the queue if needed.
+*******************************************************************************/
+int pipelineSubmit(struct pipeline *pipeline, const char* path,
+   const void *header, off_t size, uint64_t *hashResult)
+{
+   return submitJob(pipeline, path, header, size, hashResult, 0);
+}
+
+/*******************************************************************************
+   pipelineSubmitHeader
+      Queues a header with nothing to read. The job is finished as soon as
+      it's queued, so the readers skip it, and the writer only writes the
+      header.
+*******************************************************************************/
+int pipelineSubmitHeader(struct pipeline *pipeline, const char* path,
+   const void *header)
+{
+   return submitJob(pipeline, path, header, 0, NULL, 1);
+}
+
+static int submitJob(struct pipeline *pipeline, const char* path,
+   const void *header, off_t size, uint64_t *hashResult, int headerOnly)
+{
+   size_t pathLength = strlen(path) + 1;
+
+   pthread_mutex_lock(&pipeline->lock);
+   while(pipeline->submitted - pipeline->nextToWrite >= pipeline->queueDepth
+      && !pipeline->failed)
+   {
+      pthread_cond_wait(&pipeline->submitWake, &pipeline->lock);
+   }
+   if(pipeline->failed) {
+      pthread_mutex_unlock(&pipeline->lock);
+      return -1;
+   }
+
+   /* The writer has finished with the job, so nothing else is using it. */
+   struct pipeline_job *job
+      = &pipeline->jobs[pipeline->submitted % pipeline->queueDepth];
+   char *pathBuffer = job->path;
+   size_t pathCapacity = job->pathCapacity;
+   if(pathLength > pathCapacity) {
+      pathCapacity = pathLength > 256 ? pathLength : 256;
+      pathBuffer = realloc(pathBuffer, pathCapacity);
+      if(pathBuffer == NULL) {
+         pthread_mutex_unlock(&pipeline->lock);
+         return -1;
+      }
+   }
+   memset(job, 0, sizeof(struct pipeline_job));
+   job->path = pathBuffer;
+   job->pathCapacity = pathCapacity;
+   memcpy(job->path, path, pathLength);
+   memcpy(job->header, header, ARCHIVE_BLOCK_SIZE);
+   job->size = size;
+   job->hashResult = hashResult;
+   job->sequence = pipeline->submitted++;
+   job->opened = headerOnly;
+   job->done = headerOnly;
+
+   pthread_cond_broadcast(&pipeline->readersWake);
+   pthread_cond_signal(&pipeline->writerWake);
+   pthread_mutex_unlock(&pipeline->lock);
+   return 0;
+}
+
+/*******************************************************************************
+   pipelineSubmitted
+      Only the submitting thread changes the count, so it needn't lock.
+*******************************************************************************/
+long pipelineSubmitted(struct pipeline *pipeline) {
+   return pipeline->submitted;
+}
+
+/*******************************************************************************
+   pipelineWaitWritten
+      Waits for the writer to get past a job. Skipped jobs stay on the list
+      until the caller takes them, and it takes them itself, so if the job
+      was skipped it's still there.
+*******************************************************************************/
+int pipelineWaitWritten(struct pipeline *pipeline, long job) {
+   pthread_mutex_lock(&pipeline->lock);
+   while(pipeline->nextToWrite <= job && !pipeline->failed) {
+      pthread_cond_wait(&pipeline->submitWake, &pipeline->lock);
+   }
+   int result = pipeline->failed ? -1 : 0;
+   for(size_t i = 0; i < pipeline->skippedCount && result == 0; i++) {
+      if(pipeline->skipped[i].job == job) result = 1;
+   }
+   pthread_mutex_unlock(&pipeline->lock);
+   return result;
+}
+
+/*******************************************************************************
+   pipelineDrain
+      Waits for the writer to catch up. The writer only moves on to the 
+      next job once it's done with the archive, so the archive is free once
+      nothing is left to write.
+*******************************************************************************/
+int pipelineDrain(struct pipeline *pipeline) {
+   pthread_mutex_lock(&pipeline->lock);
+   while(pipeline->nextToWrite != pipeline->submitted && !pipeline->failed) {
+      pthread_cond_wait(&pipeline->submitWake, &pipeline->lock);
+   }
+   int failed = pipeline->failed;
+   pthread_mutex_unlock(&pipeline->lock);
+   return failed ? -1 : 0;
+}
+
+/*******************************************************************************
+   pipelineFinish
+      Waits for the queue to empty and the threads to stop.
+*******************************************************************************/
+int pipelineFinish(struct pipeline *pipeline) {
+   pthread_mutex_lock(&pipeline->lock);
+   pipeline->finishing = 1;
+   pthread_cond_broadcast(&pipeline->readersWake);
+   pthread_cond_broadcast(&pipeline->writerWake);
+   pthread_mutex_unlock(&pipeline->lock);
+
+   if(pipeline->writerStarted) {
+      pthread_join(pipeline->writer, NULL);
+      pipeline->writerStarted = 0;
+   }
+   for(int i = 0; i < pipeline->readerCount; i++) {
+      pthread_join(pipeline->readers[i], NULL);
+   }
+   pipeline->readerCount = 0;
+
+   return pipeline->failed ? -1 : 0;
+}
+
+/*******************************************************************************
+   pipelineFailedPath
+      Returns the path of the file which stopped the pipeline, if any.
+*******************************************************************************/
+const char *pipelineFailedPath(struct pipeline *pipeline) {
+   return pipeline->failedPath;
+}
+
+/*******************************************************************************
+   pipelineTakeSkipped
+      Hands over the files left out since the last call.
+*******************************************************************************/
+size_t pipelineTakeSkipped(struct pipeline *pipeline,
+   struct pipeline_skip **skipped)
+{
+   pthread_mutex_lock(&pipeline->lock);
+   size_t count = pipeline->skippedCount;
+   *skipped = pipeline->skipped;
+   pipeline->skipped = NULL;
+   pipeline->skippedCount = 0;
+   pipeline->skippedCapacity = 0;
+   pthread_mutex_unlock(&pipeline->lock);
+   return count;
+}
+
+/*******************************************************************************
+   pipelineFreeSkipped
+      Frees what pipelineTakeSkipped returned.
+*******************************************************************************/
+void pipelineFreeSkipped(struct pipeline_skip *skipped, size_t count) {
+   for(size_t i = 0; i < count; i++) {
+      free(skipped[i].path);
+   }
+   free(skipped);
+}
+
+/*******************************************************************************
+   pipelineFree
+      Frees a finished pipeline.
+*******************************************************************************/
+void pipelineFree(struct pipeline *pipeline) {
+   if(pipeline->jobs != NULL) {
+      for(int i = 0; i < pipeline->queueDepth; i++) {
+         free(pipeline->jobs[i].path);
+      }
+   }
+   if(pipeline->bufferMemory != NULL) {
+      pthread_mutex_destroy(&pipeline->lock);
+      pthread_cond_destroy(&pipeline->readersWake);
+      pthread_cond_destroy(&pipeline->writerWake);
+      pthread_cond_destroy(&pipeline->submitWake);
+   }
+   free(pipeline->jobs);
+   free(pipeline->readers);
+   free(pipeline->buffers);
+   free(pipeline->bufferMemory);
+   free(pipeline->failedPath);
+   pipelineFreeSkipped(pipeline->skipped, pipeline->skippedCount);
+   free(pipeline);
+}
+
+/*******************************************************************************
+   readerThread
+      Takes jobs in order and reads them, until the pipeline is finishing and
+      there's nothing left to read.
+*******************************************************************************/
+static void *readerThread(void *argument) {
+   struct pipeline *pipeline = (struct pipeline *)argument;
+
+   pthread_mutex_lock(&pipeline->lock);
+   for(;;) {
+      while(pipeline->nextToRead == pipeline->submitted
+         && !pipeline->finishing)
+      {
+         pthread_cond_wait(&pipeline->readersWake, &pipeline->lock);
+      }
+      if(pipeline->nextToRead == pipeline->submitted) break;
+
+      struct pipeline_job *job
+         = &pipeline->jobs[pipeline->nextToRead % pipeline->queueDepth];
+      pipeline->nextToRead++;
+
+      if(pipeline->failed || job->done) {
+         /* Header only jobs have nothing to read, and after a failure
+            don't bother reading anything else, just let the writer
+            clear the job. */
+         job->done = 1;
+         pthread_cond_signal(&pipeline->writerWake);
+         continue;
+      }
+
+      pthread_mutex_unlock(&pipeline->lock);
+      readJob(pipeline, job);
+      pthread_mutex_lock(&pipeline->lock);
+   }
+   pthread_mutex_unlock(&pipeline->lock);
+   return NULL;
+}
+
+/*******************************************************************************
+   readJob
+      Reads a file into buffers from the pool, handing each one to the
+      writer as soon as it's full.
+      Called without the lock held.
+*******************************************************************************/
+static void readJob(struct pipeline *pipeline, struct pipeline_job *job) {
+   uint64_t started = statsStart();
+   struct cached_file source;
+   int fileDescriptor = cacheOpen(&source, job->path, pipeline->cacheMode);
+   int openError = errno;
+   statsStop(STATS_OPEN, started);
+
+   pthread_mutex_lock(&pipeline->lock);
+   if(fileDescriptor == -1) {
+      job->vanished = openError == ENOENT;
+      job->failed = !job->vanished;
+      job->done = 1;
+      pthread_cond_signal(&pipeline->writerWake);
+      pthread_mutex_unlock(&pipeline->lock);
+      return;
+   }
+   job->opened = 1;
+   pthread_cond_signal(&pipeline->writerWake);
+   pthread_mutex_unlock(&pipeline->lock);
+
+   off_t remaining = job->size;
+   int endOfFile = 0;
+   int failed = 0;
+   struct content_hash hash;
+   contentHashInit(&hash);
+
+   while(remaining > 0 && !failed) {
+      pthread_mutex_lock(&pipeline->lock);
+      while(!pipeline->failed && (pipeline->freeCount == 0
+         || (pipeline->freeCount == 1
+            && job->sequence != pipeline->nextToWrite)))
+      {
+         pthread_cond_wait(&pipeline->readersWake, &pipeline->lock);
+      }
+      if(pipeline->failed) {
+         pthread_mutex_unlock(&pipeline->lock);
+         break;
+      }
+      struct pipeline_buffer *buffer = pipeline->freeBuffers;
+      pipeline->freeBuffers = buffer->next;
+      pipeline->freeCount--;
+      pthread_mutex_unlock(&pipeline->lock);
+
+      size_t wanted = remaining < PIPELINE_BUFFER_SIZE
+         ? (size_t)remaining : PIPELINE_BUFFER_SIZE;
+      size_t filled = 0;
+      while(filled < wanted && !endOfFile) {
+         /* Only a short read leaves the next one unaligned. */
+         if(filled % CACHE_DIRECT_ALIGNMENT != 0 
+            && cacheStopDirect(&source) != 0) 
+         {
+            failed = 1;
+            break;
+         }
+         size_t length = cacheReadLength(&source, wanted - filled);
+         throttleBytes(length);
+         started = statsStart();
+         uint64_t throttleStarted = throttleStart();
+         ssize_t bytesRead = read(fileDescriptor, &buffer->data[filled],
+            length);
+         throttleStop(throttleStarted);
+         statsStop(STATS_READ, started);
+         if(bytesRead < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EINVAL && source.direct 
+               && cacheStopDirect(&source) == 0)
+            {
+               continue;
+            }
+            failed = 1;
+            break;
+         }
+         /* Only the last read of a file is rounded up, so anything past
+            what was wanted is what the file has grown by since. */
+         if((size_t)bytesRead > wanted - filled) bytesRead = wanted - filled;
+         statsAdd(STATS_BYTES_READ, bytesRead);
+         if(bytesRead == 0) endOfFile = 1;
+         filled += bytesRead;
+      }
+      /* The file is shorter than it was when it was stat'd, so fill the
+         gap, the archive has to match the header. */
+      if(filled < wanted) memset(&buffer->data[filled], 0, wanted - filled);
+      buffer->length = wanted;
+      buffer->next = NULL;
+      remaining -= wanted;
+      if(job->hashResult != NULL) {
+         contentHashUpdate(&hash, buffer->data, wanted);
+      }
+
+      pthread_mutex_lock(&pipeline->lock);
+      if(job->last != NULL) {
+         job->last->next = buffer;
+      } else {
+         job->first = buffer;
+      }
+      job->last = buffer;
+      pthread_cond_signal(&pipeline->writerWake);
+      pthread_mutex_unlock(&pipeline->lock);
+   }
+
+   cacheFinish(&source, job->size - remaining);
+   close(fileDescriptor);
+   if(job->hashResult != NULL) *job->hashResult = contentHashFinal(&hash);
+
+   pthread_mutex_lock(&pipeline->lock);
+   job->failed = failed;
+   job->done = 1;
+   pthread_cond_signal(&pipeline->writerWake);
+   pthread_mutex_unlock(&pipeline->lock);
+}
+
+/* Reads in flight at once for each file, so large files keep the queue 
+   busy too. */
+#define URING_READS_PER_FILE 4
+/* What the bottom two bits of an operation's user data mean, the rest is
+   the index of the file or buffer. */
+#define URING_OPEN 0
+#define URING_READ 1
+#define URING_CLOSE 2
+
+/*******************************************************************************
+   uringReaderThread
+      Reads jobs through an io_uring, keeping as many opens and reads in 
+      flight as the queue and the buffer pool allow.
+*******************************************************************************/
+static void *uringReaderThread(void *argument) {
+   struct pipeline *pipeline = (struct pipeline *)argument;
+   struct uring ring;
+   unsigned entries = pipeline->queueDepth * 2 < 256 
+      ? pipeline->queueDepth * 2 : 256;
+   struct uring_file *files 
+      = calloc(pipeline->queueDepth, sizeof(struct uring_file));
+   if(files == NULL || uringInit(&ring, entries) != 0) {
+      /* Only if memory is short, as io_uring was checked for. 
+         Read the ordinary way instead. */
+      free(files);
+      return readerThread(pipeline);
+   }
+   for(int i = 0; i < pipeline->queueDepth; i++) files[i].source.fd = -1;
+   /* Files opened, or being opened, and not finished with yet. */
+   int reading = 0;
+   /* Bytes queued to read, which the throttle hasn't been asked about. */
+   size_t unthrottled = 0;
+
+   pthread_mutex_lock(&pipeline->lock);
+   for(;;) {
+      /* Start opening anything newly submitted. */
+      while(pipeline->nextToRead < pipeline->submitted) {
+         int slot = pipeline->nextToRead % pipeline->queueDepth;
+         struct pipeline_job *job = &pipeline->jobs[slot];
+         struct uring_file *file = &files[slot];
+         if(pipeline->failed || job->done) {
+            /* Header only jobs have nothing to read, and after a failure
+               don't bother reading anything else, just let the writer
+               clear the job. */
+            job->done = 1;
+            pthread_cond_signal(&pipeline->writerWake);
+            pipeline->nextToRead++;
+            continue;
+         }
+         enum cache_mode mode = pipeline->cacheMode;
+         if(mode == CACHE_DIRECT && pipeline->directRefused) {
+            mode = CACHE_DROP;
+         }
+         if(uringPrepareOpen(&ring, AT_FDCWD, job->path, 
+            cacheOpenFlags(mode) | O_CLOEXEC, 0, 
+            (uint64_t)slot << 2 | URING_OPEN) != 0)
+         {
+            break;
+         }
+         memset(file, 0, sizeof(struct uring_file));
+         file->job = job;
+         file->source.fd = -1;
+         file->source.mode = mode;
+         file->openStarted = statsStart();
+         contentHashInit(&file->hash);
+         pipeline->nextToRead++;
+         reading++;
+      }
+      unthrottled += queueUringReads(pipeline, &ring, files);
+
+      if(ring.unsubmitted == 0 && ring.inFlight == 0) {
+         /* Files may still be waiting for buffers. */
+         if(pipeline->finishing && reading == 0
+            && pipeline->nextToRead == pipeline->submitted) 
+         {
+            break;
+         }
+         pthread_cond_wait(&pipeline->readersWake, &pipeline->lock);
+         continue;
+      }
+      pthread_mutex_unlock(&pipeline->lock);
+
+      /* Reads are held back before they're sent, rather than while
+         queueing them, as that's done holding the lock. */
+      throttleBytes(unthrottled);
+      unthrottled = 0;
+
+      /* Only block if there was nothing new to send. */
+      int submitted = uringSubmit(&ring, ring.unsubmitted > 0 ? 0 : 1);
+
+      pthread_mutex_lock(&pipeline->lock);
+      if(submitted != 0) {
+         failPipeline(pipeline, pipeline->jobs[
+            pipeline->nextToWrite % pipeline->queueDepth].path);
+         /* Don't leave the writer waiting on files which won't finish. */
+         for(int i = 0; i < pipeline->queueDepth; i++) {
+            if(files[i].job == NULL) continue;
+            files[i].job->failed = 1;
+            files[i].job->done = 1;
+            files[i].job = NULL;
+         }
+         pthread_cond_broadcast(&pipeline->writerWake);
+         break;
+      }
+      uint64_t userData;
+      int result;
+      while(uringComplete(&ring, &userData, &result)) {
+         completeUringOperation(pipeline, &ring, files, userData, result);
+      }
+      for(long sequence = pipeline->nextToWrite; 
+         sequence < pipeline->nextToRead; sequence++) 
+      {
+         struct uring_file *file = &files[sequence % pipeline->queueDepth];
+         if(file->job != NULL && publishUringFile(pipeline, &ring, file)) {
+            reading--;
+         }
+      }
+   }
+   pthread_mutex_unlock(&pipeline->lock);
+
+   /* Anything left open after a failure. */
+   for(int i = 0; i < pipeline->queueDepth; i++) {
+      if(files[i].source.fd >= 0) close(files[i].source.fd);
+   }
+   uringFree(&ring);
+   free(files);
+   return NULL;
+}
+
+/*******************************************************************************
+   queueUringReads
+      Gives free buffers to open files, oldest first, and queues reads into
+      them. Called with the lock held.
+      Returns the number of bytes queued.
+*******************************************************************************/
+static size_t queueUringReads(struct pipeline *pipeline, struct uring *ring,
+   struct uring_file *files)
+{
+   size_t queuedBytes = 0;
+   for(long sequence = pipeline->nextToWrite; 
+      sequence < pipeline->nextToRead && !pipeline->failed; sequence++)
+   {
+      struct uring_file *file = &files[sequence % pipeline->queueDepth];
+      if(file->job == NULL || file->source.fd < 0 || file->failed) continue;
+
+      while(file->queued < file->job->size
+         && file->reads < URING_READS_PER_FILE
+         && (pipeline->freeCount > 1 || (pipeline->freeCount == 1
+            && sequence == pipeline->nextToWrite)))
+      {
+         struct pipeline_buffer *buffer = pipeline->freeBuffers;
+         off_t remaining = file->job->size - file->queued;
+         size_t wanted = remaining < PIPELINE_BUFFER_SIZE
+            ? (size_t)remaining : PIPELINE_BUFFER_SIZE;
+         /* Past the end of a file which has shrunk, there's nothing to 
+            read, the buffer is just filled with zeros. */
+         if(!file->endOfFile && uringPrepareRead(ring, file->source.fd, 
+            buffer->data, cacheReadLength(&file->source, wanted),
+            file->queued, 
+            (uint64_t)(buffer - pipeline->buffers) << 2 | URING_READ) != 0)
+         {
+            return queuedBytes;
+         }
+         pipeline->freeBuffers = buffer->next;
+         pipeline->freeCount--;
+
+         buffer->next = NULL;
+         buffer->length = wanted;
+         buffer->filled = 0;
+         buffer->offset = file->queued;
+         buffer->complete = file->endOfFile;
+         buffer->file = file;
+         buffer->started = statsStart();
+         buffer->throttleStarted = file->endOfFile ? 0 : throttleStart();
+         if(!file->endOfFile) queuedBytes += wanted;
+         if(file->last != NULL) {
+            file->last->next = buffer;
+         } else {
+            file->first = buffer;
+         }
+         file->last = buffer;
+         file->queued += wanted;
+         if(!file->endOfFile) file->reads++;
+      }
+   }
+   return queuedBytes;
+}
+
+/*******************************************************************************
+   completeUringOperation
+      Records the result of an open or read. Called with the lock held.
+*******************************************************************************/
+static void completeUringOperation(struct pipeline *pipeline,
+   struct uring *ring, struct uring_file *files, uint64_t userData, 
+   int result)
+{
+   int kind = userData & 3;
+   if(kind == URING_CLOSE) return;
+
+   if(kind == URING_OPEN) {
+      struct uring_file *file = &files[userData >> 2];
+      statsStop(STATS_OPEN, file->openStarted);
+      enum cache_mode mode = file->source.mode;
+      if(result == -EINVAL && mode == CACHE_DIRECT) {
+         /* The file system doesn't do O_DIRECT. Open it the ordinary way,
+            and don't ask again. */
+         pipeline->directRefused = 1;
+         result = cacheOpen(&file->source, file->job->path, CACHE_DROP);
+         if(result < 0) result = -errno;
+      } else if(result >= 0) {
+         cacheAdopt(&file->source, result, mode, mode == CACHE_DIRECT);
+      }
+      if(result < 0) {
+         /* Failed either way, so the job is finished, but it isn't an
+            error if the file's gone. */
+         file->failed = 1;
+         file->job->vanished = result == -ENOENT;
+      } else {
+         file->job->opened = 1;
+         pthread_cond_signal(&pipeline->writerWake);
+      }
+      return;
+   }
+
+   struct pipeline_buffer *buffer = &pipeline->buffers[userData >> 2];
+   struct uring_file *file = buffer->file;
+   if(result == -EINTR || result == -EAGAIN) {
+      result = 0;
+   } else if(result == -EINVAL && file->source.direct
+      && cacheStopDirect(&file->source) == 0)
+   {
+      /* Asked for again below, without O_DIRECT. */
+      result = 0;
+   } else if(result < 0) {
+      file->failed = 1;
+      result = 0;
+   } else if(result == 0) {
+      /* The file is shorter than it was when it was stat'd. */
+      file->endOfFile = 1;
+   }
+   buffer->filled += result;
+   /* Rounded up direct reads can bring in what the file has grown by. */
+   if(buffer->filled > buffer->length) buffer->filled = buffer->length;
+
+   if(buffer->filled < buffer->length && !file->failed && !file->endOfFile) {
+      /* Short read, ask for the rest. O_DIRECT can't carry on after one
+         which wasn't a whole number of blocks. */
+      if(buffer->filled % CACHE_DIRECT_ALIGNMENT != 0
+         && cacheStopDirect(&file->source) != 0)
+      {
+         file->failed = 1;
+      } else if(uringPrepareRead(ring, file->source.fd, 
+         &buffer->data[buffer->filled],
+         cacheReadLength(&file->source, buffer->length - buffer->filled),
+         buffer->offset + buffer->filled, userData) == 0)
+      {
+         return;
+      }
+      file->failed = 1;
+   }
+   buffer->complete = 1;
+   file->reads--;
+   /* From being queued to being filled, short reads and all. */
+   statsStop(STATS_READ, buffer->started);
+   statsAdd(STATS_BYTES_READ, buffer->filled);
+   throttleStop(buffer->throttleStarted);
+}
+
+/*******************************************************************************
+   publishUringFile
+      Hands a file's finished buffers to the writer in order, and finishes
+      the job once everything has been read. Called with the lock held.
+      Returns 1 once the job is done.
+*******************************************************************************/
+static int publishUringFile(struct pipeline *pipeline, struct uring *ring,
+   struct uring_file *file)
+{
+   struct pipeline_job *job = file->job;
+   int published = 0;
+   while(file->first != NULL && file->first->complete) {
+      struct pipeline_buffer *buffer = file->first;
+      file->first = buffer->next;
+      if(file->first == NULL) file->last = NULL;
+
+      /* The archive has to match the header, whatever was read. */
+      if(buffer->filled < buffer->length) {
+         memset(&buffer->data[buffer->filled], 0, 
+            buffer->length - buffer->filled);
+      }
+      if(job->hashResult != NULL) {
+         contentHashUpdate(&file->hash, buffer->data, buffer->length);
+      }
+      buffer->next = NULL;
+      if(job->last != NULL) {
+         job->last->next = buffer;
+      } else {
+         job->first = buffer;
+      }
+      job->last = buffer;
+      published = 1;
+   }
+
+   int finished = file->reads == 0 && file->first == NULL
+      && (file->failed || pipeline->failed || file->queued == job->size);
+   if(finished && (file->source.fd >= 0 || file->failed)) {
+      if(file->source.fd >= 0) cacheFinish(&file->source, file->queued);
+      if(file->source.fd >= 0 
+         && uringPrepareClose(ring, file->source.fd, URING_CLOSE) != 0) 
+      {
+         close(file->source.fd);
+      }
+      file->source.fd = -1;
+      if(job->hashResult != NULL && !file->failed) {
+         *job->hashResult = contentHashFinal(&file->hash);
+      }
+      job->failed = file->failed && !job->vanished;
+      job->done = 1;
+      file->job = NULL;
+      pthread_cond_signal(&pipeline->writerWake);
+      return 1;
+   }
+   if(published) pthread_cond_signal(&pipeline->writerWake);
+   return 0;
+}
+
+/*******************************************************************************
+   writerThread
+      Writes jobs to the archive in the order they were submitted.
+*******************************************************************************/
+static void *writerThread(void *argument) {
+   struct pipeline *pipeline = (struct pipeline *)argument;
+   struct archive_writer *archive = pipeline->archive;
+
+   pthread_mutex_lock(&pipeline->lock);
+   for(;;) {
+      while(pipeline->nextToWrite == pipeline->submitted
+         && !pipeline->finishing)
+      {
+         pthread_cond_wait(&pipeline->writerWake, &pipeline->lock);
+      }
+      if(pipeline->nextToWrite == pipeline->submitted) break;
+
+      struct pipeline_job *job
+         = &pipeline->jobs[pipeline->nextToWrite % pipeline->queueDepth];
+      while(!job->opened && !job->done) {
+         pthread_cond_wait(&pipeline->writerWake, &pipeline->lock);
+      }
+
+      int writing = job->opened && !pipeline->failed;
+      if(writing) {
+         pthread_mutex_unlock(&pipeline->lock);
+         writing = archiveWrite(archive, job->header, ARCHIVE_BLOCK_SIZE) == 0;
+         pthread_mutex_lock(&pipeline->lock);
+      }
+
+      for(;;) {
+         while(job->first == NULL && !job->done) {
+            pthread_cond_wait(&pipeline->writerWake, &pipeline->lock);
+         }
+         struct pipeline_buffer *buffer = job->first;
+         if(buffer == NULL) break;
+         job->first = buffer->next;
+         if(job->first == NULL) job->last = NULL;
+
+         if(writing && !pipeline->failed) {
+            pthread_mutex_unlock(&pipeline->lock);
+            writing = archiveWrite(archive, buffer->data, buffer->length) == 0;
+            pthread_mutex_lock(&pipeline->lock);
+         }
+
+         buffer->next = pipeline->freeBuffers;
+         pipeline->freeBuffers = buffer;
+         pipeline->freeCount++;
+         pthread_cond_broadcast(&pipeline->readersWake);
+      }
+
+      if(writing && !job->failed) {
+         pthread_mutex_unlock(&pipeline->lock);
+         writing = archiveWritePadding(archive) == 0;
+         pthread_mutex_lock(&pipeline->lock);
+      }
+      if(job->failed || (job->opened && !writing)) {
+         failPipeline(pipeline, job->path);
+      } else if(job->vanished && !pipeline->failed) {
+         skipJob(pipeline, job);
+      }
+
+      pipeline->nextToWrite++;
+      /* The next job's reader may be waiting for the last buffer. */
+      pthread_cond_broadcast(&pipeline->readersWake);
+      pthread_cond_signal(&pipeline->submitWake);
+   }
+   pthread_mutex_unlock(&pipeline->lock);
+   return NULL;
+}
+
+/*******************************************************************************
+   failPipeline
+      Records the first failure, and wakes everyone so they stop.
+      Called with the lock held.
+*******************************************************************************/
+static void failPipeline(struct pipeline *pipeline, const char* path) {
+   if(!pipeline->failed) {
+      pipeline->failed = 1;
+      pipeline->failedPath = strdup(path);
+   }
+   pthread_cond_broadcast(&pipeline->readersWake);
+   pthread_cond_broadcast(&pipeline->submitWake);
+}
+
+/*******************************************************************************
+   skipJob
+      Records a file which wasn't written, as it had been deleted, for the
+      caller to take out of it's plans. Called with the lock held.
+*******************************************************************************/
+static void skipJob(struct pipeline *pipeline, struct pipeline_job *job) {
+   if(pipeline->skippedCount == pipeline->skippedCapacity) {
+      size_t capacity = pipeline->skippedCapacity > 0
+         ? pipeline->skippedCapacity * 2 : 16;
+      struct pipeline_skip *skipped = realloc(pipeline->skipped,
+         capacity * sizeof(struct pipeline_skip));
+      if(skipped == NULL) {
+         failPipeline(pipeline, job->path);
+         return;
+      }
+      pipeline->skipped = skipped;
+      pipeline->skippedCapacity = capacity;
+   }
+   struct pipeline_skip *skip = &pipeline->skipped[pipeline->skippedCount];
+   skip->path = strdup(job->path);
+   if(skip->path == NULL) {
+      failPipeline(pipeline, job->path);
+      return;
+   }
+   skip->job = job->sequence;
+   skip->length = ARCHIVE_BLOCK_SIZE + (job->size + ARCHIVE_BLOCK_SIZE - 1)
+      / ARCHIVE_BLOCK_SIZE * ARCHIVE_BLOCK_SIZE;
+   pipeline->skippedCount++;
+}
@@ -0,0 +1,122 @@
+/*******************************************************************************
+
+   File        : pipeline.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Read-ahead pipeline for backup. Reader threads read files
+                 into a pool of buffers, while a single writer thread adds
+                 them to the archive in the order they were submitted.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.01 - io_uring reader.
+                 16/10/2026 - v1.02 - Draining, for files written directly.
+                 16/10/2026 - v1.03 - Header only entries.
+                 16/10/2026 - v1.04 - Page cache modes.
+                 17/10/2026 - v1.05 - Skipping deleted files.
+                 17/10/2026 - v1.06 - Waiting for single jobs.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <sys/types.h>
+
+#include "archiveio.h"
+#include "contenthash.h"
+#include "pagecache.h"
+
+/* Each buffer in the pool holds this much of a file. */
+#define PIPELINE_BUFFER_SIZE (256 * 1024)
+
+/* How the readers read files. */
+#define PIPELINE_IO_SYNC 0
+#define PIPELINE_IO_URING 1
+
+struct pipeline_options {
+   /* Threads opening and reading files. */
+   int readers;
+   /* Files which can be submitted but not yet written. */
+   int queueDepth;
+   /* Buffers shared by the readers, at least 2. */
+   int buffers;
+   /* With PIPELINE_IO_URING, one thread keeps opens and reads for many
+      files in flight, and readers is ignored. Falls back to 
+      PIPELINE_IO_SYNC if the kernel doesn't support io_uring. */
+   int io;
+   /* How files are read, see pagecache.h. The buffers are aligned for
+      CACHE_DIRECT. */
+   enum cache_mode cacheMode;
+};
+
+/* A file left out of the archive, as it was deleted before it could be
+   opened. */
+struct pipeline_skip {
+   char *path;
+   /* It's job number, see pipelineSubmitted. */
+   long job;
+   /* The header and padded data it would have taken up. */
+   off_t length;
+};
+
+struct pipeline;
+
+/* Returns NULL if the threads or buffers couldn't be created. */
+struct pipeline *pipelineStart(struct archive_writer *archive,
+   const struct pipeline_options *options);
+
+/* Queues a file to be added to the archive, after the 512 byte header.
+   Exactly size bytes of data are written, followed by padding, just as
+   backupFile does.
+   If hashResult isn't NULL, the content hash of the data written is stored
+   there, by the time pipelineFinish returns.
+   Blocks while the queue is full.
+   If the file has been deleted by the time it's opened, nothing at all is
+   written for it, see pipelineTakeSkipped.
+   Returns -1 once anything has gone wrong, see pipelineFailedPath. */
+int pipelineSubmit(struct pipeline *pipeline, const char* path,
+   const void *header, off_t size, uint64_t *hashResult);
+
+/* Queues a 512 byte header with no data after it, such as a hard link, in
+   order with the files around it. path is only used to report failures.
+   Returns -1 once anything has gone wrong. */
+int pipelineSubmitHeader(struct pipeline *pipeline, const char* path,
+   const void *header);
+
+/* How many jobs have been submitted, files and headers alike. Each job's
+   number is how many were submitted before it. */
+long pipelineSubmitted(struct pipeline *pipeline);
+
+/* Waits for one job to be written, or left out.
+   Returns 1 if the file was left out as it had been deleted, and -1 once
+   anything has gone wrong, see pipelineFailedPath. */
+int pipelineWaitWritten(struct pipeline *pipeline, long job);
+
+/* Waits for everything submitted so far to be written, leaving the
+   threads running, so the caller can write to the archive itself before
+   submitting anything else.
+   Returns -1 once anything has gone wrong, see pipelineFailedPath. */
+int pipelineDrain(struct pipeline *pipeline);
+
+/* Waits for everything submitted to be written, then stops the threads.
+   Returns 0 if every file was written. */
+int pipelineFinish(struct pipeline *pipeline);
+
+/* The path of the file that couldn't be read or written, or NULL.
+   Only settled once pipelineFinish has returned. */
+const char *pipelineFailedPath(struct pipeline *pipeline);
+
+/* Once pipelineDrain or pipelineFinish has returned, hands over the files
+   left out since the last call, in the order they were submitted. Every
+   file submitted after one is written that much earlier in the archive.
+   Returns how many there are, to be freed with pipelineFreeSkipped. */
+size_t pipelineTakeSkipped(struct pipeline *pipeline,
+   struct pipeline_skip **skipped);
+void pipelineFreeSkipped(struct pipeline_skip *skipped, size_t count);
+
+void pipelineFree(struct pipeline *pipeline);
+
+#endif
@@ -0,0 +1,213 @@
+/*******************************************************************************
+
+   File        : readorder.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Collects the files found by the walker into a window, and
+                 hands them back in the order they sit on the disk, so
+                 backups of spinning disks read rather than seek.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   Directories are read in whatever order the file system keeps them,
+   which for most is a hash of the name, and says nothing about where the
+   data is. Sorting a window of files, thousands rather than one
+   directory's worth, gives the disk long runs to read in one sweep, while
+   keeping memory bounded for any size of tree.
+
+   Physical order costs an extra open, and a FIEMAP call, for each file,
+   asking for just the first extent. That's cheap next to a seek, but on
+   file systems that don't support it, the first refusal switches the
+   window over to inode order.
+
+   Entries are kept the way the walker keeps them in ordered mode, with
+   every name in one pool.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "readorder.h"
+#include "stats.h"
+
+struct read_entry {
+   /* Where the path starts in the window's names. */
+   size_t name;
+   struct stat fileStat;
+   uint64_t key;
+};
+
+struct read_window {
+   enum read_order order;
+   int capacity;
+   int count;
+   struct read_entry *entries;
+   char *names;
+   size_t namesUsed;
+   size_t namesCapacity;
+   /* Set once FIEMAP has been refused. */
+   int noFiemap;
+};
+
+static uint64_t getPhysicalOffset(struct read_window *window,
+   const char* path);
+static int compareEntries(const void *a, const void *b);
+
+/*******************************************************************************
+   readWindowCreate
+      Makes an empty window.
+*******************************************************************************/
+struct read_window *readWindowCreate(enum read_order order, int capacity) {
+   struct read_window *window = calloc(1, sizeof(struct read_window));
+   if(window == NULL) return NULL;
+   window->order = order;
+   window->capacity = capacity > 0 ? capacity : READ_WINDOW_DEFAULT;
+   window->entries = malloc(window->capacity * sizeof(struct read_entry));
+   if(window->entries == NULL) {
+      free(window);
+      return NULL;
+   }
+   return window;
+}
+
+/*******************************************************************************
+   readWindowAdd
+      Adds a file to the window.
+*******************************************************************************/
+int readWindowAdd(struct read_window *window, const char* path,
+   const struct stat *fileStat)
+{
+   size_t pathLength = strlen(path) + 1;
+   if(window->namesUsed + pathLength > window->namesCapacity) {
+      size_t capacity = window->namesCapacity > 0
+         ? window->namesCapacity * 2 : 65536;
+      while(window->namesUsed + pathLength > capacity) capacity *= 2;
+      char *names = realloc(window->names, capacity);
+      if(names == NULL) return -1;
+      window->names = names;
+      window->namesCapacity = capacity;
+   }
+
+   struct read_entry *entry = &window->entries[window->count++];
+   entry->name = window->namesUsed;
+   memcpy(&window->names[entry->name], path, pathLength);
+   window->namesUsed += pathLength;
+   entry->fileStat = *fileStat;
+   entry->key = fileStat->st_ino;
+   return window->count == window->capacity;
+}
+
+/*******************************************************************************
+   readWindowDrain
+      Works out where each file is, if ordering physically, then sorts them
+      and hands them to the callback.
+*******************************************************************************/
+int readWindowDrain(struct read_window *window, walkCallback callback) {
+   if(window->order == READ_ORDER_PHYSICAL && !window->noFiemap) {
+      for(int i = 0; i < window->count && !window->noFiemap; i++) {
+         struct read_entry *entry = &window->entries[i];
+         entry->key = getPhysicalOffset(window,
+            &window->names[entry->name]);
+      }
+      /* Refused part way through, so it's inodes for all of them. */
+      if(window->noFiemap) {
+         for(int i = 0; i < window->count; i++) {
+            window->entries[i].key = window->entries[i].fileStat.st_ino;
+         }
+      }
+   }
+   if(window->order != READ_ORDER_WALK) {
+      qsort(window->entries, window->count, sizeof(struct read_entry),
+         compareEntries);
+   }
+
+   int result = 0;
+   for(int i = 0; result == 0 && i < window->count; i++) {
+      struct read_entry *entry = &window->entries[i];
+      result = callback(&window->names[entry->name], &entry->fileStat,
+         FTW_F, NULL);
+   }
+   window->count = 0;
+   window->namesUsed = 0;
+   return result;
+}
+
+void readWindowFree(struct read_window *window) {
+   free(window->entries);
+   free(window->names);
+   free(window);
+}
+
+/*******************************************************************************
+   getPhysicalOffset
+      Where the file's first extent starts on the disk. Files without any,
+      being empty, or kept inside their inode, need no seek, so they go
+      first. Files which can't be opened go last, they'll fail again when
+      they're archived.
+*******************************************************************************/
+static uint64_t getPhysicalOffset(struct read_window *window,
+   const char* path)
+{
+   uint64_t started = statsStart();
+   int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+   if(fd == -1) {
+      statsStop(STATS_STAT, started);
+      return UINT64_MAX;
+   }
+
+   union {
+      struct fiemap map;
+      char space[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+   } request;
+   memset(&request, 0, sizeof(request));
+   request.map.fm_start = 0;
+   request.map.fm_length = FIEMAP_MAX_OFFSET;
+   request.map.fm_extent_count = 1;
+   uint64_t offset = 0;
+   if(ioctl(fd, FS_IOC_FIEMAP, &request.map) != 0) {
+      if(errno == EOPNOTSUPP || errno == ENOTTY || errno == EINVAL) {
+         window->noFiemap = 1;
+      }
+      offset = UINT64_MAX;
+   } else if(request.map.fm_mapped_extents > 0) {
+      offset = request.map.fm_extents[0].fe_physical;
+   }
+   close(fd);
+   statsStop(STATS_STAT, started);
+   return offset;
+}
+
+/*******************************************************************************
+   compareEntries
+      qsort comparison, by device, then key, then the order added.
+*******************************************************************************/
+static int compareEntries(const void *a, const void *b) {
+   const struct read_entry *first = a;
+   const struct read_entry *second = b;
+   if(first->fileStat.st_dev != second->fileStat.st_dev) {
+      return first->fileStat.st_dev < second->fileStat.st_dev ? -1 : 1;
+   }
+   if(first->key != second->key) return first->key < second->key ? -1 : 1;
+   /* Names are pooled in the order files were added, which keeps hard
+      links, sharing an inode, in the order they were found. */
+   return first->name < second->name ? -1 : first->name > second->name;
+}
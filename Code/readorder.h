@@ -0,0 +1,49 @@
+/*******************************************************************************
+
+   File        : readorder.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Collects the files found by the walker into a window, and
+                 hands them back in the order they sit on the disk, so
+                 backups of spinning disks read rather than seek.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef READORDER_H
+#define READORDER_H
+
+#include <sys/stat.h>
+
+#include "walker.h"
+
+enum read_order {
+   /* The order the walker finds them in. */
+   READ_ORDER_WALK,
+   /* By inode number, which most file systems allocate near the data. */
+   READ_ORDER_INODE,
+   /* By where the first block of data is, from FIEMAP. File systems
+      without it, such as NFS, are ordered by inode instead. */
+   READ_ORDER_PHYSICAL
+};
+
+#define READ_WINDOW_DEFAULT 8192
+
+struct read_window;
+
+/* Holds up to capacity files. Returns NULL if out of memory. */
+struct read_window *readWindowCreate(enum read_order order, int capacity);
+/* Copies the path and status. Returns 1 once the window is full, and
+   should be drained, or -1 if out of memory. */
+int readWindowAdd(struct read_window *window, const char* path,
+   const struct stat *fileStat);
+/* Sorts the files, and hands each to the callback, as FTW_F, emptying the
+   window. Stops at, and returns, the first non-zero result. */
+int readWindowDrain(struct read_window *window, walkCallback callback);
+void readWindowFree(struct read_window *window);
+
+#endif
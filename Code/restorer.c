@@ -0,0 +1,985 @@
+/*******************************************************************************
+
+   File        : restorer.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Parallel file extraction for restore, with a cache of the
+                 directories already created.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.01 - io_uring writes.
+                 16/10/2026 - v1.02 - Sparse files.
+                 16/10/2026 - v1.03 - Hard links.
+                 16/10/2026 - v1.04 - Stats.
+                 16/10/2026 - v1.05 - Reused jobs.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   restore used to mkdir every folder in a file's path, for every file, and
+   then write the file itself with fopen, fwrite, chmod and utime, all by
+   path, so the kernel walked the whole path again for each call.
+
+   Here every folder is a node in a trie of path components. A folder is
+   only created the first time it's seen, and while it's in use it's kept
+   open, so files are created relative to it with openat. Only so many
+   folders are kept open at once, those that aren't being used by any
+   queued file are closed as needed, and reopened if they come up again.
+
+   The archive has to be read in order, so the main thread reads each file
+   into memory and queues it for one of the worker threads, which create,
+   write, chmod and timestamp it. Files are given to workers by a hash of
+   their path, so two entries for the same path are always handled by the
+   same worker, in archive order. Files too large to be worth holding in
+   memory are written by the main thread, once that worker has caught up.
+
+   With io_uring, each worker takes a batch of queued files at a time, and
+   opens, writes and closes the whole batch with one system call for each
+   step. There's no io_uring fchmod or futimens, so those are still made
+   one at a time.
+
+   Sparse files are always written by the main thread, each extent at it's
+   own offset. The file is truncated when it's opened, so whatever isn't
+   written is left as a hole, and it's extended to it's full size at the
+   end, in case it ends in one.
+
+   Hard links are queued for the worker handling the link's path, like any
+   other file, but only once the worker handling the target has written 
+   everything it was given, so the target is there to link to.
+
+   Finished jobs go back on a free list, keeping their path buffer, and
+   their data buffer if it's small, so restoring a tree of small files
+   doesn't call the allocator for every file. Names point into the job's
+   own copy of the path, rather than being copied again.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "restorer.h"
+#include "uring.h"
+#include "archiveio.h"
+#include "stats.h"
+
+/* Files up to this size are read into memory and written by a worker. */
+#define RESTORER_QUEUE_FILE_SIZE (1024 * 1024)
+/* The most file data held in memory at once. */
+#define RESTORER_QUEUE_BYTES (64 * 1024 * 1024)
+/* Larger files are copied through a buffer of this size. */
+#define RESTORER_COPY_SIZE (256 * 1024)
+/* The most files an io_uring worker writes at once. */
+#define RESTORER_BATCH_SIZE 32
+/* Jobs on the free list only keep data buffers up to this size. */
+#define RESTORER_KEEP_DATA_SIZE (64 * 1024)
+
+struct dir_node {
+   struct dir_node *parent;
+   char *name;
+   /* -1 while closed. */
+   int fd;
+   /* Queued files in this folder, and folders being opened inside it.
+      The folder can't be closed while it's in use. */
+   int users;
+   int created;
+   /* Chain in the node table. */
+   struct dir_node *nextInBucket;
+};
+
+struct restore_job {
+   struct restore_job *next;
+   struct dir_node *directory;
+   /* The file name, within memberPath. */
+   char *name;
+   /* The full path, for warnings, followed by the link target's path, 
+      both in paths. */
+   char *memberPath;
+   char *paths;
+   size_t pathsCapacity;
+   int deleting;
+   /* Set for a hard link to targetName, in targetDirectory. */
+   int linking;
+   struct dir_node *targetDirectory;
+   char *targetName;
+   mode_t mode;
+   time_t modifiedTime;
+   char *data;
+   size_t dataCapacity;
+   size_t size;
+};
+
+struct restore_worker {
+   struct restorer *restorer;
+   pthread_t thread;
+   struct restore_job *first;
+   struct restore_job *last;
+   /* Set while a job taken from the queue is being written. */
+   int busy;
+   pthread_cond_t wake;
+};
+
+struct restorer {
+   struct dir_node root;
+
+   /* Nodes by parent and name, only used by the main thread. */
+   struct dir_node **buckets;
+   size_t bucketCount;
+   size_t nodeCount;
+
+   /* Large files are copied through this, by the main thread. */
+   char *copyBuffer;
+
+   /* Open folders, other than the root. */
+   struct dir_node **openNodes;
+   int openCount;
+   int maxOpen;
+   int clockHand;
+
+   struct restore_worker *workers;
+   int workerCount;
+   int useUring;
+
+   /* Protects the job queues, the users counts, and everything below. */
+   pthread_mutex_t lock;
+   /* Signalled when a worker finishes a job. */
+   pthread_cond_t jobDone;
+   size_t queuedBytes;
+   int finishing;
+   long failures;
+   /* Finished jobs, to be used again. */
+   struct restore_job *freeJobs;
+};
+
+static struct restore_job *makeJob(struct restorer *restorer,
+   const char* memberPath, const char* targetPath, mode_t mode, 
+   time_t modifiedTime);
+static struct restore_job *takeJob(struct restorer *restorer,
+   const char* memberPath, const char* targetPath);
+static void poolJob(struct restorer *restorer, struct restore_job *job);
+static int copyFile(struct restorer *restorer, struct restore_job *job,
+   FILE *archiveFile, const struct sparse_extent *extents, size_t count,
+   off_t fileSize);
+static void *workerThread(void *argument);
+static void writeJob(struct restorer *restorer, struct restore_job *job);
+static void writeBatch(struct restorer *restorer, struct uring *ring,
+   struct restore_job **jobs, int count);
+static void finishFile(struct restorer *restorer, struct restore_job *job,
+   int fileDescriptor, int failed);
+static struct dir_node *getDirectory(struct restorer *restorer,
+   char *memberPath, char **name);
+static struct dir_node *findChild(struct restorer *restorer,
+   struct dir_node *parent, const char* name);
+static int openNode(struct restorer *restorer, struct dir_node *node);
+static void closeUnusedNode(struct restorer *restorer);
+static struct restore_worker *workerFor(struct restorer *restorer,
+   struct dir_node *directory, const char* name);
+static void queueJob(struct restorer *restorer, struct restore_job *job);
+static void waitForWorker(struct restorer *restorer,
+   struct restore_worker *worker);
+static void releaseDirectory(struct restorer *restorer,
+   struct dir_node *directory);
+static void reportFailure(struct restorer *restorer, const char* memberPath);
+static void freeJob(struct restorer *restorer, struct restore_job *job);
+
+/*******************************************************************************
+   restorerStart
+      Opens the restore folder, and starts the workers.
+*******************************************************************************/
+struct restorer *restorerStart(const char* restorePath, int threads,
+   int useUring)
+{
+   mkdir(restorePath, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+   int rootFd = open(restorePath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if(rootFd == -1) return NULL;
+
+   struct restorer *restorer = calloc(1, sizeof(struct restorer));
+   if(restorer == NULL) {
+      close(rootFd);
+      return NULL;
+   }
+   restorer->root.fd = rootFd;
+   restorer->root.users = 1;
+   restorer->root.created = 1;
+
+   /* Leave plenty of descriptors for the files being written. */
+   struct rlimit fileLimit;
+   restorer->maxOpen = 256;
+   if(getrlimit(RLIMIT_NOFILE, &fileLimit) == 0
+      && fileLimit.rlim_cur != RLIM_INFINITY
+      && fileLimit.rlim_cur / 4 < (rlim_t)restorer->maxOpen)
+   {
+      restorer->maxOpen = fileLimit.rlim_cur / 4;
+   }
+   if(restorer->maxOpen < 8) restorer->maxOpen = 8;
+
+   if(threads < 1) threads = sysconf(_SC_NPROCESSORS_ONLN);
+   if(threads < 1) threads = 1;
+   restorer->useUring = useUring && uringAvailable();
+
+   restorer->bucketCount = 1024;
+   restorer->buckets = calloc(restorer->bucketCount,
+      sizeof(struct dir_node *));
+   restorer->openNodes = calloc(restorer->maxOpen, sizeof(struct dir_node *));
+   restorer->workers = calloc(threads, sizeof(struct restore_worker));
+   if(restorer->buckets == NULL || restorer->openNodes == NULL
+      || restorer->workers == NULL)
+   {
+      restorerFinish(restorer);
+      return NULL;
+   }
+
+   pthread_mutex_init(&restorer->lock, NULL);
+   pthread_cond_init(&restorer->jobDone, NULL);
+   for(int i = 0; i < threads; i++) {
+      struct restore_worker *worker = &restorer->workers[i];
+      worker->restorer = restorer;
+      pthread_cond_init(&worker->wake, NULL);
+      if(pthread_create(&worker->thread, NULL, workerThread, worker) != 0) {
+         pthread_cond_destroy(&worker->wake);
+         break;
+      }
+      restorer->workerCount++;
+   }
+   if(restorer->workerCount == 0) {
+      restorerFinish(restorer);
+      return NULL;
+   }
+   return restorer;
+}
+
+/*******************************************************************************
+   restorerAddFile
+      Reads a file's data, and queues it for a worker, or writes it here if
+      it's too large.
+*******************************************************************************/
+int restorerAddFile(struct restorer *restorer, const char* memberPath,
+   mode_t mode, time_t modifiedTime, FILE *archiveFile, off_t size)
+{
+   struct restore_job *job 
+      = makeJob(restorer, memberPath, NULL, mode, modifiedTime);
+   if(job == NULL) return -1;
+   job->size = size;
+
+   if(size <= RESTORER_QUEUE_FILE_SIZE) {
+      /* A buffer kept from an earlier file is used if it's big enough, 
+         there's no need to keep it's contents. */
+      if(job->data == NULL || job->dataCapacity < (size_t)size) {
+         free(job->data);
+         job->dataCapacity = size > 0 ? size : 1;
+         job->data = malloc(job->dataCapacity);
+      }
+      if(job->data == NULL
+         || (size > 0 && fread(job->data, size, 1, archiveFile) != 1))
+      {
+         if(job->directory != NULL) {
+            releaseDirectory(restorer, job->directory);
+         }
+         freeJob(restorer, job);
+         return -1;
+      }
+      if(job->directory == NULL || job->name == NULL) {
+         reportFailure(restorer, memberPath);
+         if(job->directory != NULL) {
+            releaseDirectory(restorer, job->directory);
+         }
+         freeJob(restorer, job);
+         return 0;
+      }
+      queueJob(restorer, job);
+      return 0;
+   }
+
+   /* Too large to hold, so copy it through a buffer. */
+   struct sparse_extent whole = { 0, size };
+   return copyFile(restorer, job, archiveFile, &whole, 1, size);
+}
+
+/*******************************************************************************
+   restorerAddSparseFile
+      Writes a sparse file's extents where they belong, leaving the rest
+      as holes.
+*******************************************************************************/
+int restorerAddSparseFile(struct restorer *restorer, const char* memberPath,
+   mode_t mode, time_t modifiedTime, FILE *archiveFile,
+   const struct sparse_map *map, off_t size)
+{
+   struct restore_job *job 
+      = makeJob(restorer, memberPath, NULL, mode, modifiedTime);
+   if(job == NULL) return -1;
+   return copyFile(restorer, job, archiveFile, map->extents, map->count,
+      size);
+}
+
+/*******************************************************************************
+   makeJob
+      Sets up a job for a file, creating the folder it goes in.
+*******************************************************************************/
+static struct restore_job *makeJob(struct restorer *restorer,
+   const char* memberPath, const char* targetPath, mode_t mode, 
+   time_t modifiedTime)
+{
+   struct restore_job *job = takeJob(restorer, memberPath, targetPath);
+   if(job == NULL) return NULL;
+   job->mode = mode;
+   job->modifiedTime = modifiedTime;
+
+   /* The folder is created even if the data turns out to be unreadable,
+      the same as restoring it by hand would. Only separators are changed 
+      in the copy, so the name is at the same place in the job's path. */
+   char *pathCopy = strdupa(memberPath);
+   char *name;
+   job->directory = getDirectory(restorer, pathCopy, &name);
+   if(job->directory != NULL) {
+      job->name = &job->memberPath[name - pathCopy];
+   }
+   return job;
+}
+
+/*******************************************************************************
+   takeJob
+      Takes a job from the free list, or makes a new one, and copies the 
+      paths into it. Everything else is cleared, but the buffers are kept.
+*******************************************************************************/
+static struct restore_job *takeJob(struct restorer *restorer,
+   const char* memberPath, const char* targetPath)
+{
+   pthread_mutex_lock(&restorer->lock);
+   struct restore_job *job = restorer->freeJobs;
+   if(job != NULL) restorer->freeJobs = job->next;
+   pthread_mutex_unlock(&restorer->lock);
+   if(job == NULL) {
+      job = calloc(1, sizeof(struct restore_job));
+      if(job == NULL) return NULL;
+   }
+
+   char *paths = job->paths;
+   size_t pathsCapacity = job->pathsCapacity;
+   char *data = job->data;
+   size_t dataCapacity = job->dataCapacity;
+   memset(job, 0, sizeof(struct restore_job));
+   job->paths = paths;
+   job->pathsCapacity = pathsCapacity;
+   job->data = data;
+   job->dataCapacity = dataCapacity;
+
+   size_t memberLength = strlen(memberPath) + 1;
+   size_t targetLength = targetPath != NULL ? strlen(targetPath) + 1 : 0;
+   if(memberLength + targetLength > job->pathsCapacity) {
+      size_t capacity = memberLength + targetLength > 512 
+         ? memberLength + targetLength : 512;
+      paths = realloc(job->paths, capacity);
+      if(paths == NULL) {
+         freeJob(restorer, job);
+         return NULL;
+      }
+      job->paths = paths;
+      job->pathsCapacity = capacity;
+   }
+   memcpy(job->paths, memberPath, memberLength);
+   if(targetPath != NULL) {
+      memcpy(&job->paths[memberLength], targetPath, targetLength);
+   }
+   job->memberPath = job->paths;
+   return job;
+}
+
+/*******************************************************************************
+   copyFile
+      Copies a file's extents from the archive through a buffer, once
+      anything else for the same path has been written, then frees the job.
+      The data is still read if the file can't be written, so the archive
+      is left at the next header.
+*******************************************************************************/
+static int copyFile(struct restorer *restorer, struct restore_job *job,
+   FILE *archiveFile, const struct sparse_extent *extents, size_t count,
+   off_t fileSize)
+{
+   int result = 0;
+   int fileDescriptor = -1;
+   if(job->directory != NULL && job->name != NULL) {
+      waitForWorker(restorer,
+         workerFor(restorer, job->directory, job->name));
+      uint64_t started = statsStart();
+      fileDescriptor = openat(job->directory->fd, job->name,
+         O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+      statsStop(STATS_OPEN, started);
+   }
+   if(restorer->copyBuffer == NULL) {
+      restorer->copyBuffer = malloc(RESTORER_COPY_SIZE);
+   }
+   char *buffer = restorer->copyBuffer;
+   int writing = fileDescriptor != -1 && buffer != NULL;
+   char discard[4096];
+   for(size_t i = 0; i < count && result == 0; i++) {
+      if(writing && extents[i].offset != 0
+         && lseek(fileDescriptor, extents[i].offset, SEEK_SET) < 0)
+      {
+         writing = 0;
+      }
+      off_t remaining = extents[i].length;
+      while(remaining > 0) {
+         char *target = buffer != NULL ? buffer : discard;
+         size_t targetSize = buffer != NULL ? RESTORER_COPY_SIZE : 4096;
+         size_t chunk = remaining < (off_t)targetSize
+            ? (size_t)remaining : targetSize;
+         if(fread(target, chunk, 1, archiveFile) != 1) {
+            result = -1;
+            break;
+         }
+         if(writing && writeAll(fileDescriptor, target, chunk) != 0) {
+            writing = 0;
+         }
+         remaining -= chunk;
+      }
+   }
+
+   /* Holes at the end aren't written, so set the size. */
+   int sparse = count != 1 || extents[0].length != fileSize;
+   if(writing && result == 0 && sparse
+      && ftruncate(fileDescriptor, fileSize) != 0)
+   {
+      writing = 0;
+   }
+   if(writing && result == 0) {
+      struct timespec times[2];
+      times[0].tv_nsec = UTIME_NOW;
+      times[1].tv_sec = job->modifiedTime;
+      times[1].tv_nsec = 0;
+      if(fchmod(fileDescriptor, job->mode & 07777) != 0
+         || futimens(fileDescriptor, times) != 0)
+      {
+         writing = 0;
+      }
+   }
+   if(fileDescriptor != -1 && close(fileDescriptor) != 0) writing = 0;
+   if(!writing && result == 0) reportFailure(restorer, job->memberPath);
+
+   if(job->directory != NULL) releaseDirectory(restorer, job->directory);
+   freeJob(restorer, job);
+   return result;
+}
+
+/*******************************************************************************
+   restorerLink
+      Queues a hard link to a file restored earlier.
+*******************************************************************************/
+int restorerLink(struct restorer *restorer, const char* memberPath,
+   const char* targetPath)
+{
+   struct restore_job *job = makeJob(restorer, memberPath, targetPath, 0, 0);
+   if(job == NULL) return -1;
+   job->linking = 1;
+   char *pathCopy = strdupa(targetPath);
+   char *name;
+   job->targetDirectory = getDirectory(restorer, pathCopy, &name);
+   if(job->targetDirectory != NULL) {
+      job->targetName 
+         = &job->paths[strlen(memberPath) + 1 + (name - pathCopy)];
+   }
+   if(job->directory == NULL || job->name == NULL
+      || job->targetDirectory == NULL || job->targetName == NULL)
+   {
+      reportFailure(restorer, memberPath);
+      if(job->directory != NULL) releaseDirectory(restorer, job->directory);
+      if(job->targetDirectory != NULL) {
+         releaseDirectory(restorer, job->targetDirectory);
+      }
+      freeJob(restorer, job);
+      return 0;
+   }
+
+   struct restore_worker *targetWorker
+      = workerFor(restorer, job->targetDirectory, job->targetName);
+   if(targetWorker != workerFor(restorer, job->directory, job->name)) {
+      waitForWorker(restorer, targetWorker);
+   }
+   queueJob(restorer, job);
+   return 0;
+}
+
+/*******************************************************************************
+   restorerDelete
+      Queues a file to be deleted.
+*******************************************************************************/
+int restorerDelete(struct restorer *restorer, const char* memberPath) {
+   struct restore_job *job = makeJob(restorer, memberPath, NULL, 0, 0);
+   if(job == NULL) return -1;
+   job->deleting = 1;
+   if(job->directory == NULL || job->name == NULL) {
+      reportFailure(restorer, memberPath);
+      if(job->directory != NULL) releaseDirectory(restorer, job->directory);
+      freeJob(restorer, job);
+      return 0;
+   }
+   queueJob(restorer, job);
+   return 0;
+}
+
+/*******************************************************************************
+   restorerFinish
+      Lets the workers empty their queues, then cleans everything up.
+*******************************************************************************/
+long restorerFinish(struct restorer *restorer) {
+   if(restorer->workerCount > 0) {
+      pthread_mutex_lock(&restorer->lock);
+      restorer->finishing = 1;
+      for(int i = 0; i < restorer->workerCount; i++) {
+         pthread_cond_signal(&restorer->workers[i].wake);
+      }
+      pthread_mutex_unlock(&restorer->lock);
+      for(int i = 0; i < restorer->workerCount; i++) {
+         pthread_join(restorer->workers[i].thread, NULL);
+         pthread_cond_destroy(&restorer->workers[i].wake);
+      }
+      pthread_mutex_destroy(&restorer->lock);
+      pthread_cond_destroy(&restorer->jobDone);
+   }
+
+   for(size_t i = 0; i < restorer->bucketCount && restorer->buckets; i++) {
+      struct dir_node *node = restorer->buckets[i];
+      while(node != NULL) {
+         struct dir_node *next = node->nextInBucket;
+         if(node->fd != -1) close(node->fd);
+         free(node->name);
+         free(node);
+         node = next;
+      }
+   }
+   close(restorer->root.fd);
+
+   while(restorer->freeJobs != NULL) {
+      struct restore_job *job = restorer->freeJobs;
+      restorer->freeJobs = job->next;
+      free(job->paths);
+      free(job->data);
+      free(job);
+   }
+   free(restorer->copyBuffer);
+
+   long failures = restorer->failures;
+   free(restorer->buckets);
+   free(restorer->openNodes);
+   free(restorer->workers);
+   free(restorer);
+   return failures;
+}
+
+/*******************************************************************************
+   workerThread
+      Writes the files in a worker's queue, until there are no more.
+*******************************************************************************/
+static void *workerThread(void *argument) {
+   struct restore_worker *worker = (struct restore_worker *)argument;
+   struct restorer *restorer = worker->restorer;
+
+   struct uring ring;
+   int batchSize = 1;
+   if(restorer->useUring && uringInit(&ring, RESTORER_BATCH_SIZE) == 0) {
+      batchSize = RESTORER_BATCH_SIZE;
+   }
+   struct restore_job *batch[RESTORER_BATCH_SIZE];
+
+   pthread_mutex_lock(&restorer->lock);
+   while(1) {
+      while(worker->first == NULL && !restorer->finishing) {
+         pthread_cond_wait(&worker->wake, &restorer->lock);
+      }
+      if(worker->first == NULL) break;
+
+      /* A batch is written all at once, so it can't have the same path in
+         it twice, and deletes and links are done on their own. */
+      int count = 0;
+      while(worker->first != NULL && count < batchSize) {
+         struct restore_job *job = worker->first;
+         int alone = job->deleting || job->linking;
+         int clash = count > 0 && alone;
+         for(int i = 0; i < count && !clash; i++) {
+            clash = batch[i]->directory == job->directory
+               && strcmp(batch[i]->name, job->name) == 0;
+         }
+         if(clash) break;
+         worker->first = job->next;
+         batch[count++] = job;
+         if(alone) break;
+      }
+      if(worker->first == NULL) worker->last = NULL;
+      worker->busy = 1;
+      pthread_mutex_unlock(&restorer->lock);
+
+      if(count > 1) {
+         writeBatch(restorer, &ring, batch, count);
+      } else {
+         writeJob(restorer, batch[0]);
+      }
+
+      pthread_mutex_lock(&restorer->lock);
+      worker->busy = 0;
+      for(int i = 0; i < count; i++) {
+         restorer->queuedBytes -= batch[i]->size;
+         batch[i]->directory->users--;
+         if(batch[i]->linking) batch[i]->targetDirectory->users--;
+         poolJob(restorer, batch[i]);
+      }
+      pthread_cond_broadcast(&restorer->jobDone);
+   }
+   pthread_mutex_unlock(&restorer->lock);
+   if(batchSize > 1) uringFree(&ring);
+   return NULL;
+}
+
+/*******************************************************************************
+   writeJob
+      Creates, deletes or links a file relative to it's folder.
+*******************************************************************************/
+static void writeJob(struct restorer *restorer, struct restore_job *job) {
+   int directoryFd = job->directory->fd;
+   if(job->deleting) {
+      /* Already gone is fine, that's what was wanted. */
+      if(unlinkat(directoryFd, job->name, 0) != 0 && errno != ENOENT) {
+         reportFailure(restorer, job->memberPath);
+      }
+      return;
+   }
+
+   if(job->linking) {
+      /* Replace whatever is there, as writing a file would. */
+      int targetFd = job->targetDirectory->fd;
+      if(linkat(targetFd, job->targetName, directoryFd, job->name, 0) != 0
+         && (errno != EEXIST
+            || unlinkat(directoryFd, job->name, 0) != 0
+            || linkat(targetFd, job->targetName, directoryFd, job->name, 
+               0) != 0))
+      {
+         reportFailure(restorer, job->memberPath);
+      }
+      return;
+   }
+
+   uint64_t started = statsStart();
+   int fileDescriptor = openat(directoryFd, job->name,
+      O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+   statsStop(STATS_OPEN, started);
+   if(fileDescriptor == -1) {
+      reportFailure(restorer, job->memberPath);
+      return;
+   }
+   int failed = writeAll(fileDescriptor, job->data, job->size) != 0;
+   finishFile(restorer, job, fileDescriptor, failed);
+   if(close(fileDescriptor) != 0 && !failed) {
+      reportFailure(restorer, job->memberPath);
+   }
+}
+
+/*******************************************************************************
+   writeBatch
+      Writes several files through the worker's io_uring, each step for 
+      every file at once.
+*******************************************************************************/
+static void writeBatch(struct restorer *restorer, struct uring *ring,
+   struct restore_job **jobs, int count)
+{
+   int fileDescriptors[RESTORER_BATCH_SIZE];
+   int failed[RESTORER_BATCH_SIZE];
+   uint64_t index;
+   int result;
+
+   for(int i = 0; i < count; i++) {
+      fileDescriptors[i] = -1;
+      failed[i] = uringPrepareOpen(ring, jobs[i]->directory->fd, 
+         jobs[i]->name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 
+         S_IRUSR | S_IWUSR, i) != 0;
+   }
+   uringSubmit(ring, ring->inFlight + ring->unsubmitted);
+   while(uringComplete(ring, &index, &result)) {
+      if(result >= 0) fileDescriptors[index] = result;
+   }
+
+   int writing = 0;
+   for(int i = 0; i < count; i++) {
+      failed[i] = fileDescriptors[i] == -1;
+      if(failed[i] || jobs[i]->size == 0) continue;
+      if(uringPrepareWrite(ring, fileDescriptors[i], jobs[i]->data, 
+         jobs[i]->size, 0, i) == 0) 
+      {
+         writing++;
+      } else {
+         failed[i] = writeAll(fileDescriptors[i], jobs[i]->data, 
+            jobs[i]->size) != 0;
+      }
+   }
+   if(writing > 0) uringSubmit(ring, writing);
+   while(uringComplete(ring, &index, &result)) {
+      struct restore_job *job = jobs[index];
+      if(result < 0) {
+         failed[index] = 1;
+      } else if((size_t)result < job->size) {
+         /* Short write, finish it off the ordinary way. */
+         failed[index] = lseek(fileDescriptors[index], result, SEEK_SET) < 0
+            || writeAll(fileDescriptors[index], &job->data[result], 
+               job->size - result) != 0;
+      }
+   }
+
+   int closing = 0;
+   for(int i = 0; i < count; i++) {
+      if(fileDescriptors[i] == -1) {
+         reportFailure(restorer, jobs[i]->memberPath);
+         continue;
+      }
+      finishFile(restorer, jobs[i], fileDescriptors[i], failed[i]);
+      if(uringPrepareClose(ring, fileDescriptors[i], i) == 0) {
+         closing++;
+      } else {
+         close(fileDescriptors[i]);
+      }
+   }
+   if(closing > 0) uringSubmit(ring, closing);
+   while(uringComplete(ring, &index, &result)) {
+   }
+}
+
+/*******************************************************************************
+   finishFile
+      Sets a written file's permissions and modified time, and reports it
+      if anything has gone wrong.
+*******************************************************************************/
+static void finishFile(struct restorer *restorer, struct restore_job *job,
+   int fileDescriptor, int failed)
+{
+   struct timespec times[2];
+   times[0].tv_nsec = UTIME_NOW;
+   times[1].tv_sec = job->modifiedTime;
+   times[1].tv_nsec = 0;
+   if(failed 
+      || fchmod(fileDescriptor, job->mode & 07777) != 0
+      || futimens(fileDescriptor, times) != 0) 
+   {
+      reportFailure(restorer, job->memberPath);
+   }
+}
+
+/*******************************************************************************
+   getDirectory
+      Finds, creating and opening if needed, the folder a file goes in.
+      memberPath is split up in place, and name is left pointing at the
+      file name. The folder is returned in use, see releaseDirectory.
+      Returns NULL for paths which would leave the restore folder.
+*******************************************************************************/
+static struct dir_node *getDirectory(struct restorer *restorer,
+   char *memberPath, char **name)
+{
+   struct dir_node *node = &restorer->root;
+   char *component = memberPath;
+   while(*component == '/') component++;
+
+   char *separator;
+   while((separator = strchr(component, '/')) != NULL) {
+      *separator = '\0';
+      if(strcmp(component, "..") == 0) return NULL;
+      if(*component != '\0' && strcmp(component, ".") != 0) {
+         node = findChild(restorer, node, component);
+         if(node == NULL) return NULL;
+      }
+      component = separator + 1;
+   }
+   if(*component == '\0' || strcmp(component, "..") == 0
+      || strcmp(component, ".") == 0)
+   {
+      return NULL;
+   }
+   *name = component;
+
+   if(openNode(restorer, node) != 0) return NULL;
+   pthread_mutex_lock(&restorer->lock);
+   node->users++;
+   pthread_mutex_unlock(&restorer->lock);
+   return node;
+}
+
+/*******************************************************************************
+   findChild
+      Looks up a folder's subfolder in the trie, adding it if it's new.
+*******************************************************************************/
+static struct dir_node *findChild(struct restorer *restorer,
+   struct dir_node *parent, const char* name)
+{
+   size_t hash = (size_t)parent * 31;
+   for(const unsigned char *c = (const unsigned char *)name; *c; c++) {
+      hash = hash * 131 + *c;
+   }
+   size_t bucket = hash % restorer->bucketCount;
+   for(struct dir_node *node = restorer->buckets[bucket]; node != NULL;
+      node = node->nextInBucket)
+   {
+      if(node->parent == parent && strcmp(node->name, name) == 0) {
+         return node;
+      }
+   }
+
+   struct dir_node *node = calloc(1, sizeof(struct dir_node));
+   if(node == NULL) return NULL;
+   node->name = strdup(name);
+   if(node->name == NULL) {
+      free(node);
+      return NULL;
+   }
+   node->parent = parent;
+   node->fd = -1;
+   node->nextInBucket = restorer->buckets[bucket];
+   restorer->buckets[bucket] = node;
+   restorer->nodeCount++;
+   return node;
+}
+
+/*******************************************************************************
+   openNode
+      Makes sure a folder exists and is open, opening it's parents first.
+*******************************************************************************/
+static int openNode(struct restorer *restorer, struct dir_node *node) {
+   if(node->fd != -1) return 0;
+   if(openNode(restorer, node->parent) != 0) return -1;
+
+   /* Keep the parent open while it's needed here. */
+   pthread_mutex_lock(&restorer->lock);
+   node->parent->users++;
+   pthread_mutex_unlock(&restorer->lock);
+
+   if(restorer->openCount == restorer->maxOpen) closeUnusedNode(restorer);
+
+   if(!node->created) {
+      mkdirat(node->parent->fd, node->name,
+         S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+      node->created = 1;
+   }
+   node->fd = openat(node->parent->fd, node->name,
+      O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+   pthread_mutex_lock(&restorer->lock);
+   node->parent->users--;
+   pthread_mutex_unlock(&restorer->lock);
+
+   if(node->fd == -1) return -1;
+   restorer->openNodes[restorer->openCount++] = node;
+   return 0;
+}
+
+/*******************************************************************************
+   closeUnusedNode
+      Closes an open folder which nothing is using, waiting for the workers
+      to finish with one if they're all in use.
+*******************************************************************************/
+static void closeUnusedNode(struct restorer *restorer) {
+   pthread_mutex_lock(&restorer->lock);
+   while(1) {
+      for(int i = 0; i < restorer->openCount; i++) {
+         int candidate = (restorer->clockHand + i) % restorer->openCount;
+         struct dir_node *node = restorer->openNodes[candidate];
+         if(node->users > 0) continue;
+
+         close(node->fd);
+         node->fd = -1;
+         restorer->openNodes[candidate]
+            = restorer->openNodes[--restorer->openCount];
+         restorer->clockHand = restorer->openCount > 0
+            ? (candidate + 1) % restorer->openCount : 0;
+         pthread_mutex_unlock(&restorer->lock);
+         return;
+      }
+      pthread_cond_wait(&restorer->jobDone, &restorer->lock);
+   }
+}
+
+static struct restore_worker *workerFor(struct restorer *restorer,
+   struct dir_node *directory, const char* name)
+{
+   size_t hash = (size_t)directory;
+   for(const unsigned char *c = (const unsigned char *)name; *c; c++) {
+      hash = hash * 131 + *c;
+   }
+   return &restorer->workers[hash % restorer->workerCount];
+}
+
+/*******************************************************************************
+   queueJob
+      Gives a job to it's worker, once there's room in memory for it.
+*******************************************************************************/
+static void queueJob(struct restorer *restorer, struct restore_job *job) {
+   struct restore_worker *worker
+      = workerFor(restorer, job->directory, job->name);
+
+   pthread_mutex_lock(&restorer->lock);
+   while(restorer->queuedBytes > 0
+      && restorer->queuedBytes + job->size > RESTORER_QUEUE_BYTES)
+   {
+      pthread_cond_wait(&restorer->jobDone, &restorer->lock);
+   }
+   restorer->queuedBytes += job->size;
+   if(worker->last != NULL) {
+      worker->last->next = job;
+   } else {
+      worker->first = job;
+   }
+   worker->last = job;
+   pthread_cond_signal(&worker->wake);
+   pthread_mutex_unlock(&restorer->lock);
+}
+
+static void waitForWorker(struct restorer *restorer,
+   struct restore_worker *worker)
+{
+   pthread_mutex_lock(&restorer->lock);
+   while(worker->first != NULL || worker->busy) {
+      pthread_cond_wait(&restorer->jobDone, &restorer->lock);
+   }
+   pthread_mutex_unlock(&restorer->lock);
+}
+
+static void releaseDirectory(struct restorer *restorer,
+   struct dir_node *directory)
+{
+   pthread_mutex_lock(&restorer->lock);
+   directory->users--;
+   pthread_mutex_unlock(&restorer->lock);
+}
+
+static void reportFailure(struct restorer *restorer, const char* memberPath) {
+   printf("Warning: Unable to restore \"%s\".\n", memberPath);
+   pthread_mutex_lock(&restorer->lock);
+   restorer->failures++;
+   pthread_mutex_unlock(&restorer->lock);
+}
+
+/*******************************************************************************
+   freeJob
+      Puts a job back on the free list.
+*******************************************************************************/
+static void freeJob(struct restorer *restorer, struct restore_job *job) {
+   pthread_mutex_lock(&restorer->lock);
+   poolJob(restorer, job);
+   pthread_mutex_unlock(&restorer->lock);
+}
+
+/* Called with the lock held. */
+static void poolJob(struct restorer *restorer, struct restore_job *job) {
+   if(job->dataCapacity > RESTORER_KEEP_DATA_SIZE) {
+      free(job->data);
+      job->data = NULL;
+      job->dataCapacity = 0;
+   }
+   job->next = restorer->freeJobs;
+   restorer->freeJobs = job;
+}
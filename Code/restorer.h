@@ -0,0 +1,63 @@
+/*******************************************************************************
+
+   File        : restorer.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Parallel file extraction for restore, with a cache of the
+                 directories already created.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.01 - io_uring writes.
+                 16/10/2026 - v1.02 - Sparse files.
+                 16/10/2026 - v1.03 - Hard links.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef RESTORER_H
+#define RESTORER_H
+
+#include <sys/types.h>
+#include <stdio.h>
+
+#include "sparse.h"
+
+struct restorer;
+
+/* Creates restorePath if needed, and starts threads writing files into it.
+   threads of 0 means one per processor. With useUring, the threads write
+   files in batches through io_uring, if the kernel supports it.
+   Returns NULL if the folder or the threads couldn't be created. */
+struct restorer *restorerStart(const char* restorePath, int threads,
+   int useUring);
+
+/* Restores a file from the next size bytes of archiveFile. The data is
+   read before this returns, the file may be written later.
+   Files restored to the same path are always written in the order given.
+   Returns -1 if the archive couldn't be read. */
+int restorerAddFile(struct restorer *restorer, const char* memberPath,
+   mode_t mode, time_t modifiedTime, FILE *archiveFile, off_t size);
+
+/* Restores a sparse file, reading the data for each extent in the map from
+   archiveFile, and leaving holes everywhere else. size is the size of the
+   whole file. Returns -1 if the archive couldn't be read. */
+int restorerAddSparseFile(struct restorer *restorer, const char* memberPath,
+   mode_t mode, time_t modifiedTime, FILE *archiveFile,
+   const struct sparse_map *map, off_t size);
+
+/* Links memberPath to a file restored earlier, once it's been written.
+   Returns -1 if out of memory. */
+int restorerLink(struct restorer *restorer, const char* memberPath,
+   const char* targetPath);
+
+/* Deletes a file, after anything restored to the same path before it.
+   Returns -1 if out of memory. */
+int restorerDelete(struct restorer *restorer, const char* memberPath);
+
+/* Waits for every file to be written, stops the threads and frees the
+   restorer. Returns the number of files which couldn't be restored. */
+long restorerFinish(struct restorer *restorer);
+
+#endif
@@ -0,0 +1,195 @@
+/*******************************************************************************
+
+   File        : sparse.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Finding the holes in sparse files, and the GNU tar sparse
+                 map stored with them in the archive.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   Files with holes, such as VM images and preallocated databases, read
+   back as zeros where the holes are, so archiving them byte for byte means
+   reading and storing all those zeros. The file system will say where the
+   data is with SEEK_DATA and SEEK_HOLE, so only that needs archiving, along
+   with a map of where it goes.
+
+   The map is GNU tar's sparse format 1.0, so GNU tar can extract the file
+   too. The archived data starts with the number of extents, then the
+   offset and length of each one, all as decimal numbers on their own
+   lines, padded to a 512 byte block, and then the extents' data, one after
+   another. If the file ends in a hole, the last extent is an empty one at
+   the end of the file, so the file can be extended to the right size.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "sparse.h"
+
+/* The most extents a map in an archive is allowed to have, so a corrupt
+   one can't ask for unlimited memory. */
+#define SPARSE_MAX_EXTENTS (16 * 1024 * 1024)
+
+static int addExtent(struct sparse_map *map, off_t offset, off_t length);
+static int readNumber(FILE *file, char block[512], size_t *position,
+   off_t *mapLength, off_t *value);
+
+/*******************************************************************************
+   sparseMapFile
+      Walks a file's data with SEEK_DATA and SEEK_HOLE.
+*******************************************************************************/
+int sparseMapFile(int fd, off_t size, struct sparse_map *map) {
+   memset(map, 0, sizeof(struct sparse_map));
+
+   off_t offset = 0;
+   while(offset < size) {
+      off_t data = lseek(fd, offset, SEEK_DATA);
+      if(data == -1) {
+         /* Past the last data, the rest is a hole. */
+         if(errno == ENXIO) break;
+         /* Not supported here, so treat it like any other file. */
+         sparseFree(map);
+         lseek(fd, 0, SEEK_SET);
+         return 1;
+      }
+      if(data >= size) break;
+      off_t hole = lseek(fd, data, SEEK_HOLE);
+      if(hole == -1 || hole > size) hole = size;
+      if(addExtent(map, data, hole - data) != 0) {
+         sparseFree(map);
+         lseek(fd, 0, SEEK_SET);
+         return -1;
+      }
+      offset = hole;
+   }
+   lseek(fd, 0, SEEK_SET);
+
+   /* All data, nothing to gain. */
+   if(map->count == 1 && map->extents[0].offset == 0
+      && map->extents[0].length == size)
+   {
+      sparseFree(map);
+      return 1;
+   }
+
+   struct sparse_extent *last
+      = map->count > 0 ? &map->extents[map->count - 1] : NULL;
+   if((last == NULL || last->offset + last->length < size)
+      && addExtent(map, size, 0) != 0)
+   {
+      sparseFree(map);
+      return -1;
+   }
+   return 0;
+}
+
+/*******************************************************************************
+   sparseMapText
+      Formats a map for the archive.
+*******************************************************************************/
+size_t sparseMapText(const struct sparse_map *map, char **text) {
+   /* Each number is at most 19 digits and a new line. */
+   size_t capacity = (map->count * 2 + 1) * 20 + 512;
+   char *buffer = malloc(capacity);
+   if(buffer == NULL) return 0;
+
+   size_t length = sprintf(buffer, "%zu\n", map->count);
+   for(size_t i = 0; i < map->count; i++) {
+      length += sprintf(&buffer[length], "%lld\n%lld\n",
+         (long long)map->extents[i].offset,
+         (long long)map->extents[i].length);
+   }
+   size_t padded = (length + 511) / 512 * 512;
+   memset(&buffer[length], 0, padded - length);
+   *text = buffer;
+   return padded;
+}
+
+/*******************************************************************************
+   sparseReadMap
+      Reads the map in front of a sparse file's data, a block at a time.
+*******************************************************************************/
+int sparseReadMap(FILE *file, struct sparse_map *map, off_t *mapLength) {
+   memset(map, 0, sizeof(struct sparse_map));
+   char block[512];
+   size_t position = 512;
+   *mapLength = 0;
+
+   off_t count;
+   if(readNumber(file, block, &position, mapLength, &count) != 0
+      || count > SPARSE_MAX_EXTENTS)
+   {
+      return -1;
+   }
+   for(off_t i = 0; i < count; i++) {
+      off_t offset;
+      off_t length;
+      if(readNumber(file, block, &position, mapLength, &offset) != 0
+         || readNumber(file, block, &position, mapLength, &length) != 0
+         || addExtent(map, offset, length) != 0)
+      {
+         sparseFree(map);
+         return -1;
+      }
+   }
+   return 0;
+}
+
+void sparseFree(struct sparse_map *map) {
+   free(map->extents);
+   memset(map, 0, sizeof(struct sparse_map));
+}
+
+static int addExtent(struct sparse_map *map, off_t offset, off_t length) {
+   if(map->count == map->capacity) {
+      size_t capacity = map->capacity > 0 ? map->capacity * 2 : 16;
+      struct sparse_extent *extents = realloc(map->extents,
+         capacity * sizeof(struct sparse_extent));
+      if(extents == NULL) return -1;
+      map->extents = extents;
+      map->capacity = capacity;
+   }
+   map->extents[map->count].offset = offset;
+   map->extents[map->count].length = length;
+   map->count++;
+   map->dataSize += length;
+   return 0;
+}
+
+/*******************************************************************************
+   readNumber
+      Reads a decimal number and the new line after it, reading another
+      block of the map when the current one runs out.
+*******************************************************************************/
+static int readNumber(FILE *file, char block[512], size_t *position,
+   off_t *mapLength, off_t *value)
+{
+   int digits = 0;
+   *value = 0;
+   for(;;) {
+      if(*position == 512) {
+         if(fread(block, 512, 1, file) != 1) return -1;
+         *mapLength += 512;
+         *position = 0;
+      }
+      char c = block[(*position)++];
+      if(c == '\n') return digits > 0 ? 0 : -1;
+      if(c < '0' || c > '9' || ++digits > 18) return -1;
+      *value = *value * 10 + (c - '0');
+   }
+}
@@ -0,0 +1,55 @@
+/*******************************************************************************
+
+   File        : sparse.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Finding the holes in sparse files, and the GNU tar sparse
+                 map stored with them in the archive.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <sys/types.h>
+#include <stdio.h>
+
+/* A run of data in a file, everything between runs is a hole. */
+struct sparse_extent {
+   off_t offset;
+   off_t length;
+};
+
+struct sparse_map {
+   struct sparse_extent *extents;
+   size_t count;
+   size_t capacity;
+   /* The total length of the extents, which is all that's archived. */
+   off_t dataSize;
+};
+
+/* Finds the data in the first size bytes of an open file, leaving it
+   positioned at the start.
+   Returns 0 if the file has holes, 1 if it hasn't (or the file system
+   can't say), and -1 if out of memory. The map is empty unless 0 is
+   returned. */
+int sparseMapFile(int fd, off_t size, struct sparse_map *map);
+
+/* Formats a map the way GNU tar's sparse format 1.0 stores it, in front of
+   the data: decimal numbers, one per line, padded with zeros to a 512 byte
+   block. Returns the padded length, or 0 if out of memory. */
+size_t sparseMapText(const struct sparse_map *map, char **text);
+
+/* Reads a map written by sparseMapText, leaving the file at the data.
+   mapLength is set to the number of bytes read.
+   Returns -1 if the map is corrupt or the file ends. */
+int sparseReadMap(FILE *file, struct sparse_map *map, off_t *mapLength);
+
+void sparseFree(struct sparse_map *map);
+
+#endif
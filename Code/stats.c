@@ -0,0 +1,303 @@
+/*******************************************************************************
+
+   File        : stats.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Per-phase timers and counters, for the --stats report.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.01 - Page cache use.
+                 16/10/2026 - v1.02 - Throttling.
+                 16/10/2026 - v1.03 - Excluded entries.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   Each thread records into it's own block of counters, found through a
+   thread local pointer, so recording never takes a lock or shares a cache
+   line. Blocks are added to a list the first time a thread records
+   anything, and are only added up when the report is printed, once the
+   threads are done. They're never freed, the report is the last thing a
+   tool does.
+
+   Times come from the monotonic clock, which is read without a system call.
+   With stats off, statsStart returns 0 before reading it, and statsStop
+   returns as soon as it sees that, so the cost is a function call.
+
+   Latencies are counted in powers of two of microseconds, the first bucket
+   is anything under 1us, and bucket n anything under 2^n us, up to the
+   last, which holds anything slower.
+
+   The page cache's size comes from /proc/meminfo when stats are enabled,
+   and again for the report. Anything else running changes it too, so it's
+   only a rough guide, but it shows the difference --cache makes.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+#include "idcache.h"
+
+#define STATS_BUCKETS 24
+/* Phases with a latency histogram. */
+#define STATS_HISTOGRAMS 2
+
+struct thread_stats {
+   uint64_t calls[STATS_PHASE_COUNT];
+   uint64_t nanoseconds[STATS_PHASE_COUNT];
+   uint64_t histograms[STATS_HISTOGRAMS][STATS_BUCKETS];
+   uint64_t counters[STATS_COUNTER_COUNT];
+   struct thread_stats *next;
+};
+
+static const char *phaseNames[STATS_PHASE_COUNT] = {
+   "walk", "stat", "lookup", "open", "read", "format", "compress", "write",
+   "throttle"
+};
+static const char *counterNames[STATS_COUNTER_COUNT] = {
+   "directories", "entries", "excluded", "files", "bytes_read",
+   "bytes_written", "bytes_uncached"
+};
+static const enum stats_phase histogramPhases[STATS_HISTOGRAMS] = {
+   STATS_OPEN, STATS_READ
+};
+
+static int enabled = 0;
+static uint64_t enabledAt;
+static long long cachedAtStart;
+static struct thread_stats *threads = NULL;
+static pthread_mutex_t threadsLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct thread_stats *ownStats = NULL;
+
+static struct thread_stats *getOwnStats();
+static uint64_t now();
+static long long pageCacheSize();
+static int bucketFor(uint64_t nanoseconds);
+static void printTable(const char* tool, const struct thread_stats *total,
+   int threadCount, double seconds, long long cacheGrowth);
+static void printJson(const char* tool, const struct thread_stats *total,
+   int threadCount, double seconds, long long cacheGrowth);
+
+void statsEnable() {
+   cachedAtStart = pageCacheSize();
+   enabledAt = now();
+   enabled = 1;
+}
+
+uint64_t statsStart() {
+   return enabled ? now() : 0;
+}
+
+void statsStop(enum stats_phase phase, uint64_t started) {
+   if(started == 0) return;
+   uint64_t elapsed = now() - started;
+   struct thread_stats *stats = getOwnStats();
+   if(stats == NULL) return;
+   stats->calls[phase]++;
+   stats->nanoseconds[phase] += elapsed;
+   for(int i = 0; i < STATS_HISTOGRAMS; i++) {
+      if(histogramPhases[i] == phase) {
+         stats->histograms[i][bucketFor(elapsed)]++;
+      }
+   }
+}
+
+void statsAdd(enum stats_counter counter, uint64_t amount) {
+   if(!enabled) return;
+   struct thread_stats *stats = getOwnStats();
+   if(stats != NULL) stats->counters[counter] += amount;
+}
+
+/*******************************************************************************
+   statsReport
+      Adds up every thread's counters, and prints them.
+*******************************************************************************/
+void statsReport(const char* tool, int json) {
+   if(!enabled) return;
+   double seconds = (now() - enabledAt) / 1e9;
+   long long cacheGrowth = pageCacheSize() - cachedAtStart;
+
+   struct thread_stats total;
+   memset(&total, 0, sizeof(struct thread_stats));
+   int threadCount = 0;
+   pthread_mutex_lock(&threadsLock);
+   for(struct thread_stats *stats = threads; stats != NULL;
+      stats = stats->next)
+   {
+      for(int i = 0; i < STATS_PHASE_COUNT; i++) {
+         total.calls[i] += stats->calls[i];
+         total.nanoseconds[i] += stats->nanoseconds[i];
+      }
+      for(int i = 0; i < STATS_HISTOGRAMS; i++) {
+         for(int j = 0; j < STATS_BUCKETS; j++) {
+            total.histograms[i][j] += stats->histograms[i][j];
+         }
+      }
+      for(int i = 0; i < STATS_COUNTER_COUNT; i++) {
+         total.counters[i] += stats->counters[i];
+      }
+      threadCount++;
+   }
+   pthread_mutex_unlock(&threadsLock);
+
+   fflush(stdout);
+   if(json) {
+      printJson(tool, &total, threadCount, seconds, cacheGrowth);
+   } else {
+      printTable(tool, &total, threadCount, seconds, cacheGrowth);
+   }
+   fflush(stderr);
+}
+
+/*******************************************************************************
+   printTable
+      The report for people.
+*******************************************************************************/
+static void printTable(const char* tool, const struct thread_stats *total,
+   int threadCount, double seconds, long long cacheGrowth)
+{
+   fprintf(stderr, "\n%s statistics, %.3fs, %d threads recording:\n",
+      tool, seconds, threadCount);
+   fprintf(stderr, "%-10s %12s %12s %12s\n", "phase", "calls", "seconds",
+      "mean us");
+   for(int i = 0; i < STATS_PHASE_COUNT; i++) {
+      if(total->calls[i] == 0) continue;
+      fprintf(stderr, "%-10s %12llu %12.3f %12.1f\n", phaseNames[i],
+         (unsigned long long)total->calls[i], total->nanoseconds[i] / 1e9,
+         total->nanoseconds[i] / 1e3 / total->calls[i]);
+   }
+
+   fprintf(stderr, "\n");
+   for(int i = 0; i < STATS_COUNTER_COUNT; i++) {
+      fprintf(stderr, "%-14s %llu\n", counterNames[i],
+         (unsigned long long)total->counters[i]);
+   }
+   struct id_cache_stats cacheStats;
+   idCacheStats(&cacheStats);
+   fprintf(stderr, "%-14s %lu hits, %lu misses\n", "name lookups",
+      cacheStats.hits, cacheStats.misses);
+   /* What a normal run would have added, less what this one did. */
+   uint64_t moved = total->counters[STATS_BYTES_READ]
+      + total->counters[STATS_BYTES_WRITTEN];
+   fprintf(stderr, "%-14s %+lld bytes, %llu of %llu read and written kept "
+      "out\n", "page cache", cacheGrowth,
+      (unsigned long long)total->counters[STATS_BYTES_UNCACHED],
+      (unsigned long long)moved);
+
+   for(int i = 0; i < STATS_HISTOGRAMS; i++) {
+      if(total->calls[histogramPhases[i]] == 0) continue;
+      fprintf(stderr, "\n%s latency:\n", phaseNames[histogramPhases[i]]);
+      for(int j = 0; j < STATS_BUCKETS; j++) {
+         if(total->histograms[i][j] == 0) continue;
+         if(j < STATS_BUCKETS - 1) {
+            fprintf(stderr, "   < %8lluus %12llu\n", 1ULL << j,
+               (unsigned long long)total->histograms[i][j]);
+         } else {
+            fprintf(stderr, "   >=%8lluus %12llu\n", 1ULL << (j - 1),
+               (unsigned long long)total->histograms[i][j]);
+         }
+      }
+   }
+}
+
+/*******************************************************************************
+   printJson
+      The report for monitoring, on one line. Every phase, counter and
+      bucket is always there, even if it's 0, so the shape never changes.
+      bounds_us holds the upper bound of each bucket but the last.
+*******************************************************************************/
+static void printJson(const char* tool, const struct thread_stats *total,
+   int threadCount, double seconds, long long cacheGrowth)
+{
+   fprintf(stderr, "{\"tool\":\"%s\",\"seconds\":%.6f,\"threads\":%d,"
+      "\"phases\":{", tool, seconds, threadCount);
+   for(int i = 0; i < STATS_PHASE_COUNT; i++) {
+      fprintf(stderr, "%s\"%s\":{\"calls\":%llu,\"seconds\":%.6f}",
+         i > 0 ? "," : "", phaseNames[i],
+         (unsigned long long)total->calls[i], total->nanoseconds[i] / 1e9);
+   }
+
+   fprintf(stderr, "},\"counters\":{");
+   for(int i = 0; i < STATS_COUNTER_COUNT; i++) {
+      fprintf(stderr, "%s\"%s\":%llu", i > 0 ? "," : "", counterNames[i],
+         (unsigned long long)total->counters[i]);
+   }
+   struct id_cache_stats cacheStats;
+   idCacheStats(&cacheStats);
+   fprintf(stderr, "},\"lookups\":{\"hits\":%lu,\"misses\":%lu}",
+      cacheStats.hits, cacheStats.misses);
+   fprintf(stderr, ",\"page_cache_growth\":%lld", cacheGrowth);
+
+   fprintf(stderr, ",\"histograms\":{");
+   for(int i = 0; i < STATS_HISTOGRAMS; i++) {
+      fprintf(stderr, "%s\"%s\":{\"bounds_us\":[", i > 0 ? "," : "",
+         phaseNames[histogramPhases[i]]);
+      for(int j = 0; j < STATS_BUCKETS - 1; j++) {
+         fprintf(stderr, "%s%llu", j > 0 ? "," : "", 1ULL << j);
+      }
+      fprintf(stderr, "],\"counts\":[");
+      for(int j = 0; j < STATS_BUCKETS; j++) {
+         fprintf(stderr, "%s%llu", j > 0 ? "," : "",
+            (unsigned long long)total->histograms[i][j]);
+      }
+      fprintf(stderr, "]}");
+   }
+   fprintf(stderr, "}}\n");
+}
+
+/*******************************************************************************
+   getOwnStats
+      The calling thread's counters, made the first time it records.
+      Returns NULL if out of memory, and what would have been recorded is
+      lost.
+*******************************************************************************/
+static struct thread_stats *getOwnStats() {
+   if(ownStats != NULL) return ownStats;
+   ownStats = calloc(1, sizeof(struct thread_stats));
+   if(ownStats == NULL) return NULL;
+   pthread_mutex_lock(&threadsLock);
+   ownStats->next = threads;
+   threads = ownStats;
+   pthread_mutex_unlock(&threadsLock);
+   return ownStats;
+}
+
+static uint64_t now() {
+   struct timespec time;
+   clock_gettime(CLOCK_MONOTONIC, &time);
+   return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static int bucketFor(uint64_t nanoseconds) {
+   uint64_t microseconds = nanoseconds / 1000;
+   int bucket = 0;
+   while(microseconds > 0 && bucket < STATS_BUCKETS - 1) {
+      microseconds >>= 1;
+      bucket++;
+   }
+   return bucket;
+}
+
+/* The "Cached:" line of /proc/meminfo, in bytes, or 0 if it can't be read. */
+static long long pageCacheSize() {
+   FILE *meminfo = fopen("/proc/meminfo", "r");
+   if(meminfo == NULL) return 0;
+   char line[256];
+   long long kilobytes = 0;
+   while(fgets(line, sizeof(line), meminfo) != NULL) {
+      if(sscanf(line, "Cached: %lld kB", &kilobytes) == 1) break;
+   }
+   fclose(meminfo);
+   return kilobytes * 1024;
+}
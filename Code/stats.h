@@ -0,0 +1,79 @@
+/*******************************************************************************
+
+   File        : stats.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Per-phase timers and counters, for the --stats report.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.01 - Page cache use.
+                 16/10/2026 - v1.02 - Throttling.
+                 16/10/2026 - v1.03 - Excluded entries.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/* Where the time goes. Time is added up over every thread, so phases run
+   in parallel can add up to more than the time taken. */
+enum stats_phase {
+   /* opendir, readdir and closedir. */
+   STATS_WALK,
+   STATS_STAT,
+   /* User and group names, only the lookups which miss the cache. */
+   STATS_LOOKUP,
+   /* Opening files to read, or creating them when restoring. */
+   STATS_OPEN,
+   STATS_READ,
+   /* Making tar headers, or listing lines. */
+   STATS_FORMAT,
+   STATS_COMPRESS,
+   /* Writing the archive, the listing, or restored files. */
+   STATS_WRITE,
+   /* Held back by --limit-rate, or backing off, see throttle.c. */
+   STATS_THROTTLE,
+   STATS_PHASE_COUNT
+};
+
+enum stats_counter {
+   STATS_DIRECTORIES,
+   /* Everything the walker found, folders included. */
+   STATS_ENTRIES,
+   /* Entries skipped by exclude rules, a folder counting once. */
+   STATS_EXCLUDED,
+   /* Files listed, archived or restored. */
+   STATS_FILES,
+   STATS_BYTES_READ,
+   STATS_BYTES_WRITTEN,
+   /* Bytes read or written which were dropped from the page cache after,
+      or never went through it, see pagecache.c. */
+   STATS_BYTES_UNCACHED,
+   STATS_COUNTER_COUNT
+};
+
+/* Starts the clock, and turns recording on. Until it's called, everything
+   below does nothing. */
+void statsEnable();
+
+/* The time a phase started, or 0 if stats aren't enabled. */
+uint64_t statsStart();
+
+/* Adds the time since started to a phase. Opens and reads are also added
+   to a latency histogram. */
+void statsStop(enum stats_phase phase, uint64_t started);
+
+void statsAdd(enum stats_counter counter, uint64_t amount);
+
+/* Prints the totals from every thread to stderr, as a table, or as a
+   single line of JSON, along with how much the page cache grew by while
+   enabled. Every thread that recorded anything must have
+   finished. */
+void statsReport(const char* tool, int json);
+
+#endif
@@ -0,0 +1,257 @@
+/*******************************************************************************
+
+   File        : tarheader.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Tar header blocks, and encoding and decoding their numbers
+                 and checksums.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   Every member has a header made and read, so the numbers in them are
+   turned to and from octal without sprintf, or a loop per digit. Octal
+   digits are 3 bits each, so 8 of them fit in 24 bits, and spreading those
+   bits out to one digit per byte of a 64 bit word is 3 shift, or and mask
+   steps, each one halving the width of the pieces. Adding '0' to every byte
+   at once then makes them characters. Reading is the same steps backwards,
+   after checking every byte of the word is a digit at once, and finding
+   where the digits stop from the first byte which isn't one.
+
+   Words are worked on with the first character in the lowest byte, so
+   they're byte swapped on big endian machines as they're loaded and
+   stored.
+
+   Checksums add the header up 8 bytes at a time, as 4 lanes of 16 bits,
+   with the odd and even bytes kept apart until the end, neither of which
+   can overflow a lane in 512 bytes, then add the lanes together.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include "tarheader.h"
+
+#define TAR_BLOCK_SIZE 512
+
+#define ONES 0x0101010101010101ULL
+
+static int fitsDigits(int64_t value, size_t digits);
+static uint64_t loadWord(const void *bytes);
+static void storeWord(void *bytes, uint64_t word);
+static uint64_t octalWord(uint64_t value);
+static int leadingOctalDigits(uint64_t word);
+static uint64_t octalValue(uint64_t word, int digits);
+static void putBase256(char *field, size_t fieldSize, int64_t value);
+static int64_t getBase256(const char *field, size_t fieldSize);
+static unsigned int sumBlock(const unsigned char *block);
+
+/*******************************************************************************
+   tarPutNumber
+      Up to 22 digits are made, 8 at a time, and as many as are needed
+      copied into the field.
+*******************************************************************************/
+void tarPutNumber(char *field, size_t fieldSize, size_t digits,
+   int64_t value)
+{
+   if(value >= 0 && !fitsDigits(value, digits)) digits = fieldSize - 1;
+   if(value < 0 || !fitsDigits(value, digits)) {
+      putBase256(field, fieldSize, value);
+      return;
+   }
+
+   char text[24];
+   storeWord(&text[0], octalWord((uint64_t)value >> 48));
+   storeWord(&text[8], octalWord((uint64_t)value >> 24));
+   storeWord(&text[16], octalWord((uint64_t)value));
+   memcpy(field, &text[24 - digits], digits);
+   field[digits] = ' ';
+   if(digits + 1 < fieldSize) field[digits + 1] = '\0';
+}
+
+/*******************************************************************************
+   tarGetNumber
+      Reads 8 characters at a time while they're all digits. The last word
+      read is the field's last 8 bytes, shifted to drop those already read,
+      so nothing past the field is read.
+*******************************************************************************/
+int64_t tarGetNumber(const char *field, size_t fieldSize) {
+   if((unsigned char)field[0] & 0x80) return getBase256(field, fieldSize);
+
+   size_t position = 0;
+   while(position < fieldSize && field[position] == ' ') position++;
+
+   uint64_t value = 0;
+   while(position < fieldSize) {
+      uint64_t word;
+      if(fieldSize - position >= 8) {
+         word = loadWord(&field[position]);
+      } else if(fieldSize >= 8) {
+         /* The field's last 8 bytes, less those already read. */
+         word = loadWord(&field[fieldSize - 8])
+            >> (8 * (8 - (fieldSize - position)));
+      } else {
+         char last[8] = { 0 };
+         memcpy(last, &field[position], fieldSize - position);
+         word = loadWord(last);
+      }
+      int digits = leadingOctalDigits(word);
+      if(digits == 0) break;
+      value = (value << (3 * digits)) | octalValue(word, digits);
+      if(digits < 8) break;
+      position += 8;
+   }
+   return (int64_t)value;
+}
+
+/*******************************************************************************
+   tarSetChecksum
+      The checksum field is counted as spaces, and written as 6 digits, a
+      null, and a space, like the original tar.
+*******************************************************************************/
+void tarSetChecksum(struct tar_header_block *header) {
+   memset(header->checksum, ' ', sizeof(header->checksum));
+   unsigned int checksum = sumBlock((const unsigned char *)header);
+   tarPutNumber(header->checksum, sizeof(header->checksum), 6, checksum);
+   header->checksum[6] = '\0';
+   header->checksum[7] = ' ';
+}
+
+/*******************************************************************************
+   tarVerifyChecksum
+      Some old tars added the bytes up as signed chars, so that's accepted
+      too, it's only worked out if the usual sum doesn't match.
+*******************************************************************************/
+int tarVerifyChecksum(const struct tar_header_block *header) {
+   int64_t stored = tarGetNumber(header->checksum, sizeof(header->checksum));
+
+   unsigned int checksum = sumBlock((const unsigned char *)header);
+   for(size_t i = 0; i < sizeof(header->checksum); i++) {
+      checksum += ' ' - (unsigned char)header->checksum[i];
+   }
+   if(checksum == stored) return 1;
+
+   const signed char *bytes = (const signed char *)header;
+   size_t checksumStart = offsetof(struct tar_header_block, checksum);
+   int signedChecksum = ' ' * sizeof(header->checksum);
+   for(size_t i = 0; i < TAR_BLOCK_SIZE; i++) {
+      if(i < checksumStart || i >= checksumStart + sizeof(header->checksum)) {
+         signedChecksum += bytes[i];
+      }
+   }
+   return signedChecksum == stored;
+}
+
+/* Whether a non negative value fits in so many octal digits. */
+static int fitsDigits(int64_t value, size_t digits) {
+   return digits >= 21 || (uint64_t)value >> (3 * digits) == 0;
+}
+
+static uint64_t loadWord(const void *bytes) {
+   uint64_t word;
+   memcpy(&word, bytes, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+   word = __builtin_bswap64(word);
+#endif
+   return word;
+}
+
+static void storeWord(void *bytes, uint64_t word) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+   word = __builtin_bswap64(word);
+#endif
+   memcpy(bytes, &word, sizeof(word));
+}
+
+/*******************************************************************************
+   octalWord
+      The low 24 bits of value as 8 octal digits, most significant digit
+      first in memory order, so the lowest byte of the little endian word
+      returned.
+*******************************************************************************/
+static uint64_t octalWord(uint64_t value) {
+   uint64_t word = value & 0xFFFFFF;
+   word = (word | (word << 20)) & 0x00000FFF00000FFFULL;
+   word = (word | (word << 10)) & 0x003F003F003F003FULL;
+   word = (word | (word << 5)) & 0x0707070707070707ULL;
+   /* Lowest digit is in the lowest byte now, it's wanted last. */
+   return __builtin_bswap64(word) + '0' * ONES;
+}
+
+/*******************************************************************************
+   leadingOctalDigits
+      A byte is a digit if it's top 5 bits match '0'. Those that don't are
+      left non zero by the xor, and the high bit of each non zero byte is
+      found without carries between bytes.
+*******************************************************************************/
+static int leadingOctalDigits(uint64_t word) {
+   uint64_t misses = (word & (0xF8 * ONES)) ^ ('0' * ONES);
+   misses = (((misses & (0x7F * ONES)) + 0x7F * ONES) | misses) & (0x80 * ONES);
+   return misses == 0 ? 8 : __builtin_ctzll(misses) >> 3;
+}
+
+/*******************************************************************************
+   octalValue
+      The value of the first digits characters of word, which must be 1 to 8.
+      They're moved to the top of the word and byte swapped, leaving the
+      last digit in the lowest byte, then packed back together.
+*******************************************************************************/
+static uint64_t octalValue(uint64_t word, int digits) {
+   word &= 0x07 * ONES;
+   word <<= 8 * (8 - digits);
+   word = __builtin_bswap64(word);
+   word = (word | (word >> 5)) & 0x003F003F003F003FULL;
+   word = (word | (word >> 10)) & 0x00000FFF00000FFFULL;
+   word = (word | (word >> 20)) & 0xFFFFFF;
+   return word;
+}
+
+/*******************************************************************************
+   putBase256
+      The first byte is 0x80 for positive numbers, 0xFF for negative, the
+      number fills the rest of the field, high byte first.
+*******************************************************************************/
+static void putBase256(char *field, size_t fieldSize, int64_t value) {
+   uint64_t bits = (uint64_t)value;
+   for(size_t i = fieldSize - 1; i > 0; i--) {
+      field[i] = (char)(bits & 0xFF);
+      bits = value < 0 ? (bits >> 8) | 0xFF00000000000000ULL : bits >> 8;
+   }
+   field[0] = value < 0 ? (char)0xFF : (char)0x80;
+}
+
+static int64_t getBase256(const char *field, size_t fieldSize) {
+   const unsigned char *bytes = (const unsigned char *)field;
+   int negative = bytes[0] & 0x40;
+   uint64_t value = negative ? ~0ULL : 0;
+   value = (value << 6) | (bytes[0] & 0x3F);
+   for(size_t i = 1; i < fieldSize; i++) {
+      if(!negative && value >> 55 != 0) return -1;
+      value = (value << 8) | bytes[i];
+   }
+   return (int64_t)value;
+}
+
+/* Byte order doesn't matter to a sum, so words are loaded as they are. */
+static unsigned int sumBlock(const unsigned char *block) {
+   uint64_t evenLanes = 0;
+   uint64_t oddLanes = 0;
+   for(int i = 0; i < TAR_BLOCK_SIZE; i += 8) {
+      uint64_t word;
+      memcpy(&word, &block[i], sizeof(word));
+      evenLanes += word & 0x00FF00FF00FF00FFULL;
+      oddLanes += (word >> 8) & 0x00FF00FF00FF00FFULL;
+   }
+   uint64_t lanes = evenLanes + oddLanes;
+   lanes = (lanes & 0x0000FFFF0000FFFFULL)
+      + ((lanes >> 16) & 0x0000FFFF0000FFFFULL);
+   return (unsigned int)((lanes & 0xFFFFFFFF) + (lanes >> 32));
+}
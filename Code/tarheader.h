@@ -0,0 +1,99 @@
+/*******************************************************************************
+
+   File        : tarheader.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Tar header blocks, and encoding and decoding their numbers
+                 and checksums.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef TARHEADER_H
+#define TARHEADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tar files are formed of 512 byte blocks.
+   Before each file in the archive, there's a header block, containg file
+   details. Following the header is the file's data, with padding to fill the
+   gap between the end of file, and the next 512 byte block.
+
+   There are different tar header formats, I am using the UStar format.
+   Early formats only allowed file paths 100 characters long, maximum.
+   However, UStar format provides an extra 155 characters at the end of the
+   header for longer files paths, which I am making use of.
+   The extra characters, if not null, are appended to the beginning of the
+   first filePath field. */
+struct tar_header_block {
+      /* Old, Pre-POSIX.1-1988 fields */
+      /* Must be null terminated unless all 100 characters are used. */
+      char filePath[100];
+      /* Octal mode. */
+      char fileMode[8];
+      /* Octal number in ASCII, null (or space) terminated, zero padded. */
+      char ownerId[8];
+      /* Octal number in ASCII, null (or space) terminated, zero padded. */
+      char groupId[8];
+      /* Octal, or base-256 for files of 8GiB and over, see tarPutNumber. */
+      char fileSize[12];
+      /* Numeric, octal unix time format. */
+      char modifiedTime[12];
+      /* The checksum is calculated based on the header with an empty
+         checksum containing space characters. */
+      char checksum[8];
+      /* This field was originally the link type, but with the ustar format,
+         it represents the file type.
+         eg, normal file/symbolic link/directory... */
+      char type;
+      /* Must be null terminated unless all 100 characters are used. */
+      char linkName[100];
+      /* UStar only fields from here.   */
+      /* Must be null terminated */
+      char ustarMagic[6];
+      /* Always "00" */
+      char version[2];
+      /* Must be null terminated */
+      char ownerName[32];
+      /* Must be null terminated */
+      char groupName[32];
+      /* Magor and minor are for devices, which I'm not using, so for this
+         purpose they can be left null. */
+      char major[8];
+      char minor[8];
+      /* The file path prefix, must be null terminated unless all 155 characters
+         are used. */
+      char filePathPrefix[155];
+      /* The header uses 500/512 bytes of it's block. Some custom formats
+         can make use of the extra 12 bytes, but in generally it's null.
+         As an improvement, this tool could use some of this space to store
+         a file's change timestamp (not modified date). */
+      char unused[12];
+};
+
+/* Writes value into a numeric field as that many zero padded octal digits,
+   followed by a space, and a null if there's room. Values too long for
+   that use every digit the field has room for, and values too long even
+   for that, or negative, are written in base-256 as GNU tar does, the
+   first byte flagging it, and the rest a big endian two's complement
+   number. */
+void tarPutNumber(char *field, size_t fieldSize, size_t digits,
+   int64_t value);
+
+/* Reads a numeric field, octal or base-256, skipping leading spaces and
+   stopping at the first character which isn't an octal digit.
+   Returns -1 for base-256 numbers too large for 63 bits. */
+int64_t tarGetNumber(const char *field, size_t fieldSize);
+
+/* Fills in a header's checksum, from the rest of the header. */
+void tarSetChecksum(struct tar_header_block *header);
+
+/* Returns 1 if a header's checksum matches it's contents. */
+int tarVerifyChecksum(const struct tar_header_block *header);
+
+#endif
@@ -0,0 +1,182 @@
+/*******************************************************************************
+
+   File        : throttle.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Holds backups back, so they share the disks with whatever
+                 else the host is doing.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   The limits are token buckets, one for bytes and one for files, filled at
+   the rate given, and holding at most a tenth of a second's worth, so a
+   pause in reading doesn't save up for a burst. Taking more than is there
+   leaves the bucket in debt, and the caller sleeps until it's paid off, so
+   with several readers each waits it's turn, without anything having to
+   wake them. Reads are capped at a megabyte while a byte limit is set, or
+   one large file would go through at full speed, then stop for seconds.
+
+   The back off follows the average read time, over roughly the last eight
+   reads. Each read finishing while it's over the limit doubles the pause
+   before the next, up to a second, and each one finishing under it halves
+   it again, so the backup slows down quickly when the disks get busy, and
+   speeds back up as they recover.
+
+   All of it is shared between threads, under one lock, only taken once
+   something has been enabled.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "throttle.h"
+#include "stats.h"
+
+/* How much of a second's worth a bucket holds. */
+#define THROTTLE_BURST 0.1
+#define THROTTLE_CHUNK (1024 * 1024)
+/* The back off, in nanoseconds. */
+#define THROTTLE_BACKOFF_MIN 1000000ULL
+#define THROTTLE_BACKOFF_MAX 1000000000ULL
+/* From linux/ioprio.h, which isn't always installed. */
+#define THROTTLE_WHO_PROCESS 1
+#define THROTTLE_CLASS_SHIFT 13
+
+struct token_bucket {
+   /* Tokens a second, 0 for no limit. */
+   double rate;
+   double tokens;
+   double capacity;
+   uint64_t filled;
+};
+
+static int enabled = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct token_bucket bytes;
+static struct token_bucket files;
+static uint64_t latencyLimit = 0;
+static double averageLatency = 0;
+static uint64_t backoff = 0;
+
+static void startBucket(struct token_bucket *bucket, double rate);
+static uint64_t takeTokens(struct token_bucket *bucket, double amount);
+static void sleepFor(uint64_t nanoseconds);
+static uint64_t now();
+
+void throttleEnable(const struct throttle_options *options) {
+   startBucket(&bytes, options->bytesPerSecond);
+   startBucket(&files, options->filesPerSecond);
+   latencyLimit = options->latencyLimit > 0
+      ? (uint64_t)options->latencyLimit * 1000 : 0;
+   enabled = bytes.rate > 0 || files.rate > 0 || latencyLimit > 0;
+}
+
+/*******************************************************************************
+   throttleSetPriority
+      Threads copy their I/O priority from the thread which started them,
+      which covers the kernel's own io_uring workers too.
+*******************************************************************************/
+int throttleSetPriority(int ioClass, int level) {
+   return syscall(SYS_ioprio_set, THROTTLE_WHO_PROCESS, 0,
+      ioClass << THROTTLE_CLASS_SHIFT | level) == 0 ? 0 : -1;
+}
+
+void throttleBytes(size_t length) {
+   if(!enabled) return;
+   pthread_mutex_lock(&lock);
+   uint64_t wait = takeTokens(&bytes, length) + backoff;
+   pthread_mutex_unlock(&lock);
+   sleepFor(wait);
+}
+
+void throttleFile() {
+   if(!enabled) return;
+   pthread_mutex_lock(&lock);
+   uint64_t wait = takeTokens(&files, 1);
+   pthread_mutex_unlock(&lock);
+   sleepFor(wait);
+}
+
+size_t throttleChunk(size_t length) {
+   if(!enabled || bytes.rate <= 0 || length <= THROTTLE_CHUNK) return length;
+   return THROTTLE_CHUNK;
+}
+
+uint64_t throttleStart() {
+   return latencyLimit > 0 ? now() : 0;
+}
+
+/*******************************************************************************
+   throttleStop
+      Adds a read's time to the average, and moves the back off.
+*******************************************************************************/
+void throttleStop(uint64_t started) {
+   if(started == 0) return;
+   uint64_t elapsed = now() - started;
+   pthread_mutex_lock(&lock);
+   averageLatency = averageLatency == 0 ? elapsed
+      : averageLatency * 7 / 8 + elapsed / 8.0;
+   if(averageLatency > latencyLimit) {
+      backoff = backoff == 0 ? THROTTLE_BACKOFF_MIN : backoff * 2;
+      if(backoff > THROTTLE_BACKOFF_MAX) backoff = THROTTLE_BACKOFF_MAX;
+   } else {
+      backoff /= 2;
+      if(backoff < THROTTLE_BACKOFF_MIN) backoff = 0;
+   }
+   pthread_mutex_unlock(&lock);
+}
+
+static void startBucket(struct token_bucket *bucket, double rate) {
+   bucket->rate = rate > 0 ? rate : 0;
+   bucket->capacity = bucket->rate * THROTTLE_BURST;
+   bucket->tokens = bucket->capacity;
+   bucket->filled = now();
+}
+
+/*******************************************************************************
+   takeTokens
+      Fills the bucket for the time since it was last filled, takes what's
+      asked for, and returns how long until any debt is paid off, in
+      nanoseconds. Called with the lock held.
+*******************************************************************************/
+static uint64_t takeTokens(struct token_bucket *bucket, double amount) {
+   if(bucket->rate <= 0) return 0;
+   uint64_t time = now();
+   bucket->tokens += (time - bucket->filled) / 1e9 * bucket->rate;
+   if(bucket->tokens > bucket->capacity) bucket->tokens = bucket->capacity;
+   bucket->filled = time;
+   bucket->tokens -= amount;
+   return bucket->tokens < 0
+      ? (uint64_t)(-bucket->tokens / bucket->rate * 1e9) : 0;
+}
+
+/*******************************************************************************
+   sleepFor
+      Sleeps, counting the time as throttled in the stats.
+*******************************************************************************/
+static void sleepFor(uint64_t nanoseconds) {
+   if(nanoseconds == 0) return;
+   uint64_t started = statsStart();
+   struct timespec duration = { nanoseconds / 1000000000ULL,
+      nanoseconds % 1000000000ULL };
+   while(nanosleep(&duration, &duration) != 0);
+   statsStop(STATS_THROTTLE, started);
+}
+
+static uint64_t now() {
+   struct timespec time;
+   clock_gettime(CLOCK_MONOTONIC, &time);
+   return (uint64_t)time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
@@ -0,0 +1,60 @@
+/*******************************************************************************
+
+   File        : throttle.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Holds backups back, so they share the disks with whatever
+                 else the host is doing.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ioprio classes, as the kernel numbers them. */
+#define THROTTLE_CLASS_BEST_EFFORT 2
+#define THROTTLE_CLASS_IDLE 3
+
+struct throttle_options {
+   /* 0 for no limit. */
+   double bytesPerSecond;
+   double filesPerSecond;
+   /* If reads take longer than this on average, in microseconds, readers
+      back off until they don't. 0 to never back off. */
+   long latencyLimit;
+};
+
+/* Until it's called, everything below does nothing, and costs a function
+   call. */
+void throttleEnable(const struct throttle_options *options);
+
+/* Sets the I/O scheduling class, and level within it, for this thread, and
+   every thread it starts from here on. Returns -1 if the kernel refused. */
+int throttleSetPriority(int ioClass, int level);
+
+/* Waits until length more bytes can be read, and for any back off. Never
+   call it holding a lock. */
+void throttleBytes(size_t length);
+
+/* Waits until another file can be started. */
+void throttleFile();
+
+/* The most to read in one go, so a limit is kept to smoothly, rather than
+   a large file at a time. */
+size_t throttleChunk(size_t length);
+
+/* Times a read, for the back off. throttleStart returns 0 if there's no
+   latency limit, and throttleStop does nothing with 0. Neither waits, so
+   both can be called holding a lock. */
+uint64_t throttleStart();
+void throttleStop(uint64_t started);
+
+#endif
@@ -0,0 +1,311 @@
+/*******************************************************************************
+
+   File        : uring.c
+
+   Date        : Friday 16th October 2026
+
+   Description : A small io_uring wrapper, for keeping many file operations
+                 in flight from one thread.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   This talks to the kernel directly, rather than through liburing, so
+   nothing new is needed to build. Only what backup and restore use is here:
+   open, read, write and close.
+   Where the headers or the kernel don't have io_uring, uringInit fails, and
+   callers carry on with ordinary system calls.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "uring.h"
+
+#if defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#endif
+
+#ifdef HAVE_IO_URING
+
+static struct io_uring_sqe *getEntry(struct uring *ring);
+
+/*******************************************************************************
+   uringAvailable
+      Tries to create a tiny ring, as the kernel may have io_uring compiled 
+      out or disabled.
+*******************************************************************************/
+int uringAvailable() {
+   static int available = -1;
+   if(available == -1) {
+      struct uring ring;
+      available = uringInit(&ring, 4) == 0;
+      if(available) uringFree(&ring);
+   }
+   return available;
+}
+
+/*******************************************************************************
+   uringInit
+      Creates a ring and maps it's queues.
+*******************************************************************************/
+int uringInit(struct uring *ring, unsigned entries) {
+   memset(ring, 0, sizeof(struct uring));
+   struct io_uring_params params;
+   memset(&params, 0, sizeof(params));
+   ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+   if(ring->fd < 0) return -1;
+   ring->entries = params.sq_entries;
+
+   ring->submitRingSize = params.sq_off.array 
+      + params.sq_entries * sizeof(unsigned);
+   ring->completeRingSize = params.cq_off.cqes 
+      + params.cq_entries * sizeof(struct io_uring_cqe);
+   /* Newer kernels map both queues together. */
+   if(params.features & IORING_FEAT_SINGLE_MMAP) {
+      if(ring->completeRingSize > ring->submitRingSize) {
+         ring->submitRingSize = ring->completeRingSize;
+      }
+   }
+   ring->submitRing = mmap(NULL, ring->submitRingSize, 
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, 
+      IORING_OFF_SQ_RING);
+   if(ring->submitRing == MAP_FAILED) {
+      ring->submitRing = NULL;
+      uringFree(ring);
+      return -1;
+   }
+   if(params.features & IORING_FEAT_SINGLE_MMAP) {
+      ring->completeRing = ring->submitRing;
+   } else {
+      ring->completeRing = mmap(NULL, ring->completeRingSize, 
+         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, 
+         IORING_OFF_CQ_RING);
+      if(ring->completeRing == MAP_FAILED) {
+         ring->completeRing = NULL;
+         uringFree(ring);
+         return -1;
+      }
+   }
+   ring->submitEntriesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+   ring->submitEntries = mmap(NULL, ring->submitEntriesSize, 
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, 
+      IORING_OFF_SQES);
+   if(ring->submitEntries == MAP_FAILED) {
+      ring->submitEntries = NULL;
+      uringFree(ring);
+      return -1;
+   }
+
+   char *submitRing = ring->submitRing;
+   char *completeRing = ring->completeRing;
+   ring->submitHead = (unsigned *)(submitRing + params.sq_off.head);
+   ring->submitTail = (unsigned *)(submitRing + params.sq_off.tail);
+   ring->submitMask = (unsigned *)(submitRing + params.sq_off.ring_mask);
+   ring->submitArray = (unsigned *)(submitRing + params.sq_off.array);
+   ring->completeHead = (unsigned *)(completeRing + params.cq_off.head);
+   ring->completeTail = (unsigned *)(completeRing + params.cq_off.tail);
+   ring->completeMask = (unsigned *)(completeRing + params.cq_off.ring_mask);
+   ring->completions = completeRing + params.cq_off.cqes;
+   return 0;
+}
+
+void uringFree(struct uring *ring) {
+   if(ring->submitEntries != NULL) {
+      munmap(ring->submitEntries, ring->submitEntriesSize);
+   }
+   if(ring->completeRing != NULL && ring->completeRing != ring->submitRing) {
+      munmap(ring->completeRing, ring->completeRingSize);
+   }
+   if(ring->submitRing != NULL) {
+      munmap(ring->submitRing, ring->submitRingSize);
+   }
+   if(ring->fd >= 0) close(ring->fd);
+   memset(ring, 0, sizeof(struct uring));
+   ring->fd = -1;
+}
+
+/*******************************************************************************
+   getEntry
+      Claims the next free submission entry, NULL if the queue is full.
+*******************************************************************************/
+static struct io_uring_sqe *getEntry(struct uring *ring) {
+   /* The kernel consumes everything when it's submitted, so the queue is 
+      only full of unsubmitted entries, but completions also have to have 
+      somewhere to go. */
+   if(ring->unsubmitted + ring->inFlight >= ring->entries) return NULL;
+
+   unsigned tail = *ring->submitTail + ring->unsubmitted;
+   unsigned index = tail & *ring->submitMask;
+   struct io_uring_sqe *entry 
+      = &((struct io_uring_sqe *)ring->submitEntries)[index];
+   memset(entry, 0, sizeof(struct io_uring_sqe));
+   ring->submitArray[index] = index;
+   ring->unsubmitted++;
+   return entry;
+}
+
+int uringPrepareOpen(struct uring *ring, int directoryFd, const char* path,
+   int flags, mode_t mode, uint64_t userData)
+{
+   struct io_uring_sqe *entry = getEntry(ring);
+   if(entry == NULL) return -1;
+   entry->opcode = IORING_OP_OPENAT;
+   entry->fd = directoryFd;
+   entry->addr = (uint64_t)(uintptr_t)path;
+   entry->len = mode;
+   entry->open_flags = flags;
+   entry->user_data = userData;
+   return 0;
+}
+
+int uringPrepareRead(struct uring *ring, int fd, void *buffer,
+   size_t length, off_t offset, uint64_t userData)
+{
+   struct io_uring_sqe *entry = getEntry(ring);
+   if(entry == NULL) return -1;
+   entry->opcode = IORING_OP_READ;
+   entry->fd = fd;
+   entry->addr = (uint64_t)(uintptr_t)buffer;
+   entry->len = length;
+   entry->off = offset;
+   entry->user_data = userData;
+   return 0;
+}
+
+int uringPrepareWrite(struct uring *ring, int fd, const void *buffer,
+   size_t length, off_t offset, uint64_t userData)
+{
+   struct io_uring_sqe *entry = getEntry(ring);
+   if(entry == NULL) return -1;
+   entry->opcode = IORING_OP_WRITE;
+   entry->fd = fd;
+   entry->addr = (uint64_t)(uintptr_t)buffer;
+   entry->len = length;
+   entry->off = offset;
+   entry->user_data = userData;
+   return 0;
+}
+
+int uringPrepareClose(struct uring *ring, int fd, uint64_t userData) {
+   struct io_uring_sqe *entry = getEntry(ring);
+   if(entry == NULL) return -1;
+   entry->opcode = IORING_OP_CLOSE;
+   entry->fd = fd;
+   entry->user_data = userData;
+   return 0;
+}
+
+/*******************************************************************************
+   uringSubmit
+      Publishes the prepared entries, and enters the kernel, if there's 
+      anything to send or wait for.
+*******************************************************************************/
+int uringSubmit(struct uring *ring, unsigned waitFor) {
+   unsigned submitting = ring->unsubmitted;
+   if(submitting > 0) {
+      __atomic_store_n(ring->submitTail, *ring->submitTail + submitting,
+         __ATOMIC_RELEASE);
+      ring->unsubmitted = 0;
+      ring->inFlight += submitting;
+   }
+   if(waitFor > ring->inFlight) waitFor = ring->inFlight;
+
+   /* Completions already waiting count towards waitFor. */
+   unsigned ready = __atomic_load_n(ring->completeTail, __ATOMIC_ACQUIRE)
+      - *ring->completeHead;
+   if(submitting == 0 && ready >= waitFor) return 0;
+
+   while(1) {
+      int result = syscall(__NR_io_uring_enter, ring->fd, submitting,
+         ready >= waitFor ? 0 : waitFor, 
+         ready >= waitFor ? 0 : IORING_ENTER_GETEVENTS, NULL, 0);
+      if(result >= 0) return 0;
+      if(errno != EINTR) return -1;
+      /* Everything was consumed before the interruption. */
+      submitting = 0;
+   }
+}
+
+/*******************************************************************************
+   uringComplete
+      Pops a completion off the queue.
+*******************************************************************************/
+int uringComplete(struct uring *ring, uint64_t *userData, int *result) {
+   unsigned head = *ring->completeHead;
+   if(head == __atomic_load_n(ring->completeTail, __ATOMIC_ACQUIRE)) {
+      return 0;
+   }
+   struct io_uring_cqe *completion = &((struct io_uring_cqe *)
+      ring->completions)[head & *ring->completeMask];
+   *userData = completion->user_data;
+   *result = completion->res;
+   __atomic_store_n(ring->completeHead, head + 1, __ATOMIC_RELEASE);
+   ring->inFlight--;
+   return 1;
+}
+
+#else
+
+/* No io_uring here, everything fails and callers use the synchronous 
+   path. */
+int uringAvailable() {
+   return 0;
+}
+
+int uringInit(struct uring *ring, unsigned entries) {
+   memset(ring, 0, sizeof(struct uring));
+   ring->fd = -1;
+   errno = ENOSYS;
+   return -1;
+}
+
+void uringFree(struct uring *ring) {
+}
+
+int uringPrepareOpen(struct uring *ring, int directoryFd, const char* path,
+   int flags, mode_t mode, uint64_t userData)
+{
+   return -1;
+}
+
+int uringPrepareRead(struct uring *ring, int fd, void *buffer,
+   size_t length, off_t offset, uint64_t userData)
+{
+   return -1;
+}
+
+int uringPrepareWrite(struct uring *ring, int fd, const void *buffer,
+   size_t length, off_t offset, uint64_t userData)
+{
+   return -1;
+}
+
+int uringPrepareClose(struct uring *ring, int fd, uint64_t userData) {
+   return -1;
+}
+
+int uringSubmit(struct uring *ring, unsigned waitFor) {
+   errno = ENOSYS;
+   return -1;
+}
+
+int uringComplete(struct uring *ring, uint64_t *userData, int *result) {
+   return 0;
+}
+
+#endif
@@ -0,0 +1,73 @@
+/*******************************************************************************
+
+   File        : uring.h
+
+   Date        : Friday 16th October 2026
+
+   Description : A small io_uring wrapper, for keeping many file operations
+                 in flight from one thread.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef URING_H
+#define URING_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+struct uring {
+   int fd;
+   unsigned entries;
+   /* Submissions prepared but not yet handed to the kernel. */
+   unsigned unsubmitted;
+   /* Operations handed to the kernel without a completion yet. */
+   unsigned inFlight;
+
+   void *submitRing;
+   size_t submitRingSize;
+   void *completeRing;
+   size_t completeRingSize;
+   void *submitEntries;
+   size_t submitEntriesSize;
+
+   unsigned *submitHead;
+   unsigned *submitTail;
+   unsigned *submitMask;
+   unsigned *submitArray;
+   unsigned *completeHead;
+   unsigned *completeTail;
+   unsigned *completeMask;
+   void *completions;
+};
+
+/* Whether the kernel supports io_uring at all. */
+int uringAvailable();
+
+/* Returns -1, with errno set, if the ring can't be created. */
+int uringInit(struct uring *ring, unsigned entries);
+void uringFree(struct uring *ring);
+
+/* Each of these queues an operation, returning -1 if the submission queue
+   is full. Nothing is sent to the kernel until uringSubmit.
+   userData comes back with the operation's result. */
+int uringPrepareOpen(struct uring *ring, int directoryFd, const char* path,
+   int flags, mode_t mode, uint64_t userData);
+int uringPrepareRead(struct uring *ring, int fd, void *buffer,
+   size_t length, off_t offset, uint64_t userData);
+int uringPrepareWrite(struct uring *ring, int fd, const void *buffer,
+   size_t length, off_t offset, uint64_t userData);
+int uringPrepareClose(struct uring *ring, int fd, uint64_t userData);
+
+/* Sends everything prepared to the kernel, and waits until at least
+   waitFor operations have completed. */
+int uringSubmit(struct uring *ring, unsigned waitFor);
+
+/* Takes the next completion, returning 0 if there isn't one. result is what
+   the equivalent system call would have returned, or -errno. */
+int uringComplete(struct uring *ring, uint64_t *userData, int *result);
+
+#endif
@@ -0,0 +1,879 @@
+/*******************************************************************************
+
+   File        : walker.c
+
+   Date        : Friday 16th October 2026
+
+   Description : Multi-threaded directory walker, a drop in replacement for
+                 nftw used by listfiles, backupfiles and backup.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.01 - Stats.
+                 16/10/2026 - v1.02 - Pooled entry names.
+                 16/10/2026 - v1.03 - getdents64 and statx.
+                 16/10/2026 - v1.04 - Exclude rules.
+                 17/10/2026 - v1.05 - Bounded read ahead in ordered mode.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   nftw reads one directory at a time, and stats one entry at a time, so on
+   file systems where each metadata call has to wait on a disk or the network
+   the walk spends most of it's time waiting.
+
+   This walker keeps a pool of threads, each with it's own deque of
+   directories still to be read. A thread pushes the sub-directories it finds
+   onto the back of it's own deque, and takes work from the back too, so each
+   thread works depth first through it's own part of the tree. When a thread
+   runs out of work it steals from the front of another thread's deque, which
+   is where the biggest, least recently found, sub-trees are.
+
+   The calling thread is always thread 0, so "-j 1" doesn't start any threads.
+
+   Directories are read with getdents64, into a large buffer, and entries
+   are stat'ed with statx, relative to the open directory, so the kernel
+   doesn't look up every folder in the path again for each one. Most file
+   systems say what type an entry is in the directory itself, so entries
+   the callback doesn't want aren't stat'ed at all, and neither are
+   directories, unless it wants those. Paths are only built for entries of
+   the types wanted, and directories.
+
+   Exclude rules are checked on that same type, before the stat, so an
+   excluded folder costs one lookup in the filter, and nothing under it is
+   ever read. Only entries of unknown type are stat'ed first.
+
+   In ordered mode everything read is kept until it's been emitted, so the
+   other threads stop taking directories once WALK_READ_AHEAD entries are
+   waiting, until the emitting thread catches up. That thread never waits
+   for them, it reads whatever it's waiting on itself.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "walker.h"
+#include "stats.h"
+
+/* Big enough for a few hundred entries a call. */
+#define WALK_BUFFER_SIZE 65536
+/* Entries read, in ordered mode, before the emitting thread has reached
+   their directory, at around 200 bytes each. */
+#define WALK_READ_AHEAD 65536
+
+struct walk_dir;
+
+/* An entry found in a directory, only kept in ordered mode, where entries
+   have to be sorted before they are handed to the callback. */
+struct walk_entry {
+   /* Where the name starts in the directory's names. */
+   size_t name;
+   struct stat fileStat;
+   int flag;
+   /* Set for sub-directories, which are read separately. */
+   struct walk_dir *directory;
+};
+
+struct walk_dir {
+   char *path;
+   int pathLength;
+   /* The offset of the directory's name within it's path, and it's depth,
+      as reported in struct FTW. */
+   int base;
+   int level;
+   struct stat fileStat;
+   /* Ordered mode only.
+      scanned is protected by the walker lock, and the entries belong to
+      the thread which read the directory until scanned is set. */
+   int scanned;
+   int flag;
+   struct walk_entry *entries;
+   int entryCount;
+   /* Every entry's name, one after another, so there's one allocation for
+      the lot rather than one for each. */
+   char *names;
+   size_t namesUsed;
+};
+
+struct walk_deque {
+   pthread_mutex_t lock;
+   struct walk_dir **items;
+   /* Items are stored between head (front, stolen from) and
+      tail (back, pushed and popped by the owner). */
+   int head;
+   int tail;
+   int capacity;
+};
+
+struct walker {
+   walkCallback callback;
+   int ordered;
+   /* From the options, with 0 meaning everything. */
+   int types;
+   unsigned int statxMask;
+   const struct path_filter *filter;
+   int filterBase;
+   int threadCount;
+   struct walk_deque *deques;
+
+   /* Protects everything below. */
+   pthread_mutex_t lock;
+   pthread_cond_t stateChanged;
+   /* Directories pushed but not yet fully read. When this reaches 0 with no
+      thread reading, the walk is finished. */
+   long pending;
+   /* Directories sitting in a deque. Threads only sleep when this is 0. */
+   long queued;
+   /* Ordered mode only, entries in directories read but not yet reached
+      by emitDirectory. */
+   long readAhead;
+   /* Only set with the lock held, but read without it too, by threads
+      checking whether to carry on, so it's set and read atomically.
+      result is set first, so anyone who sees stopped sees it too. */
+   int stopped;
+   int result;
+
+   /* Held while the callback is running, the per-entry functions aren't
+      written to be thread safe. */
+   pthread_mutex_t callbackLock;
+};
+
+struct walk_thread {
+   struct walker *walker;
+   int index;
+};
+
+static struct walk_dir *newDirectory(const char* path, int pathLength,
+   int base, int level, const struct stat *fileStat);
+static void freeDirectory(struct walk_dir *directory);
+static void pushDirectory(struct walker *walker, int index,
+   struct walk_dir *directory);
+static struct walk_dir *takeDirectory(struct walker *walker, int index);
+static void scanDirectory(struct walker *walker, int index,
+   struct walk_dir *directory);
+static int runCallback(struct walker *walker, const char* path,
+   const struct stat *fileStat, int flag, int base, int level);
+static void stopWalk(struct walker *walker, int result);
+static int isStopped(struct walker *walker);
+static int runOneTask(struct walker *walker, int index, int wait);
+static void *workerThread(void *argument);
+static int emitDirectory(struct walker *walker, struct walk_dir *directory);
+static int compareEntries(const void *a, const void *b, void *names);
+static int wantsType(struct walker *walker, mode_t mode);
+static int isExcluded(struct walker *walker, const char* path,
+   int pathLength, int isDirectory);
+static int statEntry(struct walker *walker, int dirFd, const char* name,
+   struct stat *fileStat);
+static unsigned int getStatxMask(int fields);
+
+/*******************************************************************************
+   walkTree
+      Walks the tree below rootPath, calling callback for every entry.
+      Returns 0 on success, -1 if the root couldn't be read, or the first
+      non-zero value returned by the callback.
+*******************************************************************************/
+int walkTree(const char* rootPath, walkCallback callback,
+   const struct walk_options *options)
+{
+   struct stat rootStat;
+   if(lstat(rootPath, &rootStat) != 0) return -1;
+
+   int rootLength = strlen(rootPath);
+   int rootBase = rootLength;
+   while(rootBase > 0 && rootPath[rootBase - 1] != '/') rootBase--;
+
+   /* A single file doesn't need a walk, just report it like nftw would. */
+   if(!S_ISDIR(rootStat.st_mode)) {
+      struct FTW fileTreeWalker = { rootBase, 0 };
+      return callback(rootPath, &rootStat,
+         S_ISLNK(rootStat.st_mode) ? FTW_SL : FTW_F, &fileTreeWalker);
+   }
+
+   struct walker walker;
+   memset(&walker, 0, sizeof(walker));
+   walker.callback = callback;
+   walker.ordered = options != NULL && options->ordered;
+   walker.types = options != NULL && options->types != 0 ? options->types
+      : WALK_FILES | WALK_DIRECTORIES | WALK_OTHERS;
+   walker.statxMask = getStatxMask(options != NULL ? options->fields : 0);
+   walker.filter = options != NULL ? options->filter : NULL;
+   walker.filterBase = options != NULL && options->filterBase > 0
+      ? options->filterBase : rootLength + 1;
+   walker.threadCount = options != NULL && options->threads > 1
+      ? options->threads : 1;
+   pthread_mutex_init(&walker.lock, NULL);
+   pthread_mutex_init(&walker.callbackLock, NULL);
+   pthread_cond_init(&walker.stateChanged, NULL);
+
+   walker.deques = calloc(walker.threadCount, sizeof(struct walk_deque));
+   if(walker.deques == NULL) return -1;
+   for(int i = 0; i < walker.threadCount; i++) {
+      pthread_mutex_init(&walker.deques[i].lock, NULL);
+   }
+
+   struct walk_dir *root
+      = newDirectory(rootPath, rootLength, rootBase, 0, &rootStat);
+   if(root == NULL) {
+      free(walker.deques);
+      return -1;
+   }
+   pushDirectory(&walker, 0, root);
+
+   /* Thread 0 is the calling thread, so only start the others. */
+   pthread_t *threads = calloc(walker.threadCount, sizeof(pthread_t));
+   struct walk_thread *threadArguments
+      = calloc(walker.threadCount, sizeof(struct walk_thread));
+   int started = 1;
+   if(threads != NULL && threadArguments != NULL) {
+      for(int i = 1; i < walker.threadCount; i++) {
+         threadArguments[i].walker = &walker;
+         threadArguments[i].index = i;
+         if(pthread_create(&threads[i], NULL, workerThread,
+            &threadArguments[i]) != 0)
+         {
+            /* Carry on with however many threads we managed to start. */
+            break;
+         }
+         started++;
+      }
+   }
+
+   if(walker.ordered) {
+      int result = emitDirectory(&walker, root);
+      if(result != 0) stopWalk(&walker, result);
+   } else {
+      struct walk_thread mainThread = { &walker, 0 };
+      workerThread(&mainThread);
+   }
+
+   /* Any threads still working are either finishing a directory,
+      or about to notice the walk is over. */
+   pthread_mutex_lock(&walker.lock);
+   __atomic_store_n(&walker.stopped, 1, __ATOMIC_RELEASE);
+   pthread_cond_broadcast(&walker.stateChanged);
+   pthread_mutex_unlock(&walker.lock);
+
+   for(int i = 1; i < started; i++) {
+      pthread_join(threads[i], NULL);
+   }
+
+   /* In unordered mode directories are freed as they're read.
+      In ordered mode they're freed as they're emitted.
+      Either way, anything left is there because the walk was stopped early. */
+   if(walker.ordered) freeDirectory(root);
+
+   for(int i = 0; i < walker.threadCount; i++) {
+      if(!walker.ordered) {
+         for(int j = walker.deques[i].head; j < walker.deques[i].tail; j++) {
+            freeDirectory(walker.deques[i].items[j]);
+         }
+      }
+      pthread_mutex_destroy(&walker.deques[i].lock);
+      free(walker.deques[i].items);
+   }
+   free(walker.deques);
+   free(threads);
+   free(threadArguments);
+   pthread_mutex_destroy(&walker.lock);
+   pthread_mutex_destroy(&walker.callbackLock);
+   pthread_cond_destroy(&walker.stateChanged);
+
+   return walker.result;
+}
+
+/*******************************************************************************
+   newDirectory
+      Allocates a directory to be read later.
+*******************************************************************************/
+static struct walk_dir *newDirectory(const char* path, int pathLength,
+   int base, int level, const struct stat *fileStat)
+{
+   struct walk_dir *directory = calloc(1, sizeof(struct walk_dir));
+   if(directory == NULL) return NULL;
+   directory->path = malloc(pathLength + 1);
+   if(directory->path == NULL) {
+      free(directory);
+      return NULL;
+   }
+   memcpy(directory->path, path, pathLength);
+   directory->path[pathLength] = '\0';
+   directory->pathLength = pathLength;
+   directory->base = base;
+   directory->level = level;
+   directory->fileStat = *fileStat;
+   return directory;
+}
+
+/*******************************************************************************
+   freeDirectory
+      Frees a directory, and any sub-directories which haven't already been
+      freed.
+*******************************************************************************/
+static void freeDirectory(struct walk_dir *directory) {
+   for(int i = 0; i < directory->entryCount; i++) {
+      if(directory->entries[i].directory != NULL) {
+         freeDirectory(directory->entries[i].directory);
+      }
+   }
+   free(directory->entries);
+   free(directory->names);
+   free(directory->path);
+   free(directory);
+}
+
+/*******************************************************************************
+   pushDirectory
+      Adds a directory to the back of a thread's deque.
+*******************************************************************************/
+static void pushDirectory(struct walker *walker, int index,
+   struct walk_dir *directory)
+{
+   struct walk_deque *deque = &walker->deques[index];
+   pthread_mutex_lock(&deque->lock);
+   if(deque->tail == deque->capacity) {
+      /* Move the items back to the start before growing. */
+      int count = deque->tail - deque->head;
+      if(deque->head > 0 && count < deque->capacity / 2) {
+         memmove(deque->items, &deque->items[deque->head],
+            count * sizeof(struct walk_dir *));
+      } else {
+         int capacity = deque->capacity > 0 ? deque->capacity * 2 : 64;
+         struct walk_dir **items
+            = malloc(capacity * sizeof(struct walk_dir *));
+         if(items == NULL) {
+            printf("Fatal Error: Out of memory while walking files.\n");
+            exit(1);
+         }
+         memcpy(items, &deque->items[deque->head],
+            count * sizeof(struct walk_dir *));
+         free(deque->items);
+         deque->items = items;
+         deque->capacity = capacity;
+      }
+      deque->head = 0;
+      deque->tail = count;
+   }
+   deque->items[deque->tail++] = directory;
+   pthread_mutex_unlock(&deque->lock);
+
+   pthread_mutex_lock(&walker->lock);
+   walker->pending++;
+   walker->queued++;
+   pthread_cond_broadcast(&walker->stateChanged);
+   pthread_mutex_unlock(&walker->lock);
+}
+
+/*******************************************************************************
+   takeDirectory
+      Takes a directory from the back of the thread's own deque, or steals
+      one from the front of another thread's deque.
+      Returns NULL if every deque is empty.
+*******************************************************************************/
+static struct walk_dir *takeDirectory(struct walker *walker, int index) {
+   struct walk_dir *directory = NULL;
+
+   struct walk_deque *deque = &walker->deques[index];
+   pthread_mutex_lock(&deque->lock);
+   if(deque->tail > deque->head) {
+      directory = deque->items[--deque->tail];
+   }
+   pthread_mutex_unlock(&deque->lock);
+
+   for(int i = 1; directory == NULL && i < walker->threadCount; i++) {
+      deque = &walker->deques[(index + i) % walker->threadCount];
+      pthread_mutex_lock(&deque->lock);
+      if(deque->tail > deque->head) {
+         directory = deque->items[deque->head++];
+      }
+      pthread_mutex_unlock(&deque->lock);
+   }
+
+   if(directory != NULL) {
+      pthread_mutex_lock(&walker->lock);
+      walker->queued--;
+      pthread_mutex_unlock(&walker->lock);
+   }
+   return directory;
+}
+
+/*******************************************************************************
+   runCallback
+      Calls the callback, stopping the walk if it asks to.
+*******************************************************************************/
+static int runCallback(struct walker *walker, const char* path,
+   const struct stat *fileStat, int flag, int base, int level)
+{
+   struct FTW fileTreeWalker = { base, level };
+   pthread_mutex_lock(&walker->callbackLock);
+   int result = isStopped(walker)
+      ? walker->result
+      : walker->callback(path, fileStat, flag, &fileTreeWalker);
+   pthread_mutex_unlock(&walker->callbackLock);
+   if(result != 0) stopWalk(walker, result);
+   return result;
+}
+
+/*******************************************************************************
+   stopWalk
+      Stops the walk, keeping the first result which asked to stop.
+*******************************************************************************/
+static void stopWalk(struct walker *walker, int result) {
+   pthread_mutex_lock(&walker->lock);
+   if(!walker->stopped) {
+      walker->result = result;
+      __atomic_store_n(&walker->stopped, 1, __ATOMIC_RELEASE);
+   }
+   pthread_cond_broadcast(&walker->stateChanged);
+   pthread_mutex_unlock(&walker->lock);
+}
+
+/*******************************************************************************
+   isStopped
+      Whether the walk has been stopped, for threads without the lock.
+*******************************************************************************/
+static int isStopped(struct walker *walker) {
+   return __atomic_load_n(&walker->stopped, __ATOMIC_ACQUIRE);
+}
+
+/*******************************************************************************
+   scanDirectory
+      Reads a directory and stats each entry the callback wants.
+      In unordered mode entries are handed straight to the callback,
+      in ordered mode they're sorted and kept for emitDirectory.
+*******************************************************************************/
+static void scanDirectory(struct walker *walker, int index,
+   struct walk_dir *directory)
+{
+   uint64_t started = statsStart();
+   int dirFd = open(directory->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   statsStop(STATS_WALK, started);
+   statsAdd(STATS_DIRECTORIES, 1);
+   directory->flag = dirFd != -1 ? FTW_D : FTW_DNR;
+
+   if(!walker->ordered && (walker->types & WALK_DIRECTORIES)) {
+      if(runCallback(walker, directory->path, &directory->fileStat,
+         directory->flag, directory->base, directory->level) != 0)
+      {
+         if(dirFd != -1) close(dirFd);
+         return;
+      }
+   }
+
+   /* Sub-directories are pushed once the directory has been read, in
+      reverse order, so this thread pops the first one first. */
+   struct walk_dir **subDirectories = NULL;
+   int subDirectoryCount = 0;
+   int subDirectoryCapacity = 0;
+
+   char *path = NULL;
+   int pathCapacity = 0;
+   int entryCapacity = 0;
+   size_t namesCapacity = 0;
+
+   char *buffer = dirFd != -1 ? malloc(WALK_BUFFER_SIZE) : NULL;
+   if(dirFd != -1 && buffer == NULL) {
+      printf("Fatal Error: Out of memory while walking files.\n");
+      exit(1);
+   }
+   ssize_t bufferLength = 0;
+   ssize_t offset = 0;
+   int stopped = 0;
+   while(dirFd != -1 && !stopped) {
+      if(offset >= bufferLength) {
+         started = statsStart();
+         bufferLength = getdents64(dirFd, buffer, WALK_BUFFER_SIZE);
+         statsStop(STATS_WALK, started);
+         offset = 0;
+         if(bufferLength <= 0) break;
+      }
+      struct dirent64 *dirEntry = (struct dirent64 *)&buffer[offset];
+      offset += dirEntry->d_reclen;
+
+      const char *name = dirEntry->d_name;
+      if(name[0] == '.'
+         && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+      {
+         continue;
+      }
+      statsAdd(STATS_ENTRIES, 1);
+
+      /* The directory entry's type is enough to skip what isn't wanted,
+         or excluded, and to walk directories without a stat, when it's
+         known. */
+      unsigned char type = dirEntry->d_type;
+      if(type != DT_UNKNOWN && type != DT_DIR
+         && !wantsType(walker, DTTOIF(type)))
+      {
+         continue;
+      }
+
+      /* Build "directory/name" in a buffer reused for every entry. */
+      int nameLength = strlen(name);
+      int pathLength = directory->pathLength + 1 + nameLength;
+      if(pathLength + 1 > pathCapacity) {
+         pathCapacity = (pathLength + 1) * 2;
+         path = realloc(path, pathCapacity);
+         if(path == NULL) {
+            printf("Fatal Error: Out of memory while walking files.\n");
+            exit(1);
+         }
+      }
+      memcpy(path, directory->path, directory->pathLength);
+      path[directory->pathLength] = '/';
+      memcpy(&path[directory->pathLength + 1], name, nameLength + 1);
+
+      if(type != DT_UNKNOWN
+         && isExcluded(walker, path, pathLength, type == DT_DIR))
+      {
+         continue;
+      }
+
+      struct stat fileStat;
+      int flag = FTW_F;
+      if(type == DT_DIR && !(walker->types & WALK_DIRECTORIES)) {
+         memset(&fileStat, 0, sizeof(fileStat));
+         fileStat.st_mode = S_IFDIR;
+      } else if(statEntry(walker, dirFd, name, &fileStat) != 0) {
+         memset(&fileStat, 0, sizeof(fileStat));
+         flag = FTW_NS;
+      } else if(!S_ISDIR(fileStat.st_mode)
+         && !wantsType(walker, fileStat.st_mode))
+      {
+         continue;
+      } else if(S_ISLNK(fileStat.st_mode)) {
+         flag = FTW_SL;
+      }
+
+      if(type == DT_UNKNOWN
+         && isExcluded(walker, path, pathLength, S_ISDIR(fileStat.st_mode)))
+      {
+         continue;
+      }
+
+      struct walk_dir *subDirectory = NULL;
+      if(flag == FTW_F && S_ISDIR(fileStat.st_mode)) {
+         subDirectory = newDirectory(path, pathLength,
+            directory->pathLength + 1, directory->level + 1, &fileStat);
+         if(subDirectory == NULL) {
+            printf("Fatal Error: Out of memory while walking files.\n");
+            exit(1);
+         }
+         if(subDirectoryCount == subDirectoryCapacity) {
+            subDirectoryCapacity
+               = subDirectoryCapacity > 0 ? subDirectoryCapacity * 2 : 16;
+            subDirectories = realloc(subDirectories,
+               subDirectoryCapacity * sizeof(struct walk_dir *));
+            if(subDirectories == NULL) {
+               printf("Fatal Error: Out of memory while walking files.\n");
+               exit(1);
+            }
+         }
+         subDirectories[subDirectoryCount++] = subDirectory;
+      }
+
+      if(walker->ordered) {
+         if(directory->entryCount == entryCapacity) {
+            entryCapacity = entryCapacity > 0 ? entryCapacity * 2 : 16;
+            directory->entries = realloc(directory->entries,
+               entryCapacity * sizeof(struct walk_entry));
+            if(directory->entries == NULL) {
+               printf("Fatal Error: Out of memory while walking files.\n");
+               exit(1);
+            }
+         }
+         if(directory->namesUsed + nameLength + 1 > namesCapacity) {
+            namesCapacity = namesCapacity > 0 ? namesCapacity * 2 : 4096;
+            while(directory->namesUsed + nameLength + 1 > namesCapacity) {
+               namesCapacity *= 2;
+            }
+            directory->names = realloc(directory->names, namesCapacity);
+            if(directory->names == NULL) {
+               printf("Fatal Error: Out of memory while walking files.\n");
+               exit(1);
+            }
+         }
+         struct walk_entry *entry = &directory->entries[directory->entryCount++];
+         entry->name = directory->namesUsed;
+         memcpy(&directory->names[entry->name], name, nameLength + 1);
+         directory->namesUsed += nameLength + 1;
+         entry->fileStat = fileStat;
+         entry->flag = flag;
+         entry->directory = subDirectory;
+      } else if(subDirectory == NULL) {
+         stopped = runCallback(walker, path, &fileStat, flag,
+            directory->pathLength + 1, directory->level + 1) != 0;
+      }
+   }
+
+   started = statsStart();
+   if(dirFd != -1) close(dirFd);
+   statsStop(STATS_WALK, started);
+   free(buffer);
+   free(path);
+
+   if(walker->ordered) {
+      qsort_r(directory->entries, directory->entryCount,
+         sizeof(struct walk_entry), compareEntries, directory->names);
+      /* Sorting moved the entries, but the sub-directories list only holds
+         the directories themselves, so it's still valid. Pushing in sorted
+         order means the first sub-directory emitted is read first. */
+      subDirectoryCount = 0;
+      for(int i = directory->entryCount - 1; i >= 0; i--) {
+         if(directory->entries[i].directory != NULL) {
+            subDirectories[subDirectoryCount++]
+               = directory->entries[i].directory;
+         }
+      }
+   }
+
+   /* Checked once, as the walk could stop part way through, and anything
+      already pushed belongs to whoever takes it. */
+   int discard = !walker->ordered && isStopped(walker);
+   for(int i = 0; i < subDirectoryCount; i++) {
+      if(walker->ordered) {
+         pushDirectory(walker, index, subDirectories[i]);
+      } else if(discard) {
+         freeDirectory(subDirectories[i]);
+      } else {
+         pushDirectory(walker, index,
+            subDirectories[subDirectoryCount - 1 - i]);
+      }
+   }
+   free(subDirectories);
+
+   pthread_mutex_lock(&walker->lock);
+   directory->scanned = 1;
+   if(walker->ordered) walker->readAhead += directory->entryCount;
+   pthread_cond_broadcast(&walker->stateChanged);
+   pthread_mutex_unlock(&walker->lock);
+}
+
+/*******************************************************************************
+   runOneTask
+      Reads one directory, if there is one waiting.
+      If wait is set, and there's nothing waiting, or in ordered mode too
+      much has been read ahead, sleeps until something changes.
+      Returns 0 once the walk is over.
+*******************************************************************************/
+static int runOneTask(struct walker *walker, int index, int wait) {
+   if(wait && walker->ordered) {
+      pthread_mutex_lock(&walker->lock);
+      while(walker->readAhead >= WALK_READ_AHEAD && !walker->stopped) {
+         pthread_cond_wait(&walker->stateChanged, &walker->lock);
+      }
+      pthread_mutex_unlock(&walker->lock);
+   }
+
+   struct walk_dir *directory = takeDirectory(walker, index);
+   if(directory != NULL) {
+      scanDirectory(walker, index, directory);
+      if(!walker->ordered) freeDirectory(directory);
+
+      pthread_mutex_lock(&walker->lock);
+      walker->pending--;
+      if(walker->pending == 0) pthread_cond_broadcast(&walker->stateChanged);
+      pthread_mutex_unlock(&walker->lock);
+      return 1;
+   }
+
+   pthread_mutex_lock(&walker->lock);
+   int running = !walker->stopped && walker->pending > 0;
+   if(running && wait && walker->queued == 0) {
+      pthread_cond_wait(&walker->stateChanged, &walker->lock);
+   }
+   pthread_mutex_unlock(&walker->lock);
+   return running;
+}
+
+/*******************************************************************************
+   workerThread
+      Reads directories until the walk is over.
+*******************************************************************************/
+static void *workerThread(void *argument) {
+   struct walk_thread *thread = (struct walk_thread *)argument;
+   while(runOneTask(thread->walker, thread->index, 1));
+   return NULL;
+}
+
+/*******************************************************************************
+   emitDirectory
+      Ordered mode only, hands a directory and everything below it to the
+      callback, depth first, in name order.
+      While waiting for a directory to be read, the calling thread helps.
+*******************************************************************************/
+static int emitDirectory(struct walker *walker, struct walk_dir *directory) {
+   pthread_mutex_lock(&walker->lock);
+   while(!directory->scanned && !walker->stopped) {
+      if(walker->queued > 0) {
+         pthread_mutex_unlock(&walker->lock);
+         runOneTask(walker, 0, 0);
+         pthread_mutex_lock(&walker->lock);
+      } else {
+         pthread_cond_wait(&walker->stateChanged, &walker->lock);
+      }
+   }
+   int stopped = walker->stopped;
+   if(!stopped) {
+      int waiting = walker->readAhead >= WALK_READ_AHEAD;
+      walker->readAhead -= directory->entryCount;
+      if(waiting && walker->readAhead < WALK_READ_AHEAD) {
+         pthread_cond_broadcast(&walker->stateChanged);
+      }
+   }
+   pthread_mutex_unlock(&walker->lock);
+   if(stopped) return walker->result;
+
+   int result = !(walker->types & WALK_DIRECTORIES) ? 0
+      : runCallback(walker, directory->path, &directory->fileStat,
+         directory->flag, directory->base, directory->level);
+
+   char *path = NULL;
+   int pathCapacity = 0;
+
+   for(int i = 0; result == 0 && i < directory->entryCount; i++) {
+      struct walk_entry *entry = &directory->entries[i];
+      if(entry->directory != NULL) {
+         result = emitDirectory(walker, entry->directory);
+         if(result == 0) {
+            freeDirectory(entry->directory);
+            entry->directory = NULL;
+         }
+         continue;
+      }
+
+      const char *name = &directory->names[entry->name];
+      int nameLength = strlen(name);
+      int pathLength = directory->pathLength + 1 + nameLength;
+      if(pathLength + 1 > pathCapacity) {
+         pathCapacity = (pathLength + 1) * 2;
+         path = realloc(path, pathCapacity);
+         if(path == NULL) {
+            printf("Fatal Error: Out of memory while walking files.\n");
+            exit(1);
+         }
+      }
+      memcpy(path, directory->path, directory->pathLength);
+      path[directory->pathLength] = '/';
+      memcpy(&path[directory->pathLength + 1], name, nameLength + 1);
+
+      result = runCallback(walker, path, &entry->fileStat, entry->flag,
+         directory->pathLength + 1, directory->level + 1);
+   }
+
+   free(path);
+   return result;
+}
+
+/*******************************************************************************
+   compareEntries
+      qsort_r comparison, orders entries by name.
+*******************************************************************************/
+static int compareEntries(const void *a, const void *b, void *names) {
+   return strcmp(&((const char *)names)[((const struct walk_entry *)a)->name],
+      &((const char *)names)[((const struct walk_entry *)b)->name]);
+}
+
+/*******************************************************************************
+   wantsType
+      Whether the callback wants entries with this mode.
+*******************************************************************************/
+static int wantsType(struct walker *walker, mode_t mode) {
+   int type = S_ISREG(mode) ? WALK_FILES
+      : S_ISDIR(mode) ? WALK_DIRECTORIES : WALK_OTHERS;
+   return (walker->types & type) != 0;
+}
+
+/*******************************************************************************
+   isExcluded
+      Whether the filter excludes an entry, counting those it does.
+*******************************************************************************/
+static int isExcluded(struct walker *walker, const char* path,
+   int pathLength, int isDirectory)
+{
+   if(walker->filter == NULL || walker->filterBase > pathLength) return 0;
+   if(!pathFilterExcludes(walker->filter, &path[walker->filterBase],
+      isDirectory))
+   {
+      return 0;
+   }
+   statsAdd(STATS_EXCLUDED, 1);
+   return 1;
+}
+
+/*******************************************************************************
+   statEntry
+      statx, asking only for what the callback reads, and filling in a
+      struct stat for it. Kernels without statx get fstatat instead.
+*******************************************************************************/
+static int statEntry(struct walker *walker, int dirFd, const char* name,
+   struct stat *fileStat)
+{
+   /* Shared by every thread, and only ever set, so it's read and set
+      atomically, without a lock. */
+   static int noStatx = 0;
+   uint64_t started = statsStart();
+   int result;
+   struct statx extendedStat;
+   if(__atomic_load_n(&noStatx, __ATOMIC_RELAXED)
+      || ((result = statx(dirFd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+         walker->statxMask, &extendedStat)) != 0 && errno == ENOSYS))
+   {
+      __atomic_store_n(&noStatx, 1, __ATOMIC_RELAXED);
+      result = fstatat(dirFd, name, fileStat, AT_SYMLINK_NOFOLLOW);
+      statsStop(STATS_STAT, started);
+      return result;
+   }
+   statsStop(STATS_STAT, started);
+   if(result != 0) return result;
+
+   memset(fileStat, 0, sizeof(struct stat));
+   fileStat->st_dev = makedev(extendedStat.stx_dev_major,
+      extendedStat.stx_dev_minor);
+   fileStat->st_ino = extendedStat.stx_ino;
+   fileStat->st_mode = extendedStat.stx_mode;
+   fileStat->st_nlink = extendedStat.stx_nlink;
+   fileStat->st_uid = extendedStat.stx_uid;
+   fileStat->st_gid = extendedStat.stx_gid;
+   fileStat->st_rdev = makedev(extendedStat.stx_rdev_major,
+      extendedStat.stx_rdev_minor);
+   fileStat->st_size = extendedStat.stx_size;
+   fileStat->st_blksize = extendedStat.stx_blksize;
+   fileStat->st_blocks = extendedStat.stx_blocks;
+   fileStat->st_atim.tv_sec = extendedStat.stx_atime.tv_sec;
+   fileStat->st_atim.tv_nsec = extendedStat.stx_atime.tv_nsec;
+   fileStat->st_mtim.tv_sec = extendedStat.stx_mtime.tv_sec;
+   fileStat->st_mtim.tv_nsec = extendedStat.stx_mtime.tv_nsec;
+   fileStat->st_ctim.tv_sec = extendedStat.stx_ctime.tv_sec;
+   fileStat->st_ctim.tv_nsec = extendedStat.stx_ctime.tv_nsec;
+   return 0;
+}
+
+/*******************************************************************************
+   getStatxMask
+      Turns walk_options.fields into the statx fields to ask for.
+*******************************************************************************/
+static unsigned int getStatxMask(int fields) {
+   if(fields == 0) return STATX_BASIC_STATS;
+   unsigned int mask = STATX_TYPE | STATX_INO;
+   if(fields & WALK_MODE) mask |= STATX_MODE;
+   if(fields & WALK_LINKS) mask |= STATX_NLINK;
+   if(fields & WALK_OWNER) mask |= STATX_UID | STATX_GID;
+   if(fields & WALK_SIZE) mask |= STATX_SIZE | STATX_BLOCKS;
+   if(fields & WALK_MODIFIED) mask |= STATX_MTIME;
+   if(fields & WALK_CHANGED) mask |= STATX_CTIME;
+   return mask;
+}
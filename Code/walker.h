@@ -0,0 +1,83 @@
+/*******************************************************************************
+
+   File        : walker.h
+
+   Date        : Friday 16th October 2026
+
+   Description : Multi-threaded directory walker, a drop in replacement for
+                 nftw used by listfiles, backupfiles and backup.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.01 - Entry types and stat fields.
+                 16/10/2026 - v1.02 - Exclude rules.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef WALKER_H
+#define WALKER_H
+
+#include <sys/stat.h>
+#include <ftw.h>
+
+#include "pathfilter.h"
+
+/* The callback has exactly the same signature as an nftw callback, so the
+   existing per-entry functions (printFile, backupFile) can be handed to the
+   walker without any changes.
+   As with nftw, returning a non-zero value stops the walk, and that value
+   is returned from walkTree. */
+typedef int (*walkCallback)(const char* path, const struct stat *fileStat,
+   int flag, struct FTW* fileTreeWalker);
+
+/* Entry types, for walk_options.types. */
+#define WALK_FILES 1
+#define WALK_DIRECTORIES 2
+/* Symbolic links, devices, sockets and pipes. */
+#define WALK_OTHERS 4
+
+/* Parts of struct stat, for walk_options.fields. The type is always
+   filled in, and the device and inode come with everything. */
+#define WALK_MODE 1
+#define WALK_LINKS 2
+#define WALK_OWNER 4
+/* The size, and the blocks used. */
+#define WALK_SIZE 8
+#define WALK_MODIFIED 16
+#define WALK_CHANGED 32
+
+struct walk_options {
+   /* The number of threads used to read directories and stat entries.
+      Values below 1 are treated as 1. */
+   int threads;
+   /* When set, entries are sorted by name within each directory and handed
+      to the callback in a depth-first order which doesn't depend on the
+      number of threads, or the order the file system returns entries in.
+      This keeps listings and archives diffable between runs. */
+   int ordered;
+   /* The types of entry the callback wants, 0 for all of them. The rest
+      are skipped by the type in their directory entry, without a stat,
+      on file systems which give one. Directories are walked either way. */
+   int types;
+   /* The parts of struct stat the callback reads, 0 for all of them.
+      Anything else may be left as 0. */
+   int fields;
+   /* Entries the filter excludes are skipped before they're stat'ed,
+      wherever the directory entry gives their type, and excluded folders
+      aren't read at all. NULL to keep everything. */
+   struct path_filter *filter;
+   /* Where the path the filter sees starts, in the paths handed to the
+      callback, for walks of a folder inside the one the rules are written
+      for. 0 for the walk's own root. */
+   int filterBase;
+};
+
+/* The callback is never called from two threads at once, so per-entry
+   functions written for nftw don't need any locking of their own.
+   Directories and stat calls are spread between the threads, which is where
+   the time goes on high latency file systems. */
+int walkTree(const char* rootPath, walkCallback callback,
+   const struct walk_options *options);
+
+#endif
@@ -0,0 +1,743 @@
+/*******************************************************************************
+
+   File        : watcher.c
+
+   Date        : Friday 16th October 2026
+
+   Description : backup --watch, which keeps a journal of every file changed
+                 under a folder, for the next backup of it.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+                 16/10/2026 - v1.01 - Exclude rules left to backups.
+                 17/10/2026 - v1.02 - Only the archive's own files ignored.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+/*******************************************************************************
+   Note:
+
+   inotify is used rather than fanotify, as it doesn't need root. The cost
+   is a watch for every folder, so the first thing done is walking the tree
+   to add them, and folders created later are walked as they appear.
+   Anything created in a new folder before it's watched is covered by
+   recording the folder itself, which the backup walks.
+
+   Watches know their folder by a number, which is looked up in a table of
+   paths, relative to the watched folder. A folder renamed within the tree
+   comes as a pair of events sharing a cookie, and the paths of it, and
+   every folder in it, are changed to match. One moved out of the tree
+   never gets it's second event, so it's watches are removed instead.
+
+   Changes are collected, and added to the journal once a second. Each path
+   is only added once per journal, and a journal smaller or larger than
+   when it was last added to has been taken by a backup, so everything is
+   added again to the new one. Paths already added are still queued when
+   they change again, as that's the only way to notice the journal was
+   taken, when nothing else has changed.
+
+   If the kernel's queue of events overflows, or a folder can't be watched,
+   changes have been missed, and a JOURNAL_LOST record makes the next
+   backup scan everything.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "watcher.h"
+#include "journal.h"
+
+/* Changes to folders themselves aren't archived, only what's in them. */
+#define WATCH_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_MOVED_FROM \
+   | IN_MOVED_TO | IN_EXCL_UNLINK | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+/* How often changes are added to the journal, in milliseconds. */
+#define WATCH_FLUSH_INTERVAL 1000
+
+#define WATCH_PATH_LENGTH (PATH_MAX + NAME_MAX + 2)
+
+/* A watched folder. */
+struct watch {
+   int wd;
+   char *path;
+   struct watch *nextInBucket;
+};
+
+/* A path which has changed. pending is set until it's in the journal,
+   and written once it is, so it isn't added again. */
+struct changed_path {
+   char *path;
+   int pending;
+   int written;
+   struct changed_path *nextInBucket;
+   struct changed_path *nextPending;
+};
+
+static int inotifyFd = -1;
+static char watchedRoot[PATH_MAX];
+static size_t watchedRootLength = 0;
+/* Relative to watchedRoot, NULL if it's outside it. */
+static char ignoredPath[WATCH_PATH_LENGTH];
+static const char *ignored = NULL;
+static size_t ignoredLength = 0;
+/* Chained hash tables, like the link table, doubling when 3/4 full. */
+static struct watch **watches = NULL;
+static size_t watchBucketCount = 0;
+static size_t watchCount = 0;
+static struct changed_path **changes = NULL;
+static size_t changeBucketCount = 0;
+static size_t changeCount = 0;
+static struct changed_path *firstPending = NULL;
+/* Changes were missed since the journal was last added to. */
+static int lost = 0;
+/* A folder couldn't be watched, so every journal has to say so. */
+static int incomplete = 0;
+/* Until the first walk is done, a folder which can't be watched is fatal. */
+static int startingUp = 1;
+/* A folder moved from, waiting for where it was moved to. */
+static int moving = 0;
+static uint32_t moveCookie = 0;
+static char movedFrom[WATCH_PATH_LENGTH];
+/* The journal as it was left, last time it was added to. */
+static dev_t journalDevice = 0;
+static ino_t journalInode = 0;
+static off_t journalSize = -1;
+static volatile sig_atomic_t stopping = 0;
+
+static int watchFolder(const char* path, const struct stat *fileStat,
+   int flag, struct FTW* fileTreeWalker);
+static void watchFolders(const char* relativePath);
+static void handleEvent(const struct inotify_event *event);
+static void finishMove();
+static int addChanges(const char* journalPath);
+static void markChanged(const char* relativePath);
+static void forgetWritten();
+static int addWatch(int wd, const char* relativePath);
+static struct watch *findWatch(int wd);
+static void removeWatch(int wd);
+static void renameWatches(const char* fromPath, const char* toPath);
+static void forgetWatches(const char* folder);
+static int isInFolder(const char* path, const char* folder);
+static void getFullPath(const char* relativePath, char fullPath[]);
+static void joinPath(char path[], const char* folder, const char* name);
+static void setIgnoredPath(const char* path);
+static int isIgnored(const char* relativePath);
+static size_t hashPath(const char* path);
+static int growWatches();
+static int growChanges();
+static uint64_t millisecondsNow();
+static void stopWatching(int signalNumber);
+static void outOfMemory();
+
+/*******************************************************************************
+   watchTree
+      Watches every folder, adds a JOURNAL_LOST record for whatever happened
+      before, and only then tells backups the journal can be used. From
+      there on, changes are added to it until a signal says to stop.
+*******************************************************************************/
+int watchTree(const char* rootPath, const char* journalPath,
+   const char* ignoredArchive, const struct walk_options *options)
+{
+   if(realpath(rootPath, watchedRoot) == NULL) {
+      printf("Fatal Error: Unable to find the folder to watch:\n"
+            "\"%s\"\n", rootPath);
+      return -1;
+   }
+   watchedRootLength = strcmp(watchedRoot, "/") == 0 ? 0
+      : strlen(watchedRoot);
+   setIgnoredPath(ignoredArchive);
+
+   int lockFd = journalStartWatching(journalPath);
+   if(lockFd == -1) {
+      if(errno == EWOULDBLOCK) {
+         printf("Fatal Error: Another watcher is already keeping the "
+               "journal:\n\"%s\"\n", journalPath);
+      } else {
+         printf("Fatal Error: Unable to lock the journal:\n"
+               "\"%s\"\n", journalPath);
+      }
+      return -1;
+   }
+
+   inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   watchBucketCount = 256;
+   watches = calloc(watchBucketCount, sizeof(struct watch *));
+   changeBucketCount = 256;
+   changes = calloc(changeBucketCount, sizeof(struct changed_path *));
+   if(inotifyFd == -1) {
+      printf("Fatal Error: Unable to start watching for changes.\n");
+      close(lockFd);
+      return -1;
+   }
+   if(watches == NULL || changes == NULL) outOfMemory();
+
+   printf("\nWatching for changes in:\n%s\n", watchedRoot);
+   fflush(stdout);
+   struct walk_options folderOptions = *options;
+   folderOptions.types = WALK_DIRECTORIES;
+   folderOptions.fields = WALK_MODE;
+   /* Everything is recorded, and each backup applies it's own rules, so
+      changing them between runs doesn't lose anything. */
+   folderOptions.filter = NULL;
+   if(walkTree(watchedRootLength > 0 ? watchedRoot : "/", watchFolder,
+      &folderOptions) != 0)
+   {
+      close(inotifyFd);
+      close(lockFd);
+      return -1;
+   }
+   startingUp = 0;
+
+   lost = 1;
+   if(addChanges(journalPath) != 0 || journalWatching(lockFd, watchedRoot) != 0)
+   {
+      printf("Fatal Error: Unable to write the journal:\n"
+            "\"%s\"\n", journalPath);
+      close(inotifyFd);
+      close(lockFd);
+      return -1;
+   }
+   printf("Watching %zu folders, keeping changes in:\n%s\n", watchCount,
+      journalPath);
+   fflush(stdout);
+
+   /* Without SA_RESTART, so poll is interrupted too. */
+   struct sigaction action;
+   memset(&action, 0, sizeof(action));
+   action.sa_handler = stopWatching;
+   sigemptyset(&action.sa_mask);
+   sigaction(SIGINT, &action, NULL);
+   sigaction(SIGTERM, &action, NULL);
+
+   static char events[65536]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+   uint64_t lastAdded = millisecondsNow();
+   int failing = 0;
+   while(!stopping) {
+      struct pollfd pollFd = { inotifyFd, POLLIN, 0 };
+      if(poll(&pollFd, 1, WATCH_FLUSH_INTERVAL) > 0) {
+         ssize_t length = read(inotifyFd, events, sizeof(events));
+         char *position = events;
+         while(length > 0 && position < events + length) {
+            const struct inotify_event *event
+               = (const struct inotify_event *)position;
+            handleEvent(event);
+            position += sizeof(struct inotify_event) + event->len;
+         }
+         finishMove();
+      }
+
+      if(millisecondsNow() - lastAdded >= WATCH_FLUSH_INTERVAL) {
+         /* Anything not added is tried again next time. */
+         if(addChanges(journalPath) != 0 && !failing) {
+            printf("Warning: Unable to write the journal, retrying.\n");
+            fflush(stdout);
+         }
+         failing = firstPending != NULL;
+         lastAdded = millisecondsNow();
+      }
+   }
+
+   int result = addChanges(journalPath);
+   if(result != 0) {
+      printf("Warning: Unable to write the last changes to the journal.\n");
+   }
+   printf("Stopped watching.\n");
+
+   close(inotifyFd);
+   inotifyFd = -1;
+   close(lockFd);
+   for(size_t i = 0; i < watchBucketCount; i++) {
+      struct watch *watch = watches[i];
+      while(watch != NULL) {
+         struct watch *next = watch->nextInBucket;
+         free(watch->path);
+         free(watch);
+         watch = next;
+      }
+   }
+   for(size_t i = 0; i < changeBucketCount; i++) {
+      struct changed_path *change = changes[i];
+      while(change != NULL) {
+         struct changed_path *next = change->nextInBucket;
+         free(change->path);
+         free(change);
+         change = next;
+      }
+   }
+   free(watches);
+   free(changes);
+   return result;
+}
+
+/*******************************************************************************
+   watchFolder
+      Called by the walker for every entry in a folder being watched.
+*******************************************************************************/
+static int watchFolder(const char* path, const struct stat *fileStat,
+   int flag, struct FTW* fileTreeWalker)
+{
+   if(!S_ISDIR(fileStat->st_mode)) return 0;
+
+   int wd = inotify_add_watch(inotifyFd, path, WATCH_EVENTS);
+   if(wd == -1) {
+      /* Gone before it could be watched, so there's nothing to miss. */
+      if(errno == ENOENT || errno == ENOTDIR) return 0;
+      if(startingUp) {
+         printf("Fatal Error: Unable to watch \"%s\".\n", path);
+         if(errno == ENOSPC) {
+            printf("There are more folders than inotify watches, raising\n"
+                  "fs.inotify.max_user_watches will allow more.\n");
+         }
+         return 1;
+      }
+      if(!incomplete) {
+         printf("Warning: Unable to watch \"%s\", backups will scan\n"
+               "every file until the watcher is restarted.\n", path);
+         fflush(stdout);
+      }
+      incomplete = 1;
+      lost = 1;
+      return 0;
+   }
+
+   const char *relativePath = &path[watchedRootLength];
+   if(relativePath[0] == '/') relativePath++;
+   if(addWatch(wd, relativePath) != 0) outOfMemory();
+   return 0;
+}
+
+/*******************************************************************************
+   watchFolders
+      Watches a new folder, and everything in it.
+*******************************************************************************/
+static void watchFolders(const char* relativePath) {
+   static const struct walk_options options = { 1, 0, WALK_DIRECTORIES,
+      WALK_MODE };
+   char fullPath[WATCH_PATH_LENGTH];
+   getFullPath(relativePath, fullPath);
+   /* It may be gone already, which is fine. */
+   walkTree(fullPath, watchFolder, &options);
+}
+
+/*******************************************************************************
+   handleEvent
+      Events on a folder itself are also sent, with it's name, to the
+      folder it's in, so only those with a name are looked at.
+*******************************************************************************/
+static void handleEvent(const struct inotify_event *event) {
+   if(event->mask & IN_Q_OVERFLOW) {
+      lost = 1;
+      return;
+   }
+   if(event->mask & IN_IGNORED) {
+      removeWatch(event->wd);
+      return;
+   }
+   struct watch *watch = findWatch(event->wd);
+   if(watch == NULL || event->len == 0) return;
+
+   char path[WATCH_PATH_LENGTH];
+   joinPath(path, watch->path, event->name);
+
+   if(event->mask & IN_ISDIR) {
+      if(event->mask & IN_MOVED_FROM) {
+         finishMove();
+         moving = 1;
+         moveCookie = event->cookie;
+         strcpy(movedFrom, path);
+      } else if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+         if((event->mask & IN_MOVED_TO) && moving
+            && event->cookie == moveCookie)
+         {
+            renameWatches(movedFrom, path);
+            moving = 0;
+         } else {
+            watchFolders(path);
+         }
+         /* Changes may have been recorded under it's old name, or made
+            before it was watched. */
+         markChanged(path);
+      }
+      return;
+   }
+   if(event->mask & IN_MOVED_FROM) return;
+   markChanged(path);
+}
+
+/*******************************************************************************
+   finishMove
+      A folder moved from, with nothing moved to in the same read, has left
+      the tree, so it's watches go.
+*******************************************************************************/
+static void finishMove() {
+   if(!moving) return;
+   forgetWatches(movedFrom);
+   moving = 0;
+}
+
+/*******************************************************************************
+   addChanges
+      Adds everything pending to the journal.
+*******************************************************************************/
+static int addChanges(const char* journalPath) {
+   if(firstPending == NULL && !lost) return 0;
+
+   struct stat fileStatus;
+   int fd = journalLock(journalPath, &fileStatus);
+   if(fd == -1) return -1;
+   if(fileStatus.st_ino != journalInode || fileStatus.st_dev != journalDevice
+      || fileStatus.st_size != journalSize)
+   {
+      forgetWritten();
+      if(incomplete) lost = 1;
+   }
+
+   struct journal_records records = { NULL, 0, 0 };
+   int result = lost ? journalAddRecord(&records, JOURNAL_LOST, "") : 0;
+   for(struct changed_path *change = firstPending;
+      result == 0 && change != NULL; change = change->nextPending)
+   {
+      if(!change->written) {
+         result = journalAddRecord(&records, JOURNAL_PATH, change->path);
+      }
+   }
+   if(result != 0) {
+      close(fd);
+      journalFreeRecords(&records);
+      return -1;
+   }
+   if(journalUnlock(fd, &records) != 0) {
+      journalFreeRecords(&records);
+      return -1;
+   }
+
+   journalDevice = fileStatus.st_dev;
+   journalInode = fileStatus.st_ino;
+   journalSize = fileStatus.st_size + records.length;
+   journalFreeRecords(&records);
+   while(firstPending != NULL) {
+      firstPending->pending = 0;
+      firstPending->written = 1;
+      firstPending = firstPending->nextPending;
+   }
+   lost = 0;
+   return 0;
+}
+
+/*******************************************************************************
+   markChanged
+      Adds a path to those waiting to go in the journal, unless it's
+      already there.
+*******************************************************************************/
+static void markChanged(const char* relativePath) {
+   if(isIgnored(relativePath)) return;
+
+   size_t bucket = hashPath(relativePath) % changeBucketCount;
+   struct changed_path *change = changes[bucket];
+   while(change != NULL && strcmp(change->path, relativePath) != 0) {
+      change = change->nextInBucket;
+   }
+   if(change == NULL) {
+      if((changeCount + 1) * 4 > changeBucketCount * 3 && growChanges() != 0)
+      {
+         outOfMemory();
+      }
+      change = calloc(1, sizeof(struct changed_path));
+      if(change == NULL || (change->path = strdup(relativePath)) == NULL) {
+         outOfMemory();
+      }
+      bucket = hashPath(relativePath) % changeBucketCount;
+      change->nextInBucket = changes[bucket];
+      changes[bucket] = change;
+      changeCount++;
+   }
+   if(change->pending) return;
+   change->pending = 1;
+   change->nextPending = firstPending;
+   firstPending = change;
+}
+
+/*******************************************************************************
+   forgetWritten
+      The journal was taken, so nothing written is in it anymore. Paths
+      which aren't pending are dropped, keeping the table to what's changed
+      since the last backup.
+*******************************************************************************/
+static void forgetWritten() {
+   for(size_t i = 0; i < changeBucketCount; i++) {
+      struct changed_path **link = &changes[i];
+      while(*link != NULL) {
+         struct changed_path *change = *link;
+         if(change->pending) {
+            change->written = 0;
+            link = &change->nextInBucket;
+         } else {
+            *link = change->nextInBucket;
+            free(change->path);
+            free(change);
+            changeCount--;
+         }
+      }
+   }
+}
+
+/*******************************************************************************
+   addWatch
+      Watching a folder again gives the same number, so an existing entry
+      just has it's path updated.
+*******************************************************************************/
+static int addWatch(int wd, const char* relativePath) {
+   char *path = strdup(relativePath);
+   if(path == NULL) return -1;
+   struct watch *watch = findWatch(wd);
+   if(watch != NULL) {
+      free(watch->path);
+      watch->path = path;
+      return 0;
+   }
+
+   if((watchCount + 1) * 4 > watchBucketCount * 3 && growWatches() != 0) {
+      free(path);
+      return -1;
+   }
+   watch = malloc(sizeof(struct watch));
+   if(watch == NULL) {
+      free(path);
+      return -1;
+   }
+   watch->wd = wd;
+   watch->path = path;
+   size_t bucket = (size_t)wd % watchBucketCount;
+   watch->nextInBucket = watches[bucket];
+   watches[bucket] = watch;
+   watchCount++;
+   return 0;
+}
+
+static struct watch *findWatch(int wd) {
+   struct watch *watch = watches[(size_t)wd % watchBucketCount];
+   while(watch != NULL && watch->wd != wd) watch = watch->nextInBucket;
+   return watch;
+}
+
+static void removeWatch(int wd) {
+   struct watch **link = &watches[(size_t)wd % watchBucketCount];
+   while(*link != NULL && (*link)->wd != wd) link = &(*link)->nextInBucket;
+   if(*link == NULL) return;
+   struct watch *watch = *link;
+   *link = watch->nextInBucket;
+   free(watch->path);
+   free(watch);
+   watchCount--;
+}
+
+/*******************************************************************************
+   renameWatches
+      Moves a folder, and every folder in it, to it's new path.
+*******************************************************************************/
+static void renameWatches(const char* fromPath, const char* toPath) {
+   size_t fromLength = strlen(fromPath);
+   char path[WATCH_PATH_LENGTH];
+   for(size_t i = 0; i < watchBucketCount; i++) {
+      for(struct watch *watch = watches[i]; watch != NULL;
+         watch = watch->nextInBucket)
+      {
+         if(!isInFolder(watch->path, fromPath)) continue;
+         snprintf(path, WATCH_PATH_LENGTH, "%s%s", toPath,
+            &watch->path[fromLength]);
+         char *renamed = strdup(path);
+         if(renamed == NULL) outOfMemory();
+         free(watch->path);
+         watch->path = renamed;
+      }
+   }
+}
+
+/*******************************************************************************
+   forgetWatches
+      Stops watching a folder, and every folder in it.
+*******************************************************************************/
+static void forgetWatches(const char* folder) {
+   for(size_t i = 0; i < watchBucketCount; i++) {
+      struct watch **link = &watches[i];
+      while(*link != NULL) {
+         struct watch *watch = *link;
+         if(isInFolder(watch->path, folder)) {
+            inotify_rm_watch(inotifyFd, watch->wd);
+            *link = watch->nextInBucket;
+            free(watch->path);
+            free(watch);
+            watchCount--;
+         } else {
+            link = &watch->nextInBucket;
+         }
+      }
+   }
+}
+
+/*******************************************************************************
+   isInFolder
+      Whether a relative path is the folder, or anything in it.
+*******************************************************************************/
+static int isInFolder(const char* path, const char* folder) {
+   size_t length = strlen(folder);
+   if(length == 0) return 1;
+   return strncmp(path, folder, length) == 0
+      && (path[length] == '\0' || path[length] == '/');
+}
+
+static void getFullPath(const char* relativePath, char fullPath[]) {
+   if(relativePath[0] == '\0') {
+      snprintf(fullPath, WATCH_PATH_LENGTH, "%s",
+         watchedRootLength > 0 ? watchedRoot : "/");
+   } else {
+      snprintf(fullPath, WATCH_PATH_LENGTH, "%s/%s", watchedRoot,
+         relativePath);
+   }
+}
+
+static void joinPath(char path[], const char* folder, const char* name) {
+   if(folder[0] == '\0') {
+      snprintf(path, WATCH_PATH_LENGTH, "%s", name);
+   } else {
+      snprintf(path, WATCH_PATH_LENGTH, "%s/%s", folder, name);
+   }
+}
+
+/*******************************************************************************
+   setIgnoredPath
+      The archive may not exist yet, so it's folder is resolved instead.
+      The archive's own files are ignored, see isIgnored.
+*******************************************************************************/
+static void setIgnoredPath(const char* path) {
+   char folder[WATCH_PATH_LENGTH];
+   snprintf(folder, WATCH_PATH_LENGTH, "%s", path);
+   char *name = strrchr(folder, '/');
+   const char *folderPath = ".";
+   if(name != NULL) {
+      *name++ = '\0';
+      folderPath = name == &folder[1] ? "/" : folder;
+   } else {
+      name = folder;
+   }
+
+   char resolved[PATH_MAX];
+   if(realpath(folderPath, resolved) == NULL) return;
+   size_t length = strlen(resolved);
+   if(length < watchedRootLength
+      || strncmp(resolved, watchedRoot, watchedRootLength) != 0
+      || (resolved[watchedRootLength] != '\0'
+         && resolved[watchedRootLength] != '/'))
+   {
+      return;
+   }
+   const char *relativeFolder = &resolved[watchedRootLength];
+   if(relativeFolder[0] == '/') relativeFolder++;
+   joinPath(ignoredPath, relativeFolder, name);
+   ignored = ignoredPath;
+   ignoredLength = strlen(ignoredPath);
+}
+
+/*******************************************************************************
+   isIgnored
+      Whether a path is the archive, or one of the files kept beside it,
+      the journal, it's lock and the copies taken of it, and the manifest.
+      Other files with names starting the same are watched as usual.
+*******************************************************************************/
+static int isIgnored(const char* relativePath) {
+   if(ignored == NULL || strncmp(relativePath, ignored, ignoredLength) != 0) {
+      return 0;
+   }
+   const char *suffix = &relativePath[ignoredLength];
+   return suffix[0] == '\0' || strcmp(suffix, ".manifest") == 0
+      || strcmp(suffix, ".journal") == 0
+      || strncmp(suffix, ".journal.", 9) == 0;
+}
+
+/*******************************************************************************
+   hashPath
+      FNV-1a.
+*******************************************************************************/
+static size_t hashPath(const char* path) {
+   uint64_t hash = 0xcbf29ce484222325ULL;
+   for(; *path != '\0'; path++) {
+      hash = (hash ^ (unsigned char)*path) * 0x100000001b3ULL;
+   }
+   return (size_t)hash;
+}
+
+static int growWatches() {
+   size_t bucketCount = watchBucketCount * 2;
+   struct watch **buckets = calloc(bucketCount, sizeof(struct watch *));
+   if(buckets == NULL) return -1;
+   for(size_t i = 0; i < watchBucketCount; i++) {
+      struct watch *watch = watches[i];
+      while(watch != NULL) {
+         struct watch *next = watch->nextInBucket;
+         size_t bucket = (size_t)watch->wd % bucketCount;
+         watch->nextInBucket = buckets[bucket];
+         buckets[bucket] = watch;
+         watch = next;
+      }
+   }
+   free(watches);
+   watches = buckets;
+   watchBucketCount = bucketCount;
+   return 0;
+}
+
+static int growChanges() {
+   size_t bucketCount = changeBucketCount * 2;
+   struct changed_path **buckets
+      = calloc(bucketCount, sizeof(struct changed_path *));
+   if(buckets == NULL) return -1;
+   for(size_t i = 0; i < changeBucketCount; i++) {
+      struct changed_path *change = changes[i];
+      while(change != NULL) {
+         struct changed_path *next = change->nextInBucket;
+         size_t bucket = hashPath(change->path) % bucketCount;
+         change->nextInBucket = buckets[bucket];
+         buckets[bucket] = change;
+         change = next;
+      }
+   }
+   free(changes);
+   changes = buckets;
+   changeBucketCount = bucketCount;
+   return 0;
+}
+
+static uint64_t millisecondsNow() {
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void stopWatching(int signalNumber) {
+   stopping = 1;
+}
+
+/*******************************************************************************
+   outOfMemory
+      Nothing is written to the journal after this, and the watcher's lock
+      goes with it, so backups go back to scanning.
+*******************************************************************************/
+static void outOfMemory() {
+   printf("Fatal Error: Out of memory while watching for changes.\n");
+   exit(1);
+}
@@ -0,0 +1,29 @@
+/*******************************************************************************
+
+   File        : watcher.h
+
+   Date        : Friday 16th October 2026
+
+   Description : backup --watch, which keeps a journal of every file changed
+                 under a folder, for the next backup of it.
+
+   History     : 16/10/2026 - v1.00 - Initial Implementation.
+
+   Author      : Alex H. Newark
+
+*******************************************************************************/
+
+#ifndef WATCHER_H
+#define WATCHER_H
+
+#include "walker.h"
+
+/* Watches everything under rootPath, adding what changes to the journal,
+   until interrupted or terminated. Nothing is recorded under ignoredPath,
+   which is the archive the journal is kept for, so writing it, or the
+   journal, isn't a change. The options are used for the first walk, which
+   watches every folder. Returns -1 if it couldn't start. */
+int watchTree(const char* rootPath, const char* journalPath,
+   const char* ignoredPath, const struct walk_options *options);
+
+#endif